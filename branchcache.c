@@ -0,0 +1,500 @@
+/*
+ *   fs/cifssrv/branchcache.c
+ *
+ *   Copyright (C) 2015 Samsung Electronics Co., Ltd.
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <crypto/hash.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+
+#include "glob.h"
+#include "export.h"
+#include "branchcache.h"
+
+/* number of files hashed in parallel */
+#define PCC_MAX_ACTIVE		2
+
+/* size of block hash section of a full segment in content information */
+#define PCC_BLOCKS_SECTION_SIZE	\
+	(sizeof(__le32) + PCC_BLOCKS_PER_SEGMENT * PCC_HASH_SIZE)
+
+static struct crypto_shash *pcc_sha256;
+/* keyed with hash of server secret, makes segment secrets */
+static struct crypto_shash *pcc_hmac;
+static struct workqueue_struct *pcc_wq;
+
+/* files being hashed, keyed by inode */
+static DEFINE_HASHTABLE(pcc_pending, 6);
+static DEFINE_SPINLOCK(pcc_lock);
+
+/**
+ * struct pcc_work - hash generation of a file
+ * @work:	work item on pcc_wq
+ * @node:	entry in pcc_pending
+ * @inode:	inode being hashed
+ * @filp:	file to read data from
+ * @tid:	tree id of share the file belongs to, for stats
+ */
+struct pcc_work {
+	struct work_struct work;
+	struct hlist_node node;
+	struct inode *inode;
+	struct file *filp;
+	__u64 tid;
+};
+
+/* disable content information of a share that can not keep it */
+static void pcc_disable_share(__u64 tid, const char *why, int err)
+{
+	struct cifssrv_share *share = find_matching_share(tid);
+
+	if (share && !share->pcc_disabled) {
+		cifssrv_err("%s on %s, err %d\n", why, share->sharename, err);
+		share->pcc_disabled = true;
+	}
+}
+
+static struct shash_desc *pcc_alloc_desc(struct crypto_shash *tfm)
+{
+	struct shash_desc *desc;
+
+	desc = kzalloc(sizeof(struct shash_desc) + crypto_shash_descsize(tfm),
+			GFP_KERNEL);
+	if (desc)
+		desc->tfm = tfm;
+	return desc;
+}
+
+/*
+ * file version the hashes are valid for: size and mtime. Change time is
+ * left out since every xattr write, our own hashes included, moves it.
+ */
+static void pcc_get_version(struct inode *inode, struct pcc_segment_xattr *ver)
+{
+	ver->size = cpu_to_le64(i_size_read(inode));
+	ver->mtime = cpu_to_le64(timespec_to_ns(&inode->i_mtime));
+}
+
+static bool pcc_same_version(struct pcc_segment_xattr *a,
+	struct pcc_segment_xattr *b)
+{
+	return a->size == b->size && a->mtime == b->mtime;
+}
+
+static void pcc_xattr_name(char *name, size_t len, unsigned int segment)
+{
+	snprintf(name, len, "%s%u", XATTR_NAME_PEERDIST, segment);
+}
+
+static unsigned int pcc_segment_blocks(loff_t size, unsigned int segment)
+{
+	loff_t len = size - (loff_t)segment * PCC_SEGMENT_SIZE;
+
+	return DIV_ROUND_UP(min_t(loff_t, len, PCC_SEGMENT_SIZE),
+			PCC_BLOCK_SIZE);
+}
+
+/**
+ * pcc_load_segment() - read persisted hashes of a segment
+ * @dentry:	dentry of file
+ * @segment:	segment index
+ * @ver:	current version of file
+ *
+ * Return:	segment hashes to be freed with kvfree(), or NULL if there
+ *		are none for this version of the file
+ */
+static struct pcc_segment_xattr *pcc_load_segment(struct dentry *dentry,
+	unsigned int segment, struct pcc_segment_xattr *ver)
+{
+	struct pcc_segment_xattr *seg = NULL;
+	char name[32];
+	ssize_t len;
+
+	pcc_xattr_name(name, sizeof(name), segment);
+	len = smb_vfs_getxattr(dentry, name, (char **)&seg, 1);
+	if (len <= 0)
+		return NULL;
+
+	if (len < sizeof(struct pcc_segment_xattr) ||
+		len != sizeof(struct pcc_segment_xattr) +
+			le32_to_cpu(seg->cBlocks) * PCC_HASH_SIZE ||
+		le32_to_cpu(seg->cBlocks) != pcc_segment_blocks(
+			le64_to_cpu(ver->size), segment) ||
+		!pcc_same_version(seg, ver)) {
+		kvfree(seg);
+		return NULL;
+	}
+	return seg;
+}
+
+/**
+ * pcc_hash_segment() - hash the blocks of a segment
+ * @filp:	file to read
+ * @desc:	sha256 descriptor
+ * @buf:	buffer of PCC_BLOCK_SIZE
+ * @segment:	segment index
+ * @size:	file size
+ * @seg:	filled with block hashes and hash of data
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int pcc_hash_segment(struct file *filp, struct shash_desc *desc,
+	char *buf, unsigned int segment, loff_t size,
+	struct pcc_segment_xattr *seg)
+{
+	loff_t start = (loff_t)segment * PCC_SEGMENT_SIZE, pos = start, end;
+	mm_segment_t old_fs;
+	unsigned int i = 0;
+	ssize_t nbytes;
+	size_t len;
+	int err = 0;
+
+	end = min_t(loff_t, start + PCC_SEGMENT_SIZE, size);
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (pos < end) {
+		len = min_t(loff_t, PCC_BLOCK_SIZE, end - pos);
+		nbytes = vfs_read(filp, buf, len, &pos);
+		if (nbytes != len) {
+			err = nbytes < 0 ? nbytes : -ESTALE;
+			break;
+		}
+
+		err = crypto_shash_digest(desc, buf, len,
+				seg->BlockHashes[i++]);
+		if (err)
+			break;
+		cond_resched();
+	}
+	set_fs(old_fs);
+	if (err)
+		return err;
+
+	seg->cbSegment = cpu_to_le32(end - start);
+	seg->cBlocks = cpu_to_le32(i);
+	return crypto_shash_digest(desc, (u8 *)seg->BlockHashes,
+			i * PCC_HASH_SIZE, seg->HashOfData);
+}
+
+/* hash a file segment by segment, keeping segments already hashed */
+static void pcc_generate(struct work_struct *work)
+{
+	struct pcc_work *pw = container_of(work, struct pcc_work, work);
+	struct dentry *dentry = pw->filp->f_path.dentry;
+	struct pcc_segment_xattr ver, now, *seg, *old;
+	struct cifssrv_share *share;
+	struct shash_desc *desc;
+	unsigned int i, nsegs;
+	ktime_t start = ktime_get();
+	size_t hashed = 0;
+	char name[32], *buf;
+	loff_t size;
+	int err = -ENOMEM;
+
+	seg = vmalloc(sizeof(struct pcc_segment_xattr) +
+			PCC_BLOCKS_PER_SEGMENT * PCC_HASH_SIZE);
+	buf = vmalloc(PCC_BLOCK_SIZE);
+	desc = pcc_alloc_desc(pcc_sha256);
+	if (!seg || !buf || !desc)
+		goto out;
+
+	pcc_get_version(pw->inode, &ver);
+	size = le64_to_cpu(ver.size);
+	nsegs = DIV_ROUND_UP(size, PCC_SEGMENT_SIZE);
+	err = 0;
+	for (i = 0; i < nsegs; i++) {
+		old = pcc_load_segment(dentry, i, &ver);
+		if (old) {
+			kvfree(old);
+			continue;
+		}
+
+		memcpy(seg, &ver, offsetof(struct pcc_segment_xattr,
+				cbSegment));
+		err = pcc_hash_segment(pw->filp, desc, buf, i, size, seg);
+		if (err)
+			break;
+		hashed += le32_to_cpu(seg->cbSegment);
+
+		/* file changed under us, these hashes are of no version */
+		pcc_get_version(pw->inode, &now);
+		if (!pcc_same_version(&now, &ver)) {
+			err = -ESTALE;
+			break;
+		}
+
+		pcc_xattr_name(name, sizeof(name), i);
+		err = smb_store_cont_xattr(&pw->filp->f_path, name, seg,
+				sizeof(struct pcc_segment_xattr) +
+				le32_to_cpu(seg->cBlocks) * PCC_HASH_SIZE);
+		if (err) {
+			pcc_disable_share(pw->tid, "can not store hashes", err);
+			break;
+		}
+
+		/* hashes that never load back would be made over and over */
+		old = pcc_load_segment(dentry, i, &ver);
+		if (!old) {
+			err = -ESTALE;
+			pcc_disable_share(pw->tid, "stored hashes do not load",
+					err);
+			break;
+		}
+		kvfree(old);
+	}
+
+out:
+	/* the share is looked up again, the work may outlive the open */
+	share = find_matching_share(pw->tid);
+	if (share) {
+		atomic_long_add(hashed, &share->stats.pcc_hashed_bytes);
+		atomic_long_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+				&share->stats.pcc_hash_ns);
+	}
+	if (err)
+		cifssrv_debug("hash generation stopped, err %d\n", err);
+
+	spin_lock(&pcc_lock);
+	hash_del(&pw->node);
+	spin_unlock(&pcc_lock);
+
+	fput(pw->filp);
+	kfree(desc);
+	vfree(buf);
+	vfree(seg);
+	kfree(pw);
+}
+
+/* start hashing a file unless it is already being hashed */
+static void pcc_queue(struct cifssrv_file *fp)
+{
+	struct inode *inode = file_inode(fp->filp);
+	struct pcc_work *pw, *new;
+
+	new = kzalloc(sizeof(struct pcc_work), GFP_KERNEL);
+	if (!new)
+		return;
+
+	spin_lock(&pcc_lock);
+	hash_for_each_possible(pcc_pending, pw, node, (unsigned long)inode) {
+		if (pw->inode == inode) {
+			spin_unlock(&pcc_lock);
+			kfree(new);
+			return;
+		}
+	}
+
+	INIT_WORK(&new->work, pcc_generate);
+	new->inode = inode;
+	new->filp = get_file(fp->filp);
+	new->tid = fp->share ? fp->share->tid : 0;
+	hash_add(pcc_pending, &new->node, (unsigned long)inode);
+	spin_unlock(&pcc_lock);
+
+	queue_work(pcc_wq, &new->work);
+}
+
+/* copy the part of [start, start + len) that lies in [off, end) */
+static void pcc_copy(char *buf, loff_t off, loff_t end, loff_t start,
+	const void *src, size_t len)
+{
+	loff_t from = max(start, off), to = min_t(loff_t, start + len, end);
+
+	if (from < to)
+		memcpy(buf + (from - off), src + (from - start), to - from);
+}
+
+/**
+ * cifssrv_pcc_read_hash() - read a range of content information of a file
+ * @fp:		cifssrv file pointer, opened with read access
+ * @offset:	offset in content information
+ * @length:	bytes of content information wanted
+ * @buf:	buffer to fill
+ * @nbytes:	bytes filled in
+ *
+ * Content information V1 of the whole file is laid out as MS-PCCRC 2.3
+ * describes. Only the segments in the requested range are read from
+ * their xattrs, if any of them is missing or stale the file is queued
+ * for hashing and the client fetches data from us meanwhile.
+ *
+ * Return:	0 on success, -EAGAIN if hashes are not ready, otherwise error
+ */
+int cifssrv_pcc_read_hash(struct cifssrv_file *fp, loff_t offset,
+	unsigned int length, char *buf, unsigned int *nbytes)
+{
+	struct dentry *dentry = fp->filp->f_path.dentry;
+	struct pcc_content_info_v1 hdr;
+	struct pcc_segment_description sd;
+	struct pcc_segment_xattr ver, *seg;
+	struct shash_desc *desc;
+	loff_t size, descs_off, blocks_off, total, end, d_start, b_start;
+	unsigned int i, nsegs, b_len;
+	__le32 cblocks;
+	int err = 0;
+
+	if (!pcc_wq || (fp->share && fp->share->pcc_disabled) ||
+			fp->is_stream)
+		return -EOPNOTSUPP;
+
+	pcc_get_version(file_inode(fp->filp), &ver);
+	size = le64_to_cpu(ver.size);
+	if (!size)
+		return -ENODATA;
+
+	nsegs = DIV_ROUND_UP(size, PCC_SEGMENT_SIZE);
+	descs_off = sizeof(struct pcc_content_info_v1);
+	blocks_off = descs_off +
+		nsegs * sizeof(struct pcc_segment_description);
+	total = blocks_off + (loff_t)(nsegs - 1) * PCC_BLOCKS_SECTION_SIZE +
+		sizeof(__le32) +
+		pcc_segment_blocks(size, nsegs - 1) * PCC_HASH_SIZE;
+	if (offset < 0 || offset >= total)
+		return -EINVAL;
+
+	length = min_t(loff_t, length, total - offset);
+	end = offset + length;
+
+	desc = pcc_alloc_desc(pcc_hmac);
+	if (!desc)
+		return -ENOMEM;
+
+	hdr.Version = cpu_to_le16(PCC_VERSION_1);
+	hdr.dwHashAlgo = cpu_to_le32(PCC_HASH_ALGO_SHA256);
+	hdr.dwOffsetInFirstSegment = 0;
+	hdr.dwReadBytesInLastSegment = cpu_to_le32(size -
+			(loff_t)(nsegs - 1) * PCC_SEGMENT_SIZE);
+	hdr.cSegments = cpu_to_le32(nsegs);
+	pcc_copy(buf, offset, end, 0, &hdr, sizeof(hdr));
+
+	for (i = 0; i < nsegs && !err; i++) {
+		d_start = descs_off + i * sizeof(sd);
+		b_start = blocks_off + (loff_t)i * PCC_BLOCKS_SECTION_SIZE;
+		b_len = sizeof(__le32) +
+			pcc_segment_blocks(size, i) * PCC_HASH_SIZE;
+		if ((d_start >= end || d_start + sizeof(sd) <= offset) &&
+				(b_start >= end || b_start + b_len <= offset))
+			continue;
+
+		seg = pcc_load_segment(dentry, i, &ver);
+		if (!seg) {
+			err = -EAGAIN;
+			break;
+		}
+
+		sd.ullOffsetInContent = cpu_to_le64((loff_t)i *
+				PCC_SEGMENT_SIZE);
+		sd.cbSegment = seg->cbSegment;
+		sd.cbBlockSize = cpu_to_le32(PCC_BLOCK_SIZE);
+		memcpy(sd.SegmentHashOfData, seg->HashOfData, PCC_HASH_SIZE);
+		err = crypto_shash_digest(desc, seg->HashOfData, PCC_HASH_SIZE,
+				sd.SegmentSecret);
+		pcc_copy(buf, offset, end, d_start, &sd, sizeof(sd));
+
+		cblocks = seg->cBlocks;
+		pcc_copy(buf, offset, end, b_start, &cblocks, sizeof(cblocks));
+		pcc_copy(buf, offset, end, b_start + sizeof(cblocks),
+				seg->BlockHashes, b_len - sizeof(cblocks));
+		kvfree(seg);
+	}
+	kfree(desc);
+
+	if (err == -EAGAIN) {
+		if (fp->share)
+			atomic_long_inc(&fp->share->stats.pcc_misses);
+		pcc_queue(fp);
+		return err;
+	} else if (err) {
+		return err;
+	}
+
+	if (fp->share)
+		atomic_long_inc(&fp->share->stats.pcc_hits);
+	*nbytes = length;
+	return 0;
+}
+
+/**
+ * cifssrv_pcc_init() - set up content information generation
+ *
+ * The server secret is made at random, content information handed out
+ * before a restart is no longer valid after it. Missing crypto support
+ * only disables BranchCache.
+ *
+ * Return:	0 on success, otherwise -ENOMEM
+ */
+int cifssrv_pcc_init(void)
+{
+	struct shash_desc *desc;
+	u8 secret[PCC_HASH_SIZE], key[PCC_HASH_SIZE];
+	int err;
+
+	pcc_sha256 = crypto_alloc_shash("sha256", 0, 0);
+	if (IS_ERR(pcc_sha256)) {
+		pcc_sha256 = NULL;
+		goto no_crypto;
+	}
+
+	pcc_hmac = crypto_alloc_shash("hmac(sha256)", 0, 0);
+	if (IS_ERR(pcc_hmac)) {
+		pcc_hmac = NULL;
+		goto no_crypto;
+	}
+
+	desc = pcc_alloc_desc(pcc_sha256);
+	if (!desc)
+		goto no_crypto;
+	get_random_bytes(secret, sizeof(secret));
+	err = crypto_shash_digest(desc, secret, sizeof(secret), key);
+	kfree(desc);
+	if (!err)
+		err = crypto_shash_setkey(pcc_hmac, key, sizeof(key));
+	if (err)
+		goto no_crypto;
+
+	pcc_wq = alloc_workqueue("cifssrv_pcc", WQ_UNBOUND, PCC_MAX_ACTIVE);
+	if (!pcc_wq) {
+		cifssrv_pcc_exit();
+		return -ENOMEM;
+	}
+	return 0;
+
+no_crypto:
+	cifssrv_err("sha256 not available, BranchCache disabled\n");
+	cifssrv_pcc_exit();
+	return 0;
+}
+
+/**
+ * cifssrv_pcc_exit() - wait for hash generation and free crypto
+ */
+void cifssrv_pcc_exit(void)
+{
+	if (pcc_wq) {
+		destroy_workqueue(pcc_wq);
+		pcc_wq = NULL;
+	}
+	if (pcc_hmac) {
+		crypto_free_shash(pcc_hmac);
+		pcc_hmac = NULL;
+	}
+	if (pcc_sha256) {
+		crypto_free_shash(pcc_sha256);
+		pcc_sha256 = NULL;
+	}
+}
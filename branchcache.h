@@ -0,0 +1,68 @@
+/*
+ *   fs/cifssrv/branchcache.h
+ *
+ *   Copyright (C) 2015 Samsung Electronics Co., Ltd.
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSSRV_BRANCHCACHE_H
+#define __CIFSSRV_BRANCHCACHE_H
+
+/* Content Information V1, MS-PCCRC 2.3 */
+#define PCC_VERSION_1		0x0100
+#define PCC_HASH_ALGO_SHA256	0x0000800C
+#define PCC_SEGMENT_SIZE	(32 * 1024 * 1024)
+#define PCC_BLOCK_SIZE		(64 * 1024)
+#define PCC_BLOCKS_PER_SEGMENT	(PCC_SEGMENT_SIZE / PCC_BLOCK_SIZE)
+#define PCC_HASH_SIZE		32
+
+struct pcc_content_info_v1 {
+	__le16 Version;
+	__le32 dwHashAlgo;
+	__le32 dwOffsetInFirstSegment;
+	__le32 dwReadBytesInLastSegment;
+	__le32 cSegments;
+} __packed;
+
+struct pcc_segment_description {
+	__le64 ullOffsetInContent;
+	__le32 cbSegment;
+	__le32 cbBlockSize;
+	__u8 SegmentHashOfData[PCC_HASH_SIZE];
+	__u8 SegmentSecret[PCC_HASH_SIZE];
+} __packed;
+
+/*
+ * Block hashes of a segment as kept in a "user.peerdist.<segment>"
+ * xattr. They are only valid for the file version they were made of.
+ * The version has no change time, storing the xattr itself moves it.
+ */
+struct pcc_segment_xattr {
+	__le64 size;
+	__le64 mtime;
+	__le32 cbSegment;
+	__le32 cBlocks;
+	__u8 HashOfData[PCC_HASH_SIZE];
+	__u8 BlockHashes[0][PCC_HASH_SIZE];
+} __packed;
+
+int cifssrv_pcc_init(void);
+void cifssrv_pcc_exit(void);
+int cifssrv_pcc_read_hash(struct cifssrv_file *fp, loff_t offset,
+	unsigned int length, char *buf, unsigned int *nbytes);
+
+#endif /* __CIFSSRV_BRANCHCACHE_H */
@@ -118,7 +118,15 @@ static void init_params(struct cifssrv_share *share)
 	set_attr_oplocks(&share->config.attr);
 	set_attr_readonly(&share->config.attr);
 	set_attr_writeok(&share->config.attr);
+	clear_attr_zerodetect(&share->config.attr);
+	clear_attr_branchcache(&share->config.attr);
 	share->config.max_connections = 0;
+	share->config.max_mem = 0;
+	share->config.stream_threshold = 0;
+	share->config.prealloc_max = 0;
+	share->config.defer_delete_size = 0;
+	share->config.stream_xattr_max = 4096;
+	share->config.statfs_cache_time = 1000;
 }
 
 /**
@@ -138,6 +146,7 @@ static int add_share(char *sharename, char *pathname)
 		return -ENOMEM;
 
 	init_params(share);
+	smb_vfs_statfs_init(share);
 
 	ret = __add_share(share, sharename, pathname);
 	if (!ret) {
@@ -154,6 +163,7 @@ static int add_share(char *sharename, char *pathname)
  */
 static inline void free_share(struct cifssrv_share *share)
 {
+	smb_vfs_statfs_exit(share);
 	kfree(share->sharename);
 
 	if (share->path)
@@ -620,6 +630,7 @@ static struct cifssrv_share *check_share(char *share_name, int *alloc_share)
 		return ERR_PTR(-ENOMEM);
 
 	init_params(share);
+	smb_vfs_statfs_init(share);
 	*alloc_share = 1;
 	return share;
 }
@@ -865,6 +876,7 @@ enum {
 	Opt_maptoguest,
 	Opt_server_min_protocol,
 	Opt_server_max_protocol,
+	Opt_sess_max_mem,
 
 	Opt_global_err
 };
@@ -878,6 +890,7 @@ static const match_table_t cifssrv_global_tokens = {
 	{ Opt_maptoguest, "map to guest = %s" },
 	{ Opt_server_min_protocol, "server min protocol = %s" },
 	{ Opt_server_max_protocol, "server max protocol = %s" },
+	{ Opt_sess_max_mem, "max session memory = %s" },
 
 	{ Opt_global_err, NULL }
 };
@@ -890,7 +903,15 @@ enum {
 	Opt_guestok,
 	Opt_guestonly,
 	Opt_oplocks,
+	Opt_zerodetect,
+	Opt_branchcache,
 	Opt_maxcon,
+	Opt_maxmem,
+	Opt_stream_threshold,
+	Opt_prealloc,
+	Opt_defer_delete,
+	Opt_stream_xattr_max,
+	Opt_statfs_cache,
 	Opt_comment,
 	Opt_allowhost,
 	Opt_denyhost,
@@ -915,7 +936,15 @@ static const match_table_t cifssrv_share_tokens = {
 	{ Opt_guestok, "guest ok = %s" },
 	{ Opt_guestonly, "guest only = %s" },
 	{ Opt_oplocks, "oplocks = %s" },
+	{ Opt_zerodetect, "zero detection = %s" },
+	{ Opt_branchcache, "branchcache = %s" },
 	{ Opt_maxcon, "max connections = %s" },
+	{ Opt_maxmem, "max memory = %s" },
+	{ Opt_stream_threshold, "stream threshold = %s" },
+	{ Opt_prealloc, "preallocation size = %s" },
+	{ Opt_defer_delete, "deferred delete size = %s" },
+	{ Opt_stream_xattr_max, "stream xattr size = %s" },
+	{ Opt_statfs_cache, "statfs cache time = %s" },
 	{ Opt_comment, "comment = %s" },
 	{ Opt_allowhost, "allow hosts = %s" },
 	{ Opt_denyhost, "deny hosts = %s" },
@@ -1057,6 +1086,18 @@ static int cifssrv_parse_global_options(char *configdata)
 				server_max_pr = cifssrv_max_protocol();
 			kfree(string);
 			break;
+		case Opt_sess_max_mem:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			/* configured in KB, 0 means no limit */
+			if (kstrtoul(string, 10, &cifssrv_sess_max_mem))
+				cifssrv_err("bad max session memory %s\n",
+						string);
+			else
+				cifssrv_sess_max_mem <<= 10;
+			kfree(string);
+			break;
 		default:
 			cifssrv_err("[%s] not supported\n", data);
 			break;
@@ -1169,6 +1210,22 @@ static int cifssrv_parse_share_options(const char *configdata)
 			else
 				set_attr_oplocks(&share->config.attr);
 			break;
+		case Opt_zerodetect:
+			if (!share || cifssrv_get_config_val(args, &val))
+				goto config_err;
+			if (val == 1)
+				set_attr_zerodetect(&share->config.attr);
+			else
+				clear_attr_zerodetect(&share->config.attr);
+			break;
+		case Opt_branchcache:
+			if (!share || cifssrv_get_config_val(args, &val))
+				goto config_err;
+			if (val == 1)
+				set_attr_branchcache(&share->config.attr);
+			else
+				clear_attr_branchcache(&share->config.attr);
+			break;
 		case Opt_maxcon:
 			string = match_strdup(args);
 			if (string == NULL)
@@ -1180,6 +1237,83 @@ static int cifssrv_parse_share_options(const char *configdata)
 			share->config.max_connections = val;
 			kfree(string);
 			break;
+		case Opt_maxmem:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			if (!share || kstrtoul(string, 10,
+						&share->config.max_mem)) {
+				kfree(string);
+				goto config_err;
+			}
+			/* configured in KB, 0 means no limit */
+			share->config.max_mem <<= 10;
+			kfree(string);
+			break;
+		case Opt_stream_threshold:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			if (!share || kstrtoul(string, 10,
+					&share->config.stream_threshold)) {
+				kfree(string);
+				goto config_err;
+			}
+			/* configured in KB, 0 disables drop-behind */
+			share->config.stream_threshold <<= 10;
+			kfree(string);
+			break;
+		case Opt_prealloc:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			if (!share || kstrtoul(string, 10,
+					&share->config.prealloc_max)) {
+				kfree(string);
+				goto config_err;
+			}
+			/* configured in KB, 0 disables preallocation */
+			share->config.prealloc_max <<= 10;
+			kfree(string);
+			break;
+		case Opt_defer_delete:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			if (!share || kstrtoul(string, 10,
+					&share->config.defer_delete_size)) {
+				kfree(string);
+				goto config_err;
+			}
+			/* configured in KB, 0 deletes inline */
+			share->config.defer_delete_size <<= 10;
+			kfree(string);
+			break;
+		case Opt_stream_xattr_max:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			if (!share || kstrtoul(string, 10,
+					&share->config.stream_xattr_max)) {
+				kfree(string);
+				goto config_err;
+			}
+			/* configured in KB, 0 keeps all streams in xattrs */
+			share->config.stream_xattr_max <<= 10;
+			kfree(string);
+			break;
+		case Opt_statfs_cache:
+			string = match_strdup(args);
+			if (string == NULL)
+				goto out_nomem;
+			/* configured in msecs, 0 does statfs on every query */
+			if (!share || kstrtoul(string, 10,
+					&share->config.statfs_cache_time)) {
+				kfree(string);
+				goto config_err;
+			}
+			kfree(string);
+			break;
 		case Opt_comment:
 			if (!share || cifssrv_get_config_str(args,
 						&share->config.comment))
@@ -1386,6 +1520,24 @@ static ssize_t show_share_config(char *buf, int offset,
 		cum += ret;
 	}
 
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tzero detection = %d\n",
+				get_attr_zerodetect(&share->config.attr));
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tbranchcache = %d\n",
+				get_attr_branchcache(&share->config.attr));
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
 	if (cum < limit) {
 		ret = snprintf(buf + cum, limit - cum,
 				"\twriteable = %d\n",
@@ -1404,6 +1556,60 @@ static ssize_t show_share_config(char *buf, int offset,
 		cum += ret;
 	}
 
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tmax memory = %lu\n",
+				share->config.max_mem >> 10);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tstream threshold = %lu\n",
+				share->config.stream_threshold >> 10);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tpreallocation size = %lu\n",
+				share->config.prealloc_max >> 10);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tdeferred delete size = %lu\n",
+				share->config.defer_delete_size >> 10);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tstream xattr size = %lu\n",
+				share->config.stream_xattr_max >> 10);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
+	if (cum < limit) {
+		ret = snprintf(buf + cum, limit - cum,
+				"\tstatfs cache time = %lu\n",
+				share->config.statfs_cache_time);
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
 	if (cum < limit && share->config.write_list) {
 		ret = snprintf(buf + cum, limit - cum,
 				"\twrite list = %s\n",
@@ -1467,6 +1673,147 @@ static ssize_t config_store(struct kobject *kobj,
 	return len;
 }
 
+/**
+ * show_share_stat() - show cifssrv share stat
+ * @buf:	destination buffer for stat info
+ * @offset:	offset in destination buffer
+ * @share:	show stat info of this share
+ *
+ * Return:      output buffer length
+ */
+static ssize_t show_share_stat(char *buf, int offset,
+		struct cifssrv_share *share)
+{
+	int cum = offset, limit = PAGE_SIZE, i;
+	long scanned, scan_ns;
+
+	cum += scnprintf(buf + cum, limit - cum, "[%s]\n", share->sharename);
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tMemory used = %ld\n",
+			atomic_long_read(&share->stats.mem_used));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tReadahead hits = %ld\n",
+			atomic_long_read(&share->stats.ra_hits));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tReadahead misses = %ld\n",
+			atomic_long_read(&share->stats.ra_misses));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tDropped behind pages = %ld\n",
+			atomic_long_read(&share->stats.dropped_pages));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tBuffered I/O bytes = %ld\n",
+			atomic_long_read(&share->stats.buffered_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tDirect I/O bytes = %ld\n",
+			atomic_long_read(&share->stats.direct_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tAsync I/O in flight = %d\n",
+			atomic_read(&share->stats.aio_inflight));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tAsync I/O max in flight = %d\n",
+			atomic_read(&share->stats.aio_max_inflight));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tSync batches 1/2/4/8/16/32/64/more =");
+	if (cum >= limit - 1)
+		return cum;
+
+	for (i = 0; i < SMB_SYNC_BATCH_BUCKETS; i++) {
+		cum += scnprintf(buf + cum, limit - cum, " %ld",
+				atomic_long_read(&share->stats.sync_batch[i]));
+		if (cum >= limit - 1)
+			return cum;
+	}
+
+	cum += scnprintf(buf + cum, limit - cum, "\n");
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tPreallocated bytes = %ld\n",
+			atomic_long_read(&share->stats.prealloc_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tPending reclaim bytes = %ld\n",
+			atomic_long_read(&share->stats.reclaim_pending));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tServer side copy bytes = %ld\n",
+			atomic_long_read(&share->stats.copy_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tCloned bytes = %ld\n",
+			atomic_long_read(&share->stats.clone_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	scanned = atomic_long_read(&share->stats.zero_scan_bytes);
+	scan_ns = atomic_long_read(&share->stats.zero_scan_ns);
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tZero detect scanned bytes = %ld\n"
+			"\tZero detect scan ns per GB = %ld\n"
+			"\tZero detect saved bytes = %ld\n",
+			scanned, scanned >> 30 ? scan_ns / (scanned >> 30) : 0,
+			atomic_long_read(&share->stats.zero_saved_bytes));
+	if (cum >= limit - 1)
+		return cum;
+
+	scanned = atomic_long_read(&share->stats.pcc_hashed_bytes);
+	scan_ns = atomic_long_read(&share->stats.pcc_hash_ns);
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tHash requests served = %ld\n"
+			"\tHash requests not ready = %ld\n"
+			"\tHashed bytes = %ld\n"
+			"\tHash ns per GB = %ld\n",
+			atomic_long_read(&share->stats.pcc_hits),
+			atomic_long_read(&share->stats.pcc_misses),
+			scanned, scanned >> 30 ? scan_ns / (scanned >> 30) : 0);
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"\tStatfs cache hits = %ld\n"
+			"\tStatfs cache misses = %ld\n",
+			atomic_long_read(&share->stats.statfs_hits),
+			atomic_long_read(&share->stats.statfs_misses));
+	if (cum >= limit - 1)
+		return cum;
+
+	return cum;
+}
+
 /**
  * show_server_stat() - show cifssrv server stat
  * @buf:	destination buffer for stat info
@@ -1479,12 +1826,11 @@ static ssize_t show_server_stat(char *buf)
 	struct list_head *tmp;
 	int count = 0, cum = 0, ret = 0, limit = PAGE_SIZE;
 
-	ret = snprintf(buf+cum, limit - cum,
+	cum += scnprintf(buf + cum, limit - cum,
 			"Server uptime secs = %ld\n",
 			(jiffies - server_start_time)/HZ);
-	if (ret < 0)
+	if (cum >= limit - 1)
 		return cum;
-	cum += ret;
 
 	list_for_each(tmp, &cifssrv_share_list) {
 		share = list_entry(tmp, struct cifssrv_share, list);
@@ -1492,11 +1838,71 @@ static ssize_t show_server_stat(char *buf)
 			count++;
 	}
 
-	ret = snprintf(buf+cum, limit - cum,
+	cum += scnprintf(buf + cum, limit - cum,
 			"Number of shares = %d\n", count);
-	if (ret < 0)
+	if (cum >= limit - 1)
 		return cum;
-	cum += ret;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Durable state memory = %ld\n",
+			atomic_long_read(&cifssrv_durable_mem));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Attribute cache hits = %ld\n"
+			"Attribute cache misses = %ld\n",
+			atomic_long_read(&cifssrv_attr_hits),
+			atomic_long_read(&cifssrv_attr_misses));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Security descriptor cache hits = %ld\n"
+			"Security descriptor cache misses = %ld\n",
+			atomic_long_read(&cifssrv_sd_hits),
+			atomic_long_read(&cifssrv_sd_misses));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Negative lookup cache hits = %ld\n"
+			"Negative lookup cache misses = %ld\n",
+			atomic_long_read(&cifssrv_neg_hits),
+			atomic_long_read(&cifssrv_neg_misses));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Casefold index hits = %ld\n"
+			"Casefold directory scans = %ld\n",
+			atomic_long_read(&cifssrv_casefold_hits),
+			atomic_long_read(&cifssrv_casefold_scans));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Attribute and delete only opens = %ld\n",
+			atomic_long_read(&cifssrv_light_opens));
+	if (cum >= limit - 1)
+		return cum;
+
+	cum += scnprintf(buf + cum, limit - cum,
+			"Opens by file id = %ld\n",
+			atomic_long_read(&cifssrv_open_by_id));
+	if (cum >= limit - 1)
+		return cum;
+
+	list_for_each(tmp, &cifssrv_share_list) {
+		share = list_entry(tmp, struct cifssrv_share, list);
+		if (!share->path)
+			continue;
+
+		ret = show_share_stat(buf, cum, share);
+		if (ret < 0)
+			return cum;
+		cum = ret;
+	}
 
 	return cum;
 }
@@ -1510,6 +1916,8 @@ static ssize_t show_server_stat(char *buf)
  */
 static ssize_t show_client_stat(char *buf, struct tcp_server_info *server)
 {
+	struct cifssrv_sess *sess;
+	struct list_head *tmp;
 	int cum = 0, ret = 0, limit = PAGE_SIZE;
 
 	ret = snprintf(buf+cum, limit - cum,
@@ -1540,6 +1948,23 @@ static ssize_t show_client_stat(char *buf, struct tcp_server_info *server)
 		return cum;
 	cum += ret;
 
+	ret = snprintf(buf+cum, limit - cum,
+			"Request memory = %ld\n",
+			atomic_long_read(&server->stats.mem_used));
+	if (ret < 0)
+		return cum;
+	cum += ret;
+
+	list_for_each(tmp, &server->cifssrv_sess) {
+		sess = list_entry(tmp, struct cifssrv_sess, cifssrv_ses_list);
+		ret = snprintf(buf+cum, limit - cum,
+				"Session %llu memory = %lu\n",
+				sess->sess_id, cifssrv_sess_mem_used(sess));
+		if (ret < 0)
+			return cum;
+		cum += ret;
+	}
+
 	if (cifssrv_debug_enable) {
 		ret = snprintf(buf+cum, limit - cum,
 				"Avg. duration per request = %ld\n",
@@ -117,6 +117,10 @@ struct cifssrv_sess {
 	bool is_anonymous;
 	bool is_guest;
 	struct fidtable_desc fidtable;
+	/* number of durable opens in fidtable */
+	atomic_t durable_open_count;
+	/* memory charged to this session, see cifssrv_charge_mem() */
+	atomic_long_t mem_used;
 	int state;
 	__u8 Preauth_HashValue[64];
 	struct cifssrv_pipe *pipe_desc[MAX_PIPE];
@@ -134,7 +138,9 @@ enum share_attrs {
 	SH_OPLOCKS,
 	SH_WRITEABLE,
 	SH_READONLY,
-	SH_WRITEOK
+	SH_WRITEOK,
+	SH_ZERODETECT,
+	SH_BRANCHCACHE
 };
 
 #define SHARE_ATTR(bit, name)					\
@@ -162,6 +168,8 @@ SHARE_ATTR(SH_GUESTONLY, guestonly)	/* default: disabled */
 SHARE_ATTR(SH_OPLOCKS, oplocks)		/* default: enabled */
 SHARE_ATTR(SH_READONLY, readonly)	/* default: enabled */
 SHARE_ATTR(SH_WRITEOK, writeok)		/* default: enabled */
+SHARE_ATTR(SH_ZERODETECT, zerodetect)	/* default: disabled */
+SHARE_ATTR(SH_BRANCHCACHE, branchcache)	/* default: disabled */
 
 struct share_config {
 	char *comment;
@@ -173,8 +181,88 @@ struct share_config {
 	char *valid_users;
 	unsigned long attr;
 	unsigned int max_connections;
+	/* memory cap in bytes for opens on this share, 0 for no limit */
+	unsigned long max_mem;
+	/* sequential transfer size in bytes that enables drop-behind */
+	unsigned long stream_threshold;
+	/* largest preallocation in bytes for appending writers, 0 disables */
+	unsigned long prealloc_max;
+	/* allocated size in bytes from which deletes are deferred */
+	unsigned long defer_delete_size;
+	/* stream size in bytes above which data moves to a companion file */
+	unsigned long stream_xattr_max;
+	/* msecs a cached statfs of the share is served as fresh, 0 disables */
+	unsigned long statfs_cache_time;
 };
 
+/* group commit batch sizes 1, 2, 3-4, 5-8, ..., 33-64, 65 and more */
+#define SMB_SYNC_BATCH_BUCKETS	8
+
+struct cifssrv_share_stats {
+	atomic_long_t mem_used;
+	/* sequential reads already covered by our readahead or not */
+	atomic_long_t ra_hits;
+	atomic_long_t ra_misses;
+	/* page cache pages dropped behind streaming readers and writers */
+	atomic_long_t dropped_pages;
+	/* file data bytes moved with and without the page cache */
+	atomic_long_t buffered_bytes;
+	atomic_long_t direct_bytes;
+	/* asynchronous I/Os in flight now and at most */
+	atomic_t aio_inflight;
+	atomic_t aio_max_inflight;
+	/* number of fsyncs by number of syncs they completed */
+	atomic_long_t sync_batch[SMB_SYNC_BATCH_BUCKETS];
+	/* bytes preallocated ahead of appending writers */
+	atomic_long_t prealloc_bytes;
+	/* bytes of deleted files waiting in trash for the reclaimer */
+	atomic_long_t reclaim_pending;
+	/* bytes copied on the server by copychunk requests */
+	atomic_long_t copy_bytes;
+	/* bytes shared with duplicate extents requests */
+	atomic_long_t clone_bytes;
+	/* write payloads scanned for zero blocks and time spent on it */
+	atomic_long_t zero_scan_bytes;
+	atomic_long_t zero_scan_ns;
+	/* zero blocks of writes turned into holes instead of written */
+	atomic_long_t zero_saved_bytes;
+	/* content information requests served and sent back for data */
+	atomic_long_t pcc_hits;
+	atomic_long_t pcc_misses;
+	/* bytes hashed for content information and time spent on it */
+	atomic_long_t pcc_hashed_bytes;
+	atomic_long_t pcc_hash_ns;
+	/* file system info queries served from cache or by statfs */
+	atomic_long_t statfs_hits;
+	atomic_long_t statfs_misses;
+};
+
+/**
+ * struct smb_statfs_cache - last statfs result of a share root
+ * @lock:	protects @st, @stamp, @valid and @gen
+ * @st:		statfs result
+ * @stamp:	jiffies when @st was taken
+ * @valid:	@st can be served
+ * @gen:	bumped on invalidation, a refresh started before is dropped
+ * @dirty:	bytes written or allocated since @st was taken
+ * @work:	background refresh once @st is past the freshness window
+ */
+struct smb_statfs_cache {
+	spinlock_t		lock;
+	struct kstatfs		st;
+	unsigned long		stamp;
+	bool			valid;
+	unsigned int		gen;
+	atomic_long_t		dirty;
+	struct work_struct	work;
+};
+
+/* hidden directory in share root holding deleted files until reclaimed */
+#define SMB_TRASH_NAME		".cifssrv_trash"
+/* hidden directory in share root holding data files of large streams */
+#define SMB_STREAMS_NAME	".cifssrv_streams"
+
+
 struct cifssrv_share {
 	char *path;
 	__u64 tid;
@@ -182,9 +270,15 @@ struct cifssrv_share {
 	int tcount;
 	char *sharename;
 	struct share_config config;
+	struct cifssrv_share_stats stats;
 	/* global list of shares */
 	struct list_head list;
 	int writeable;
+	/* leftovers in trash directory queued for reclaim */
+	atomic_t trash_swept;
+	/* content information can not be stored on this share */
+	bool pcc_disabled;
+	struct smb_statfs_cache statfs;
 };
 
 /* cifssrv_tcon is coupled with cifssrv_share */
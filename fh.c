@@ -262,6 +262,112 @@ int init_fidtable(struct fidtable_desc *ftab_desc)
 	return 0;
 }
 
+/* Memory accounting */
+
+/**
+ * cifssrv_fidtable_mem() - memory used by fid table arrays
+ * @ftab_desc:	fid table descriptor
+ *
+ * Return:      bytes allocated for fid table, fileid and bitmap arrays
+ */
+static size_t cifssrv_fidtable_mem(struct fidtable_desc *ftab_desc)
+{
+	struct fidtable *ftab = ftab_desc->ftab;
+
+	if (!ftab)
+		return 0;
+
+	return sizeof(struct fidtable) + ftab->max_fids * sizeof(void *) +
+		ftab->max_fids / BITS_PER_BYTE;
+}
+
+/**
+ * cifssrv_sess_mem_used() - memory consumed by a session
+ * @sess:	session to be accounted
+ *
+ * Return:      bytes charged to session including its fid table
+ */
+unsigned long cifssrv_sess_mem_used(struct cifssrv_sess *sess)
+{
+	return atomic_long_read(&sess->mem_used) +
+		cifssrv_fidtable_mem(&sess->fidtable);
+}
+
+/**
+ * cifssrv_charge_mem() - charge memory to a session and share
+ * @sess:	session to be charged, can be NULL
+ * @share:	share to be charged, can be NULL
+ * @size:	number of bytes to charge
+ *
+ * Limits are soft: concurrent charges may overshoot a cap by the size
+ * of the racing allocations, which is fine for bounding a client.
+ *
+ * Return:      0 on success, -ENOMEM if a cap would be exceeded
+ */
+int cifssrv_charge_mem(struct cifssrv_sess *sess,
+		struct cifssrv_share *share, size_t size)
+{
+	if (sess && cifssrv_sess_max_mem &&
+		cifssrv_sess_mem_used(sess) + size > cifssrv_sess_max_mem) {
+		cifssrv_debug("session %llu over memory limit\n",
+				sess->sess_id);
+		return -ENOMEM;
+	}
+
+	if (share && share->config.max_mem &&
+		atomic_long_read(&share->stats.mem_used) + size >
+		share->config.max_mem) {
+		cifssrv_debug("share %s over memory limit\n",
+				share->sharename);
+		return -ENOMEM;
+	}
+
+	if (sess)
+		atomic_long_add(size, &sess->mem_used);
+	if (share)
+		atomic_long_add(size, &share->stats.mem_used);
+	return 0;
+}
+
+/**
+ * cifssrv_uncharge_mem() - release memory charged by cifssrv_charge_mem()
+ * @sess:	session to be uncharged, can be NULL
+ * @share:	share to be uncharged, can be NULL
+ * @size:	number of bytes to uncharge
+ */
+void cifssrv_uncharge_mem(struct cifssrv_sess *sess,
+		struct cifssrv_share *share, size_t size)
+{
+	if (sess)
+		atomic_long_sub(size, &sess->mem_used);
+	if (share)
+		atomic_long_sub(size, &share->stats.mem_used);
+}
+
+/**
+ * cifssrv_mem_pressure() - check if a request should be throttled
+ * @work:	smb work of current request
+ *
+ * Session and connection memory is considered under pressure once it
+ * crosses three quarters of the session cap, so that clients are slowed
+ * down by fewer credits before new opens start failing.
+ *
+ * Return:      true if memory usage is close to the session limit
+ */
+bool cifssrv_mem_pressure(struct smb_work *work)
+{
+	unsigned long used;
+
+	if (!cifssrv_sess_max_mem)
+		return false;
+
+	used = atomic_long_read(&work->server->stats.mem_used);
+	if (work->sess)
+		used += cifssrv_sess_mem_used(work->sess);
+
+	return used > cifssrv_sess_max_mem - (cifssrv_sess_max_mem >> 2);
+}
+
 /* Volatile ID operations */
 
 /**
@@ -280,16 +386,24 @@ insert_id_in_fidtable(struct cifssrv_sess *sess, uint64_t sess_id,
 		uint32_t tree_id, unsigned int id, struct file *filp)
 {
 	struct cifssrv_file *fp = NULL;
+	struct cifssrv_share *share;
 	struct fidtable *ftab;
 
+	share = find_matching_share(tree_id);
+	if (cifssrv_charge_mem(sess, share, sizeof(struct cifssrv_file)))
+		return NULL;
+
 	fp = kmem_cache_zalloc(cifssrv_filp_cache, GFP_NOFS);
 	if (!fp) {
 		cifssrv_err("Failed to allocate memory for id (%u)\n", id);
+		cifssrv_uncharge_mem(sess, share, sizeof(struct cifssrv_file));
 		return NULL;
 	}
 
 	fp->filp = filp;
+	fp->inode = file_inode(filp);
 	fp->tid = tree_id;
+	fp->share = share;
 #ifdef CONFIG_CIFS_SMB2_SERVER
 	fp->sess_id = sess_id;
 #endif
@@ -303,6 +417,45 @@ insert_id_in_fidtable(struct cifssrv_sess *sess, uint64_t sess_id,
 	return ftab->fileid[id];
 }
 
+/**
+ * cifssrv_file_ext() - get rarely used state of an open file
+ * @fp:		cifssrv file pointer
+ *
+ * Directory listing, stream and symlink state is not needed by most
+ * opens, so it is allocated on first use and freed with the open. So
+ * is the state of reads and appends, which metadata only opens never
+ * touch.
+ *
+ * Return:      extended open state on success, otherwise NULL
+ */
+struct cifssrv_file_ext *cifssrv_file_ext(struct cifssrv_file *fp)
+{
+	struct cifssrv_file_ext *ext;
+
+	if (fp->ext)
+		return fp->ext;
+
+	if (cifssrv_charge_mem(NULL, fp->share,
+				sizeof(struct cifssrv_file_ext)))
+		return NULL;
+
+	ext = kzalloc(sizeof(struct cifssrv_file_ext), GFP_NOFS);
+	if (!ext) {
+		cifssrv_uncharge_mem(NULL, fp->share,
+				sizeof(struct cifssrv_file_ext));
+		return NULL;
+	}
+
+	/* another request on the same fid may have raced with us */
+	if (cmpxchg(&fp->ext, NULL, ext)) {
+		kfree(ext);
+		cifssrv_uncharge_mem(NULL, fp->share,
+				sizeof(struct cifssrv_file_ext));
+	}
+
+	return fp->ext;
+}
+
 /**
  * get_id_from_fidtable() - get cifssrv file pointer for a fid
  * @server:	TCP server instance of connection
@@ -347,8 +500,17 @@ void delete_id_from_fidtable(struct cifssrv_sess *sess, unsigned int id)
 	ftab = sess->fidtable.ftab;
 	BUG_ON(!ftab->fileid[id]);
 	fp = ftab->fileid[id];
-	if (fp->is_stream)
-		kfree(fp->stream_name);
+	if (fp->ext) {
+		if (fp->ext->sfilp)
+			fput(fp->ext->sfilp);
+		kfree(fp->ext->stream_name);
+		kfree(fp->ext);
+		cifssrv_uncharge_mem(NULL, fp->share,
+				sizeof(struct cifssrv_file_ext));
+	}
+	if (fp->is_durable)
+		atomic_dec(&sess->durable_open_count);
+	cifssrv_uncharge_mem(sess, fp->share, sizeof(struct cifssrv_file));
 	kmem_cache_free(cifssrv_filp_cache, fp);
 	ftab->fileid[id] = NULL;
 	spin_unlock(&sess->fidtable.fidtable_lock);
@@ -387,7 +549,7 @@ int close_id(struct cifssrv_sess *sess, uint64_t id, uint64_t p_id)
 	close_id_del_oplock(sess->server, fp, id);
 
 	if (fp->islink)
-		filp = fp->lfilp;
+		filp = fp->ext->lfilp;
 	else
 		filp = fp->filp;
 
@@ -398,13 +560,20 @@ int close_id(struct cifssrv_sess *sess, uint64_t id, uint64_t p_id)
 		dir = dentry->d_parent;
 
 		if (fp->is_stream && !fp->delete_pending) {
-			err = vfs_removexattr(dentry, fp->stream_name);
+			err = smb_vfs_stream_remove(fp->share, dentry,
+					fp->ext->stream_name);
 			if (err)
 				cifssrv_err("remove xattr failed : %s\n",
-					fp->stream_name);
+					fp->ext->stream_name);
 			goto out2;
 		}
 
+		if (dentry->d_inode->i_nlink == 1)
+			smb_vfs_stream_purge(fp->share, dentry);
+
+		if (!smb_vfs_defer_unlink(fp->share, filp))
+			goto close;
+
 		dget(dentry);
 #if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
 		inode_lock(dir->d_inode);
@@ -436,6 +605,10 @@ out:
 			cifssrv_debug("failed to delete, err %d\n", err);
 	}
 
+	if (fp->ext && fp->ext->prealloc_end > i_size_read(file_inode(filp)))
+		smb_vfs_trim_alloc(filp);
+
+close:
 	filp_close(filp, (struct files_struct *)filp);
 	delete_id_from_fidtable(sess, id);
 	cifssrv_close_id(&sess->fidtable, id);
@@ -564,6 +737,8 @@ int cifssrv_insert_in_global_table(struct cifssrv_sess *sess,
 	durable_state->volatile_id = volatile_id;
 	generic_fillattr(filp->f_path.dentry->d_inode, &durable_state->stat);
 	durable_state->refcount = 1;
+	atomic_long_add(sizeof(struct cifssrv_durable_state),
+			&cifssrv_durable_mem);
 
 	cifssrv_debug("filp stored = 0x%p sess = 0x%p\n", filp, sess);
 
@@ -689,6 +864,8 @@ int cifssrv_delete_durable_state(uint64_t id)
 	if (durable_state) {
 		cifssrv_debug("durable state delete persistentID (%llu) refcount = %d\n",
 			    id, durable_state->refcount);
+		atomic_long_sub(sizeof(struct cifssrv_durable_state),
+				&cifssrv_durable_mem);
 		kfree(durable_state);
 	}
 
@@ -892,6 +1069,10 @@ void cifssrv_update_durable_stat_info(struct cifssrv_sess *sess)
 	if (durable_enable == false || !sess)
 		return;
 
+	/* avoid walking the whole fid table when nothing is durable */
+	if (!atomic_read(&sess->durable_open_count))
+		return;
+
 	spin_lock(&sess->fidtable.fidtable_lock);
 	ftab = sess->fidtable.ftab;
 
@@ -974,6 +1155,7 @@ int smb_dentry_open(struct smb_work *work, const struct path *path,
 		cifssrv_err("id insert failed\n");
 		goto err_out;
 	}
+	fp->coption = cpu_to_le32(option);
 
 	if (!oplocks_enable || S_ISDIR(file_inode(filp)->i_mode))
 		*oplock = OPLOCK_NONE;
@@ -1026,6 +1208,551 @@ bool is_dir_empty(struct cifssrv_file *fp)
 	return true;
 }
 
+/* negative lookup cache, see smb_neg_lookup() */
+#define SMB_NEG_HASH_BITS	8
+#define SMB_NEG_MAX_ENTRIES	4096
+
+/**
+ * struct smb_neg_entry - name known to be missing from a directory
+ * @node:	entry in smb_neg_cache
+ * @lru:	entry in smb_neg_lru, most recently used first
+ * @dir:	directory inode, only compared as a key
+ * @stamp:	directory state the name was missing at
+ * @hash:	hash of case folded name
+ * @len:	length of name
+ * @name:	name as the client sent it
+ */
+struct smb_neg_entry {
+	struct hlist_node	node;
+	struct list_head	lru;
+	struct inode		*dir;
+	struct smb_attr_stamp	stamp;
+	unsigned int		hash;
+	int			len;
+	char			name[0];
+};
+
+static DEFINE_HASHTABLE(smb_neg_cache, SMB_NEG_HASH_BITS);
+static LIST_HEAD(smb_neg_lru);
+static DEFINE_SPINLOCK(smb_neg_lock);
+static int smb_neg_count;
+
+static unsigned int smb_fold_hash(const char *name, int len)
+{
+	unsigned long hash = 0;
+
+	while (len--)
+		hash = partial_name_hash(tolower(*name++), hash);
+	return end_name_hash(hash);
+}
+
+/*
+ * Change time may not move for a second change within the same second,
+ * so state taken from a directory changed in this second is not cached.
+ */
+static bool smb_dir_stamp_settled(struct smb_attr_stamp *stamp)
+{
+	return CURRENT_TIME.tv_sec > stamp->ctime.tv_sec;
+}
+
+/* called with smb_neg_lock held */
+static struct smb_neg_entry *smb_neg_find(struct inode *dir,
+		const char *name, int len, unsigned int hash)
+{
+	struct smb_neg_entry *e;
+
+	hash_for_each_possible(smb_neg_cache, e, node,
+			(unsigned long)dir ^ hash) {
+		if (e->dir != dir || e->hash != hash || e->len != len)
+			continue;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		if (!strncasecmp(e->name, name, len))
+#else
+		if (!strnicmp(e->name, name, len))
+#endif
+			return e;
+	}
+	return NULL;
+}
+
+/**
+ * smb_neg_lookup() - check if a name is known to be missing
+ * @dir:	directory inode
+ * @name:	name to check, compared without case
+ *
+ * An entry is only trusted while the directory is in the state it was
+ * cached at, any entry added, removed or renamed in the directory
+ * changes its change time and version.
+ *
+ * Return:	true if no entry of @dir matches @name
+ */
+static bool smb_neg_lookup(struct inode *dir, const char *name)
+{
+	struct smb_attr_stamp stamp;
+	struct smb_neg_entry *e;
+	int len = strlen(name);
+
+	smb_vfs_attr_stamp(dir, &stamp);
+	spin_lock(&smb_neg_lock);
+	e = smb_neg_find(dir, name, len, smb_fold_hash(name, len));
+	if (e && !smb_vfs_attr_stamp_equal(&e->stamp, &stamp)) {
+		hash_del(&e->node);
+		list_del(&e->lru);
+		smb_neg_count--;
+		spin_unlock(&smb_neg_lock);
+		kfree(e);
+		atomic_long_inc(&cifssrv_neg_misses);
+		return false;
+	}
+	if (e)
+		list_move(&e->lru, &smb_neg_lru);
+	spin_unlock(&smb_neg_lock);
+
+	atomic_long_inc(e ? &cifssrv_neg_hits : &cifssrv_neg_misses);
+	return e != NULL;
+}
+
+/*
+ * remember a name missing from a directory, evicting least recently used.
+ * @stamp is taken before the directory was searched, so a name created
+ * during the search leaves the entry stale rather than wrong.
+ */
+static void smb_neg_insert(struct inode *dir, struct smb_attr_stamp *stamp,
+		const char *name)
+{
+	struct smb_neg_entry *e, *old = NULL;
+	int len = strlen(name);
+
+	e = kmalloc(sizeof(struct smb_neg_entry) + len + 1, GFP_KERNEL);
+	if (!e)
+		return;
+
+	e->dir = dir;
+	e->stamp = *stamp;
+	if (!smb_dir_stamp_settled(&e->stamp)) {
+		kfree(e);
+		return;
+	}
+	e->len = len;
+	e->hash = smb_fold_hash(name, len);
+	memcpy(e->name, name, len + 1);
+
+	spin_lock(&smb_neg_lock);
+	if (smb_neg_find(dir, name, len, e->hash)) {
+		spin_unlock(&smb_neg_lock);
+		kfree(e);
+		return;
+	}
+	if (smb_neg_count >= SMB_NEG_MAX_ENTRIES) {
+		old = list_last_entry(&smb_neg_lru, struct smb_neg_entry, lru);
+		hash_del(&old->node);
+		list_del(&old->lru);
+		smb_neg_count--;
+	}
+	hash_add(smb_neg_cache, &e->node, (unsigned long)dir ^ e->hash);
+	list_add(&e->lru, &smb_neg_lru);
+	smb_neg_count++;
+	spin_unlock(&smb_neg_lock);
+	kfree(old);
+}
+
+/**
+ * smb_neg_exit() - free negative lookup cache
+ */
+void smb_neg_exit(void)
+{
+	struct smb_neg_entry *e, *tmp;
+
+	spin_lock(&smb_neg_lock);
+	list_for_each_entry_safe(e, tmp, &smb_neg_lru, lru) {
+		hash_del(&e->node);
+		list_del(&e->lru);
+		kfree(e);
+	}
+	smb_neg_count = 0;
+	spin_unlock(&smb_neg_lock);
+}
+
+/* case folded name index of directories, see smb_casefold_match() */
+#define SMB_CASE_MAX_DIRS	32
+/* names kept over all indexes, a larger directory is only scanned */
+#define SMB_CASE_MAX_NAMES	262144
+
+/**
+ * struct smb_case_name - name of a directory entry in a case index
+ * @node:	entry in a bucket of smb_case_index
+ * @hash:	hash of case folded name
+ * @len:	length of name
+ * @name:	name as stored in the directory
+ */
+struct smb_case_name {
+	struct hlist_node	node;
+	unsigned int		hash;
+	int			len;
+	char			name[0];
+};
+
+/**
+ * struct smb_case_index - case folded names of a directory
+ * @lru:	entry in smb_case_lru, most recently used first
+ * @dir:	directory inode, only compared as a key
+ * @stamp:	directory state the names were read at
+ * @count:	number of names
+ * @bits:	log2 of number of buckets
+ * @heads:	buckets of names hashed by smb_fold_hash()
+ */
+struct smb_case_index {
+	struct list_head	lru;
+	struct inode		*dir;
+	struct smb_attr_stamp	stamp;
+	unsigned int		count;
+	unsigned int		bits;
+	struct hlist_head	*heads;
+};
+
+static LIST_HEAD(smb_case_lru);
+static DEFINE_SPINLOCK(smb_case_lock);
+static int smb_case_dirs;
+static unsigned int smb_case_names;
+
+static void smb_case_free_names(struct hlist_head *head)
+{
+	struct smb_case_name *e;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry_safe(e, tmp, head, node) {
+		hlist_del(&e->node);
+		kfree(e);
+	}
+}
+
+static void smb_case_free(struct smb_case_index *idx)
+{
+	unsigned int i;
+
+	for (i = 0; i < (1U << idx->bits); i++)
+		smb_case_free_names(&idx->heads[i]);
+	vfree(idx->heads);
+	kfree(idx);
+}
+
+/* called with smb_case_lock held */
+static void smb_case_unlink(struct smb_case_index *idx)
+{
+	list_del(&idx->lru);
+	smb_case_dirs--;
+	smb_case_names -= idx->count;
+}
+
+/*
+ * Look a name up in the index of a directory and replace it with the
+ * stored name. Return -EAGAIN when there is no valid index.
+ */
+static int smb_case_find(struct inode *dir, char *name)
+{
+	struct smb_attr_stamp stamp;
+	struct smb_case_index *idx, *stale = NULL;
+	struct smb_case_name *e;
+	int len = strlen(name);
+	unsigned int hash = smb_fold_hash(name, len);
+	int err = -EAGAIN;
+
+	smb_vfs_attr_stamp(dir, &stamp);
+	spin_lock(&smb_case_lock);
+	list_for_each_entry(idx, &smb_case_lru, lru) {
+		if (idx->dir != dir)
+			continue;
+
+		if (!smb_vfs_attr_stamp_equal(&idx->stamp, &stamp)) {
+			smb_case_unlink(idx);
+			stale = idx;
+			break;
+		}
+
+		list_move(&idx->lru, &smb_case_lru);
+		err = -ENOENT;
+		hlist_for_each_entry(e, &idx->heads[hash_32(hash, idx->bits)],
+				node) {
+			if (e->hash != hash || e->len != len)
+				continue;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+			if (strncasecmp(e->name, name, len))
+#else
+			if (strnicmp(e->name, name, len))
+#endif
+				continue;
+			memcpy(name, e->name, len);
+			err = 0;
+			break;
+		}
+		break;
+	}
+	spin_unlock(&smb_case_lock);
+
+	if (stale)
+		smb_case_free(stale);
+	return err;
+}
+
+/* keep names read from a directory, evicting least recently used */
+static void smb_case_insert(struct inode *dir, struct smb_attr_stamp *stamp,
+		struct hlist_head *names, unsigned int count)
+{
+	struct smb_case_index *idx, *old, *tmp;
+	struct smb_case_name *e;
+	struct hlist_node *next;
+	LIST_HEAD(dead);
+
+	idx = kmalloc(sizeof(struct smb_case_index), GFP_KERNEL);
+	if (!idx)
+		goto out;
+
+	idx->dir = dir;
+	idx->stamp = *stamp;
+	idx->count = count;
+	idx->bits = count > 2 ? ilog2(roundup_pow_of_two(count) / 2) : 1;
+	idx->heads = vzalloc(sizeof(struct hlist_head) << idx->bits);
+	if (!idx->heads) {
+		kfree(idx);
+		goto out;
+	}
+
+	hlist_for_each_entry_safe(e, next, names, node) {
+		hlist_del(&e->node);
+		hlist_add_head(&e->node,
+			&idx->heads[hash_32(e->hash, idx->bits)]);
+	}
+
+	spin_lock(&smb_case_lock);
+	list_for_each_entry_safe(old, tmp, &smb_case_lru, lru) {
+		if (old->dir == dir) {
+			smb_case_unlink(old);
+			list_add(&old->lru, &dead);
+		}
+	}
+	while (!list_empty(&smb_case_lru) &&
+	       (smb_case_dirs >= SMB_CASE_MAX_DIRS ||
+		smb_case_names + count > SMB_CASE_MAX_NAMES)) {
+		old = list_last_entry(&smb_case_lru, struct smb_case_index,
+				lru);
+		smb_case_unlink(old);
+		list_add(&old->lru, &dead);
+	}
+	list_add(&idx->lru, &smb_case_lru);
+	smb_case_dirs++;
+	smb_case_names += count;
+	spin_unlock(&smb_case_lock);
+
+	list_for_each_entry_safe(old, tmp, &dead, lru)
+		smb_case_free(old);
+	return;
+out:
+	smb_case_free_names(names);
+}
+
+/*
+ * Read a directory once, look for a name without case and build the
+ * index of the directory on the way. A directory with more names than
+ * the index can keep is only scanned.
+ */
+static int smb_case_scan(struct path *dir, char *name)
+{
+	struct inode *inode = dir->dentry->d_inode;
+	struct smb_attr_stamp stamp, now;
+	struct smb_readdir_data readdir_data = {
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		.ctx.actor = smb_filldir,
+#endif
+		.dirent = (void *)__get_free_page(GFP_KERNEL)
+	};
+	struct smb_dirent *buf_p;
+	struct smb_case_name *e;
+	struct file *dfilp;
+	HLIST_HEAD(names);
+	unsigned int count = 0;
+	int namelen = strlen(name);
+	int iter, reclen, ret;
+	bool keep = true, match_found = false;
+
+	if (!readdir_data.dirent)
+		return -ENOMEM;
+
+	smb_vfs_attr_stamp(inode, &stamp);
+	dfilp = dentry_open(dir, O_RDONLY | O_LARGEFILE, current_cred());
+	if (IS_ERR(dfilp)) {
+		cifssrv_err("cannot open directory for caseless lookup\n");
+		free_page((unsigned long)(readdir_data.dirent));
+		return -EINVAL;
+	}
+
+	do {
+		readdir_data.used = 0;
+		readdir_data.full = 0;
+		ret = smb_vfs_readdir(dfilp, smb_filldir, &readdir_data);
+		if (ret || !readdir_data.used)
+			break;
+
+		buf_p = (struct smb_dirent *)readdir_data.dirent;
+		for (iter = 0; iter < readdir_data.used; iter += reclen,
+		     buf_p = (struct smb_dirent *)((char *)buf_p + reclen)) {
+			int length = buf_p->namelen;
+
+			reclen = ALIGN(sizeof(struct smb_dirent) + length,
+				       sizeof(__le64));
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+			if (!match_found && length == namelen &&
+			    !strncasecmp(name, buf_p->name, namelen)) {
+#else
+			if (!match_found && length == namelen &&
+			    !strnicmp(name, buf_p->name, namelen)) {
+#endif
+				memcpy(name, buf_p->name, namelen);
+				match_found = true;
+			}
+
+			if (!keep)
+				continue;
+			if (count >= SMB_CASE_MAX_NAMES) {
+				keep = false;
+				smb_case_free_names(&names);
+				continue;
+			}
+			e = kmalloc(sizeof(struct smb_case_name) + length,
+					GFP_KERNEL);
+			if (!e) {
+				keep = false;
+				smb_case_free_names(&names);
+				continue;
+			}
+			e->hash = smb_fold_hash(buf_p->name, length);
+			e->len = length;
+			memcpy(e->name, buf_p->name, length);
+			hlist_add_head(&e->node, &names);
+			count++;
+		}
+	} while (keep || !match_found);
+
+	fput(dfilp);
+	free_page((unsigned long)(readdir_data.dirent));
+
+	smb_vfs_attr_stamp(inode, &now);
+	if (!ret && keep && smb_vfs_attr_stamp_equal(&stamp, &now) &&
+	    smb_dir_stamp_settled(&stamp))
+		smb_case_insert(inode, &stamp, &names, count);
+	else
+		smb_case_free_names(&names);
+
+	atomic_long_inc(&cifssrv_casefold_scans);
+	if (ret)
+		return ret;
+	return match_found ? 0 : -ENOENT;
+}
+
+/**
+ * smb_casefold_match() - find an entry of a directory without case
+ * @dir:	path of directory
+ * @name:	name to find, replaced with the stored name on success
+ *
+ * A file system doing casefolding itself has matched the name already.
+ * Otherwise names missing before are answered by the negative cache,
+ * and the rest by the folded name index of the directory, which is
+ * built by one read of the directory and dropped when it changes.
+ *
+ * Return:	0 on success, -ENOENT if no entry matches, otherwise error
+ */
+static int smb_casefold_match(struct path *dir, char *name)
+{
+	struct inode *inode = dir->dentry->d_inode;
+	struct smb_attr_stamp stamp;
+	int err;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+	if (IS_CASEFOLDED(inode))
+		return -ENOENT;
+#endif
+	smb_vfs_attr_stamp(inode, &stamp);
+	if (smb_neg_lookup(inode, name))
+		return -ENOENT;
+
+	err = smb_case_find(inode, name);
+	if (err == -EAGAIN)
+		err = smb_case_scan(dir, name);
+	else
+		atomic_long_inc(&cifssrv_casefold_hits);
+
+	if (err == -ENOENT)
+		smb_neg_insert(inode, &stamp, name);
+	return err;
+}
+
+/**
+ * smb_casefold_exit() - free folded name indexes
+ */
+void smb_casefold_exit(void)
+{
+	struct smb_case_index *idx, *tmp;
+	LIST_HEAD(dead);
+
+	spin_lock(&smb_case_lock);
+	list_splice_init(&smb_case_lru, &dead);
+	smb_case_dirs = 0;
+	smb_case_names = 0;
+	spin_unlock(&smb_case_lock);
+
+	list_for_each_entry_safe(idx, tmp, &dead, lru)
+		smb_case_free(idx);
+}
+
+/*
+ * Walk a name relative to the share root one component at a time, each
+ * component missing with its case is looked for in its parent without
+ * case. Every lookup still starts at the share root so that ".." and
+ * symlinks resolve the same as in a single walk.
+ */
+static int smb_casefold_walk(struct path *root, char *rel,
+		unsigned int flags, struct path *path)
+{
+	struct path dir, next;
+	char *comp = rel, *end;
+	int err;
+
+	dir = *root;
+	path_get(&dir);
+	for (;;) {
+		end = strchr(comp, '/');
+		if (end)
+			*end = '\0';
+
+		err = vfs_path_lookup(root->dentry, root->mnt, rel,
+				end ? LOOKUP_FOLLOW | LOOKUP_DIRECTORY : flags,
+				&next);
+		if (err == -ENOENT && strcmp(comp, ".") && strcmp(comp, "..")) {
+			err = smb_casefold_match(&dir, comp);
+			if (!err)
+				err = vfs_path_lookup(root->dentry, root->mnt,
+					rel, end ? LOOKUP_FOLLOW |
+					LOOKUP_DIRECTORY : flags, &next);
+		}
+
+		path_put(&dir);
+		if (end)
+			*end = '/';
+		if (err)
+			return err;
+
+		dir = next;
+		if (end)
+			while (*++end == '/')
+				;
+		if (!end || *end == '\0')
+			break;
+		comp = end;
+	}
+
+	*path = dir;
+	return 0;
+}
+
 /**
  * smb_kern_path() - lookup a file and get path info
  * @name:	name of file for lookup
@@ -1061,84 +1788,151 @@ int smb_kern_path(char *name, unsigned int flags, struct path *path,
 		return err;
 }
 
+/* check if a path component is a directory the server keeps to itself */
+static bool smb_share_private_comp(const char *name, size_t len)
+{
+	return (len == sizeof(SMB_TRASH_NAME) - 1 &&
+		!strncasecmp(name, SMB_TRASH_NAME, len)) ||
+		(len == sizeof(SMB_STREAMS_NAME) - 1 &&
+		 !strncasecmp(name, SMB_STREAMS_NAME, len));
+}
+
 /**
- * smb_search_dir() - lookup a file in a directory
- * @dirname:	directory name
- * @filename:	filename to lookup
+ * smb_share_private_name() - check a client path for private directories
+ * @name:	path given by client
  *
- * Return:	0 on success, otherwise error
+ * Any component named like the trash or streams directory is refused,
+ * without case, so that neither ".." nor a caseless lookup can reach
+ * them.
+ *
+ * Return:	true if @name has a private directory component
  */
-int smb_search_dir(char *dirname, char *filename)
+bool smb_share_private_name(const char *name)
 {
-	struct path dir_path;
-	int ret;
-	struct file *dfilp;
-	int flags = O_RDONLY|O_LARGEFILE;
-	int used_count, reclen;
-	int iter;
-	struct smb_dirent *buf_p;
-	int namelen = strlen(filename);
-	int dirnamelen = strlen(dirname);
-	bool match_found = false;
-	struct smb_readdir_data readdir_data = {
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-		.ctx.actor = smb_filldir,
-#endif
-		.dirent = (void *)__get_free_page(GFP_KERNEL)
-	};
+	const char *end;
 
-	if (!readdir_data.dirent) {
-		ret = -ENOMEM;
-		goto out;
+	while (*name) {
+		end = strchrnul(name, '/');
+		if (smb_share_private_comp(name, end - name))
+			return true;
+		name = *end ? end + 1 : end;
 	}
+	return false;
+}
 
-	ret = smb_kern_path(dirname, 0, &dir_path, true);
-	if (ret)
-		goto out;
+/**
+ * smb_share_private_dentry() - check if a dentry is a private directory
+ * @root:	share root
+ * @dentry:	dentry to check
+ *
+ * Catches symlinks leading into the trash or streams directory of the
+ * share root.
+ *
+ * Return:	true if @dentry is a private directory or below one
+ */
+bool smb_share_private_dentry(struct path *root, struct dentry *dentry)
+{
+	struct dentry *d = dget(dentry), *parent;
+	bool private = false;
+
+	while (d != root->dentry && !IS_ROOT(d)) {
+		parent = dget_parent(d);
+		if (parent == root->dentry) {
+			spin_lock(&d->d_lock);
+			private = smb_share_private_comp(d->d_name.name,
+					d->d_name.len);
+			spin_unlock(&d->d_lock);
+		}
+		dput(d);
+		d = parent;
+	}
+	dput(d);
+	return private;
+}
 
-	dfilp = dentry_open(&dir_path, flags, current_cred());
-	if (IS_ERR(dfilp)) {
-		cifssrv_err("cannot open directory %s\n", dirname);
-		ret = -EINVAL;
-		goto out2;
+/**
+ * smb_share_kern_path() - lookup a file relative to the pinned share root
+ * @tcon:	tree connection the name belongs to
+ * @name:	absolute name of file, as built by convert_to_unix_name()
+ * @flags:	lookup flags
+ * @path:	if lookup succeed, return path info
+ * @caseless:	caseless filename lookup
+ *
+ * The share prefix of @name is skipped and the rest is walked from the
+ * share root pinned at tree connect, so the share path is not resolved
+ * again for every request. The share root acts as the lookup root, so
+ * neither ".." nor an absolute symlink can lead out of the share.
+ * Names outside the share (or a tree connect without a share path) fall
+ * back to smb_kern_path(). A caseless lookup matches every component
+ * of the name without case, see smb_casefold_match(). Private
+ * directories of the server are never found, see
+ * smb_share_private_name().
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_share_kern_path(struct cifssrv_tcon *tcon, char *name,
+		unsigned int flags, struct path *path, bool caseless)
+{
+	char *rel;
+	size_t len;
+	int err;
+
+	if (smb_share_private_name(name))
+		return -ENOENT;
+
+	if (!tcon || !tcon->share->path || !tcon->share_path.dentry)
+		return smb_kern_path(name, flags, path, caseless);
+
+	len = strlen(tcon->share->path);
+	while (len > 1 && tcon->share->path[len - 1] == '/')
+		len--;
+	if (strncmp(name, tcon->share->path, len) ||
+	    (name[len] != '/' && name[len] != '\0'))
+		return smb_kern_path(name, flags, path, caseless);
+
+	rel = name + len;
+	while (*rel == '/')
+		rel++;
+	if (*rel == '\0') {
+		*path = tcon->share_path;
+		path_get(path);
+		return 0;
 	}
 
-	while (!ret && !match_found) {
-		readdir_data.used = 0;
-		readdir_data.full = 0;
-		ret = smb_vfs_readdir(dfilp, smb_filldir, &readdir_data);
-		used_count = readdir_data.used;
-		if (ret || !used_count)
-			break;
+	err = vfs_path_lookup(tcon->share_path.dentry, tcon->share_path.mnt,
+			rel, flags, path);
+	if (err && caseless)
+		err = smb_casefold_walk(&tcon->share_path, rel, flags, path);
+	if (err)
+		return err;
 
-		buf_p = (struct smb_dirent *)readdir_data.dirent;
-		for (iter = 0; iter < used_count; iter += reclen,
-		     buf_p = (struct smb_dirent *)((char *)buf_p + reclen)) {
-			int length;
+	if (smb_share_private_dentry(&tcon->share_path, path->dentry)) {
+		path_put(path);
+		return -ENOENT;
+	}
+	return 0;
+}
 
-			reclen = ALIGN(sizeof(struct smb_dirent) +
-				       buf_p->namelen, sizeof(__le64));
-			length = buf_p->namelen;
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-			if (length != namelen ||
-				strncasecmp(filename, buf_p->name, namelen))
-#else
-			if (length != namelen ||
-				strnicmp(filename, buf_p->name, namelen))
-#endif
-				continue;
-			/* got match, make absolute name */
-			memcpy(dirname + dirnamelen + 1, buf_p->name, namelen);
-			match_found = true;
-			break;
-		}
+/**
+ * smb_search_dir() - lookup a file in a directory
+ * @dirname:	directory name
+ * @filename:	filename to lookup, follows @dirname after a '/'
+ *
+ * Return:	0 on success, -ENOENT if no entry matches, otherwise error
+ */
+int smb_search_dir(char *dirname, char *filename)
+{
+	struct path dir_path;
+	int dirnamelen = strlen(dirname);
+	int ret;
+
+	ret = smb_kern_path(dirname, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+			&dir_path, true);
+	if (!ret) {
+		ret = smb_casefold_match(&dir_path, filename);
+		path_put(&dir_path);
 	}
 
-	free_page((unsigned long)(readdir_data.dirent));
-	fput(dfilp);
-out2:
-	path_put(&dir_path);
-out:
 	dirname[dirnamelen] = '/';
 	return ret;
 }
@@ -55,6 +55,8 @@
 
 struct tcp_server_info;
 struct cifssrv_sess;
+struct cifssrv_share;
+struct smb_work;
 
 struct smb_readdir_data {
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
@@ -74,36 +76,70 @@ struct smb_dirent {
 	char            name[];
 };
 
-struct cifssrv_file {
-	struct file *filp;
+/* rarely used open state, allocated on demand by cifssrv_file_ext() */
+struct cifssrv_file_ext {
 	/* Will be used for in case of symlink */
 	struct file *lfilp;
-	struct timespec open_time;
-	bool islink;
 	/* if ls is happening on directory, below is valid*/
 	struct smb_readdir_data	readdir_data;
 	int		dirent_offset;
+	char *stream_name;
+	ssize_t ssize;
+	/* companion file holding data of a large stream */
+	struct file *sfilp;
+	/* sequential read detection, see smb_vfs_readahead() */
+	loff_t ra_start;
+	loff_t ra_end;
+	loff_t ra_ahead;
+	/* append preallocation, see smb_vfs_prealloc() */
+	loff_t prealloc_end;
+	loff_t prealloc_chunk;
+	/* drop-behind state of large sequential transfers */
+	loff_t rd_dropped;
+	loff_t wr_start;
+	loff_t wr_end;
+	loff_t wr_flushed;
+	loff_t wr_dropped;
+};
+
+struct cifssrv_file {
+	/*
+	 * Fields read on every request and by share mode checks while
+	 * walking global_name_table are kept together at the start.
+	 */
+	struct file *filp;
+	struct inode *inode;
+	struct hlist_node node;
 	/* oplock info */
 	struct ofile_info *ofile;
+	struct cifssrv_share *share;
+	uint32_t tid;
+	__le32 daccess;
+	__le32 saccess;
+	__le32 coption;
+	__le32 cdoption;
+	__le32 fattr;
+	/*
+	 * Separate bools, not bitfields: they are set from different
+	 * contexts, e.g. delete_pending by SET_INFO while a lease break
+	 * clears lease_granted, and must not share a word.
+	 */
+	bool islink;
 	bool delete_on_close;
 	bool delete_pending;
+	bool attrib_only;
 	bool is_nt_open;
 	bool lease_granted;
-	char LeaseKey[16];
 	bool is_durable;
+	bool is_stream;
+	bool no_prealloc;
+	char LeaseKey[16];
 	uint64_t persistent_id;
 	uint64_t sess_id;
-	uint32_t tid;
-	__le32 daccess;
-	__le32 saccess;
-	__le32 coption;
-	__le32 cdoption;
-	__le32 fattr;
 	__u64 create_time;
-	bool is_stream;
-	char *stream_name;
-	ssize_t ssize;
-	struct hlist_node node;
+	struct timespec open_time;
+	/* cold state, NULL until needed */
+	struct cifssrv_file_ext *ext;
 };
 
 #ifdef CONFIG_CIFS_SMB2_SERVER
@@ -175,6 +211,13 @@ insert_id_in_fidtable(struct cifssrv_sess *sess, uint64_t sess_id,
 		uint32_t tree_id, unsigned int id, struct file *filp);
 void delete_id_from_fidtable(struct cifssrv_sess *sess,
 		unsigned int id);
+struct cifssrv_file_ext *cifssrv_file_ext(struct cifssrv_file *fp);
+unsigned long cifssrv_sess_mem_used(struct cifssrv_sess *sess);
+int cifssrv_charge_mem(struct cifssrv_sess *sess,
+		struct cifssrv_share *share, size_t size);
+void cifssrv_uncharge_mem(struct cifssrv_sess *sess,
+		struct cifssrv_share *share, size_t size);
+bool cifssrv_mem_pressure(struct smb_work *work);
 
 #ifdef CONFIG_CIFS_SMB2_SERVER
 /* Persistent-ID operations */
@@ -81,6 +81,18 @@ extern bool lease_enable;
 extern bool durable_enable;
 extern bool multi_channel_enable;
 extern unsigned int alloc_roundup_size;
+extern unsigned long cifssrv_sess_max_mem;
+extern atomic_long_t cifssrv_durable_mem;
+extern atomic_long_t cifssrv_attr_hits;
+extern atomic_long_t cifssrv_attr_misses;
+extern atomic_long_t cifssrv_sd_hits;
+extern atomic_long_t cifssrv_sd_misses;
+extern atomic_long_t cifssrv_neg_hits;
+extern atomic_long_t cifssrv_neg_misses;
+extern atomic_long_t cifssrv_casefold_hits;
+extern atomic_long_t cifssrv_casefold_scans;
+extern atomic_long_t cifssrv_light_opens;
+extern atomic_long_t cifssrv_open_by_id;
 extern unsigned long server_start_time;
 extern struct fidtable_desc global_fidtable;
 extern char *netbios_name;
@@ -223,6 +235,75 @@ extern struct hlist_head global_name_table[1024];
 #define XATTR_NAME_STREAM	(XATTR_USER_PREFIX STREAM_PREFIX)
 #define XATTR_NAME_STREAM_LEN	(sizeof(XATTR_NAME_STREAM) - 1)
 
+/* STREAM REFERENCE XATTR PREFIX, companion file id of a stream */
+#define STREAM_REF_PREFIX	"stream_ref."
+#define STREAM_REF_PREFIX_LEN	(sizeof(STREAM_REF_PREFIX) - 1)
+#define XATTR_NAME_STREAM_REF	(XATTR_USER_PREFIX STREAM_REF_PREFIX)
+
+/* DOS ATTRIBUTE XATTR PREFIX */
+#define DOS_ATTRIBUTE_PREFIX	"dos.attribute."
+#define DOS_ATTRIBUTE_PREFIX_LEN	(sizeof(DOS_ATTRIBUTE_PREFIX) - 1)
+#define DOS_ATTRIBUTE_LEN		(sizeof(__le32))
+#define XATTR_NAME_DOS_ATTRIBUTE	(XATTR_USER_PREFIX DOS_ATTRIBUTE_PREFIX)
+#define XATTR_NAME_DOS_ATTRIBUTE_LEN	(sizeof(XATTR_NAME_DOS_ATTRIBUTE) - 1)
+
+/* WINDOWS METADATA XATTR, replaces creation time and DOS attribute ones */
+#define META_PREFIX		"cifssrv.meta"
+#define META_PREFIX_LEN		(sizeof(META_PREFIX) - 1)
+#define XATTR_NAME_META		(XATTR_USER_PREFIX META_PREFIX)
+
+#define SMB_META_VERSION	1
+
+/* smb_meta flags */
+#define SMB_META_ATTR		0x0001	/* attr holds client set attributes */
+#define SMB_META_DEFAULT_STREAM	0x0002	/* default stream xattr is stored */
+#define SMB_META_HAS_STREAMS	0x0004	/* named streams may exist */
+
+/*
+ * Windows metadata of a file kept in one xattr, see smb_vfs_get_meta().
+ * Later versions only append fields.
+ */
+struct smb_meta {
+	__u8	version;
+	__u8	reserved;
+	__le16	flags;
+	__le32	attr;
+	__le64	create_time;
+} __packed;
+
+/* attributes of a file kept in xattrs, see smb_vfs_get_attr() */
+struct smb_attr {
+	__u64	create_time;
+	__le32	attr;
+	__u32	ea_size;
+};
+
+/* inode state cached attributes are valid for */
+struct smb_attr_stamp {
+	unsigned long	ino;
+	struct timespec	ctime;
+	u64		version;
+};
+
+/* BRANCHCACHE HASHES XATTR PREFIX */
+#define PEERDIST_PREFIX		"peerdist."
+#define PEERDIST_PREFIX_LEN	(sizeof(PEERDIST_PREFIX) - 1)
+#define XATTR_NAME_PEERDIST	(XATTR_USER_PREFIX PEERDIST_PREFIX)
+
+/* opaque offload token, see smb_vfs_offload_read() */
+struct storage_offload_token {
+	__be32	TokenType;
+	__u8	Reserved[2];
+	__be16	TokenIdLength;
+	__u8	TokenId[504];
+} __packed;
+
+/* data range of a file, as returned by FSCTL_QUERY_ALLOCATED_RANGES */
+struct file_allocated_range_buffer {
+	__le64	file_offset;
+	__le64	length;
+} __packed;
+
 enum statusEnum {
 	CifsNew = 0,
 	CifsGood,
@@ -265,6 +346,8 @@ struct cifssrv_stats {
 	int request_served;
 	long int avg_req_duration;
 	long int max_timed_request;
+	/* request buffers and work items queued on this connection */
+	atomic_long_t mem_used;
 };
 
 /* per smb session structure/fields */
@@ -389,6 +472,8 @@ struct trans_state {
 	int		got_data;
 };
 
+struct smb_aio;
+
 /* one of these for every pending CIFS request at the server */
 struct smb_work {
 	struct list_head qhead;		/* works waiting on reply
@@ -425,6 +510,17 @@ struct smb_work {
 
 	struct cifssrv_sess *sess;
 	struct cifssrv_tcon *tcon;
+	/* bytes charged to server->stats.mem_used for this work */
+	size_t mem_charged;
+	/* asynchronous I/O in flight, see smb_vfs_read_async() */
+	struct smb_aio *aio;
+	/* builds the response once aio has completed */
+	int (*async_done)(struct smb_work *work, ssize_t ret);
+	/*
+	 * runs async_done, apart from work since I/O may complete while
+	 * handle_smb_work() is still running
+	 */
+	struct work_struct async_work;
 };
 
 struct smb_version_ops {
@@ -513,6 +609,7 @@ int switch_req_buf(struct tcp_server_info *server);
 int negotiate_dialect(void *buf);
 struct cifssrv_sess *lookup_session_on_conn(struct tcp_server_info *server,
 		uint64_t sess_id);
+void cifssrv_charge_work_mem(struct smb_work *work, size_t size);
 
 /* cifssrv export functions */
 extern int cifssrv_export_init(void);
@@ -546,9 +643,33 @@ extern struct cifssrv_file *find_fp_in_hlist_using_inode(struct inode *inode);
 int smb_vfs_create(const char *name, umode_t mode);
 int smb_vfs_mkdir(const char *name, umode_t mode);
 int smb_vfs_read(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
-	char **buf, size_t count, loff_t *pos);
+	char **buf, size_t count, loff_t *pos, bool unbuffered);
 int smb_vfs_write(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
-	char *buf, size_t count, loff_t *pos, bool fsync, ssize_t *written);
+	char *buf, size_t count, loff_t *pos, bool fsync, bool unbuffered,
+	ssize_t *written);
+int smb_vfs_read_async(struct smb_work *work, uint64_t fid, uint64_t p_id,
+	size_t count, loff_t pos, bool unbuffered);
+int smb_vfs_write_async(struct smb_work *work, uint64_t fid, uint64_t p_id,
+	char *buf, size_t count, loff_t pos, bool unbuffered);
+ssize_t smb_vfs_aio_result(struct smb_work *work);
+int smb_vfs_copy_file_range(struct cifssrv_sess *sess,
+	struct cifssrv_file *src_fp, loff_t src_off,
+	struct cifssrv_file *dst_fp, loff_t dst_off, size_t len,
+	ssize_t *copied);
+bool smb_vfs_can_reflink(long f_type);
+void smb_vfs_offload_invalidate(struct inode *inode, loff_t off,
+	loff_t len);
+int smb_vfs_offload_read(struct cifssrv_file *fp, loff_t off, loff_t len,
+	unsigned int ttl, struct storage_offload_token *token,
+	loff_t *xfer_len);
+int smb_vfs_offload_write(struct cifssrv_sess *sess,
+	struct cifssrv_file *dst_fp, loff_t dst_off, loff_t len,
+	loff_t xfer_off, struct storage_offload_token *token,
+	loff_t *written);
+void smb_vfs_offload_exit(void);
+int smb_vfs_clone_file_range(struct cifssrv_sess *sess,
+	struct cifssrv_file *src_fp, loff_t src_off,
+	struct cifssrv_file *dst_fp, loff_t dst_off, loff_t len);
 int smb_vfs_getattr(struct cifssrv_sess *sess, uint64_t fid,
 		struct kstat *stat);
 int smb_vfs_setattr(struct cifssrv_sess *sess, const char *name,
@@ -558,11 +679,11 @@ int smb_dentry_open(struct smb_work *work, const struct path *path,
 		int flags, __u16 *fid, int *oplock, int option,
 		int fexist);
 int smb_vfs_unlink(char *name);
-int smb_vfs_link(const char *oldname, const char *newname);
+int smb_vfs_link(struct cifssrv_tcon *tcon, char *oldname, char *newname);
 int smb_vfs_symlink(const char *name, const char *symname);
 int smb_vfs_readlink(struct path *path, char *buf, int len);
-int smb_vfs_rename(struct cifssrv_sess *sess, char *oldname,
-		char *newname, uint64_t oldfid);
+int smb_vfs_rename(struct cifssrv_sess *sess, struct cifssrv_tcon *tcon,
+		char *oldname, char *newname, uint64_t oldfid);
 int smb_vfs_truncate(struct cifssrv_sess *sess, const char *name,
 		uint64_t fid, loff_t size);
 ssize_t smb_vfs_listxattr(struct dentry *dentry, char **list, int size);
@@ -572,7 +693,13 @@ int smb_vfs_setxattr(const char *filename, struct path *path, const char *name,
 		const void *value, size_t size, int flags);
 int smb_kern_path(char *name, unsigned int flags, struct path *path,
 		bool caseless);
+bool smb_share_private_name(const char *name);
+bool smb_share_private_dentry(struct path *root, struct dentry *dentry);
+int smb_share_kern_path(struct cifssrv_tcon *tcon, char *name,
+		unsigned int flags, struct path *path, bool caseless);
 int smb_search_dir(char *dirname, char *filename);
+void smb_neg_exit(void);
+void smb_casefold_exit(void);
 void smb_vfs_set_fadvise(struct file *filp, int option);
 int smb_vfs_lock(struct file *filp, int cmd, struct file_lock *flock);
 int smb_vfs_locks_mandatory_area(struct file *filp, loff_t start,
@@ -580,6 +707,44 @@ int smb_vfs_locks_mandatory_area(struct file *filp, loff_t start,
 int smb_vfs_readdir(struct file *file, filldir_t filler,
 			struct smb_readdir_data *buf);
 int smb_vfs_alloc_size(struct file *filp, loff_t len);
+int smb_vfs_trim_alloc(struct file *filp);
+int smb_vfs_set_alloc_size(struct cifssrv_sess *sess, uint64_t fid,
+	loff_t size);
+int smb_vfs_zero_data(struct cifssrv_sess *sess, struct cifssrv_file *fp,
+	loff_t off, loff_t len, bool punch);
+int smb_vfs_fill_holes(struct file *filp);
+int smb_vfs_fqar_lseek(struct file *filp, loff_t start, loff_t length,
+	struct file_allocated_range_buffer *ranges, int in_count,
+	int *out_count);
+int smb_vfs_defer_unlink(struct cifssrv_share *share, struct file *filp);
+ssize_t smb_vfs_stream_size(struct cifssrv_share *share,
+	struct dentry *dentry, char *name);
+int smb_vfs_stream_remove(struct cifssrv_share *share,
+	struct dentry *dentry, char *name);
+void smb_vfs_stream_purge(struct cifssrv_share *share, struct dentry *dentry);
+int smb_vfs_get_meta(struct path *path, struct smb_meta *meta);
+int smb_vfs_set_meta(struct path *path, struct smb_meta *meta);
+bool smb_vfs_user_ea(const char *name);
+void smb_vfs_attr_stamp(struct inode *inode, struct smb_attr_stamp *stamp);
+bool smb_vfs_attr_stamp_equal(struct smb_attr_stamp *a,
+	struct smb_attr_stamp *b);
+int smb_vfs_get_attr(struct dentry *dentry, struct smb_attr *attr);
+int smb_vfs_get_ea_list(struct dentry *dentry, char *buf, int len);
+unsigned int smb_vfs_attr_gen(void);
+void smb_vfs_put_ea_list(struct dentry *dentry, struct smb_attr_stamp *stamp,
+	unsigned int gen, char *buf, int len);
+void smb_vfs_attr_invalidate(struct inode *inode);
+void smb_vfs_attr_exit(void);
+int smb_vfs_reclaim_init(void);
+void smb_vfs_reclaim_exit(void);
+int smb_vfs_share_statfs(struct cifssrv_share *share, struct kstatfs *st);
+void smb_vfs_statfs_invalidate(struct cifssrv_share *share);
+void smb_vfs_statfs_dirty(struct cifssrv_share *share, loff_t bytes);
+void smb_vfs_statfs_init(struct cifssrv_share *share);
+void smb_vfs_statfs_exit(struct cifssrv_share *share);
+u64 smb_vfs_file_id(struct path *path);
+int smb_vfs_open_by_id(struct path *root, u64 id, struct path *path);
+void smb_vfs_fileid_exit(void);
 int smb_vfs_truncate_xattr(struct dentry *dentry);
 
 /* smb1ops functions */
@@ -602,6 +767,7 @@ extern int cifssrv_read_from_socket(struct tcp_server_info *server, char *buf,
 		unsigned int to_read);
 
 extern void handle_smb_work(struct work_struct *work);
+extern void queue_async_smb_work(struct smb_work *smb_work);
 extern int SMB_NTencrypt(unsigned char *, unsigned char *, unsigned char *,
 		const struct nls_table *);
 extern int smb_E_md4hash(const unsigned char *passwd, unsigned char *p16,
@@ -629,7 +795,8 @@ int smb_filldir(void *__buf, const char *name, int namlen,
 #endif
 int smb_get_shortname(struct tcp_server_info *server, char *longname,
 		char *shortname);
-char *read_next_entry(struct kstat *kstat, struct smb_dirent *de, char *dpath);
+char *read_next_entry(struct kstat *kstat, struct smb_dirent *de,
+		struct path *dir_path, u64 *file_id);
 void *fill_common_info(char **p, struct kstat *kstat);
 char *convname_updatenextoffset(char *namestr, int len, int size,
 		const struct nls_table *local_nls, int *name_len,
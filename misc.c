@@ -279,6 +279,7 @@ int switch_rsp_buf(struct smb_work *smb_work)
 
 	smb_work->rsp_buf = buf;
 	smb_work->rsp_large_buf = true;
+	cifssrv_charge_work_mem(smb_work, SMBMaxBufSize);
 	return 0;
 }
 
@@ -587,10 +588,10 @@ int smb_check_shared_mode(struct file *filp, struct cifssrv_file *curr_fp)
 	 */
 	hash_for_each_possible(global_name_table, prev_fp, node,
 			(unsigned long)file_inode(filp))
-		if (file_inode(filp) == GET_FP_INODE(prev_fp)) {
+		if (file_inode(filp) == prev_fp->inode) {
 			if (prev_fp->is_stream && curr_fp->is_stream) {
-				if (strcmp(prev_fp->stream_name,
-					curr_fp->stream_name)) {
+				if (strcmp(prev_fp->ext->stream_name,
+					curr_fp->ext->stream_name)) {
 					continue;
 				}
 
@@ -606,6 +607,10 @@ int smb_check_shared_mode(struct file *filp, struct cifssrv_file *curr_fp)
 				break;
 			}
 
+			/* attribute only opens take no part in share modes */
+			if (prev_fp->attrib_only || curr_fp->attrib_only)
+				continue;
+
 			if (!(prev_fp->saccess & (FILE_SHARE_DELETE_LE)) &&
 					curr_fp->daccess & (FILE_DELETE_LE |
 				FILE_GENERIC_ALL_LE | FILE_MAXIMAL_ACCESS_LE)) {
@@ -698,7 +703,7 @@ struct cifssrv_file *find_fp_in_hlist_using_inode(struct inode *inode)
 
 	hash_for_each_possible(global_name_table, fp, node,
 			(unsigned long)inode)
-		if (inode == GET_FP_INODE(fp))
+		if (inode == fp->inode)
 			return fp;
 
 	return NULL;
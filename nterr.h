@@ -559,7 +559,10 @@ extern const struct nt_err_code_struct nt_errs[];
 #define NT_STATUS_QUOTA_LIST_INCONSISTENT (0xC0000000 | 0x0266)
 #define NT_STATUS_FILE_IS_OFFLINE (0xC0000000 | 0x0267)
 #define NT_STATUS_NETWORK_SESSION_EXPIRED  (0xC0000000 | 0x035c)
+#define NT_STATUS_INVALID_TOKEN (0xC0000000 | 0x0465)
 #define NT_STATUS_NO_SUCH_JOB (0xC0000000 | 0xEDE)     /* scheduler */
 #define NT_STATUS_NO_PREAUTH_INTEGRITY_HASH_OVERLAP (0xC0000000 | 0x5D0000)
+#define NT_STATUS_HASH_NOT_SUPPORTED (0xC0000000 | 0xA100)
+#define NT_STATUS_HASH_NOT_PRESENT (0xC0000000 | 0xA101)
 #define NT_STATUS_PENDING 0x00000103
 #endif				/* _NTERR_H */
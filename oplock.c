@@ -57,7 +57,7 @@ void release_ofile(struct cifssrv_file *fp)
 	fp->ofile = NULL;
 
 	hash_for_each_possible(global_name_table, tmp_fp, node,
-			(unsigned long)GET_FP_INODE(fp)) {
+			(unsigned long)fp->inode) {
 		if (ofile == tmp_fp->ofile)
 			tmp_fp->ofile = NULL;
 	}
@@ -258,6 +258,8 @@ int smb_allocate_rsp_buf(struct smb_work *smb_work)
 	if (need_large_buf) {
 		smb_work->rsp_large_buf = true;
 		smb_work->rsp_buf = mempool_alloc(cifssrv_rsp_poolp, GFP_NOFS);
+		if (smb_work->rsp_buf)
+			cifssrv_charge_work_mem(smb_work, SMBMaxBufSize);
 	} else {
 		smb_work->rsp_large_buf = false;
 		smb_work->rsp_buf = mempool_alloc(cifssrv_sm_rsp_poolp,
@@ -718,7 +720,8 @@ int smb_rename(struct smb_work *smb_work)
 	}
 	strncpy(tmp_name, abs_newname, strlen(abs_newname) + 1);
 
-	rc = smb_kern_path(tmp_name, 0, &path, 1);
+	rc = smb_share_kern_path(smb_work->tcon, tmp_name,
+			0, &path, 1);
 	if (rc)
 		file_present = false;
 	else
@@ -735,7 +738,8 @@ int smb_rename(struct smb_work *smb_work)
 	}
 
 	cifssrv_debug("rename %s -> %s\n", abs_oldname, abs_newname);
-	rc = smb_vfs_rename(smb_work->sess, abs_oldname, abs_newname, 0);
+	rc = smb_vfs_rename(smb_work->sess, smb_work->tcon,
+			abs_oldname, abs_newname, 0);
 	if (rc) {
 		rsp->hdr.Status.CifsError = NT_STATUS_NO_MEMORY;
 		goto out;
@@ -1794,8 +1798,15 @@ int smb_nt_create_andx(struct smb_work *smb_work)
 	if (IS_ERR(conv_name))
 		return PTR_ERR(conv_name);
 
-	err = smb_kern_path(conv_name, 0, &path,
-			(req->hdr.Flags & SMBFLG_CASELESS) &&
+	/* neither opened nor created, see smb_share_private_name() */
+	if (smb_share_private_name(conv_name)) {
+		cifssrv_debug("private name %s refused\n", conv_name);
+		err = -ENOENT;
+		goto out;
+	}
+
+	err = smb_share_kern_path(smb_work->tcon, conv_name,
+			0, &path, (req->hdr.Flags & SMBFLG_CASELESS) &&
 			!create_directory);
 	if (err) {
 		file_present = false;
@@ -1919,7 +1930,8 @@ int smb_nt_create_andx(struct smb_work *smb_work)
 			}
 		}
 
-		err = smb_kern_path(conv_name, 0, &path, 0);
+		err = smb_share_kern_path(smb_work->tcon, conv_name,
+			0, &path, 0);
 		if (err) {
 			cifssrv_err("cannot get linux path, err = %d\n", err);
 			goto out;
@@ -2296,12 +2308,14 @@ int smb_read_andx(struct smb_work *smb_work)
 
 	cifssrv_debug("fid %u, offset %lld, count %zu\n", req->Fid, pos, count);
 	nbytes = smb_vfs_read(smb_work->sess, req->Fid, 0, &smb_work->rdata_buf,
-		count, &pos);
+		count, &pos, false);
 	if (nbytes < 0) {
 		err = nbytes;
 		goto out;
 	}
 
+	cifssrv_charge_work_mem(smb_work, count);
+
 	/* read success, prepare response */
 	rsp->hdr.Status.CifsError = NT_STATUS_OK;
 	rsp->hdr.WordCount = 12;
@@ -2371,7 +2385,7 @@ int smb_write(struct smb_work *smb_work)
 		nbytes = 0;
 	} else
 		err = smb_vfs_write(smb_work->sess, req->Fid, 0, data_buf,
-			count, &pos, 0, &nbytes);
+			count, &pos, 0, false, &nbytes);
 
 out:
 	rsp->hdr.WordCount = 1;
@@ -2538,7 +2552,7 @@ int smb_write_andx(struct smb_work *smb_work)
 
 	cifssrv_debug("fid %u, offset %lld, count %zu\n", req->Fid, pos, count);
 	err = smb_vfs_write(smb_work->sess, req->Fid, 0, data_buf, count, &pos,
-			writethrough, &nbytes);
+			writethrough, false, &nbytes);
 	if (err < 0)
 		goto out;
 
@@ -2642,7 +2656,9 @@ int smb_flush(struct smb_work *smb_work)
 	return err;
 
 out:
-	if (err)
+	if (err == -EACCES)
+		rsp->hdr.Status.CifsError = NT_STATUS_ACCESS_DENIED;
+	else if (err)
 		rsp->hdr.Status.CifsError = NT_STATUS_INVALID_HANDLE;
 
 	return err;
@@ -3421,6 +3437,7 @@ int query_path_info(struct smb_work *smb_work)
 	char *name;
 	struct path path;
 	struct kstat st;
+	struct smb_attr attr;
 	int rc;
 	FILE_ALL_INFO *ainfo;
 	FILE_UNIX_BASIC_INFO *unix_info;
@@ -3443,7 +3460,8 @@ int query_path_info(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	rc = smb_kern_path(name, 0, &path, 0);
+	rc = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, 0);
 	if (rc) {
 		rsp_hdr->Status.CifsError = NT_STATUS_OBJECT_NAME_NOT_FOUND;
 		cifssrv_debug("cannot get linux path for %s, err %d\n",
@@ -3481,6 +3499,8 @@ int query_path_info(struct smb_work *smb_work)
 		infos->Attributes = S_ISDIR(st.mode) ?
 					ATTR_DIRECTORY : ATTR_NORMAL;
 		infos->EASize = 0;
+		if (!smb_vfs_get_attr(path.dentry, &attr))
+			infos->EASize = cpu_to_le32(attr.ea_size);
 
 		rsp_hdr->WordCount = 10;
 		rsp->t2.TotalParameterCount = 2;
@@ -3591,6 +3611,8 @@ int query_path_info(struct smb_work *smb_work)
 		memset(ptr, 0, 4);
 		ea_info = (FILE_EA_INFO *)(ptr + 4);
 		ea_info->EaSize = 0;
+		if (!smb_vfs_get_attr(path.dentry, &attr))
+			ea_info->EaSize = cpu_to_le32(attr.ea_size);
 		inc_rfc1001_len(rsp_hdr, (10 * 2 + rsp->ByteCount));
 		break;
 
@@ -3637,6 +3659,8 @@ int query_path_info(struct smb_work *smb_work)
 		ainfo->Directory = S_ISDIR(st.mode) ? 1 : 0;
 		ainfo->Pad2 = 0;
 		ainfo->EASize = 0;
+		if (!smb_vfs_get_attr(path.dentry, &attr))
+			ainfo->EASize = cpu_to_le32(attr.ea_size);
 		ainfo->FileNameLength = 0;
 		inc_rfc1001_len(rsp_hdr, (10 * 2 + rsp->ByteCount));
 		break;
@@ -3870,7 +3894,6 @@ int query_fs_info(struct smb_work *smb_work)
 	struct kstatfs stfs;
 	struct cifssrv_share *share;
 	int rc;
-	struct path path;
 	bool incomplete = false;
 	int info_level, len = 0;
 
@@ -3907,16 +3930,10 @@ int query_fs_info(struct smb_work *smb_work)
 	if (!share)
 		return -ENOENT;
 
-	rc = smb_kern_path(share->path, LOOKUP_FOLLOW, &path, 0);
-	if (rc) {
-		cifssrv_err("cannot create vfs path\n");
-		return rc;
-	}
-
-	rc = vfs_statfs(&path, &stfs);
+	rc = smb_vfs_share_statfs(share, &stfs);
 	if (rc) {
 		cifssrv_err("cannot do stat of path %s\n", share->path);
-		goto err_out;
+		return rc;
 	}
 
 	switch (info_level) {
@@ -4035,7 +4052,6 @@ int query_fs_info(struct smb_work *smb_work)
 	create_trans2_reply(smb_work, rsp->t2.TotalDataCount);
 
 err_out:
-	path_put(&path);
 	return rc;
 }
 
@@ -4281,7 +4297,8 @@ int smb_posix_open(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	err = smb_kern_path(name, 0, &path, 0);
+	err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, 0);
 	if (err) {
 		file_present = false;
 		cifssrv_debug("cannot get linux path for %s, err = %d\n",
@@ -4340,7 +4357,8 @@ int smb_posix_open(struct smb_work *smb_work)
 		if (err)
 			goto out;
 
-		err = smb_kern_path(name, 0, &path, 0);
+		err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, 0);
 		if (err) {
 			cifssrv_err("cannot get linux path, err = %d\n", err);
 			goto out;
@@ -4356,7 +4374,8 @@ int smb_posix_open(struct smb_work *smb_work)
 		if (err)
 			goto out;
 
-		err = smb_kern_path(name, 0, &path, 0);
+		err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, 0);
 		if (err) {
 			cifssrv_err("cannot get linux path, err = %d\n", err);
 			goto out;
@@ -4696,6 +4715,13 @@ int smb_set_ea(struct smb_work *smb_work)
 			eabuf->list[0].name, eabuf->list[0].name_len,
 			le16_to_cpu(eabuf->list[0].value_len));
 
+	/* xattrs of cifssrv itself are not client EAs */
+	if (!smb_vfs_user_ea(attr_name)) {
+		rsp->hdr.Status.CifsError = NT_STATUS_ACCESS_DENIED;
+		rc = -EACCES;
+		goto out;
+	}
+
 	rc = smb_vfs_setxattr(fname, NULL, attr_name, value,
 			le16_to_cpu(eabuf->list[0].value_len), 0);
 	if (rc < 0) {
@@ -4886,6 +4912,16 @@ int smb_filldir(void *__buf, const char *name, int namlen,
 	struct smb_dirent *de = (void *)(buf->dirent + buf->used);
 	unsigned int reclen;
 
+	/* deleted files waiting for reclaim, see smb_vfs_defer_unlink() */
+	if (d_type == DT_DIR && namlen == sizeof(SMB_TRASH_NAME) - 1 &&
+			!memcmp(name, SMB_TRASH_NAME, namlen))
+		return 0;
+
+	/* data of large streams, see smb_vfs_stream_write() */
+	if (d_type == DT_DIR && namlen == sizeof(SMB_STREAMS_NAME) - 1 &&
+			!memcmp(name, SMB_STREAMS_NAME, namlen))
+		return 0;
+
 	reclen = ALIGN(sizeof(struct smb_dirent) + namlen, sizeof(u64));
 	if (buf->used + reclen > PAGE_SIZE) {
 		buf->full = 1;
@@ -4904,37 +4940,43 @@ int smb_filldir(void *__buf, const char *name, int namlen,
 }
 
 /**
- * read_next_entry() - read next directory entry and return absolute name
+ * read_next_entry() - read next directory entry and return its name
  * @kstat:	stat of next dirent
  * @de:		directory entry
- * @dirpath:	directory path name
+ * @dir_path:	path of the directory being read
+ * @file_id:	if not NULL, return file id of the entry
  *
- * Return:      on success return absolute path of directory entry,
- *              otherwise NULL
+ * The entry is looked up relative to @dir_path, so the directory name is
+ * not rebuilt with d_path() for every entry.
+ *
+ * Return:	on success return entry name, otherwise NULL
  */
 char *read_next_entry(struct kstat *kstat,
-		struct smb_dirent *de, char *dirpath)
+		struct smb_dirent *de, struct path *dir_path, u64 *file_id)
 {
 	struct path path;
-	int rc, file_pathlen, dir_pathlen;
+	int rc;
 	char *name;
 
-	dir_pathlen = strlen(dirpath);
-	/* 1 for '/'*/
-	file_pathlen = dir_pathlen +  de->namelen + 1;
-	name = kmalloc(file_pathlen + 1, GFP_KERNEL);
+	name = kmalloc(de->namelen + 1, GFP_KERNEL);
 	if (!name) {
-		cifssrv_err("Name memory failed for length %d,"
-				" buf_name_len %d\n", dir_pathlen, de->namelen);
+		cifssrv_err("Name memory failed for length %d\n",
+				de->namelen);
 		return ERR_PTR(-ENOMEM);
 	}
 
-	memcpy(name, dirpath, dir_pathlen);
-	memset(name + dir_pathlen, '/', 1);
-	memcpy(name + dir_pathlen + 1, de->name, de->namelen);
-	name[file_pathlen] = '\0';
+	memcpy(name, de->name, de->namelen);
+	name[de->namelen] = '\0';
 
-	rc = smb_kern_path(name, 0, &path, 1);
+	if (!strcmp(name, "..")) {
+		/* ".." would not leave the lookup root, take the parent */
+		path.mnt = dir_path->mnt;
+		path.dentry = dget_parent(dir_path->dentry);
+		mntget(path.mnt);
+		rc = 0;
+	} else
+		rc = vfs_path_lookup(dir_path->dentry, dir_path->mnt, name,
+				0, &path);
 	if (rc) {
 		cifssrv_err("look up failed for (%s) with rc=%d\n", name, rc);
 		kfree(name);
@@ -4942,8 +4984,8 @@ char *read_next_entry(struct kstat *kstat,
 	}
 
 	generic_fillattr(path.dentry->d_inode, kstat);
-	memcpy(name, de->name, de->namelen);
-	name[de->namelen] = '\0';
+	if (file_id)
+		*file_id = smb_vfs_file_id(&path);
 	path_put(&path);
 	return name;
 }
@@ -5220,6 +5262,7 @@ int find_first(struct smb_work *smb_work)
 	struct path path;
 	struct smb_dirent *de;
 	struct cifssrv_file *dir_fp = NULL;
+	struct cifssrv_file_ext *dir_ext = NULL;
 	struct kstat kstat;
 	int params_count = sizeof(T2_FFIRST_RSP_PARMS);
 	int data_alignment_offset = 0;
@@ -5257,8 +5300,8 @@ int find_first(struct smb_work *smb_work)
 	}
 
 	cifssrv_debug("complete dir path = %s\n",  dirpath);
-	rc = smb_kern_path(dirpath, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
-			&path, 0);
+	rc = smb_share_kern_path(smb_work->tcon, dirpath,
+			LOOKUP_FOLLOW | LOOKUP_DIRECTORY, &path, 0);
 	if (rc < 0) {
 		cifssrv_debug("cannot create vfs root path <%s> %d\n",
 				dirpath, rc);
@@ -5281,10 +5324,20 @@ int find_first(struct smb_work *smb_work)
 		goto err_out;
 	}
 
-	dir_fp->readdir_data.dirent = r_data.dirent;
-	dir_fp->readdir_data.used = 0;
-	dir_fp->readdir_data.full = 0;
-	dir_fp->dirent_offset = 0;
+	dir_ext = cifssrv_file_ext(dir_fp);
+	if (!dir_ext) {
+		rsp->hdr.Status.CifsError = NT_STATUS_NO_MEMORY;
+		free_page((unsigned long)r_data.dirent);
+		path_put(&path);
+		close_id(sess, sid, 0);
+		rc = -ENOMEM;
+		goto err_out;
+	}
+
+	dir_ext->readdir_data.dirent = r_data.dirent;
+	dir_ext->readdir_data.used = 0;
+	dir_ext->readdir_data.full = 0;
+	dir_ext->dirent_offset = 0;
 
 	if (params_count % 4)
 		data_alignment_offset = 4 - params_count % 4;
@@ -5299,8 +5352,8 @@ int find_first(struct smb_work *smb_work)
 		 params_count + data_alignment_offset);
 
 	do {
-		if (dir_fp->dirent_offset >= dir_fp->readdir_data.used) {
-			dir_fp->dirent_offset = 0;
+		if (dir_ext->dirent_offset >= dir_ext->readdir_data.used) {
+			dir_ext->dirent_offset = 0;
 			r_data.used = 0;
 			r_data.full = 0;
 			rc = smb_vfs_readdir(dir_fp->filp, smb_filldir,
@@ -5310,28 +5363,29 @@ int find_first(struct smb_work *smb_work)
 				goto err_out;
 			}
 
-			dir_fp->readdir_data.used = r_data.used;
-			dir_fp->readdir_data.full = r_data.full;
-			if (!dir_fp->readdir_data.used) {
+			dir_ext->readdir_data.used = r_data.used;
+			dir_ext->readdir_data.full = r_data.full;
+			if (!dir_ext->readdir_data.used) {
 				free_page((unsigned long)
-						(dir_fp->readdir_data.dirent));
-				dir_fp->readdir_data.dirent = NULL;
+						(dir_ext->readdir_data.dirent));
+				dir_ext->readdir_data.dirent = NULL;
 				break;
 			}
 
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent);
+				((char *)dir_ext->readdir_data.dirent);
 		} else {
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent +
-				 dir_fp->dirent_offset);
+				((char *)dir_ext->readdir_data.dirent +
+				 dir_ext->dirent_offset);
 		}
 
 		reclen = ALIGN(sizeof(struct smb_dirent) + de->namelen,
 				sizeof(__le64));
-		dir_fp->dirent_offset += reclen;
+		dir_ext->dirent_offset += reclen;
 
-		namestr = read_next_entry(&kstat, de, dirpath);
+		namestr = read_next_entry(&kstat, de,
+				&dir_fp->filp->f_path, NULL);
 		if (IS_ERR(namestr)) {
 			rc = PTR_ERR(namestr);
 			cifssrv_debug("Err while dirent read rc = %d\n", rc);
@@ -5369,7 +5423,7 @@ int find_first(struct smb_work *smb_work)
 	} while (out_buf_len >= 0);
 
 	if (out_buf_len < 0)
-		dir_fp->dirent_offset -= reclen;
+		dir_ext->dirent_offset -= reclen;
 
 	if (srch_ptr && data_count == 0) {
 		rsp->hdr.Status.CifsError =
@@ -5420,13 +5474,11 @@ int find_first(struct smb_work *smb_work)
 	return 0;
 
 err_out:
-	if (dir_fp && dir_fp->readdir_data.dirent) {
+	if (dir_ext && dir_ext->readdir_data.dirent) {
+		free_page((unsigned long)(dir_ext->readdir_data.dirent));
+		dir_ext->readdir_data.dirent = NULL;
 		path_put(&(dir_fp->filp->f_path));
 		close_id(sess, sid, 0);
-		if (dir_fp->readdir_data.dirent)  {
-			free_page((unsigned long)(dir_fp->readdir_data.dirent));
-			dir_fp->readdir_data.dirent = NULL;
-		}
 	}
 
 	if (rsp->hdr.Status.CifsError == 0)
@@ -5458,6 +5510,7 @@ int find_next(struct smb_work *smb_work)
 	T2_FNEXT_RSP_PARMS *params = NULL;
 	struct smb_dirent *de;
 	struct cifssrv_file *dir_fp;
+	struct cifssrv_file_ext *dir_ext = NULL;
 	struct kstat kstat;
 	int params_count = sizeof(T2_FNEXT_RSP_PARMS);
 	int data_alignment_offset = 0;
@@ -5469,9 +5522,7 @@ int find_next(struct smb_work *smb_work)
 	__u16 sid;
 	char *bufptr = NULL;
 	char *namestr = NULL;
-	char *dirpath = NULL;
 	char *name = NULL;
-	char *pathname = NULL;
 	struct smb_readdir_data r_data = {
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
 		.ctx.actor = smb_filldir,
@@ -5499,22 +5550,15 @@ int find_next(struct smb_work *smb_work)
 		goto err_out;
 	}
 
-	r_data.dirent = dir_fp->readdir_data.dirent;
-	pathname = kmalloc(PATH_MAX, GFP_KERNEL);
-	if (!pathname) {
-		cifssrv_debug("Failed to allocate memory\n");
-		rsp->hdr.Status.CifsError = NT_STATUS_NO_MEMORY;
-		rc = -ENOMEM;
-		goto err_out;
-	}
-
-	dirpath = d_path(&(dir_fp->filp->f_path), pathname, PATH_MAX);
-	if (IS_ERR(dirpath)) {
-		rc = PTR_ERR(dirpath);
+	/* readdir state is set up by find_first */
+	dir_ext = dir_fp->ext;
+	if (!dir_ext) {
+		cifssrv_debug("no search in progress for sid\n");
+		rc = -EINVAL;
 		goto err_out;
 	}
 
-	cifssrv_debug("dirpath = %s\n", dirpath);
+	r_data.dirent = dir_ext->readdir_data.dirent;
 
 	if (params_count % 4)
 		data_alignment_offset = 4 - params_count % 4;
@@ -5529,8 +5573,8 @@ int find_next(struct smb_work *smb_work)
 		 data_alignment_offset);
 
 	do {
-		if (dir_fp->dirent_offset >= dir_fp->readdir_data.used) {
-			dir_fp->dirent_offset = 0;
+		if (dir_ext->dirent_offset >= dir_ext->readdir_data.used) {
+			dir_ext->dirent_offset = 0;
 			r_data.used = 0;
 			r_data.full = 0;
 			rc = smb_vfs_readdir(dir_fp->filp, smb_filldir,
@@ -5540,28 +5584,29 @@ int find_next(struct smb_work *smb_work)
 				goto err_out;
 			}
 
-			dir_fp->readdir_data.used = r_data.used;
-			dir_fp->readdir_data.full = r_data.full;
-			if (!dir_fp->readdir_data.used) {
+			dir_ext->readdir_data.used = r_data.used;
+			dir_ext->readdir_data.full = r_data.full;
+			if (!dir_ext->readdir_data.used) {
 				free_page((unsigned long)
-						(dir_fp->readdir_data.dirent));
-				dir_fp->readdir_data.dirent = NULL;
+						(dir_ext->readdir_data.dirent));
+				dir_ext->readdir_data.dirent = NULL;
 				break;
 			}
 
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent);
+				((char *)dir_ext->readdir_data.dirent);
 		} else {
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent +
-				 dir_fp->dirent_offset);
+				((char *)dir_ext->readdir_data.dirent +
+				 dir_ext->dirent_offset);
 		}
 
 		reclen = ALIGN(sizeof(struct smb_dirent) + de->namelen,
 				sizeof(__le64));
-		dir_fp->dirent_offset += reclen;
+		dir_ext->dirent_offset += reclen;
 
-		namestr = read_next_entry(&kstat, de, dirpath);
+		namestr = read_next_entry(&kstat, de,
+				&dir_fp->filp->f_path, NULL);
 		if (IS_ERR(namestr)) {
 			rc = PTR_ERR(namestr);
 			cifssrv_debug("Err while dirent read rc = %d\n", rc);
@@ -5581,7 +5626,7 @@ int find_next(struct smb_work *smb_work)
 	} while (out_buf_len >= 0);
 
 	if (out_buf_len < 0)
-		dir_fp->dirent_offset -= reclen;
+		dir_ext->dirent_offset -= reclen;
 
 	params = (T2_FNEXT_RSP_PARMS *)((char *)rsp + sizeof(TRANSACTION2_RSP));
 	params->SearchCount = cpu_to_le16(num_entry);
@@ -5620,15 +5665,12 @@ int find_next(struct smb_work *smb_work)
 			cpu_to_le16(params_count), '\0', data_alignment_offset);
 	inc_rfc1001_len(rsp_hdr, (10 * 2 + data_count + params_count + 1 +
 				data_alignment_offset));
-	kfree(pathname);
 	return 0;
 
 err_out:
-	if (dir_fp && dir_fp->readdir_data.dirent) {
-		if (dir_fp->readdir_data.dirent)  {
-			free_page((unsigned long)(dir_fp->readdir_data.dirent));
-			dir_fp->readdir_data.dirent = NULL;
-		}
+	if (dir_ext && dir_ext->readdir_data.dirent) {
+		free_page((unsigned long)(dir_ext->readdir_data.dirent));
+		dir_ext->readdir_data.dirent = NULL;
 		path_put(&(dir_fp->filp->f_path));
 		close_id(sess, sid, 0);
 	}
@@ -5637,7 +5679,6 @@ err_out:
 		rsp->hdr.Status.CifsError =
 			NT_STATUS_UNEXPECTED_IO_ERROR;
 
-	kfree(pathname);
 	return 0;
 }
 
@@ -5782,7 +5823,7 @@ int smb_set_file_size_finfo(struct smb_work *smb_work)
 }
 
 /**
- * smb_set_alloc_size() - set file truncate method using trans2
+ * smb_set_alloc_size() - set file allocation size using trans2
  *		set file info command - file allocation info level
  * @smb_work:	smb work containing set file info command buffer
  *
@@ -5819,7 +5860,7 @@ int smb_set_alloc_size(struct smb_work *smb_work)
 		newsize *= alloc_roundup_size;
 	}
 
-	err = smb_vfs_truncate(smb_work->sess, NULL, (uint64_t)req->Fid,
+	err = smb_vfs_set_alloc_size(smb_work->sess, (uint64_t)req->Fid,
 		newsize);
 	if (err) {
 		rsp->hdr.Status.CifsError = NT_STATUS_INVALID_PARAMETER;
@@ -5827,7 +5868,7 @@ int smb_set_alloc_size(struct smb_work *smb_work)
 	}
 
 out:
-	cifssrv_debug("fid %u, truncated to newsize %llu\n",
+	cifssrv_debug("fid %u, allocation size set to %llu\n",
 			req->Fid, newsize);
 
 	rsp->hdr.Status.CifsError = NT_STATUS_OK;
@@ -6086,6 +6127,7 @@ int query_file_info(struct smb_work *smb_work)
 	TRANSACTION2_QFI_REQ_PARAMS *req_params;
 	struct cifssrv_file *fp;
 	struct kstat st;
+	struct smb_attr attr;
 	struct file *filp;
 	FILE_STANDARD_INFO *standard_info;
 	FILE_BASIC_INFO *basic_info;
@@ -6211,6 +6253,8 @@ int query_file_info(struct smb_work *smb_work)
 		memset(ptr, 0, 4);
 		ea_info = (FILE_EA_INFO *)(ptr + 4);
 		ea_info->EaSize = 0;
+		if (!smb_vfs_get_attr(filp->f_path.dentry, &attr))
+			ea_info->EaSize = cpu_to_le32(attr.ea_size);
 		inc_rfc1001_len(rsp_hdr, (10 * 2 + rsp->ByteCount));
 		break;
 	case SMB_QUERY_FILE_UNIX_BASIC:
@@ -6273,6 +6317,8 @@ int query_file_info(struct smb_work *smb_work)
 		ainfo->Directory = S_ISDIR(st.mode) ? 1 : 0;
 		ainfo->Pad2 = 0;
 		ainfo->EASize = 0;
+		if (!smb_vfs_get_attr(filp->f_path.dentry, &attr))
+			ainfo->EASize = cpu_to_le32(attr.ea_size);
 		ainfo->FileNameLength = 0;
 		inc_rfc1001_len(rsp_hdr, (10 * 2 + rsp->ByteCount));
 		break;
@@ -6326,7 +6372,8 @@ int smb_fileinfo_rename(struct smb_work *smb_work)
 	}
 
 	cifssrv_debug("rename fid %u -> %s\n", req->Fid, newname);
-	rc = smb_vfs_rename(smb_work->sess, NULL, newname, (uint64_t)req->Fid);
+	rc = smb_vfs_rename(smb_work->sess, smb_work->tcon,
+			NULL, newname, (uint64_t)req->Fid);
 	if (rc) {
 		rsp->hdr.Status.CifsError = NT_STATUS_UNEXPECTED_IO_ERROR;
 		goto out;
@@ -6550,7 +6597,8 @@ int smb_checkdir(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	err = smb_kern_path(name, 0, &path, caseless_lookup);
+	err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, caseless_lookup);
 	if (err) {
 		if (err == -ENOENT) {
 			/*
@@ -6565,7 +6613,8 @@ int smb_checkdir(struct smb_work *smb_work)
 				*last = '\0';
 				last++;
 
-				err = smb_kern_path(name, LOOKUP_FOLLOW |
+				err = smb_share_kern_path(smb_work->tcon,
+						name, LOOKUP_FOLLOW |
 						LOOKUP_DIRECTORY, &path,
 						caseless_lookup);
 			} else {
@@ -6790,7 +6839,7 @@ int smb_nt_rename(struct smb_work *smb_work)
 			oldname, newname, oldname_len,
 			is_smbreq_unicode(&req->hdr));
 
-	err = smb_vfs_link(oldname, newname);
+	err = smb_vfs_link(smb_work->tcon, oldname, newname);
 	if (err < 0)
 		rsp->hdr.Status.CifsError = NT_STATUS_NOT_SAME_DEVICE;
 
@@ -6825,7 +6874,7 @@ int smb_creat_hardlink(struct smb_work *smb_work)
 	}
 	cifssrv_debug("oldname %s, newname %s\n", oldname, newname);
 
-	err = smb_vfs_link(oldname, newname);
+	err = smb_vfs_link(smb_work->tcon, oldname, newname);
 	if (err < 0)
 		rsp->hdr.Status.CifsError = NT_STATUS_NOT_SAME_DEVICE;
 
@@ -6932,7 +6981,8 @@ int smb_query_info(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	err = smb_kern_path(name, LOOKUP_FOLLOW, &path, 0);
+	err = smb_share_kern_path(smb_work->tcon, name,
+			LOOKUP_FOLLOW, &path, 0);
 	if (err) {
 		cifssrv_err("look up failed err %d\n", err);
 		rsp->hdr.Status.CifsError = NT_STATUS_OBJECT_NAME_NOT_FOUND;
@@ -7098,7 +7148,8 @@ int smb_open_andx(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	err = smb_kern_path(name, 0, &path, req->hdr.Flags & SMBFLG_CASELESS);
+	err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, req->hdr.Flags & SMBFLG_CASELESS);
 	if (err)
 		file_present = false;
 	else
@@ -7137,7 +7188,8 @@ int smb_open_andx(struct smb_work *smb_work)
 		if (err)
 			goto out;
 
-		err = smb_kern_path(name, 0, &path, 0);
+		err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, 0);
 		if (err) {
 			cifssrv_err("cannot get linux path, err = %d\n", err);
 			goto out;
@@ -7253,7 +7305,8 @@ int smb_setattr(struct smb_work *smb_work)
 	if (IS_ERR(name))
 		return PTR_ERR(name);
 
-	err = smb_kern_path(name, 0, &path, req->hdr.Flags & SMBFLG_CASELESS);
+	err = smb_share_kern_path(smb_work->tcon, name,
+			0, &path, req->hdr.Flags & SMBFLG_CASELESS);
 	if (err) {
 		cifssrv_debug("look up failed err %d\n", err);
 		rsp->hdr.Status.CifsError = NT_STATUS_OBJECT_NAME_NOT_FOUND;
@@ -25,6 +25,8 @@
 #include "dcerpc.h"
 #include "smbfsctl.h"
 #include "oplock.h"
+#include "branchcache.h"
+#include "smbacl.h"
 
 #include <linux/inetdevice.h>
 #include <net/addrconf.h>
@@ -525,7 +527,8 @@ int smb2_allocate_rsp_buf(struct smb_work *smb_work)
 					req->FileInfoClass ==
 					FILE_ALL_INFORMATION)) {
 				need_large_buf = true;
-			}
+			} else if (req->InfoType == SMB2_O_INFO_SECURITY)
+				need_large_buf = true;
 			break;
 		default:
 			break;
@@ -535,6 +538,8 @@ int smb2_allocate_rsp_buf(struct smb_work *smb_work)
 	if (need_large_buf) {
 		smb_work->rsp_large_buf = true;
 		smb_work->rsp_buf = mempool_alloc(cifssrv_rsp_poolp, GFP_NOFS);
+		if (smb_work->rsp_buf)
+			cifssrv_charge_work_mem(smb_work, SMBMaxBufSize);
 	} else {
 		smb_work->rsp_large_buf = false;
 		smb_work->rsp_buf = mempool_alloc(cifssrv_sm_rsp_poolp,
@@ -585,6 +590,10 @@ void smb2_set_rsp_credits(struct smb_work *smb_work)
 			aux_max = 32;
 			break;
 		}
+
+		/* stop granting extra credits near the memory limit */
+		if (cifssrv_mem_pressure(smb_work))
+			aux_max = 0;
 		aux_credits = (aux_credits < aux_max) ? aux_credits : aux_max;
 		credits_granted = aux_credits + credit_charge;
 
@@ -757,16 +766,12 @@ smb2_get_name(const char *src, const int maxlen, struct smb_work *smb_work)
 }
 
 /**
- * smb2_get_name_from_filp() - get filename string from filp
- * @filp:	file pointer containing filename
- *
- * Reconstruct complete pathname from filp, required in cases e.g. durable
- * reconnect where incoming filename in SMB2 CREATE request need to be ignored
+ * smb2_get_name_from_path() - get filename string from path
+ * @path:	path of the file
  *
- * Return:      filename on success, otherwise NULL
+ * Return:      filename on success, otherwise error pointer
  */
-char *
-smb2_get_name_from_filp(struct file *filp)
+static char *smb2_get_name_from_path(struct path *path)
 {
 	char *pathname, *name, *full_pathname;
 	int namelen;
@@ -775,7 +780,7 @@ smb2_get_name_from_filp(struct file *filp)
 	if (!pathname)
 		return ERR_PTR(-ENOMEM);
 
-	name = d_path(&filp->f_path, pathname, PATH_MAX);
+	name = d_path(path, pathname, PATH_MAX);
 	if (IS_ERR(name)) {
 		kfree(pathname);
 		return name;
@@ -795,6 +800,21 @@ smb2_get_name_from_filp(struct file *filp)
 	return full_pathname;
 }
 
+/**
+ * smb2_get_name_from_filp() - get filename string from filp
+ * @filp:	file pointer containing filename
+ *
+ * Reconstruct complete pathname from filp, required in cases e.g. durable
+ * reconnect where incoming filename in SMB2 CREATE request need to be ignored
+ *
+ * Return:      filename on success, otherwise NULL
+ */
+char *
+smb2_get_name_from_filp(struct file *filp)
+{
+	return smb2_get_name_from_path(&filp->f_path);
+}
+
 /**
  * smb2_get_dos_mode() - get file mode in dos format from unix mode
  * @stat:	kstat containing file mode
@@ -805,7 +825,7 @@ int smb2_get_dos_mode(struct kstat *stat, int attribute)
 {
 	int attr = 0;
 
-	attr = (attribute & 0x00005137) | ATTR_ARCHIVE;
+	attr = (attribute & 0x00005337) | ATTR_ARCHIVE;
 
 	if (S_ISDIR(stat->mode))
 		attr = ATTR_DIRECTORY;
@@ -1547,6 +1567,9 @@ out_err:
 	rsp->Reserved = 0;
 	/* default manual caching */
 	rsp->ShareFlags = SMB2_SHAREFLAG_MANUAL_CACHING;
+	if (!rc && !tcon->share->is_pipe &&
+			get_attr_branchcache(&tcon->share->config.attr))
+		rsp->ShareFlags |= cpu_to_le32(SHI1005_FLAGS_ENABLE_HASH);
 	inc_rfc1001_len(rsp, 16);
 	switch (rc) {
 	case -ENOENT:
@@ -1833,12 +1856,12 @@ int smb2_open(struct smb_work *smb_work)
 	struct file *filp = NULL, *lfilp = NULL;
 	struct kstat stat;
 	umode_t mode = 0;
-	bool file_present = true, islink = false;
+	bool file_present = true, islink = false, by_id = false;
 	int oplock, open_flags = 0, file_info = 0, len = 0;
 	int volatile_id = 0;
 	uint64_t persistent_id = 0;
 	int rc = 0;
-	char *name = NULL, *context_name, *lname = NULL, *pathname = NULL;
+	char *name = NULL, *context_name;
 	struct create_context *context;
 	int durable_open = false;
 	int durable_reconnect = false, durable_reopened = false;
@@ -1846,7 +1869,7 @@ int smb2_open(struct smb_work *smb_work)
 	struct cifssrv_durable_state *durable_state;
 	char *lk = NULL;
 	struct lease_ctx_info lc;
-	bool attrib_only = false;
+	bool attrib_only = false, light = false;
 	int maximal_access = 0;
 	int contxt_cnt = 0;
 	struct create_context *lease_ccontext = NULL, *durable_ccontext = NULL,
@@ -1856,6 +1879,8 @@ int smb2_open(struct smb_work *smb_work)
 	char *stream = NULL;
 	char *stream_name = NULL;
 	int stream_size = 0;
+	struct smb_meta meta;
+	bool meta_dirty = false;
 
 	req = (struct smb2_create_req *)smb_work->buf;
 	rsp = (struct smb2_create_rsp *)smb_work->rsp_buf;
@@ -1908,8 +1933,8 @@ int smb2_open(struct smb_work *smb_work)
 			req->CreateOptions & FILE_RANDOM_ACCESS_LE)
 			req->CreateOptions = ~(FILE_SEQUENTIAL_ONLY_LE);
 
-		if (req->CreateOptions & (FILE_OPEN_BY_FILE_ID_LE |
-			CREATE_TREE_CONNECTION | FILE_RESERVE_OPFILTER_LE)) {
+		if (req->CreateOptions & (CREATE_TREE_CONNECTION |
+			FILE_RESERVE_OPFILTER_LE)) {
 			rc = -EOPNOTSUPP;
 			goto err_out1;
 		}
@@ -2044,7 +2069,37 @@ int smb2_open(struct smb_work *smb_work)
 
 	}
 
-	if (req->NameLength) {
+	if (req->CreateOptions & FILE_OPEN_BY_FILE_ID_LE) {
+		/* the name is a file id, found by its handle without a walk */
+		if (le16_to_cpu(req->NameLength) != sizeof(__le64) ||
+			req->CreateDisposition != FILE_OPEN_LE ||
+			!smb_work->tcon->share_path.dentry) {
+			rc = -EINVAL;
+			goto err_out1;
+		}
+
+		rc = smb_vfs_open_by_id(&smb_work->tcon->share_path,
+			le64_to_cpu(*(__le64 *)req->Buffer), &path);
+		if (rc) {
+			cifssrv_debug("no file for id, rc = %d\n", rc);
+			if (rc != -ENOMEM && rc != -EOPNOTSUPP) {
+				rsp->hdr.Status =
+					NT_STATUS_OBJECT_NAME_NOT_FOUND;
+				rc = -EIO;
+			}
+			goto err_out1;
+		}
+
+		name = smb2_get_name_from_path(&path);
+		if (IS_ERR(name)) {
+			rc = PTR_ERR(name);
+			name = NULL;
+			path_put(&path);
+			goto err_out1;
+		}
+		by_id = true;
+		atomic_long_inc(&cifssrv_open_by_id);
+	} else if (req->NameLength) {
 		if ((req->CreateOptions & FILE_DIRECTORY_FILE_LE) &&
 			*(char *)req->Buffer == '\\') {
 			cifssrv_err("not allow directory name included leadning slash\n");
@@ -2080,7 +2135,7 @@ int smb2_open(struct smb_work *smb_work)
 
 	cifssrv_debug("converted name = %s\n", name);
 #ifdef CONFIG_CIFSSRV_STREAM_SUPPORT
-	if (strchr(name, ':')) {
+	if (!by_id && strchr(name, ':')) {
 		char *data;
 
 		stream = name;
@@ -2117,20 +2172,31 @@ int smb2_open(struct smb_work *smb_work)
 	}
 #endif
 
-	if (le32_to_cpu(req->CreateOptions) & FILE_DELETE_ON_CLOSE_LE) {
-		/*
-		 * On delete request, instead of following up, need to
-		 * look the current entity
-		 */
-		rc = smb_kern_path(name, 0, &path, 1);
-	} else {
-		/*
-		* Use LOOKUP_FOLLOW to follow the path of
-		* symlink in path buildup
-		*/
-		rc = smb_kern_path(name, LOOKUP_FOLLOW, &path, 1);
-		if (rc) { /* Case for broken link ?*/
-			rc = smb_kern_path(name, 0, &path, 1);
+	/* neither opened nor created, see smb_share_private_name() */
+	if (!by_id && smb_share_private_name(name)) {
+		cifssrv_debug("private name %s refused\n", name);
+		kfree(name);
+		rc = -ENOENT;
+		goto err_out1;
+	}
+
+	/*
+	 * Look the current entity up first. On delete request it is used
+	 * as is, otherwise a symlink is followed and both ends are kept,
+	 * so there is no need to compare names built by d_path() later.
+	 * A file opened by id is already looked up.
+	 */
+	if (!by_id) {
+		rc = smb_share_kern_path(smb_work->tcon, name, 0, &path, 1);
+		if (!rc && S_ISLNK(path.dentry->d_inode->i_mode) &&
+			!(le32_to_cpu(req->CreateOptions) &
+				FILE_DELETE_ON_CLOSE_LE)) {
+			/* broken link is opened as the link itself */
+			if (!smb_share_kern_path(smb_work->tcon, name,
+						LOOKUP_FOLLOW, &lpath, 0)) {
+				swap(path, lpath);
+				islink = true;
+			}
 		}
 	}
 
@@ -2215,7 +2281,8 @@ int smb2_open(struct smb_work *smb_work)
 				}
 			}
 
-			rc = smb_kern_path(name, 0, &path, 0);
+			rc = smb_share_kern_path(smb_work->tcon, name, 0,
+					&path, 0);
 			if (rc) {
 				cifssrv_err("cannot get linux path (%s), err = %d\n",
 						name, rc);
@@ -2257,6 +2324,7 @@ int smb2_open(struct smb_work *smb_work)
 			goto err_out;
 		}
 
+		smb_vfs_stream_purge(smb_work->tcon->share, path.dentry);
 		rc = smb_vfs_truncate_xattr(path.dentry);
 		if (rc) {
 			cifssrv_err("smb_vfs_truncate_xattr is failed, rc %d\n",
@@ -2265,6 +2333,18 @@ int smb2_open(struct smb_work *smb_work)
 		}
 	}
 
+	/*
+	 * Opens only to query or set attributes, or to delete, do not touch
+	 * file data, so an O_PATH file is enough to serve them.
+	 */
+	if (file_present && !(open_flags & O_TRUNC) && !stream &&
+			!durable_reconnect &&
+			!(req->DesiredAccess & ~FILE_LIGHT_OPEN_LE)) {
+		light = true;
+		open_flags = O_PATH;
+		atomic_long_inc(&cifssrv_light_opens);
+	}
+
 	filp = dentry_open(&path, open_flags | O_LARGEFILE, current_cred());
 	if (IS_ERR(filp)) {
 		rc = PTR_ERR(filp);
@@ -2272,44 +2352,20 @@ int smb2_open(struct smb_work *smb_work)
 		goto err_out;
 	}
 
-	pathname = kzalloc(PATH_MAX, GFP_KERNEL);
-	if (!pathname) {
-		rc = -ENOMEM;
-		cifssrv_err("Failed to allocate memory for linkpath\n");
-		goto err_out;
-	}
-
-	lname = d_path(&(filp->f_path), pathname, PATH_MAX);
-	if (IS_ERR(lname)) {
-		rc = PTR_ERR(lname);
-		kfree(pathname);
-		goto err_out;
-	}
-
-	if (strncmp(name, lname, PATH_MAX)) {
-		islink = true;
-		cifssrv_debug("Case for symlink follow, name(%s)->path(%s)\n",
-				name, lname);
-		rc = smb_kern_path(name, 0, &lpath, 0);
-		if (rc) {
-			cifssrv_err("cannot get linux path (%s), err = %d\n",
-				name, rc);
-			kfree(pathname);
-			goto err_out;
-		}
+	if (islink) {
+		cifssrv_debug("Case for symlink follow, name(%s)\n", name);
 		lfilp = dentry_open(&lpath, open_flags
 				| O_LARGEFILE, current_cred());
+		path_put(&lpath);
 		if (IS_ERR(lfilp)) {
 			rc = PTR_ERR(lfilp);
 			cifssrv_err("dentry open for (%s) failed, rc %d\n",
 				name, rc);
-			kfree(pathname);
-			path_put(&lpath);
+			lfilp = NULL;
+			islink = false;
 			goto err_out;
 		}
-		path_put(&lpath);
 	}
-	kfree(pathname);
 
 	if (file_present) {
 		if (!(open_flags & O_TRUNC))
@@ -2340,6 +2396,9 @@ int smb2_open(struct smb_work *smb_work)
 			cifssrv_debug("request smb2 create allocate size : %llu\n",
 				alloc_size);
 			rc = smb_vfs_alloc_size(filp, alloc_size);
+			/* allocation size is advisory without fallocate */
+			if (rc == -EOPNOTSUPP)
+				rc = 0;
 			if (rc < 0) {
 				cifssrv_err("smb_vfs_alloc_size is failed : %d\n",
 					rc);
@@ -2362,7 +2421,8 @@ int smb2_open(struct smb_work *smb_work)
 
 	}
 
-	smb_vfs_set_fadvise(filp, le32_to_cpu(req->CreateOptions));
+	if (!light)
+		smb_vfs_set_fadvise(filp, le32_to_cpu(req->CreateOptions));
 
 reconnect:
 	if (durable_reconnect) {
@@ -2408,9 +2468,6 @@ reconnect:
 		goto err_out;
 	}
 
-	if (S_ISDIR(stat.mode))
-		fp->readdir_data.dirent = NULL;
-
 	if (le32_to_cpu(req->CreateOptions) & FILE_DELETE_ON_CLOSE_LE)
 		fp->delete_on_close = 1;
 
@@ -2419,16 +2476,35 @@ reconnect:
 	fp->saccess = req->ShareAccess;
 	fp->coption = req->CreateOptions;
 	fp->fattr = req->FileAttributes;
+	fp->attrib_only = !(req->DesiredAccess & ~FILE_ATTRIB_ONLY_LE);
 
-	if (!S_ISDIR(file_inode(filp)->i_mode)) {
+	/* Windows metadata is read once here and stored at most once */
+	if (smb_vfs_get_meta(&path, &meta))
+		meta_dirty = true;
+
+	if (!light && !S_ISDIR(file_inode(filp)->i_mode) &&
+		!(le16_to_cpu(meta.flags) & SMB_META_DEFAULT_STREAM)) {
 		/* Create default stream in xattr */
 		smb_store_cont_xattr(&path, XATTR_NAME_STREAM, NULL, 0);
+		meta.flags |= cpu_to_le16(SMB_META_DEFAULT_STREAM);
+		meta_dirty = true;
+	}
+
+	if (stream || islink) {
+		if (!cifssrv_file_ext(fp)) {
+			rc = -ENOMEM;
+			goto err_out;
+		}
 	}
 
 	if (stream) {
 		stream_size = strlen(stream);
-		stream_name = kmalloc(XATTR_NAME_STREAM_LEN + stream_size,
+		stream_name = kmalloc(XATTR_NAME_STREAM_LEN + stream_size + 1,
 				GFP_KERNEL);
+		if (!stream_name) {
+			rc = -ENOMEM;
+			goto err_out;
+		}
 		memcpy(stream_name, XATTR_NAME_STREAM, XATTR_NAME_STREAM_LEN);
 
 		if (stream_size)
@@ -2437,8 +2513,8 @@ reconnect:
 		stream_name[XATTR_NAME_STREAM_LEN + stream_size] = '\0';
 
 		fp->is_stream = true;
-		fp->stream_name = stream_name;
-		fp->ssize = XATTR_NAME_STREAM_LEN + stream_size;
+		fp->ext->stream_name = stream_name;
+		fp->ext->ssize = XATTR_NAME_STREAM_LEN + stream_size;
 
 		/* Check if there is stream prefix in xattr space */
 		rc = smb_find_cont_xattr(&path, stream_name,
@@ -2465,6 +2541,13 @@ reconnect:
 				rc = -EINVAL;
 				goto err_out;
 			}
+
+			if (!(le16_to_cpu(meta.flags) &
+						SMB_META_HAS_STREAMS)) {
+				meta.flags |=
+					cpu_to_le16(SMB_META_HAS_STREAMS);
+				meta_dirty = true;
+			}
 		} else {
 			rc = smb_check_shared_mode(filp, fp);
 			if (rc < 0)
@@ -2481,7 +2564,7 @@ reconnect:
 	}
 
 	if (islink) {
-		fp->lfilp = lfilp;
+		fp->ext->lfilp = lfilp;
 		fp->islink = islink;
 	}
 
@@ -2502,7 +2585,7 @@ reconnect:
 					FILE_SYNCHRONIZE_LE)) == 0)
 		attrib_only = true;
 
-	if (!oplocks_enable || S_ISDIR(file_inode(filp)->i_mode)) {
+	if (!oplocks_enable || light || S_ISDIR(file_inode(filp)->i_mode)) {
 		oplock = SMB2_OPLOCK_LEVEL_NONE;
 	} else if (oplock == SMB2_OPLOCK_LEVEL_LEASE) {
 		if (!(server->srv_cap & SMB2_GLOBAL_CAP_LEASING)
@@ -2547,14 +2630,17 @@ reconnect:
 			rc = 0;
 		}
 
-		if (durable_open)
+		if (durable_open) {
 			fp->is_durable = 1;
+			atomic_inc(&sess->durable_open_count);
+		}
 	} else if (oplock == SMB2_OPLOCK_LEVEL_BATCH) {
 		/* During durable reconnect able to fetch/verify durable state
 		   but couldn't get batch oplock then we will not come here */
 		cifssrv_update_durable_state(sess, persistent_id,
 					     volatile_id, filp);
 		fp->is_durable = 1;
+		atomic_inc(&sess->durable_open_count);
 		file_info = FILE_OPENED;
 	}
 
@@ -2565,26 +2651,22 @@ reconnect:
 	rsp->Reserved = 0;
 	rsp->CreateAction = file_info;
 
-	if (file_present) {
-		char *create_time = NULL;
+	fp->create_time = le64_to_cpu(meta.create_time);
 
-		rc = smb_find_cont_xattr(&path, XATTR_NAME_CREATION_TIME,
-			XATTR_NAME_CREATION_TIME_LEN, &create_time, 1);
-		if (rc > 0)
-			fp->create_time = *create_time;
-		else
-			fp->create_time = cifs_UnixTimeToNT(stat.ctime);
-		rc = 0;
-		kvfree(create_time);
-	} else {
-		fp->create_time = cifs_UnixTimeToNT(stat.ctime);
-		rc = smb_store_cont_xattr(&path, XATTR_NAME_CREATION_TIME,
-			(void *)&fp->create_time, CREATIOM_TIME_LEN);
-		if (rc)
-			cifssrv_debug("failed to store creation time in EA\n");
-		rc = 0;
+	/* attributes set by SET_SPARSE, dropped on overwrite */
+	if (le16_to_cpu(meta.flags) & SMB_META_ATTR) {
+		if (file_info == FILE_OPENED) {
+			fp->fattr = meta.attr;
+		} else {
+			meta.flags &= ~cpu_to_le16(SMB_META_ATTR);
+			meta.attr = 0;
+			meta_dirty = true;
+		}
 	}
 
+	if (meta_dirty && smb_vfs_set_meta(&path, &meta))
+		cifssrv_debug("failed to store metadata in EA\n");
+
 	rsp->CreationTime = cpu_to_le64(fp->create_time);
 	rsp->LastAccessTime = cpu_to_le64(cifs_UnixTimeToNT(stat.atime));
 	rsp->LastWriteTime = cpu_to_le64(cifs_UnixTimeToNT(stat.mtime));
@@ -2593,7 +2675,7 @@ reconnect:
 			cpu_to_le64(stat.blocks << 9);
 	rsp->EndofFile = S_ISDIR(stat.mode) ? 0 : cpu_to_le64(stat.size);
 	rsp->FileAttributes = cpu_to_le32(smb2_get_dos_mode(&stat,
-		le32_to_cpu(req->FileAttributes)));
+		le32_to_cpu(fp->fattr)));
 
 	rsp->Reserved2 = 0;
 
@@ -2646,7 +2728,7 @@ reconnect:
 			rsp->CreateContextsLength);
 		contxt_cnt++;
 		create_disk_id_rsp_buf(rsp->Buffer + rsp->CreateContextsLength,
-			stat.ino, smb_work->tcon->share->tid);
+			smb_vfs_file_id(&path), smb_work->tcon->share->tid);
 		rsp->CreateContextsLength +=
 			cpu_to_le32(server->vals->create_disk_id_size);
 		inc_rfc1001_len(rsp_org, server->vals->create_disk_id_size);
@@ -2671,6 +2753,8 @@ reconnect:
 	}
 
 err_out:
+	if (islink && !lfilp)
+		path_put(&lpath);
 	path_put(&path);
 	kfree(name);
 err_out1:
@@ -2687,6 +2771,8 @@ err_out1:
 			rsp->hdr.Status = NT_STATUS_SHARING_VIOLATION;
 		else if (rc == -EBUSY)
 			rsp->hdr.Status = NT_STATUS_DELETE_PENDING;
+		else if (rc == -ENOMEM)
+			rsp->hdr.Status = NT_STATUS_INSUFFICIENT_RESOURCES;
 
 		if (!rsp->hdr.Status)
 			rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
@@ -2903,14 +2989,17 @@ int smb2_query_dir(struct smb_work *smb_work)
 	struct smb2_query_directory_rsp *rsp, *rsp_org;
 	struct smb_dirent *de;
 	struct cifssrv_file *dir_fp;
+	struct cifssrv_file_ext *dir_ext;
 	int data_count = 0;
 	int out_buf_len;
 	int reclen = 0;
 	int num_entry = 0;
 	int rc = 0;
 	uint64_t id = -1;
+	u64 file_id, *want_id = NULL;
 	struct kstat kstat;
-	char *dirpath, *bufptr, *namestr, *srch_ptr = NULL, *path = NULL;
+	struct file *filp;
+	char *bufptr, *namestr, *srch_ptr = NULL;
 	unsigned char srch_flag;
 	struct smb_readdir_data r_data = {
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
@@ -2983,66 +3072,64 @@ int smb2_query_dir(struct smb_work *smb_work)
 	} else
 		cifssrv_debug("Search pattern is %s\n", srch_ptr);
 
-	path = kmalloc(PATH_MAX, GFP_KERNEL);
-	if (!path) {
-		cifssrv_err("Failed to allocate memory\n");
+	dir_ext = cifssrv_file_ext(dir_fp);
+	if (!dir_ext) {
 		rsp->hdr.Status = NT_STATUS_NO_MEMORY;
 		rc = -ENOMEM;
 		goto err_out;
 	}
 
-	dirpath = d_path(&(dir_fp->filp->f_path), path, PATH_MAX);
-	if (IS_ERR(dirpath)) {
-		cifssrv_err("Failed to get complete dir path\n");
-		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
-		rc = PTR_ERR(dirpath);
-		goto err_out;
-	}
-	cifssrv_debug("Directory name is %s\n", dirpath);
-
-	if (!dir_fp->readdir_data.dirent) {
-		dir_fp->readdir_data.dirent =
+	if (!dir_ext->readdir_data.dirent) {
+		dir_ext->readdir_data.dirent =
 			(void *)__get_free_page(GFP_KERNEL);
-		if (!dir_fp->readdir_data.dirent) {
+		if (!dir_ext->readdir_data.dirent) {
 			cifssrv_err("Failed to allocate memory\n");
 			rsp->hdr.Status = NT_STATUS_NO_MEMORY;
 			rc = -ENOMEM;
 			goto err_out;
 		}
-		dir_fp->readdir_data.used = 0;
-		dir_fp->readdir_data.full = 0;
-		dir_fp->dirent_offset = 0;
+		dir_ext->readdir_data.used = 0;
+		dir_ext->readdir_data.full = 0;
+		dir_ext->dirent_offset = 0;
 	}
 
 	if (srch_flag & SMB2_REOPEN) {
 		cifssrv_debug("Reopen the directory\n");
-		filp_close(dir_fp->filp, NULL);
-		dir_fp->filp = filp_open(dirpath, O_RDONLY, 0666);
-		if (!dir_fp->filp) {
+		filp = dentry_open(&dir_fp->filp->f_path, O_RDONLY,
+				current_cred());
+		if (IS_ERR(filp)) {
 			cifssrv_debug("Reopening dir failed\n");
 			rc = -EINVAL;
 			goto err_out;
 		}
-		dir_fp->readdir_data.used = 0;
-		dir_fp->dirent_offset = 0;
+		filp_close(dir_fp->filp, NULL);
+		dir_fp->filp = filp;
+		dir_ext->readdir_data.used = 0;
+		dir_ext->dirent_offset = 0;
 	}
 
 	if (srch_flag & SMB2_RESTART_SCANS) {
 		cifssrv_debug("SMB2 RESTART SCANS\n");
 		generic_file_llseek(dir_fp->filp, 0, SEEK_SET);
-		dir_fp->readdir_data.used = 0;
-		dir_fp->dirent_offset = 0;
+		dir_ext->readdir_data.used = 0;
+		dir_ext->dirent_offset = 0;
 	}
 
 	if (srch_flag & SMB2_INDEX_SPECIFIED && le32_to_cpu(req->FileIndex)) {
 		cifssrv_debug("specified index\n");
 		generic_file_llseek(dir_fp->filp, le32_to_cpu(req->FileIndex),
 			SEEK_SET);
-		dir_fp->readdir_data.used = 0;
-		dir_fp->dirent_offset = le32_to_cpu(req->FileIndex);
+		dir_ext->readdir_data.used = 0;
+		dir_ext->dirent_offset = le32_to_cpu(req->FileIndex);
 	}
 
-	r_data.dirent = dir_fp->readdir_data.dirent;
+	/* only these levels report a file id, others need no handle */
+	if (req->FileInformationClass == FILEID_FULL_DIRECTORY_INFORMATION ||
+			req->FileInformationClass ==
+			FILEID_BOTH_DIRECTORY_INFORMATION)
+		want_id = &file_id;
+
+	r_data.dirent = dir_ext->readdir_data.dirent;
 	bufptr = (char *)rsp->Buffer;
 	out_buf_len = min_t(int,(SMBMaxBufSize + MAX_HEADER_SIZE(server) -
 			(get_rfc1002_length(rsp_org) + 4)),
@@ -3050,8 +3137,8 @@ int smb2_query_dir(struct smb_work *smb_work)
 		sizeof(struct smb2_query_directory_rsp);
 
 	do {
-		if (dir_fp->dirent_offset >= dir_fp->readdir_data.used) {
-			dir_fp->dirent_offset = 0;
+		if (dir_ext->dirent_offset >= dir_ext->readdir_data.used) {
+			dir_ext->dirent_offset = 0;
 			r_data.used = 0;
 			r_data.full = 0;
 			rc = smb_vfs_readdir(dir_fp->filp, smb_filldir,
@@ -3061,28 +3148,29 @@ int smb2_query_dir(struct smb_work *smb_work)
 				goto err_out;
 			}
 
-			dir_fp->readdir_data.used = r_data.used;
-			dir_fp->readdir_data.full = r_data.full;
-			if (!dir_fp->readdir_data.used) {
+			dir_ext->readdir_data.used = r_data.used;
+			dir_ext->readdir_data.full = r_data.full;
+			if (!dir_ext->readdir_data.used) {
 				free_page((unsigned long)
-						(dir_fp->readdir_data.dirent));
-				dir_fp->readdir_data.dirent = NULL;
+						(dir_ext->readdir_data.dirent));
+				dir_ext->readdir_data.dirent = NULL;
 				break;
 			}
 
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent);
+				((char *)dir_ext->readdir_data.dirent);
 		} else {
 			de = (struct smb_dirent *)
-				((char *)dir_fp->readdir_data.dirent +
-				 dir_fp->dirent_offset);
+				((char *)dir_ext->readdir_data.dirent +
+				 dir_ext->dirent_offset);
 		}
 
 		reclen = ALIGN(sizeof(struct smb_dirent) + de->namelen,
 				sizeof(__le64));
-		dir_fp->dirent_offset += reclen;
+		dir_ext->dirent_offset += reclen;
 
-		namestr = read_next_entry(&kstat, de, dirpath);
+		namestr = read_next_entry(&kstat, de,
+				&dir_fp->filp->f_path, want_id);
 		if (IS_ERR(namestr)) {
 			rc = PTR_ERR(namestr);
 			cifssrv_debug("Err while dirent read rc = %d\n", rc);
@@ -3090,6 +3178,9 @@ int smb2_query_dir(struct smb_work *smb_work)
 			continue;
 		}
 
+		if (want_id)
+			kstat.ino = file_id;
+
 		if (srch_flag & SMB2_RETURN_SINGLE_ENTRY) {
 			cifssrv_debug("Single entry requested\n");
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
@@ -3121,7 +3212,7 @@ int smb2_query_dir(struct smb_work *smb_work)
 	} while (out_buf_len >= 0);
 
 	if (out_buf_len < 0)
-		dir_fp->dirent_offset -= reclen;
+		dir_ext->dirent_offset -= reclen;
 
 	if (!data_count) {
 		if (srch_flag & SMB2_RETURN_SINGLE_ENTRY
@@ -3148,15 +3239,14 @@ int smb2_query_dir(struct smb_work *smb_work)
 		inc_rfc1001_len(rsp_org, 8 + data_count);
 	}
 
-	kfree(path);
 	kfree(srch_ptr);
 	return 0;
 
 err_out:
-	if (dir_fp && dir_fp->readdir_data.dirent) {
+	if (dir_fp && dir_fp->ext && dir_fp->ext->readdir_data.dirent) {
 		free_page((unsigned long)
-				(dir_fp->readdir_data.dirent));
-		dir_fp->readdir_data.dirent = NULL;
+				(dir_fp->ext->readdir_data.dirent));
+		dir_fp->ext->readdir_data.dirent = NULL;
 	}
 
 	if (rsp->hdr.Status == 0)
@@ -3164,11 +3254,89 @@ err_out:
 	smb2_set_err_rsp(smb_work);
 
 	cifssrv_err("error while processing smb2 query dir rc = %d\n", rc);
-	kfree(path);
 	kfree(srch_ptr);
 	return 0;
 }
 
+/**
+ * smb2_info_sec() - handler for smb2 query info security descriptor
+ * @smb_work:	smb work containing query info request buffer
+ *
+ * Return:	0 on success, -ENOSPC if the descriptor did not fit and the
+ *		error response carrying its size is already built,
+ *		otherwise error
+ */
+static int smb2_info_sec(struct smb_work *smb_work)
+{
+	struct smb2_query_info_req *req;
+	struct smb2_query_info_rsp *rsp, *rsp_org;
+	struct smb2_err_rsp *err_rsp;
+	struct cifssrv_file *fp;
+	uint64_t id = -1;
+	int len, room;
+
+	req = (struct smb2_query_info_req *)smb_work->buf;
+	rsp = (struct smb2_query_info_rsp *)smb_work->rsp_buf;
+	rsp_org = rsp;
+
+	if (smb_work->next_smb2_rcv_hdr_off) {
+		req = (struct smb2_query_info_req *)((char *)req +
+					smb_work->next_smb2_rcv_hdr_off);
+		rsp = (struct smb2_query_info_rsp *)((char *)rsp +
+					smb_work->next_smb2_rsp_hdr_off);
+
+		if (le64_to_cpu(req->VolatileFileId) == -1)
+			id = smb_work->cur_local_fid;
+	}
+
+	if (id == -1)
+		id = le64_to_cpu(req->VolatileFileId);
+
+	if (smb_work->tcon->share->is_pipe) {
+		rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
+		return -EOPNOTSUPP;
+	}
+
+	fp = get_id_from_fidtable(smb_work->sess, id);
+	if (!fp || (fp->is_durable && fp->persistent_id !=
+				le64_to_cpu(req->PersistentFileId))) {
+		cifssrv_debug("Invalid id for security info : %llu\n", id);
+		rsp->hdr.Status = NT_STATUS_FILE_CLOSED;
+		return -ENOENT;
+	}
+
+	if (!(fp->daccess & (FILE_READ_CONTROL_LE | FILE_MAXIMAL_ACCESS_LE |
+		FILE_GENERIC_ALL_LE))) {
+		cifssrv_err("no right to read the security descriptor : 0x%x\n",
+			fp->daccess);
+		return -EACCES;
+	}
+
+	room = SMBMaxBufSize - ((char *)rsp->Buffer -
+			(char *)smb_work->rsp_buf);
+	room = min_t(int, room, le32_to_cpu(req->OutputBufferLength));
+	len = smb_acl_get_sd(fp->filp->f_path.dentry, (char *)rsp->Buffer,
+			room, le32_to_cpu(req->AdditionalInformation));
+	if (len < 0)
+		return len;
+
+	if (len > room) {
+		/* client retries with the size given in the error data */
+		err_rsp = (struct smb2_err_rsp *)rsp;
+		err_rsp->hdr.Status = NT_STATUS_BUFFER_TOO_SMALL;
+		err_rsp->StructureSize = SMB2_ERROR_STRUCTURE_SIZE2;
+		err_rsp->Reserved = 0;
+		err_rsp->ByteCount = cpu_to_le32(sizeof(__le32));
+		*(__le32 *)err_rsp->ErrorData = cpu_to_le32(len);
+		inc_rfc1001_len(rsp_org, 8 + sizeof(__le32));
+		return -ENOSPC;
+	}
+
+	rsp->OutputBufferLength = cpu_to_le32(len);
+	inc_rfc1001_len(rsp_org, len);
+	return 0;
+}
+
 /**
  * smb2_query_info() - handler for smb2 query info command
  * @smb_work:	smb work containing query info request buffer
@@ -3210,6 +3378,12 @@ int smb2_query_info(struct smb_work *smb_work)
 		cifssrv_debug("GOT SMB2_O_INFO_FILESYSTEM\n");
 		rc = smb2_info_filesystem(smb_work);
 		break;
+	case SMB2_O_INFO_SECURITY:
+		cifssrv_debug("GOT SMB2_O_INFO_SECURITY\n");
+		rc = smb2_info_sec(smb_work);
+		if (rc == -ENOSPC)
+			return 0;
+		break;
 	default:
 		cifssrv_debug("InfoType %d not supported yet\n", req->InfoType);
 		rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
@@ -3446,6 +3620,8 @@ int smb2_get_ea(struct smb_work *smb_work, struct path *path,
 	int rc, name_len, value_len, xattr_list_len;
 	ssize_t buf_free_len, alignment_bytes, rsp_data_cnt = 0;
 	struct smb2_ea_info_req *ea_req = NULL;
+	struct smb_attr_stamp stamp;
+	unsigned int gen;
 
 	req = (struct smb2_query_info_req *)rq;
 	rsp = (struct smb2_query_info_rsp *)resp;
@@ -3466,13 +3642,25 @@ int smb2_get_ea(struct smb_work *smb_work, struct path *path,
 		(get_rfc1002_length(rsp_org) + 4)
 		- sizeof(struct smb2_query_info_rsp);
 
+	/* whole list of a file queried before is likely cached */
+	smb_vfs_attr_stamp(path->dentry->d_inode, &stamp);
+	gen = smb_vfs_attr_gen();
+	if (!req->InputBufferLength) {
+		rc = smb_vfs_get_ea_list(path->dentry, (char *)rsp->Buffer,
+				buf_free_len);
+		if (rc >= 0) {
+			rsp_data_cnt = rc;
+			goto done;
+		}
+	}
+
 	rc = smb_vfs_listxattr(path->dentry, &xattr_list, XATTR_LIST_MAX);
 	if (rc < 0) {
 		rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
 		goto out;
 	} else if (!rc) { /* there is no EA in the file */
 		cifssrv_debug("no ea data in the file\n");
-		goto done;
+		goto cache;
 	}
 	xattr_list_len = rc;
 
@@ -3487,15 +3675,7 @@ int smb2_get_ea(struct smb_work *smb_work, struct path *path,
 		 * still keep the framework generic, to list other attrs
 		 * in future.
 		 */
-		if (strncmp(name, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN))
-			continue;
-
-		if (!strncmp(&name[XATTR_USER_PREFIX_LEN], CREATION_TIME_PREFIX,
-					CREATION_TIME_PREFIX_LEN))
-			continue;
-
-		if (!strncmp(&name[XATTR_USER_PREFIX_LEN], STREAM_PREFIX,
-					STREAM_PREFIX_LEN))
+		if (!smb_vfs_user_ea(name))
 			continue;
 
 		if (req->InputBufferLength &&
@@ -3558,6 +3738,10 @@ int smb2_get_ea(struct smb_work *smb_work, struct path *path,
 
 	/* no more ea entries */
 	prev_eainfo->NextEntryOffset = 0;
+cache:
+	if (!req->InputBufferLength)
+		smb_vfs_put_ea_list(path->dentry, &stamp, gen,
+				(char *)rsp->Buffer, rsp_data_cnt);
 done:
 	rc = 0;
 	rsp->OutputBufferLength = cpu_to_le32(rsp_data_cnt);
@@ -3651,6 +3835,23 @@ int buffer_check_err(int reqOutputBufferLength, struct smb2_query_info_rsp *rsp,
 	return 0;
 }
 
+/**
+ * smb2_file_attributes() - attributes of an open file for query info
+ * @fp:		cifssrv file pointer
+ * @stat:	kstat of the file
+ *
+ * Return:	FileAttributes field value
+ */
+static __le32 smb2_file_attributes(struct cifssrv_file *fp,
+	struct kstat *stat)
+{
+	if (S_ISDIR(stat->mode))
+		return FILE_ATTRIBUTE_DIRECTORY_LE;
+	if (fp->fattr & FILE_ATTRIBUTE_SPARSE_FILE_LE)
+		return FILE_ATTRIBUTE_SPARSE_FILE_LE;
+	return FILE_ATTRIBUTE_NORMAL_LE;
+}
+
 /**
  * smb2_info_file() - handler for smb2 query info command
  * @smb_work:	smb work containing query info request buffer
@@ -3666,6 +3867,7 @@ int smb2_info_file(struct smb_work *smb_work)
 	int fileinfoclass = 0;
 	struct file *filp;
 	struct kstat stat;
+	struct smb_attr attr;
 	uint64_t id = -1;
 	int rc = 0;
 	int file_infoclass_size;
@@ -3748,8 +3950,7 @@ int smb2_info_file(struct smb_work *smb_work)
 			cpu_to_le64(cifs_UnixTimeToNT(stat.mtime));
 		basic_info->ChangeTime =
 			cpu_to_le64(cifs_UnixTimeToNT(stat.ctime));
-		basic_info->Attributes = S_ISDIR(stat.mode) ?
-					ATTR_DIRECTORY : ATTR_NORMAL;
+		basic_info->Attributes = smb2_file_attributes(fp, &stat);
 		basic_info->Pad1 = 0;
 		rsp->OutputBufferLength =
 			cpu_to_le32(offsetof(struct smb2_file_all_info,
@@ -3817,8 +4018,7 @@ int smb2_info_file(struct smb_work *smb_work)
 			cpu_to_le64(cifs_UnixTimeToNT(stat.mtime));
 		file_info->ChangeTime =
 			cpu_to_le64(cifs_UnixTimeToNT(stat.ctime));
-		file_info->Attributes = S_ISDIR(stat.mode) ?
-					ATTR_DIRECTORY : ATTR_NORMAL;
+		file_info->Attributes = smb2_file_attributes(fp, &stat);
 		file_info->Pad1 = 0;
 		file_info->AllocationSize = S_ISDIR(stat.mode) ? 0 :
 			cpu_to_le64(stat.blocks << 9);
@@ -3828,8 +4028,11 @@ int smb2_info_file(struct smb_work *smb_work)
 		file_info->DeletePending = 0;
 		file_info->Directory = S_ISDIR(stat.mode) ? 1 : 0;
 		file_info->Pad2 = 0;
-		file_info->IndexNumber = cpu_to_le64(stat.ino);
+		file_info->IndexNumber = cpu_to_le64(
+			smb_vfs_file_id(&filp->f_path));
 		file_info->EASize = 0;
+		if (!smb_vfs_get_attr(filp->f_path.dentry, &attr))
+			file_info->EASize = cpu_to_le32(attr.ea_size);
 		file_info->AccessFlags = cpu_to_le32(0x00000080);
 		file_info->CurrentByteOffset = cpu_to_le64(filp->f_pos);
 		file_info->Mode = cpu_to_le32(0x00000010);
@@ -3929,15 +4132,15 @@ int smb2_info_file(struct smb_work *smb_work)
 
 			file_info->StreamNameLength = cpu_to_le32(streamlen);
 
-			value_len = smb_vfs_getxattr(path->dentry, stream_name,
-				NULL, 0);
+			value_len = smb_vfs_stream_size(fp->share, path->dentry,
+				stream_name);
 			if (value_len < 0)
 				break;
 
-			file_info->StreamSize =
-				cpu_to_le64(streamlen + value_len);
+			file_info->StreamSize = cpu_to_le64(value_len);
 			file_info->StreamAllocationSize =
-				cpu_to_le64(XATTR_SIZE_MAX);
+				cpu_to_le64(max_t(loff_t, value_len,
+							XATTR_SIZE_MAX));
 
 			next = sizeof(struct smb2_file_stream_info)
 				+ streamlen;
@@ -3962,7 +4165,8 @@ out:
 
 		file_info = (struct smb2_file_internal_info *)rsp->Buffer;
 
-		file_info->IndexNumber = cpu_to_le64(stat.ino);
+		file_info->IndexNumber = cpu_to_le64(
+			smb_vfs_file_id(&filp->f_path));
 		rsp->OutputBufferLength =
 			cpu_to_le32(sizeof(struct smb2_file_internal_info));
 		inc_rfc1001_len(rsp_org,
@@ -3991,8 +4195,7 @@ out:
 			cpu_to_le64(cifs_UnixTimeToNT(stat.mtime));
 		file_info->ChangeTime =
 			cpu_to_le64(cifs_UnixTimeToNT(stat.ctime));
-		file_info->Attributes = S_ISDIR(stat.mode) ?
-					ATTR_DIRECTORY : ATTR_NORMAL;
+		file_info->Attributes = smb2_file_attributes(fp, &stat);
 		file_info->AllocationSize = S_ISDIR(stat.mode) ? 0 :
 				cpu_to_le64(stat.blocks << 9);
 		file_info->EndOfFile = S_ISDIR(stat.mode) ? 0 :
@@ -4010,6 +4213,8 @@ out:
 		file_info = (struct smb2_file_ea_info *)rsp->Buffer;
 
 		file_info->EASize = 0;
+		if (!smb_vfs_get_attr(filp->f_path.dentry, &attr))
+			file_info->EASize = cpu_to_le32(attr.ea_size);
 		rsp->OutputBufferLength =
 			cpu_to_le32(sizeof(struct smb2_file_ea_info));
 		inc_rfc1001_len(rsp_org, sizeof(struct smb2_file_ea_info));
@@ -4034,8 +4239,7 @@ out:
 		struct smb2_file_alloc_info *file_info;
 		file_info = (struct smb2_file_alloc_info *)rsp->Buffer;
 
-		file_info->Attributes = S_ISDIR(stat.mode) ?
-			ATTR_DIRECTORY : ATTR_NORMAL;
+		file_info->Attributes = smb2_file_attributes(fp, &stat);
 		file_info->ReparseTag = 0;
 		rsp->OutputBufferLength =
 			cpu_to_le32(sizeof(struct smb2_file_alloc_info));
@@ -4145,7 +4349,6 @@ int smb2_info_filesystem(struct smb_work *smb_work)
 	int fsinfoclass = 0;
 	struct kstatfs stfs;
 	struct cifssrv_share *share;
-	struct path path;
 	int rc = 0, len;
 	int fs_infoclass_size = 0;
 	int fs_type_idx;
@@ -4164,23 +4367,13 @@ int smb2_info_filesystem(struct smb_work *smb_work)
 	if (!share)
 		return -ENOENT;
 
-	rc = smb_kern_path(share->path, LOOKUP_FOLLOW, &path, 0);
-
-	if (rc) {
-		cifssrv_err("cannot create vfs path\n");
-		rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
-		return rc;
-	}
-
-	rc = vfs_statfs(&path, &stfs);
+	rc = smb_vfs_share_statfs(share, &stfs);
 	if (rc) {
 		cifssrv_err("cannot do stat of path %s\n", share->path);
 		rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
-		path_put(&path);
 		return rc;
 	}
 
-
 	fsinfoclass = req->FileInfoClass;
 
 	switch (fsinfoclass) {
@@ -4202,7 +4395,10 @@ int smb2_info_filesystem(struct smb_work *smb_work)
 			FILE_SYSTEM_ATTRIBUTE_INFO *fs_info;
 
 			fs_info = (FILE_SYSTEM_ATTRIBUTE_INFO *)rsp->Buffer;
-			fs_info->Attributes = cpu_to_le32(0x0001002f);
+			fs_info->Attributes = cpu_to_le32(0x0001006f);
+			/* FILE_SUPPORTS_BLOCK_REFCOUNTING */
+			if (smb_vfs_can_reflink(stfs.f_type))
+				fs_info->Attributes |= cpu_to_le32(0x08000000);
 			fs_info->MaxPathNameComponentLength =
 				cpu_to_le32(stfs.f_namelen);
 			fs_type_idx = fsTypeSearch(fs_type, stfs.f_type,
@@ -4281,16 +4477,64 @@ int smb2_info_filesystem(struct smb_work *smb_work)
 
 	default:
 		rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
-		path_put(&path);
 		return -1;
 	}
 	rc = buffer_check_err(req->OutputBufferLength, rsp,
 					fs_infoclass_size);
-	path_put(&path);
 	return rc;
 
 }
 
+/**
+ * smb2_set_info_sec() - handler for smb2 set info security descriptor
+ * @smb_work:	smb work containing set info request buffer
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb2_set_info_sec(struct smb_work *smb_work)
+{
+	struct smb2_set_info_req *req;
+	struct smb2_set_info_rsp *rsp;
+	struct cifssrv_file *fp;
+	__le32 all = FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE;
+	__u32 secinfo;
+	uint64_t id;
+
+	req = (struct smb2_set_info_req *)smb_work->buf;
+	rsp = (struct smb2_set_info_rsp *)smb_work->rsp_buf;
+
+	id = le64_to_cpu(req->VolatileFileId);
+	fp = get_id_from_fidtable(smb_work->sess, id);
+	if (!fp || (fp->is_durable && fp->persistent_id !=
+				le64_to_cpu(req->PersistentFileId))) {
+		cifssrv_debug("Invalid id for security info : %llu\n", id);
+		rsp->hdr.Status = NT_STATUS_FILE_CLOSED;
+		return -ENOENT;
+	}
+
+	/* each part of the descriptor needs its own right */
+	secinfo = le32_to_cpu(req->AdditionalInformation);
+	if (((secinfo & (OWNER_SECINFO | GROUP_SECINFO)) &&
+			!(fp->daccess & (FILE_WRITE_OWNER_LE | all))) ||
+		((secinfo & DACL_SECINFO) &&
+			!(fp->daccess & (FILE_WRITE_DAC_LE | all)))) {
+		cifssrv_err("no right to write the security descriptor : 0x%x\n",
+			fp->daccess);
+		return -EACCES;
+	}
+
+	if (le16_to_cpu(req->BufferOffset) + le32_to_cpu(req->BufferLength) >
+			get_rfc1002_length(req) + 4) {
+		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+		return -EINVAL;
+	}
+
+	return smb_acl_set_sd(smb_work->sess, id,
+			(struct smb_ntsd *)(req->hdr.ProtocolId +
+				le16_to_cpu(req->BufferOffset)),
+			le32_to_cpu(req->BufferLength), secinfo);
+}
+
 /**
  * smb2_set_info() - handler for smb2 set info command handler
  * @smb_work:	smb work containing set info request buffer
@@ -4318,6 +4562,10 @@ int smb2_set_info(struct smb_work *smb_work)
 		cifssrv_debug("GOT SMB2_O_INFO_FILE\n");
 		rc = smb2_set_info_file(smb_work);
 		break;
+	case SMB2_O_INFO_SECURITY:
+		cifssrv_debug("GOT SMB2_O_INFO_SECURITY\n");
+		rc = smb2_set_info_sec(smb_work);
+		break;
 	default:
 		rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
 	}
@@ -4378,6 +4626,12 @@ int smb2_set_ea(struct smb2_ea_info *eabuf, struct path *path)
 		attr_name[XATTR_USER_PREFIX_LEN + eabuf->EaNameLength] = '\0';
 		value = (char *)&eabuf->name + eabuf->EaNameLength + 1;
 
+		/* xattrs of cifssrv itself are not client EAs */
+		if (!smb_vfs_user_ea(attr_name)) {
+			rc = -EACCES;
+			break;
+		}
+
 		rc = smb_vfs_setxattr(NULL, path, attr_name, value,
 				le16_to_cpu(eabuf->EaValueLength), 0);
 		if (rc < 0) {
@@ -4441,7 +4695,8 @@ int smb2_create_link(struct smb_work *smb_work, struct file *filp)
 	}
 
 	cifssrv_debug("target name is %s\n", target_name);
-	rc = smb_kern_path(link_name, 0, &path, 0);
+	rc = smb_share_kern_path(smb_work->tcon, link_name,
+			0, &path, 0);
 	if (rc)
 		file_present = false;
 	else
@@ -4467,8 +4722,10 @@ int smb2_create_link(struct smb_work *smb_work, struct file *filp)
 		}
 	}
 
-	rc = smb_vfs_link(target_name, link_name);
-	if (rc)
+	rc = smb_vfs_link(smb_work->tcon, target_name, link_name);
+	if (rc == -EACCES)
+		rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+	else if (rc)
 		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
 
 out:
@@ -4540,7 +4797,8 @@ int smb2_rename(struct smb_work *smb_work, struct file *filp, int old_fid)
 	}
 	strncpy(tmp_name, new_name, strlen(new_name) + 1);
 	cifssrv_debug("new name %s\n", new_name);
-	rc = smb_kern_path(tmp_name, 0, &path, 1);
+	rc = smb_share_kern_path(smb_work->tcon, tmp_name,
+			0, &path, 1);
 	if (rc)
 		file_present = false;
 	else
@@ -4573,10 +4831,11 @@ int smb2_rename(struct smb_work *smb_work, struct file *filp, int old_fid)
 		}
 	}
 
-	rc = smb_vfs_rename(smb_work->sess, NULL, new_name, old_fid);
+	rc = smb_vfs_rename(smb_work->sess, smb_work->tcon,
+			NULL, new_name, old_fid);
 	if (rc == -ESHARE)
 		rsp->hdr.Status = NT_STATUS_SHARING_VIOLATION;
-	else if (rc == -ENOTEMPTY)
+	else if (rc == -ENOTEMPTY || rc == -EACCES)
 		rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
 	else if (rc < 0)
 		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
@@ -4645,10 +4904,12 @@ int smb2_set_info_file(struct smb_work *smb_work)
 		attrs.ia_valid = 0;
 
 		if (le64_to_cpu(file_info->CreationTime)) {
+			struct smb_meta meta;
+
 			fp->create_time = le64_to_cpu(file_info->CreationTime);
-			rc = smb_store_cont_xattr(&fp->filp->f_path,
-				XATTR_NAME_CREATION_TIME,
-				(void *)&fp->create_time, CREATIOM_TIME_LEN);
+			smb_vfs_get_meta(&fp->filp->f_path, &meta);
+			meta.create_time = file_info->CreationTime;
+			rc = smb_vfs_set_meta(&fp->filp->f_path, &meta);
 			if (rc) {
 				cifssrv_debug("failed to set creation time\n");
 				rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
@@ -4705,7 +4966,39 @@ int smb2_set_info_file(struct smb_work *smb_work)
 		break;
 	}
 	case FILE_ALLOCATION_INFORMATION:
-		/* fall through */
+	{
+		struct smb2_file_alloc_size_info *file_alloc_info;
+		loff_t alloc_size;
+
+		if (!(fp->daccess & (FILE_WRITE_DATA_LE |
+			FILE_GENERIC_WRITE_LE | FILE_MAXIMAL_ACCESS_LE |
+			FILE_GENERIC_ALL_LE))) {
+			cifssrv_err("no right to write data : 0x%x\n",
+				fp->daccess);
+			return -EACCES;
+		}
+
+		file_alloc_info =
+			(struct smb2_file_alloc_size_info *)req->Buffer;
+		alloc_size = le64_to_cpu(file_alloc_info->AllocationSize);
+
+		rc = smb_vfs_set_alloc_size(sess, id, alloc_size);
+		if (rc) {
+			cifssrv_err("set allocation size failed! fid %llu err %d\n",
+					id, rc);
+			if (rc == -EAGAIN)
+				rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+			else if (rc == -ENOSPC || rc == -EFBIG)
+				rsp->hdr.Status = NT_STATUS_DISK_FULL;
+			else
+				rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			smb2_set_err_rsp(smb_work);
+			return rc;
+		}
+		cifssrv_debug("fid %llu allocation size set to %lld\n",
+				id, alloc_size);
+		break;
+	}
 	case FILE_END_OF_FILE_INFORMATION:
 	{
 		struct smb2_file_eof_info *file_eof_info;
@@ -4893,71 +5186,34 @@ int smb2_read_pipe(struct smb_work *smb_work)
 }
 
 /**
- * smb2_read() - handler for smb2 read from file
+ * smb2_read_complete() - build smb2 read response from read result
  * @smb_work:	smb work containing read command buffer
+ * @nbytes:	number of read bytes, or error
+ *
+ * Called inline for synchronous reads and from the completion work
+ * for reads submitted with smb_vfs_read_async().
  *
  * Return:	0 on success, otherwise error
  */
-int smb2_read(struct smb_work *smb_work)
+static int smb2_read_complete(struct smb_work *smb_work, ssize_t nbytes)
 {
 	struct smb2_read_req *req;
 	struct smb2_read_rsp *rsp, *rsp_org;
-	loff_t offset;
 	size_t length, mincount;
-	ssize_t nbytes = 0;
-	uint64_t id = -1;
 	int err = 0;
 
-	req = (struct smb2_read_req *)smb_work->buf;
-	rsp = (struct smb2_read_rsp *)smb_work->rsp_buf;
+	req = (struct smb2_read_req *)(smb_work->buf +
+			smb_work->next_smb2_rcv_hdr_off);
+	rsp_org = (struct smb2_read_rsp *)smb_work->rsp_buf;
+	rsp = (struct smb2_read_rsp *)((char *)rsp_org +
+			smb_work->next_smb2_rsp_hdr_off);
 
-	rsp_org = rsp;
+	length = min_t(size_t, le32_to_cpu(req->Length), CIFS_DEFAULT_IOSIZE);
+	mincount = le32_to_cpu(req->MinimumCount);
 
-	if (smb_work->next_smb2_rcv_hdr_off) {
-		req = (struct smb2_read_req *)((char *)req +
-					smb_work->next_smb2_rcv_hdr_off);
-		rsp = (struct smb2_read_rsp *)((char *)rsp +
-					smb_work->next_smb2_rsp_hdr_off);
-		if (le64_to_cpu(req->VolatileFileId) == -1) {
-			cifssrv_debug("Compound request assigning stored FID = %llu\n",
-				    smb_work->cur_local_fid);
-			id = smb_work->cur_local_fid;
-		}
-	}
-
-	if (req->StructureSize != 49) {
-		cifssrv_err("malformed packet\n");
-		smb_work->send_no_response = 1;
-		return 0;
-	}
-
-	if (smb_work->tcon->share->is_pipe == true) {
-		cifssrv_debug("IPC pipe read request\n");
-		return smb2_read_pipe(smb_work);
-	}
-
-	if (id == -1)
-		id = le64_to_cpu(req->VolatileFileId);
-
-	offset = le32_to_cpu(req->Offset);
-	length = le32_to_cpu(req->Length);
-	mincount = le32_to_cpu(req->MinimumCount);
-
-	if (length > CIFS_DEFAULT_IOSIZE) {
-		cifssrv_debug("read size(%zu) exceeds max size(%u)\n",
-				length, CIFS_DEFAULT_IOSIZE);
-		cifssrv_debug("limiting read size to max size(%u)\n",
-				CIFS_DEFAULT_IOSIZE);
-		length = CIFS_DEFAULT_IOSIZE;
-	}
-
-	cifssrv_debug("fid %llu, offset %lld, len %zu\n", id, offset, length);
-	nbytes = smb_vfs_read(smb_work->sess, id,
-			le64_to_cpu(req->PersistentFileId),
-			&smb_work->rdata_buf, length, &offset);
-	if (nbytes < 0) {
-		err = nbytes;
-		goto out;
+	if (nbytes < 0) {
+		err = nbytes;
+		goto out;
 	}
 	if ((nbytes == 0 && length != 0) || nbytes < mincount) {
 		kvfree(smb_work->rdata_buf);
@@ -4967,8 +5223,8 @@ int smb2_read(struct smb_work *smb_work)
 		return 0;
 	}
 
-	cifssrv_debug("nbytes %zu, offset %lld mincount %zu\n",
-						nbytes, offset, mincount);
+	cifssrv_debug("nbytes %zu, mincount %zu\n", nbytes, mincount);
+	cifssrv_charge_work_mem(smb_work, length);
 
 	rsp->StructureSize = cpu_to_le16(17);
 	rsp->DataOffset = 80;
@@ -5003,6 +5259,76 @@ out:
 	return err;
 }
 
+/**
+ * smb2_read() - handler for smb2 read from file
+ * @smb_work:	smb work containing read command buffer
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb2_read(struct smb_work *smb_work)
+{
+	struct smb2_read_req *req;
+	loff_t offset;
+	size_t length;
+	ssize_t nbytes = 0;
+	uint64_t id = -1;
+	int err;
+
+	req = (struct smb2_read_req *)smb_work->buf;
+
+	if (smb_work->next_smb2_rcv_hdr_off) {
+		req = (struct smb2_read_req *)((char *)req +
+					smb_work->next_smb2_rcv_hdr_off);
+		if (le64_to_cpu(req->VolatileFileId) == -1) {
+			cifssrv_debug("Compound request assigning stored FID = %llu\n",
+				    smb_work->cur_local_fid);
+			id = smb_work->cur_local_fid;
+		}
+	}
+
+	if (req->StructureSize != 49) {
+		cifssrv_err("malformed packet\n");
+		smb_work->send_no_response = 1;
+		return 0;
+	}
+
+	if (smb_work->tcon->share->is_pipe == true) {
+		cifssrv_debug("IPC pipe read request\n");
+		return smb2_read_pipe(smb_work);
+	}
+
+	if (id == -1)
+		id = le64_to_cpu(req->VolatileFileId);
+
+	offset = le32_to_cpu(req->Offset);
+	length = le32_to_cpu(req->Length);
+
+	if (length > CIFS_DEFAULT_IOSIZE) {
+		cifssrv_debug("read size(%zu) exceeds max size(%u)\n",
+				length, CIFS_DEFAULT_IOSIZE);
+		cifssrv_debug("limiting read size to max size(%u)\n",
+				CIFS_DEFAULT_IOSIZE);
+		length = CIFS_DEFAULT_IOSIZE;
+	}
+
+	cifssrv_debug("fid %llu, offset %lld, len %zu\n", id, offset, length);
+	if (!smb_work->next_smb2_rcv_hdr_off && !req->hdr.NextCommand) {
+		smb_work->async_done = smb2_read_complete;
+		err = smb_vfs_read_async(smb_work, id,
+				le64_to_cpu(req->PersistentFileId), length,
+				offset, req->Flags & SMB2_READFLAG_READ_UNBUFFERED);
+		if (err == -EIOCBQUEUED)
+			return err;
+		smb_work->async_done = NULL;
+	}
+
+	nbytes = smb_vfs_read(smb_work->sess, id,
+			le64_to_cpu(req->PersistentFileId),
+			&smb_work->rdata_buf, length, &offset,
+			req->Flags & SMB2_READFLAG_READ_UNBUFFERED);
+	return smb2_read_complete(smb_work, nbytes);
+}
+
 /**
  * smb2_write_pipe() - handler for smb2 write on IPC pipe
  * @smb_work:	smb work containing write IPC pipe command buffer
@@ -5105,6 +5431,53 @@ out:
 	return err;
 }
 
+/**
+ * smb2_write_complete() - build smb2 write response from write result
+ * @smb_work:	smb work containing write command buffer
+ * @nbytes:	number of written bytes, or error
+ *
+ * Called inline for synchronous writes and from the completion work
+ * for writes submitted with smb_vfs_write_async().
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb2_write_complete(struct smb_work *smb_work, ssize_t nbytes)
+{
+	struct smb2_write_rsp *rsp, *rsp_org;
+	int err = nbytes;
+
+	rsp_org = (struct smb2_write_rsp *)smb_work->rsp_buf;
+	rsp = (struct smb2_write_rsp *)((char *)rsp_org +
+			smb_work->next_smb2_rsp_hdr_off);
+
+	if (nbytes >= 0) {
+		rsp->StructureSize = cpu_to_le16(17);
+		rsp->DataOffset = 0;
+		rsp->Reserved = 0;
+		rsp->DataLength = cpu_to_le32(nbytes);
+		rsp->DataRemaining = 0;
+		rsp->Reserved2 = 0;
+		inc_rfc1001_len(rsp_org, 16);
+		return 0;
+	}
+
+	if (err == -EAGAIN)
+		rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+	else if (err == -ENOSPC || err == -EFBIG)
+		rsp->hdr.Status = NT_STATUS_DISK_FULL;
+	else if (err == -ENOENT)
+		rsp->hdr.Status = NT_STATUS_FILE_CLOSED;
+	else if (err == -EACCES)
+		rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+	else if (err == -ESHARE)
+		rsp->hdr.Status = NT_STATUS_SHARING_VIOLATION;
+	else
+		rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+
+	smb2_set_err_rsp(smb_work);
+	return err;
+}
+
 /**
  * smb2_write() - handler for smb2 write from file
  * @smb_work:	smb work containing write command buffer
@@ -5114,24 +5487,20 @@ out:
 int smb2_write(struct smb_work *smb_work)
 {
 	struct smb2_write_req *req;
-	struct smb2_write_rsp *rsp, *rsp_org;
 	loff_t offset;
 	size_t length;
 	ssize_t nbytes;
 	char *data_buf;
 	bool writethrough = false;
+	bool unbuffered = false;
 	uint64_t id = -1;
 	int err = 0;
 
 	req = (struct smb2_write_req *)smb_work->buf;
-	rsp = (struct smb2_write_rsp *)smb_work->rsp_buf;
-	rsp_org = rsp;
 
 	if (smb_work->next_smb2_rcv_hdr_off) {
 		req = (struct smb2_write_req *)((char *)req +
 				smb_work->next_smb2_rcv_hdr_off);
-		rsp = (struct smb2_write_rsp *)((char *)rsp +
-				smb_work->next_smb2_rsp_hdr_off);
 		if (le64_to_cpu(req->VolatileFileId) == -1) {
 			cifssrv_debug("Compound request assigning stored FID  = %llu\n",
 				    smb_work->cur_local_fid);
@@ -5177,39 +5546,30 @@ int smb2_write(struct smb_work *smb_work)
 	cifssrv_debug("flags %u\n", le32_to_cpu(req->Flags));
 	if (le32_to_cpu(req->Flags) & SMB2_WRITEFLAG_WRITE_THROUGH)
 		writethrough = true;
+	if (le32_to_cpu(req->Flags) & SMB2_WRITEFLAG_WRITE_UNBUFFERED)
+		unbuffered = true;
 
 	cifssrv_debug("fid %llu, offset %lld, len %zu\n", id, offset, length);
+	if (!writethrough && !smb_work->next_smb2_rcv_hdr_off &&
+			!req->hdr.NextCommand) {
+		smb_work->async_done = smb2_write_complete;
+		err = smb_vfs_write_async(smb_work, id,
+			le64_to_cpu(req->PersistentFileId), data_buf, length,
+			offset, unbuffered);
+		if (err == -EIOCBQUEUED)
+			return err;
+		smb_work->async_done = NULL;
+	}
+
 	err = smb_vfs_write(smb_work->sess, id,
 		le64_to_cpu(req->PersistentFileId), data_buf, length, &offset,
-			writethrough, &nbytes);
+			writethrough, unbuffered, &nbytes);
 	if (err < 0)
 		goto out;
-
-	rsp->StructureSize = cpu_to_le16(17);
-	rsp->DataOffset = 0;
-	rsp->Reserved = 0;
-	rsp->DataLength = cpu_to_le32(nbytes);
-	rsp->DataRemaining = 0;
-	rsp->Reserved2 = 0;
-	inc_rfc1001_len(rsp_org, 16);
-	return 0;
+	err = nbytes;
 
 out:
-	if (err == -EAGAIN)
-		rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
-	else if (err == -ENOSPC || err == -EFBIG)
-		rsp->hdr.Status = NT_STATUS_DISK_FULL;
-	else if (err == -ENOENT)
-		rsp->hdr.Status = NT_STATUS_FILE_CLOSED;
-	else if (err == -EACCES)
-		rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
-	else if (err == -ESHARE)
-		rsp->hdr.Status = NT_STATUS_SHARING_VIOLATION;
-	else
-		rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
-
-	smb2_set_err_rsp(smb_work);
-	return err;
+	return smb2_write_complete(smb_work, err);
 }
 
 /**
@@ -5249,7 +5609,10 @@ int smb2_flush(struct smb_work *smb_work)
 
 out:
 	if (err) {
-		rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+		if (err == -EACCES)
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+		else
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
 		smb2_set_err_rsp(smb_work);
 	}
 
@@ -5477,6 +5840,126 @@ out:
 	return 0;
 }
 
+/**
+ * fsctl_copychunk() - copy chunks of a source file to the ioctl target
+ * @smb_work:	smb work containing ioctl command buffer
+ * @ci_req:	copychunk request
+ * @cnt_code:	FSCTL_SRV_COPYCHUNK or FSCTL_SRV_COPYCHUNK_WRITE
+ * @input_count:	size of @ci_req
+ * @id:		volatile id of target file
+ * @rsp:	ioctl response
+ *
+ * Status is set in @rsp. The copychunk response is filled in on success,
+ * when a limit was exceeded (then carrying the limits) and when a chunk
+ * failed (then carrying the progress made).
+ *
+ * Return:	size of the copychunk response or 0 if there is none
+ */
+static int fsctl_copychunk(struct smb_work *smb_work,
+	struct copychunk_ioctl_req *ci_req, unsigned int cnt_code,
+	unsigned int input_count, uint64_t id, struct smb2_ioctl_rsp *rsp)
+{
+	struct copychunk_ioctl_rsp *ci_rsp;
+	struct cifssrv_file *src_fp, *dst_fp;
+	struct srv_copychunk *chunks;
+	unsigned int i, chunk_count, chunk_count_written = 0;
+	unsigned int chunk_size_written = 0;
+	loff_t total_size_written = 0;
+	ssize_t copied;
+	int ret;
+
+	ci_rsp = (struct copychunk_ioctl_rsp *)&rsp->Buffer[0];
+
+	if (input_count < sizeof(struct copychunk_ioctl_req)) {
+		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+		return 0;
+	}
+
+	chunk_count = le32_to_cpu(ci_req->ChunkCount);
+	chunks = &ci_req->Chunks[0];
+	if (chunk_count > SMB2_COPYCHUNK_MAX_CHUNKS)
+		goto limits;
+
+	if (input_count < sizeof(struct copychunk_ioctl_req) +
+			chunk_count * sizeof(struct srv_copychunk)) {
+		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+		return 0;
+	}
+
+	for (i = 0; i < chunk_count; i++) {
+		if (!chunks[i].Length || le32_to_cpu(chunks[i].Length) >
+				SMB2_COPYCHUNK_MAX_CHUNK_SIZE)
+			goto limits;
+		total_size_written += le32_to_cpu(chunks[i].Length);
+	}
+	if (total_size_written > SMB2_COPYCHUNK_MAX_TOTAL_SIZE)
+		goto limits;
+	total_size_written = 0;
+
+	src_fp = get_id_from_fidtable(smb_work->sess,
+			le64_to_cpu(ci_req->SourceKey[0]));
+	if (!src_fp || src_fp->persistent_id !=
+			le64_to_cpu(ci_req->SourceKey[1])) {
+		rsp->hdr.Status = NT_STATUS_OBJECT_NAME_NOT_FOUND;
+		return 0;
+	}
+
+	dst_fp = get_id_from_fidtable(smb_work->sess, id);
+	if (!dst_fp) {
+		rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+		return 0;
+	}
+
+	/* plain copychunk also needs read access on the target */
+	if (!(src_fp->daccess & (FILE_READ_DATA_LE | FILE_GENERIC_READ_LE |
+			FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE)) ||
+		!(dst_fp->daccess & (FILE_WRITE_DATA_LE |
+			FILE_GENERIC_WRITE_LE | FILE_MAXIMAL_ACCESS_LE |
+			FILE_GENERIC_ALL_LE)) ||
+		(cnt_code == FSCTL_SRV_COPYCHUNK &&
+		 !(dst_fp->daccess & (FILE_READ_DATA_LE |
+			FILE_GENERIC_READ_LE | FILE_MAXIMAL_ACCESS_LE |
+			FILE_GENERIC_ALL_LE)))) {
+		rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+		return 0;
+	}
+
+	for (i = 0; i < chunk_count; i++) {
+		ret = smb_vfs_copy_file_range(smb_work->sess, src_fp,
+				le64_to_cpu(chunks[i].SourceOffset), dst_fp,
+				le64_to_cpu(chunks[i].TargetOffset),
+				le32_to_cpu(chunks[i].Length), &copied);
+		total_size_written += copied;
+		if (ret < 0) {
+			chunk_size_written = copied;
+			if (ret == -EAGAIN)
+				rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+			else if (ret == -ENODATA)
+				rsp->hdr.Status = NT_STATUS_INVALID_VIEW_SIZE;
+			else if (ret == -ENOSPC || ret == -EFBIG)
+				rsp->hdr.Status = NT_STATUS_DISK_FULL;
+			else if (ret == -EOPNOTSUPP)
+				rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
+			else
+				rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
+			break;
+		}
+		chunk_count_written++;
+	}
+
+	ci_rsp->ChunksWritten = cpu_to_le32(chunk_count_written);
+	ci_rsp->ChunkBytesWritten = cpu_to_le32(chunk_size_written);
+	ci_rsp->TotalBytesWritten = cpu_to_le32(total_size_written);
+	return sizeof(struct copychunk_ioctl_rsp);
+
+limits:
+	rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+	ci_rsp->ChunksWritten = cpu_to_le32(SMB2_COPYCHUNK_MAX_CHUNKS);
+	ci_rsp->ChunkBytesWritten = cpu_to_le32(SMB2_COPYCHUNK_MAX_CHUNK_SIZE);
+	ci_rsp->TotalBytesWritten = cpu_to_le32(SMB2_COPYCHUNK_MAX_TOTAL_SIZE);
+	return sizeof(struct copychunk_ioctl_rsp);
+}
+
 /**
  * smb2_ioctl() - handler for smb2 ioctl command
  * @smb_work:	smb work containing ioctl command buffer
@@ -5490,7 +5973,7 @@ int smb2_ioctl(struct smb_work *smb_work)
 	int cnt_code, nbytes = 0;
 	int out_buf_len;
 	char *data_buf;
-	uint64_t id = -1;
+	uint64_t id = -1, in_end;
 	int ret = 0;
 	struct tcp_server_info *server = smb_work->server;
 #ifdef CONFIG_CIFSSRV_NETLINK_INTERFACE
@@ -5523,6 +6006,21 @@ int smb2_ioctl(struct smb_work *smb_work)
 	if (id == -1)
 		id = le64_to_cpu(req->VolatileFileId);
 
+	/*
+	 * Input is read from Buffer whatever inputoffset says, both must lie
+	 * within the received PDU before any handler trusts inputcount.
+	 */
+	in_end = max_t(uint64_t, le32_to_cpu(req->inputoffset),
+			offsetof(struct smb2_ioctl_req, Buffer) - 4) +
+		le32_to_cpu(req->inputcount);
+	if (smb_work->next_smb2_rcv_hdr_off + in_end >
+			get_rfc1002_length(smb_work->buf)) {
+		cifssrv_err("ioctl input beyond request, count %u\n",
+			le32_to_cpu(req->inputcount));
+		rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+		goto out;
+	}
+
 	cnt_code = le32_to_cpu(req->CntCode);
 	out_buf_len = le32_to_cpu(req->maxoutputresp);
 #ifdef CONFIG_CIFSSRV_NETLINK_INTERFACE
@@ -5555,6 +6053,459 @@ int smb2_ioctl(struct smb_work *smb_work)
 
 		break;
 	}
+	case FSCTL_SRV_REQUEST_RESUME_KEY:
+	{
+		struct resume_key_ioctl_rsp *key_rsp;
+		struct cifssrv_file *fp;
+
+		if (out_buf_len < sizeof(struct resume_key_ioctl_rsp))
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		/* key is only resolved on this session, see fsctl_copychunk() */
+		key_rsp = (struct resume_key_ioctl_rsp *)&rsp->Buffer[0];
+		key_rsp->ResumeKey[0] = cpu_to_le64(id);
+		key_rsp->ResumeKey[1] = cpu_to_le64(fp->persistent_id);
+		key_rsp->ResumeKey[2] = 0;
+		key_rsp->ContextLength = 0;
+		nbytes = sizeof(struct resume_key_ioctl_rsp);
+
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	}
+	case FSCTL_SRV_COPYCHUNK:
+	case FSCTL_SRV_COPYCHUNK_WRITE:
+		if (out_buf_len < sizeof(struct copychunk_ioctl_rsp))
+			goto out;
+
+		nbytes = fsctl_copychunk(smb_work,
+				(struct copychunk_ioctl_req *)&req->Buffer[0],
+				cnt_code, le32_to_cpu(req->inputcount), id, rsp);
+		if (!nbytes)
+			goto out;
+
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	case FSCTL_SET_SPARSE:
+	{
+		struct file_sparse *sparse;
+		struct cifssrv_file *fp;
+		struct smb_meta meta;
+		__le32 old_fattr;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(fp->daccess & (FILE_WRITE_DATA_LE |
+				FILE_WRITE_ATTRIBUTES_LE |
+				FILE_GENERIC_WRITE_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		if (fp->is_stream ||
+				S_ISDIR(file_inode(fp->filp)->i_mode))
+			goto out;
+
+		sparse = (struct file_sparse *)&req->Buffer[0];
+		old_fattr = fp->fattr;
+		if (!le32_to_cpu(req->inputcount) || sparse->SetSparse)
+			fp->fattr |= FILE_ATTRIBUTE_SPARSE_FILE_LE;
+		else
+			fp->fattr &= ~FILE_ATTRIBUTE_SPARSE_FILE_LE;
+
+		if (fp->fattr == old_fattr)
+			break;
+
+		/* a file that is no longer sparse has no holes */
+		if (!(fp->fattr & FILE_ATTRIBUTE_SPARSE_FILE_LE)) {
+			/* filling holes writes data */
+			if (!(fp->daccess & (FILE_WRITE_DATA_LE |
+					FILE_GENERIC_WRITE_LE |
+					FILE_MAXIMAL_ACCESS_LE |
+					FILE_GENERIC_ALL_LE))) {
+				fp->fattr = old_fattr;
+				rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+				goto out;
+			}
+
+			ret = smb_vfs_fill_holes(fp->filp);
+			if (ret) {
+				fp->fattr = old_fattr;
+				if (ret == -EBADF || ret == -EACCES)
+					rsp->hdr.Status =
+						NT_STATUS_ACCESS_DENIED;
+				else
+					rsp->hdr.Status = NT_STATUS_DISK_FULL;
+				goto out;
+			}
+		}
+
+		smb_vfs_get_meta(&fp->filp->f_path, &meta);
+		meta.attr = fp->fattr;
+		meta.flags |= cpu_to_le16(SMB_META_ATTR);
+		ret = smb_vfs_set_meta(&fp->filp->f_path, &meta);
+		if (ret) {
+			fp->fattr = old_fattr;
+			rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
+			goto out;
+		}
+		break;
+	}
+	case FSCTL_SET_ZERO_DATA:
+	{
+		struct file_zero_data_information *zero_data;
+		struct cifssrv_file *fp;
+		loff_t off, bfz;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct file_zero_data_information))
+			goto out;
+
+		zero_data = (struct file_zero_data_information *)
+			&req->Buffer[0];
+		off = le64_to_cpu(zero_data->FileOffset);
+		bfz = le64_to_cpu(zero_data->BeyondFinalZero);
+		if (off < 0 || off > bfz)
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(fp->daccess & (FILE_WRITE_DATA_LE |
+				FILE_GENERIC_WRITE_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		ret = smb_vfs_zero_data(smb_work->sess, fp, off, bfz - off,
+			!!(fp->fattr & FILE_ATTRIBUTE_SPARSE_FILE_LE));
+		if (ret == -EAGAIN) {
+			rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+			goto out;
+		} else if (ret == -ENOSPC) {
+			rsp->hdr.Status = NT_STATUS_DISK_FULL;
+			goto out;
+		} else if (ret == -EOPNOTSUPP) {
+			rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
+			goto out;
+		} else if (ret) {
+			rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
+			goto out;
+		}
+		break;
+	}
+	case FSCTL_QUERY_ALLOCATED_RANGES:
+	{
+		struct file_allocated_range_buffer *qar_req, *qar_rsp;
+		struct cifssrv_file *fp;
+		int in_count, out_count;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct file_allocated_range_buffer))
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(fp->daccess & (FILE_READ_DATA_LE |
+				FILE_GENERIC_READ_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		in_count = min_t(int, out_buf_len, SMBMaxBufSize -
+				sizeof(struct smb2_ioctl_rsp)) /
+			sizeof(struct file_allocated_range_buffer);
+		if (!in_count) {
+			rsp->hdr.Status = NT_STATUS_BUFFER_TOO_SMALL;
+			goto out;
+		}
+
+		qar_req = (struct file_allocated_range_buffer *)
+			&req->Buffer[0];
+		qar_rsp = (struct file_allocated_range_buffer *)
+			&rsp->Buffer[0];
+		ret = smb_vfs_fqar_lseek(fp->filp,
+				le64_to_cpu(qar_req->file_offset),
+				le64_to_cpu(qar_req->length),
+				qar_rsp, in_count, &out_count);
+		if (ret == -E2BIG)
+			rsp->hdr.Status = NT_STATUS_BUFFER_OVERFLOW;
+		else if (ret < 0)
+			goto out;
+
+		nbytes = out_count *
+			sizeof(struct file_allocated_range_buffer);
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	}
+	case FSCTL_DUPLICATE_EXTENTS_TO_FILE:
+	{
+		struct duplicate_extents_to_file *dup_ext;
+		struct cifssrv_file *src_fp, *dst_fp;
+		loff_t src_off, dst_off, length;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct duplicate_extents_to_file))
+			goto out;
+
+		dup_ext = (struct duplicate_extents_to_file *)&req->Buffer[0];
+		src_fp = get_id_from_fidtable(smb_work->sess,
+				le64_to_cpu(dup_ext->VolatileFileHandle));
+		dst_fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!src_fp || src_fp->persistent_id !=
+				le64_to_cpu(dup_ext->PersistentFileHandle) ||
+				!dst_fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(src_fp->daccess & (FILE_READ_DATA_LE |
+				FILE_GENERIC_READ_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE)) ||
+			!(dst_fp->daccess & (FILE_WRITE_DATA_LE |
+				FILE_GENERIC_WRITE_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		src_off = le64_to_cpu(dup_ext->SourceFileOffset);
+		dst_off = le64_to_cpu(dup_ext->TargetFileOffset);
+		length = le64_to_cpu(dup_ext->ByteCount);
+		if (src_off < 0 || dst_off < 0 || length < 0) {
+			rsp->hdr.Status = NT_STATUS_INVALID_PARAMETER;
+			goto out;
+		}
+
+		ret = smb_vfs_clone_file_range(smb_work->sess, src_fp,
+				src_off, dst_fp, dst_off, length);
+		if (ret == -EOPNOTSUPP || ret == -ENOTTY) {
+			/* no reflink on this volume, client copies instead */
+			rsp->hdr.Status = NT_STATUS_INVALID_DEVICE_REQUEST;
+			goto out;
+		} else if (ret == -EXDEV) {
+			rsp->hdr.Status = NT_STATUS_NOT_SAME_DEVICE;
+			goto out;
+		} else if (ret == -EAGAIN) {
+			rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+			goto out;
+		} else if (ret == -ENOSPC || ret == -EFBIG) {
+			rsp->hdr.Status = NT_STATUS_DISK_FULL;
+			goto out;
+		} else if (ret) {
+			/* unaligned range or source range beyond EOF */
+			goto out;
+		}
+		break;
+	}
+	case FSCTL_OFFLOAD_READ:
+	{
+		struct offload_read_ioctl_req *odx_req;
+		struct offload_read_ioctl_rsp *odx_rsp;
+		struct cifssrv_file *fp;
+		loff_t xfer_len;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct offload_read_ioctl_req) ||
+			out_buf_len < sizeof(struct offload_read_ioctl_rsp))
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(fp->daccess & (FILE_READ_DATA_LE |
+				FILE_GENERIC_READ_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		odx_req = (struct offload_read_ioctl_req *)&req->Buffer[0];
+		odx_rsp = (struct offload_read_ioctl_rsp *)&rsp->Buffer[0];
+		ret = smb_vfs_offload_read(fp,
+				le64_to_cpu(odx_req->FileOffset),
+				le64_to_cpu(odx_req->CopyLength),
+				le32_to_cpu(odx_req->TokenTimeToLive),
+				&odx_rsp->Token, &xfer_len);
+		if (ret == -ENODATA) {
+			rsp->hdr.Status = NT_STATUS_END_OF_FILE;
+			goto out;
+		} else if (ret == -EBUSY || ret == -ENOMEM) {
+			rsp->hdr.Status = NT_STATUS_INSUFFICIENT_RESOURCES;
+			goto out;
+		} else if (ret == -EOPNOTSUPP) {
+			rsp->hdr.Status = NT_STATUS_NOT_SUPPORTED;
+			goto out;
+		} else if (ret) {
+			goto out;
+		}
+
+		odx_rsp->Size = cpu_to_le32(
+				sizeof(struct offload_read_ioctl_rsp));
+		odx_rsp->Flags = 0;
+		odx_rsp->TransferLength = cpu_to_le64(xfer_len);
+		nbytes = sizeof(struct offload_read_ioctl_rsp);
+
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	}
+	case FSCTL_OFFLOAD_WRITE:
+	{
+		struct offload_write_ioctl_req *odx_req;
+		struct offload_write_ioctl_rsp *odx_rsp;
+		struct cifssrv_file *fp;
+		loff_t written;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct offload_write_ioctl_req) ||
+			out_buf_len < sizeof(struct offload_write_ioctl_rsp))
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		if (!(fp->daccess & (FILE_WRITE_DATA_LE |
+				FILE_GENERIC_WRITE_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		odx_req = (struct offload_write_ioctl_req *)&req->Buffer[0];
+		odx_rsp = (struct offload_write_ioctl_rsp *)&rsp->Buffer[0];
+		ret = smb_vfs_offload_write(smb_work->sess, fp,
+				le64_to_cpu(odx_req->FileOffset),
+				le64_to_cpu(odx_req->CopyLength),
+				le64_to_cpu(odx_req->TransferOffset),
+				&odx_req->Token, &written);
+		if (ret == -ENOKEY) {
+			rsp->hdr.Status = NT_STATUS_INVALID_TOKEN;
+			goto out;
+		} else if (ret == -EINVAL) {
+			goto out;
+		} else if (ret && !written) {
+			if (ret == -EAGAIN)
+				rsp->hdr.Status = NT_STATUS_FILE_LOCK_CONFLICT;
+			else if (ret == -ENOSPC || ret == -EFBIG)
+				rsp->hdr.Status = NT_STATUS_DISK_FULL;
+			else
+				rsp->hdr.Status = NT_STATUS_UNEXPECTED_IO_ERROR;
+			goto out;
+		}
+
+		/* a partial write is reported as success with its length */
+		odx_rsp->Size = cpu_to_le32(
+				sizeof(struct offload_write_ioctl_rsp));
+		odx_rsp->Flags = 0;
+		odx_rsp->LengthWritten = cpu_to_le64(written);
+		nbytes = sizeof(struct offload_write_ioctl_rsp);
+
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	}
+	case FSCTL_SRV_READ_HASH:
+	{
+		struct srv_read_hash_req *hash_req;
+		struct srv_hash_retrieve_hash_based *hash_rsp;
+		struct cifssrv_file *fp;
+		unsigned int length;
+
+		if (le32_to_cpu(req->inputcount) <
+				sizeof(struct srv_read_hash_req) ||
+			out_buf_len <=
+				(int)sizeof(struct srv_hash_retrieve_hash_based))
+			goto out;
+
+		fp = get_id_from_fidtable(smb_work->sess, id);
+		if (!fp) {
+			rsp->hdr.Status = NT_STATUS_INVALID_HANDLE;
+			goto out;
+		}
+
+		/* only V1 is generated, V2 capable clients fall back to it */
+		hash_req = (struct srv_read_hash_req *)&req->Buffer[0];
+		if (!get_attr_branchcache(&fp->share->config.attr) ||
+			le32_to_cpu(hash_req->HashType) !=
+				SRV_HASH_TYPE_PEER_DIST ||
+			le32_to_cpu(hash_req->HashVersion) != SRV_HASH_VER_1) {
+			rsp->hdr.Status = NT_STATUS_HASH_NOT_SUPPORTED;
+			goto out;
+		}
+
+		if (le32_to_cpu(hash_req->HashRetrievalType) !=
+				SRV_HASH_RETRIEVE_HASH_BASED)
+			goto out;
+
+		if (!(fp->daccess & (FILE_READ_DATA_LE |
+				FILE_GENERIC_READ_LE |
+				FILE_MAXIMAL_ACCESS_LE |
+				FILE_GENERIC_ALL_LE))) {
+			rsp->hdr.Status = NT_STATUS_ACCESS_DENIED;
+			goto out;
+		}
+
+		hash_rsp = (struct srv_hash_retrieve_hash_based *)
+			&rsp->Buffer[0];
+		length = min_t(unsigned int, le32_to_cpu(hash_req->Length),
+			out_buf_len - sizeof(*hash_rsp));
+		ret = cifssrv_pcc_read_hash(fp, le64_to_cpu(hash_req->Offset),
+				length, hash_rsp->Buffer, &length);
+		if (ret == -EAGAIN || ret == -ENODATA) {
+			rsp->hdr.Status = NT_STATUS_HASH_NOT_PRESENT;
+			goto out;
+		} else if (ret == -EOPNOTSUPP) {
+			rsp->hdr.Status = NT_STATUS_HASH_NOT_SUPPORTED;
+			goto out;
+		} else if (ret) {
+			goto out;
+		}
+
+		hash_rsp->Offset = hash_req->Offset;
+		hash_rsp->BufferLength = cpu_to_le32(length);
+		hash_rsp->Reserved = 0;
+		nbytes = sizeof(struct srv_hash_retrieve_hash_based) + length;
+
+		rsp->PersistentFileId = req->PersistentFileId;
+		rsp->VolatileFileId = cpu_to_le64(id);
+		break;
+	}
 	case FSCTL_PIPE_TRANSCEIVE:
 		if (rsp->hdr.TreeId != 1) {
 			cifssrv_debug("Not Pipe transceive\n");
@@ -418,6 +418,12 @@ struct smb2_tree_disconnect_rsp {
 #define FILE_WRITE_RIGHTS_LE (FILE_WRITE_DATA_LE | FILE_APPEND_DATA_LE \
 			| FILE_WRITE_EA_LE | FILE_WRITE_ATTRIBUTES_LE)
 #define FILE_EXEC_RIGHTS_LE (FILE_EXECUTE_LE)
+/* opens with no other access take no part in share mode checks */
+#define FILE_ATTRIB_ONLY_LE (FILE_READ_ATTRIBUTES_LE \
+			| FILE_WRITE_ATTRIBUTES_LE | FILE_SYNCHRONIZE_LE \
+			| FILE_READ_CONTROL_LE)
+/* opens with no other access are served by an O_PATH file */
+#define FILE_LIGHT_OPEN_LE (FILE_ATTRIB_ONLY_LE | FILE_DELETE_LE)
 
 /* Impersonation Levels */
 #define IL_ANONYMOUS		cpu_to_le32(0x00000000)
@@ -596,11 +602,14 @@ struct smb2_flush_rsp {
 	__le16 Reserved;
 } __packed;
 
+/* Flags field in SMB2 READ request */
+#define SMB2_READFLAG_READ_UNBUFFERED 0x01
+
 struct smb2_read_req {
 	struct smb2_hdr hdr;
 	__le16 StructureSize; /* Must be 49 */
 	__u8   Padding; /* offset from start of SMB2 header to place read */
-	__u8   Reserved;
+	__u8   Flags; /* Reserved MBZ before SMB 3.02 */
 	__le32 Length;
 	__le64 Offset;
 	__u64  PersistentFileId; /* opaque endianness */
@@ -626,6 +635,7 @@ struct smb2_read_rsp {
 
 /* For write request Flags field below the following flag is defined: */
 #define SMB2_WRITEFLAG_WRITE_THROUGH 0x00000001
+#define SMB2_WRITEFLAG_WRITE_UNBUFFERED 0x00000002
 
 struct smb2_write_req {
 	struct smb2_hdr hdr;
@@ -746,6 +756,108 @@ struct file_object_buf_type1_ioctl_rsp {
 	__u8 DomainId[16];
 } __packed;
 
+struct file_sparse {
+	__u8 SetSparse; /* optional, TRUE when not present */
+} __packed;
+
+struct file_zero_data_information {
+	__le64 FileOffset;
+	__le64 BeyondFinalZero;
+} __packed;
+
+struct duplicate_extents_to_file {
+	__u64 PersistentFileHandle; /* source file handle, opaque endianness */
+	__u64 VolatileFileHandle;
+	__le64 SourceFileOffset;
+	__le64 TargetFileOffset;
+	__le64 ByteCount;  /* Bytes to be copied */
+} __packed;
+
+struct offload_read_ioctl_req {
+	__le32 Size;
+	__le32 Flags;
+	__le32 TokenTimeToLive; /* in milliseconds */
+	__le32 Reserved;
+	__le64 FileOffset;
+	__le64 CopyLength;
+} __packed;
+
+struct offload_read_ioctl_rsp {
+	__le32 Size;
+	__le32 Flags;
+	__le64 TransferLength;
+	struct storage_offload_token Token;
+} __packed;
+
+struct offload_write_ioctl_req {
+	__le32 Size;
+	__le32 Flags;
+	__le64 FileOffset;
+	__le64 CopyLength;
+	__le64 TransferOffset;
+	struct storage_offload_token Token;
+} __packed;
+
+struct offload_write_ioctl_rsp {
+	__le32 Size;
+	__le32 Flags;
+	__le64 LengthWritten;
+} __packed;
+
+/* FSCTL_SRV_READ_HASH, MS-SMB2 2.2.31.2 */
+#define SRV_HASH_TYPE_PEER_DIST		0x00000001
+#define SRV_HASH_VER_1			0x00000001
+#define SRV_HASH_VER_2			0x00000002
+#define SRV_HASH_RETRIEVE_HASH_BASED	0x00000001
+#define SRV_HASH_RETRIEVE_FILE_BASED	0x00000002
+
+struct srv_read_hash_req {
+	__le32 HashType;
+	__le32 HashVersion;
+	__le32 HashRetrievalType;
+	__le32 Length;
+	__le64 Offset;
+} __packed;
+
+struct srv_hash_retrieve_hash_based {
+	__le64 Offset;
+	__le32 BufferLength;
+	__le32 Reserved;
+	__u8 Buffer[0];
+} __packed;
+
+/* opaque key of a source file for copychunk, see smb2_ioctl() */
+struct resume_key_ioctl_rsp {
+	__u64 ResumeKey[3];
+	__le32 ContextLength;
+	__u8 Context[0]; /* ignored, Windows sets to 4 bytes of zero */
+} __packed;
+
+/* server side copy limits advertised to clients */
+#define SMB2_COPYCHUNK_MAX_CHUNKS	256
+#define SMB2_COPYCHUNK_MAX_CHUNK_SIZE	(1024 * 1024)
+#define SMB2_COPYCHUNK_MAX_TOTAL_SIZE	(16 * 1024 * 1024)
+
+struct srv_copychunk {
+	__le64 SourceOffset;
+	__le64 TargetOffset;
+	__le32 Length;
+	__le32 Reserved;
+} __packed;
+
+struct copychunk_ioctl_req {
+	__u64 SourceKey[3];
+	__le32 ChunkCount;
+	__le32 Reserved;
+	struct srv_copychunk Chunks[0];
+} __packed;
+
+struct copychunk_ioctl_rsp {
+	__le32 ChunksWritten;
+	__le32 ChunkBytesWritten;
+	__le32 TotalBytesWritten;
+} __packed;
+
 struct smb2_notify_req {
 	struct smb2_hdr hdr;
 	__le16 StructureSize; /* Must be 32 */
@@ -1122,6 +1234,10 @@ struct smb2_file_eof_info { /* encoding of request for level 10 */
 	__le64 EndOfFile; /* new end of file value */
 } __packed; /* level 20 Set */
 
+struct smb2_file_alloc_size_info {
+	__le64 AllocationSize; /* new allocation size value */
+} __packed; /* level 19 Set */
+
 struct smb2_file_ntwrk_info {
 	__le64 CreationTime;
 	__le64 LastAccessTime;
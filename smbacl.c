@@ -0,0 +1,803 @@
+/*
+ *   fs/cifssrv/smbacl.c
+ *
+ *   Copyright (C) 2015 Samsung Electronics Co., Ltd.
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#include <linux/posix_acl.h>
+#include <linux/posix_acl_xattr.h>
+#include <linux/sort.h>
+
+#include "glob.h"
+#include "export.h"
+#include "smbacl.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0)
+#define smb_acl_xattr_header	struct posix_acl_xattr_header
+#define smb_acl_xattr_entry	struct posix_acl_xattr_entry
+#else
+#define smb_acl_xattr_header	posix_acl_xattr_header
+#define smb_acl_xattr_entry	posix_acl_xattr_entry
+#endif
+
+/* security descriptor cache, see smb_acl_get_sd() */
+#define SMB_SD_HASH_BITS	8
+#define SMB_SD_MAX_ENTRIES	4096
+/* descriptors of files with larger POSIX ACLs are not cached */
+#define SMB_SD_CACHE_MAX	2048
+
+/**
+ * struct smb_sd_entry - security descriptor translated from an inode
+ * @node:	entry in smb_sd_cache
+ * @lru:	entry in smb_sd_lru, most recently used first
+ * @inode:	inode the descriptor is of, only compared as a key
+ * @stamp:	inode state the descriptor was made at
+ * @gen:	smb_sd_gen the descriptor was made under
+ * @len:	descriptor length
+ * @sd:		self-relative descriptor with owner, group and DACL
+ */
+struct smb_sd_entry {
+	struct hlist_node	node;
+	struct list_head	lru;
+	struct inode		*inode;
+	struct smb_attr_stamp	stamp;
+	unsigned int		gen;
+	int			len;
+	char			sd[0];
+};
+
+static DEFINE_HASHTABLE(smb_sd_cache, SMB_SD_HASH_BITS);
+static LIST_HEAD(smb_sd_lru);
+static DEFINE_SPINLOCK(smb_sd_lock);
+static int smb_sd_count;
+/* bumped by smb_acl_invalidate(), under smb_sd_lock */
+static unsigned int smb_sd_gen;
+
+/**
+ * struct smb_acl_id - permissions a DACL gives to one unix identity
+ * @tag:	ACL_USER_OBJ, ACL_USER, ACL_GROUP_OBJ, ACL_GROUP or ACL_OTHER
+ * @id:		uid or gid for ACL_USER and ACL_GROUP
+ * @allow:	permission bits of access allowed aces
+ * @deny:	permission bits of access denied aces
+ */
+struct smb_acl_id {
+	u16	tag;
+	u32	id;
+	u16	allow;
+	u16	deny;
+};
+
+static void smb_acl_unix_sid(struct smb_sid *sid, int type, u32 id)
+{
+	memset(sid, 0, 8);
+	sid->revision = SID_REVISION;
+	sid->num_subauth = 2;
+	sid->authority[5] = SID_UNIX_AUTHORITY;
+	sid->sub_auth[0] = cpu_to_le32(type);
+	sid->sub_auth[1] = cpu_to_le32(id);
+}
+
+/* S-1-1-0, everyone */
+static void smb_acl_world_sid(struct smb_sid *sid)
+{
+	memset(sid, 0, 8);
+	sid->revision = SID_REVISION;
+	sid->num_subauth = 1;
+	sid->authority[5] = 1;
+	sid->sub_auth[0] = 0;
+}
+
+static bool smb_acl_is_world(struct smb_sid *sid)
+{
+	struct smb_sid world;
+
+	smb_acl_world_sid(&world);
+	return !memcmp(sid, &world, SMB_SID_SIZE(&world));
+}
+
+/* get uid or gid of a S-1-22-1-uid or S-1-22-2-gid sid */
+static int smb_acl_sid_to_id(struct smb_sid *sid, int type, u32 *id)
+{
+	struct smb_sid unix_sid;
+
+	smb_acl_unix_sid(&unix_sid, type, 0);
+	if (memcmp(sid, &unix_sid, 12))
+		return -ENOENT;
+
+	*id = le32_to_cpu(sid->sub_auth[1]);
+	return 0;
+}
+
+/* check that a sid at @off lies within a descriptor of @len bytes */
+static struct smb_sid *smb_acl_get_sid(char *base, int len, u32 off)
+{
+	struct smb_sid *sid = (struct smb_sid *)(base + off);
+
+	if (off < sizeof(struct smb_ntsd) || off + 8 > len ||
+			sid->num_subauth > SID_MAX_SUB_AUTHORITIES ||
+			off + SMB_SID_SIZE(sid) > len)
+		return NULL;
+	return sid;
+}
+
+static u32 smb_acl_perm_to_access(int perm, bool is_dir)
+{
+	u32 access = 0;
+
+	if (perm & 4)
+		access |= SMB_ACE_READ;
+	if (perm & 2) {
+		access |= SMB_ACE_WRITE;
+		if (is_dir)
+			access |= SMB_ACE_DELETE_CHILD;
+	}
+	if (perm & 1)
+		access |= SMB_ACE_EXEC;
+	return access;
+}
+
+static int smb_acl_access_to_perm(u32 access)
+{
+	int perm = 0;
+
+	if (access & SMB_ACE_GENERIC_ALL)
+		return 7;
+	if (access & SMB_ACE_HAS_READ)
+		perm |= 4;
+	if (access & SMB_ACE_HAS_WRITE)
+		perm |= 2;
+	if (access & SMB_ACE_HAS_EXEC)
+		perm |= 1;
+	return perm;
+}
+
+/* append an ace at @p, return its size */
+static int smb_acl_add_ace(char *p, u8 type, u32 access, struct smb_sid *sid)
+{
+	struct smb_ace *ace = (struct smb_ace *)p;
+	int size = 8 + SMB_SID_SIZE(sid);
+
+	ace->type = type;
+	ace->flags = 0;
+	ace->size = cpu_to_le16(size);
+	ace->access_req = cpu_to_le32(access);
+	memcpy(&ace->sid, sid, SMB_SID_SIZE(sid));
+	return size;
+}
+
+/**
+ * smb_acl_build() - translate mode, owner and POSIX ACL of a file
+ * @dentry:	dentry of the file
+ *
+ * Owner and group become S-1-22-1-uid and S-1-22-2-gid, other
+ * becomes everyone. Named users and groups of the access ACL are
+ * given their permissions limited by the ACL mask.
+ *
+ * Return:	new cache entry holding the descriptor, or error pointer
+ */
+static struct smb_sd_entry *smb_acl_build(struct dentry *dentry)
+{
+	struct inode *inode = dentry->d_inode;
+	bool is_dir = S_ISDIR(inode->i_mode);
+	smb_acl_xattr_entry *pa = NULL;
+	struct smb_attr_stamp stamp;
+	struct smb_sd_entry *e;
+	struct smb_ntsd *pntsd;
+	struct smb_acl *dacl;
+	struct smb_sid sid;
+	char *xattr = NULL, *p;
+	int i, count = 0, named = 0, mask = 7, perm, len;
+	ssize_t xattr_len;
+
+	/* taken first, a change while reading makes the entry stale */
+	smb_vfs_attr_stamp(inode, &stamp);
+
+	if (IS_POSIXACL(inode)) {
+		xattr_len = smb_vfs_getxattr(dentry,
+				XATTR_NAME_POSIX_ACL_ACCESS, &xattr, 1);
+		if (xattr_len > (ssize_t)sizeof(smb_acl_xattr_header)) {
+			pa = (void *)(xattr + sizeof(smb_acl_xattr_header));
+			count = (xattr_len - sizeof(smb_acl_xattr_header)) /
+				sizeof(smb_acl_xattr_entry);
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		switch (le16_to_cpu(pa[i].e_tag)) {
+		case ACL_USER:
+		case ACL_GROUP:
+			named++;
+			break;
+		case ACL_MASK:
+			mask = le16_to_cpu(pa[i].e_perm) & 7;
+			break;
+		}
+	}
+
+	/* header, owner and group sids, DACL with 3 + named aces */
+	len = sizeof(struct smb_ntsd) + 2 * 16 + sizeof(struct smb_acl) +
+		2 * (8 + 16) + (8 + 12) + named * (8 + 16);
+	e = kzalloc(sizeof(struct smb_sd_entry) + len, GFP_KERNEL);
+	if (!e) {
+		kvfree(xattr);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	e->inode = inode;
+	e->stamp = stamp;
+	e->len = len;
+	pntsd = (struct smb_ntsd *)e->sd;
+	pntsd->revision = cpu_to_le16(SD_REVISION);
+	pntsd->type = cpu_to_le16(SD_SELF_RELATIVE | SD_DACL_PRESENT |
+			SD_DACL_PROTECTED);
+	p = e->sd + sizeof(struct smb_ntsd);
+
+	pntsd->osidoffset = cpu_to_le32(p - e->sd);
+	smb_acl_unix_sid((struct smb_sid *)p, SID_UNIX_USER,
+			from_kuid(&init_user_ns, inode->i_uid));
+	p += 16;
+	pntsd->gsidoffset = cpu_to_le32(p - e->sd);
+	smb_acl_unix_sid((struct smb_sid *)p, SID_UNIX_GROUP,
+			from_kgid(&init_user_ns, inode->i_gid));
+	p += 16;
+
+	pntsd->dacloffset = cpu_to_le32(p - e->sd);
+	dacl = (struct smb_acl *)p;
+	dacl->revision = cpu_to_le16(ACL_REVISION);
+	dacl->num_aces = cpu_to_le32(3 + named);
+	p += sizeof(struct smb_acl);
+
+	smb_acl_unix_sid(&sid, SID_UNIX_USER,
+			from_kuid(&init_user_ns, inode->i_uid));
+	p += smb_acl_add_ace(p, ACCESS_ALLOWED_ACE_TYPE, SMB_ACE_OWNER |
+			smb_acl_perm_to_access((inode->i_mode >> 6) & 7,
+				is_dir), &sid);
+
+	/* with a mask the group bits of mode are the mask, not the group */
+	perm = (inode->i_mode >> 3) & 7;
+	for (i = 0; i < count; i++) {
+		if (le16_to_cpu(pa[i].e_tag) == ACL_GROUP_OBJ)
+			perm = le16_to_cpu(pa[i].e_perm) & mask;
+	}
+	smb_acl_unix_sid(&sid, SID_UNIX_GROUP,
+			from_kgid(&init_user_ns, inode->i_gid));
+	p += smb_acl_add_ace(p, ACCESS_ALLOWED_ACE_TYPE,
+			smb_acl_perm_to_access(perm, is_dir), &sid);
+
+	for (i = 0; i < count; i++) {
+		switch (le16_to_cpu(pa[i].e_tag)) {
+		case ACL_USER:
+			smb_acl_unix_sid(&sid, SID_UNIX_USER,
+					le32_to_cpu(pa[i].e_id));
+			break;
+		case ACL_GROUP:
+			smb_acl_unix_sid(&sid, SID_UNIX_GROUP,
+					le32_to_cpu(pa[i].e_id));
+			break;
+		default:
+			continue;
+		}
+		perm = le16_to_cpu(pa[i].e_perm) & mask;
+		p += smb_acl_add_ace(p, ACCESS_ALLOWED_ACE_TYPE,
+				smb_acl_perm_to_access(perm, is_dir), &sid);
+	}
+
+	smb_acl_world_sid(&sid);
+	p += smb_acl_add_ace(p, ACCESS_ALLOWED_ACE_TYPE,
+			smb_acl_perm_to_access(inode->i_mode & 7, is_dir),
+			&sid);
+	dacl->size = cpu_to_le16(p - (char *)dacl);
+
+	kvfree(xattr);
+	return e;
+}
+
+/**
+ * smb_acl_copy() - copy requested parts of a full descriptor
+ * @full:	self-relative descriptor with owner, group and DACL
+ * @buf:	destination buffer
+ * @len:	destination buffer length
+ * @secinfo:	OWNER_SECINFO, GROUP_SECINFO and DACL_SECINFO bits
+ *
+ * Return:	length of the requested descriptor, nothing is copied if
+ *		it is larger than @len
+ */
+static int smb_acl_copy(struct smb_ntsd *full, char *buf, int len,
+	__u32 secinfo)
+{
+	struct smb_ntsd *pntsd = (struct smb_ntsd *)buf;
+	char *base = (char *)full;
+	struct smb_sid *osid, *gsid;
+	struct smb_acl *dacl;
+	int size = sizeof(struct smb_ntsd), off;
+
+	osid = (struct smb_sid *)(base + le32_to_cpu(full->osidoffset));
+	gsid = (struct smb_sid *)(base + le32_to_cpu(full->gsidoffset));
+	dacl = (struct smb_acl *)(base + le32_to_cpu(full->dacloffset));
+
+	if (secinfo & OWNER_SECINFO)
+		size += SMB_SID_SIZE(osid);
+	if (secinfo & GROUP_SECINFO)
+		size += SMB_SID_SIZE(gsid);
+	if (secinfo & DACL_SECINFO)
+		size += le16_to_cpu(dacl->size);
+	if (size > len)
+		return size;
+
+	memset(pntsd, 0, sizeof(struct smb_ntsd));
+	pntsd->revision = cpu_to_le16(SD_REVISION);
+	pntsd->type = cpu_to_le16(SD_SELF_RELATIVE);
+	off = sizeof(struct smb_ntsd);
+
+	if (secinfo & OWNER_SECINFO) {
+		memcpy(buf + off, osid, SMB_SID_SIZE(osid));
+		pntsd->osidoffset = cpu_to_le32(off);
+		off += SMB_SID_SIZE(osid);
+	}
+
+	if (secinfo & GROUP_SECINFO) {
+		memcpy(buf + off, gsid, SMB_SID_SIZE(gsid));
+		pntsd->gsidoffset = cpu_to_le32(off);
+		off += SMB_SID_SIZE(gsid);
+	}
+
+	if (secinfo & DACL_SECINFO) {
+		memcpy(buf + off, dacl, le16_to_cpu(dacl->size));
+		pntsd->dacloffset = cpu_to_le32(off);
+		pntsd->type = full->type;
+	}
+	return size;
+}
+
+/* called with smb_sd_lock held, returns a still valid entry */
+static struct smb_sd_entry *smb_sd_lookup(struct inode *inode)
+{
+	struct smb_attr_stamp stamp;
+	struct smb_sd_entry *e;
+
+	hash_for_each_possible(smb_sd_cache, e, node, (unsigned long)inode) {
+		if (e->inode != inode)
+			continue;
+
+		smb_vfs_attr_stamp(inode, &stamp);
+		if (!smb_vfs_attr_stamp_equal(&e->stamp, &stamp))
+			return NULL;
+		list_move(&e->lru, &smb_sd_lru);
+		return e;
+	}
+	return NULL;
+}
+
+/* called with smb_sd_lock held */
+static struct smb_sd_entry *smb_sd_unhash(struct inode *inode)
+{
+	struct smb_sd_entry *e;
+
+	hash_for_each_possible(smb_sd_cache, e, node, (unsigned long)inode) {
+		if (e->inode == inode) {
+			hash_del(&e->node);
+			list_del(&e->lru);
+			smb_sd_count--;
+			return e;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * replace cached descriptor of an inode, evicting least recently used.
+ * A descriptor made before an invalidation may predate it and is dropped.
+ */
+static void smb_sd_insert(struct smb_sd_entry *new)
+{
+	struct smb_sd_entry *old;
+
+	spin_lock(&smb_sd_lock);
+	if (new->gen != smb_sd_gen) {
+		spin_unlock(&smb_sd_lock);
+		kfree(new);
+		return;
+	}
+
+	old = smb_sd_unhash(new->inode);
+	if (!old && smb_sd_count >= SMB_SD_MAX_ENTRIES) {
+		old = list_last_entry(&smb_sd_lru, struct smb_sd_entry, lru);
+		hash_del(&old->node);
+		list_del(&old->lru);
+		smb_sd_count--;
+	}
+	hash_add(smb_sd_cache, &new->node, (unsigned long)new->inode);
+	list_add(&new->lru, &smb_sd_lru);
+	smb_sd_count++;
+	spin_unlock(&smb_sd_lock);
+	kfree(old);
+}
+
+/**
+ * smb_acl_get_sd() - get security descriptor of a file
+ * @dentry:	dentry of the file
+ * @buf:	buffer to copy self-relative descriptor to
+ * @len:	buffer length
+ * @secinfo:	requested parts of the descriptor
+ *
+ * Tools copying permissions of whole trees query every file, and
+ * Explorer queries the same ones repeatedly. Translated descriptors
+ * are cached per inode and revalidated against the inode change time
+ * and version, which chmod, chown and ACL changes all update.
+ *
+ * Return:	descriptor length, larger than @len if it did not fit,
+ *		otherwise error
+ */
+int smb_acl_get_sd(struct dentry *dentry, char *buf, int len, __u32 secinfo)
+{
+	struct inode *inode = dentry->d_inode;
+	struct smb_sd_entry *e;
+	unsigned int gen;
+	int ret = 0;
+
+	spin_lock(&smb_sd_lock);
+	e = smb_sd_lookup(inode);
+	if (e)
+		ret = smb_acl_copy((struct smb_ntsd *)e->sd, buf, len,
+				secinfo);
+	gen = smb_sd_gen;
+	spin_unlock(&smb_sd_lock);
+	if (e) {
+		atomic_long_inc(&cifssrv_sd_hits);
+		return ret;
+	}
+	atomic_long_inc(&cifssrv_sd_misses);
+
+	e = smb_acl_build(dentry);
+	if (IS_ERR(e))
+		return PTR_ERR(e);
+
+	ret = smb_acl_copy((struct smb_ntsd *)e->sd, buf, len, secinfo);
+	e->gen = gen;
+	if (e->len > SMB_SD_CACHE_MAX)
+		kfree(e);
+	else
+		smb_sd_insert(e);
+	return ret;
+}
+
+/* find or add the entry of an identity in a DACL being parsed */
+static struct smb_acl_id *smb_acl_find_id(struct smb_acl_id *ids,
+	int *count, u16 tag, u32 id)
+{
+	int i;
+
+	for (i = 0; i < *count; i++) {
+		if (ids[i].tag == tag && ids[i].id == id)
+			return &ids[i];
+	}
+
+	ids[i].tag = tag;
+	ids[i].id = id;
+	(*count)++;
+	return &ids[i];
+}
+
+static int smb_acl_id_cmp(const void *a, const void *b)
+{
+	const struct smb_acl_id *ia = a, *ib = b;
+
+	/* ACL_USER_OBJ, ACL_USER, ACL_GROUP_OBJ, ACL_GROUP, ACL_OTHER */
+	if (ia->tag != ib->tag)
+		return ia->tag < ib->tag ? -1 : 1;
+	if (ia->id != ib->id)
+		return ia->id < ib->id ? -1 : 1;
+	return 0;
+}
+
+static int smb_acl_id_perm(struct smb_acl_id *ids, int count, u16 tag)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ids[i].tag == tag)
+			return ids[i].allow & ~ids[i].deny;
+	}
+	return 0;
+}
+
+/**
+ * smb_acl_parse_dacl() - translate a DACL to mode and POSIX ACL
+ * @pntsd:	security descriptor
+ * @len:	descriptor length
+ * @uid:	owner the DACL is applied with
+ * @gid:	group the DACL is applied with
+ * @mode:	permission bits for the file
+ * @xattr:	POSIX ACL xattr if named users or groups are given, to be
+ *		freed by caller
+ * @xattr_len:	length of @xattr
+ *
+ * Aces of sids with no unix identity and inherit only aces have no
+ * POSIX equivalent and are skipped. A missing DACL grants everything,
+ * an empty one nothing.
+ *
+ * Return:	0 on success, -ENODATA if the DACL has aces but none of
+ *		them maps to a unix identity, otherwise error
+ */
+static int smb_acl_parse_dacl(struct smb_ntsd *pntsd, int len, u32 uid,
+	u32 gid, umode_t *mode, char **xattr, int *xattr_len)
+{
+	char *base = (char *)pntsd;
+	u32 off = le32_to_cpu(pntsd->dacloffset), id, acl_size, end;
+	smb_acl_xattr_entry *pa;
+	struct smb_acl_id *ids, *ent;
+	struct smb_acl *dacl;
+	struct smb_ace *ace;
+	int i, count = 0, num_aces, named, perm, ace_size, mask = 0;
+	int mapped = 0;
+	u16 tag;
+
+	*xattr = NULL;
+	if (!(le16_to_cpu(pntsd->type) & SD_DACL_PRESENT) || !off) {
+		*mode = 0777;
+		return 0;
+	}
+
+	if (off < sizeof(struct smb_ntsd) ||
+			off + sizeof(struct smb_acl) > len)
+		return -EINVAL;
+
+	dacl = (struct smb_acl *)(base + off);
+	acl_size = le16_to_cpu(dacl->size);
+	num_aces = le32_to_cpu(dacl->num_aces);
+	if (acl_size < sizeof(struct smb_acl) || off + acl_size > len ||
+			num_aces > (acl_size - sizeof(struct smb_acl)) / 16)
+		return -EINVAL;
+
+	/* owner, group and other are always there */
+	ids = kcalloc(num_aces + 3, sizeof(struct smb_acl_id), GFP_KERNEL);
+	if (!ids)
+		return -ENOMEM;
+	smb_acl_find_id(ids, &count, ACL_USER_OBJ, 0);
+	smb_acl_find_id(ids, &count, ACL_GROUP_OBJ, 0);
+	smb_acl_find_id(ids, &count, ACL_OTHER, 0);
+
+	end = off + acl_size;
+	off += sizeof(struct smb_acl);
+	for (i = 0; i < num_aces; i++, off += ace_size) {
+		ace = (struct smb_ace *)(base + off);
+		if (off + 16 > end)
+			goto out_inval;
+		ace_size = le16_to_cpu(ace->size);
+		if (ace_size < 16 || off + ace_size > end ||
+				8 + SMB_SID_SIZE(&ace->sid) > ace_size)
+			goto out_inval;
+
+		if (ace->flags & INHERIT_ONLY_ACE ||
+				(ace->type != ACCESS_ALLOWED_ACE_TYPE &&
+				 ace->type != ACCESS_DENIED_ACE_TYPE))
+			continue;
+
+		if (!smb_acl_sid_to_id(&ace->sid, SID_UNIX_USER, &id))
+			tag = id == uid ? ACL_USER_OBJ : ACL_USER;
+		else if (!smb_acl_sid_to_id(&ace->sid, SID_UNIX_GROUP, &id))
+			tag = id == gid ? ACL_GROUP_OBJ : ACL_GROUP;
+		else if (smb_acl_is_world(&ace->sid))
+			tag = ACL_OTHER;
+		else
+			continue;
+
+		if (tag != ACL_USER && tag != ACL_GROUP)
+			id = 0;
+		ent = smb_acl_find_id(ids, &count, tag, id);
+		perm = smb_acl_access_to_perm(le32_to_cpu(ace->access_req));
+		if (ace->type == ACCESS_ALLOWED_ACE_TYPE)
+			ent->allow |= perm;
+		else
+			ent->deny |= perm;
+		mapped++;
+	}
+
+	/* e.g. domain sids only, mode 000 would lock everyone out */
+	if (num_aces && !mapped) {
+		kfree(ids);
+		return -ENODATA;
+	}
+
+	named = count - 3;
+	*mode = smb_acl_id_perm(ids, count, ACL_USER_OBJ) << 6 |
+		smb_acl_id_perm(ids, count, ACL_GROUP_OBJ) << 3 |
+		smb_acl_id_perm(ids, count, ACL_OTHER);
+	if (!named) {
+		kfree(ids);
+		return 0;
+	}
+
+	sort(ids, count, sizeof(struct smb_acl_id), smb_acl_id_cmp, NULL);
+
+	/* entries plus ACL_MASK */
+	*xattr_len = posix_acl_xattr_size(count + 1);
+	*xattr = kzalloc(*xattr_len, GFP_KERNEL);
+	if (!*xattr) {
+		kfree(ids);
+		return -ENOMEM;
+	}
+
+	((smb_acl_xattr_header *)*xattr)->a_version =
+		cpu_to_le32(POSIX_ACL_XATTR_VERSION);
+	pa = (void *)(*xattr + sizeof(smb_acl_xattr_header));
+	for (i = 0; i < count; i++, pa++) {
+		perm = ids[i].allow & ~ids[i].deny;
+		if (ids[i].tag == ACL_OTHER) {
+			/* mask goes right before other */
+			pa->e_tag = cpu_to_le16(ACL_MASK);
+			pa->e_perm = cpu_to_le16(mask);
+			pa->e_id = cpu_to_le32(ACL_UNDEFINED_ID);
+			pa++;
+		} else if (ids[i].tag != ACL_USER_OBJ)
+			mask |= perm;
+
+		pa->e_tag = cpu_to_le16(ids[i].tag);
+		pa->e_perm = cpu_to_le16(perm);
+		pa->e_id = cpu_to_le32(ids[i].tag == ACL_USER ||
+				ids[i].tag == ACL_GROUP ? ids[i].id :
+				ACL_UNDEFINED_ID);
+	}
+
+	/* group bits of mode follow the mask when there is one */
+	*mode = (*mode & ~0070) | mask << 3;
+	kfree(ids);
+	return 0;
+
+out_inval:
+	kfree(ids);
+	return -EINVAL;
+}
+
+/**
+ * smb_acl_set_sd() - apply security descriptor to an open file
+ * @sess:	session the file was opened on
+ * @fid:	file id of open file
+ * @pntsd:	self-relative security descriptor
+ * @len:	descriptor length
+ * @secinfo:	parts of the descriptor to apply
+ *
+ * Owner and group are changed when they are unix sids, others have
+ * no uid or gid to map to and are left alone. The DACL sets mode and,
+ * where named users or groups are given, the POSIX access ACL. A DACL
+ * of which no ace maps to a unix identity is left alone as well.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_acl_set_sd(struct cifssrv_sess *sess, uint64_t fid,
+	struct smb_ntsd *pntsd, int len, __u32 secinfo)
+{
+	struct cifssrv_file *fp;
+	struct dentry *dentry;
+	struct inode *inode;
+	struct smb_sid *sid;
+	struct iattr attrs;
+	char *xattr = NULL;
+	int xattr_len = 0, err;
+	umode_t mode;
+	u32 uid, gid;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp)
+		return -ENOENT;
+
+	if (len < sizeof(struct smb_ntsd))
+		return -EINVAL;
+
+	dentry = fp->filp->f_path.dentry;
+	inode = dentry->d_inode;
+	uid = from_kuid(&init_user_ns, inode->i_uid);
+	gid = from_kgid(&init_user_ns, inode->i_gid);
+	attrs.ia_valid = 0;
+
+	if (secinfo & OWNER_SECINFO && pntsd->osidoffset) {
+		sid = smb_acl_get_sid((char *)pntsd, len,
+				le32_to_cpu(pntsd->osidoffset));
+		if (!sid)
+			return -EINVAL;
+		if (!smb_acl_sid_to_id(sid, SID_UNIX_USER, &uid)) {
+			attrs.ia_uid = make_kuid(&init_user_ns, uid);
+			attrs.ia_valid |= ATTR_UID;
+		} else
+			cifssrv_debug("owner sid has no uid, ignored\n");
+	}
+
+	if (secinfo & GROUP_SECINFO && pntsd->gsidoffset) {
+		sid = smb_acl_get_sid((char *)pntsd, len,
+				le32_to_cpu(pntsd->gsidoffset));
+		if (!sid)
+			return -EINVAL;
+		if (!smb_acl_sid_to_id(sid, SID_UNIX_GROUP, &gid)) {
+			attrs.ia_gid = make_kgid(&init_user_ns, gid);
+			attrs.ia_valid |= ATTR_GID;
+		} else
+			cifssrv_debug("group sid has no gid, ignored\n");
+	}
+
+	if (secinfo & DACL_SECINFO) {
+		err = smb_acl_parse_dacl(pntsd, len, uid, gid, &mode, &xattr,
+				&xattr_len);
+		if (err == -ENODATA) {
+			cifssrv_debug("no ace has a unix identity, dacl ignored\n");
+			secinfo &= ~DACL_SECINFO;
+		} else if (err) {
+			return err;
+		} else {
+			attrs.ia_mode = (inode->i_mode & ~S_IRWXUGO) | mode;
+			attrs.ia_valid |= ATTR_MODE;
+		}
+	}
+
+	err = smb_vfs_setattr(sess, NULL, fid, &attrs);
+	if (err)
+		goto out;
+
+	if (secinfo & DACL_SECINFO && IS_POSIXACL(inode)) {
+		if (xattr)
+			err = smb_vfs_setxattr(NULL, &fp->filp->f_path,
+					XATTR_NAME_POSIX_ACL_ACCESS, xattr,
+					xattr_len, 0);
+		else {
+			err = vfs_removexattr(dentry,
+					XATTR_NAME_POSIX_ACL_ACCESS);
+			if (err == -ENODATA || err == -EOPNOTSUPP)
+				err = 0;
+		}
+	}
+
+out:
+	smb_acl_invalidate(inode);
+	kfree(xattr);
+	return err;
+}
+
+/**
+ * smb_acl_invalidate() - drop cached security descriptor of an inode
+ * @inode:	inode whose owner, mode or ACL changed
+ *
+ * Change time has a coarse granularity on some file systems, so such
+ * changes made by cifssrv drop the entry instead of relying on it, and
+ * bump the generation so that a descriptor made before is not inserted.
+ */
+void smb_acl_invalidate(struct inode *inode)
+{
+	struct smb_sd_entry *e;
+
+	spin_lock(&smb_sd_lock);
+	smb_sd_gen++;
+	e = smb_sd_unhash(inode);
+	spin_unlock(&smb_sd_lock);
+	kfree(e);
+}
+
+/**
+ * smb_acl_exit() - free security descriptor cache
+ */
+void smb_acl_exit(void)
+{
+	struct smb_sd_entry *e, *tmp;
+
+	spin_lock(&smb_sd_lock);
+	list_for_each_entry_safe(e, tmp, &smb_sd_lru, lru) {
+		hash_del(&e->node);
+		list_del(&e->lru);
+		kfree(e);
+	}
+	smb_sd_count = 0;
+	spin_unlock(&smb_sd_lock);
+}
@@ -0,0 +1,105 @@
+/*
+ *   fs/cifssrv/smbacl.h
+ *
+ *   Copyright (C) 2015 Samsung Electronics Co., Ltd.
+ *   Copyright (C) 2016 Namjae Jeon <namjae.jeon@protocolfreedom.org>
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
+ */
+
+#ifndef __CIFSSRV_SMBACL_H
+#define __CIFSSRV_SMBACL_H
+
+/* security information in AdditionalInformation, MS-DTYP 2.4.7 */
+#define OWNER_SECINFO		0x00000001
+#define GROUP_SECINFO		0x00000002
+#define DACL_SECINFO		0x00000004
+#define SACL_SECINFO		0x00000008
+
+/* security descriptor control, MS-DTYP 2.4.6 */
+#define SD_DACL_PRESENT		0x0004
+#define SD_DACL_PROTECTED	0x1000
+#define SD_SELF_RELATIVE	0x8000
+
+#define SD_REVISION		1
+#define SID_REVISION		1
+#define ACL_REVISION		2
+#define SID_MAX_SUB_AUTHORITIES	15
+
+#define ACCESS_ALLOWED_ACE_TYPE	0x00
+#define ACCESS_DENIED_ACE_TYPE	0x01
+
+/* ace flags */
+#define INHERIT_ONLY_ACE	0x08
+
+/* access rights made of one unix permission bit, MS-SMB2 2.2.13.1 */
+#define SMB_ACE_READ		0x00120089
+#define SMB_ACE_WRITE		0x00120116
+#define SMB_ACE_EXEC		0x001200A0
+/* rights of the owner on top of its permission bits */
+#define SMB_ACE_OWNER		0x000D0000
+#define SMB_ACE_DELETE_CHILD	0x00000040
+
+/* rights that grant a unix permission bit when set in an ace */
+#define SMB_ACE_HAS_READ	0x80000001
+#define SMB_ACE_HAS_WRITE	0x40000006
+#define SMB_ACE_HAS_EXEC	0x20000020
+#define SMB_ACE_GENERIC_ALL	0x10000000
+
+/* sid authority of unix users and groups, S-1-22-1-uid and S-1-22-2-gid */
+#define SID_UNIX_AUTHORITY	22
+#define SID_UNIX_USER		1
+#define SID_UNIX_GROUP		2
+
+struct smb_sid {
+	__u8 revision;
+	__u8 num_subauth;
+	__u8 authority[6];
+	__le32 sub_auth[SID_MAX_SUB_AUTHORITIES];
+} __packed;
+
+/* size of a sid without its unused sub authorities */
+#define SMB_SID_SIZE(sid)	(8 + 4 * (sid)->num_subauth)
+
+struct smb_ntsd {
+	__le16 revision;
+	__le16 type;
+	__le32 osidoffset;
+	__le32 gsidoffset;
+	__le32 sacloffset;
+	__le32 dacloffset;
+} __packed;
+
+struct smb_acl {
+	__le16 revision;
+	__le16 size;
+	__le32 num_aces;
+} __packed;
+
+struct smb_ace {
+	__u8 type;
+	__u8 flags;
+	__le16 size;
+	__le32 access_req;
+	struct smb_sid sid;
+} __packed;
+
+int smb_acl_get_sd(struct dentry *dentry, char *buf, int len, __u32 secinfo);
+int smb_acl_set_sd(struct cifssrv_sess *sess, uint64_t fid,
+	struct smb_ntsd *pntsd, int len, __u32 secinfo);
+void smb_acl_invalidate(struct inode *inode);
+void smb_acl_exit(void);
+
+#endif /* __CIFSSRV_SMBACL_H */
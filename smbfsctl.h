@@ -86,6 +86,13 @@
 #define FSCTL_LMR_SET_LINK_TRACK_INF 0x001400EC /* BB add struct */
 #define FSCTL_VALIDATE_NEGOTIATE_INFO 0x00140204
 #define FSCTL_QUERY_NETWORK_INTERFACE_INFO 0x001401FC
+#define FSCTL_SRV_REQUEST_RESUME_KEY 0x00140078
+#define FSCTL_SRV_COPYCHUNK          0x001440F2
+#define FSCTL_SRV_COPYCHUNK_WRITE    0x001480F2
+#define FSCTL_DUPLICATE_EXTENTS_TO_FILE 0x00098344
+#define FSCTL_OFFLOAD_READ           0x00094264
+#define FSCTL_OFFLOAD_WRITE          0x00098268
+#define FSCTL_SRV_READ_HASH          0x001441BB
 
 #define IO_REPARSE_TAG_MOUNT_POINT   0xA0000003
 #define IO_REPARSE_TAG_HSM           0xC0000004
@@ -25,8 +25,10 @@
 #include "smb1pdu.h"
 #ifdef CONFIG_CIFS_SMB2_SERVER
 #include "smb2pdu.h"
+#include "branchcache.h"
 #endif
 #include "oplock.h"
+#include "smbacl.h"
 
 bool global_signing;
 unsigned long server_start_time;
@@ -65,6 +67,34 @@ struct hlist_head global_name_table[1024];
 /* Default: allocation roundup size = 1048576, to disable set 0 in config */
 unsigned int alloc_roundup_size = 1048576;
 
+/* Default: no per session memory cap, set "max session memory" in config */
+unsigned long cifssrv_sess_max_mem;
+
+/* memory held by durable handle state in global fid table */
+atomic_long_t cifssrv_durable_mem = ATOMIC_LONG_INIT(0);
+
+/* attribute cache lookups served from cache or from xattrs */
+atomic_long_t cifssrv_attr_hits = ATOMIC_LONG_INIT(0);
+atomic_long_t cifssrv_attr_misses = ATOMIC_LONG_INIT(0);
+
+/* security descriptor lookups served from cache or translated */
+atomic_long_t cifssrv_sd_hits = ATOMIC_LONG_INIT(0);
+atomic_long_t cifssrv_sd_misses = ATOMIC_LONG_INIT(0);
+
+/* caseless lookup misses answered by negative cache or by a dir search */
+atomic_long_t cifssrv_neg_hits = ATOMIC_LONG_INIT(0);
+atomic_long_t cifssrv_neg_misses = ATOMIC_LONG_INIT(0);
+
+/* caseless matches served by a folded name index or by a dir scan */
+atomic_long_t cifssrv_casefold_hits = ATOMIC_LONG_INIT(0);
+atomic_long_t cifssrv_casefold_scans = ATOMIC_LONG_INIT(0);
+
+/* opens served by an O_PATH file, see smb2_open() */
+atomic_long_t cifssrv_light_opens = ATOMIC_LONG_INIT(0);
+
+/* opens of a file found by its file id, see smb_vfs_open_by_id() */
+atomic_long_t cifssrv_open_by_id = ATOMIC_LONG_INIT(0);
+
 /**
  * cifssrv_buf_get() - get large response buffer
  *
@@ -269,6 +299,19 @@ out:
 	return 0;
 }
 
+/**
+ * cifssrv_charge_work_mem() - account memory held by a work item
+ * @work:	smb work holding the memory
+ * @size:	number of bytes to charge
+ *
+ * Charged memory is released when the work item is freed.
+ */
+void cifssrv_charge_work_mem(struct smb_work *work, size_t size)
+{
+	work->mem_charged += size;
+	atomic_long_add(size, &work->server->stats.mem_used);
+}
+
 /**
  * queue_dynamic_work_helper() - helper function to queue smb request
  *		work to worker thread
@@ -293,15 +336,19 @@ void queue_dynamic_work_helper(struct tcp_server_info *server)
 		work->buf = server->wbuf;
 		work->req_wbuf = 1;
 		server->wbuf = NULL;
+		cifssrv_charge_work_mem(work, CIFS_DEFAULT_IOSIZE);
 	} else if (server->large_buf) {
 		work->buf = server->bigbuf;
 		work->large_buf = 1;
 		server->large_buf = false;
 		server->bigbuf = NULL;
+		cifssrv_charge_work_mem(work, SMBMaxBufSize);
 	} else {
 		work->buf = server->smallbuf;
 		server->smallbuf = NULL;
+		cifssrv_charge_work_mem(work, MAX_CIFS_SMALL_BUFFER_SIZE);
 	}
+	cifssrv_charge_work_mem(work, sizeof(struct smb_work));
 
 	if (add_request_to_queue(work)) {
 		spin_lock(&server->request_lock);
@@ -383,9 +430,129 @@ static void free_workitem_buffers(struct smb_work *smb_work)
 
 	if (smb_work->rdata_buf)
 		kvfree(smb_work->rdata_buf);
+	atomic_long_sub(smb_work->mem_charged,
+			&smb_work->server->stats.mem_used);
 	kmem_cache_free(cifssrv_work_cache, smb_work);
 }
 
+/**
+ * smb_prepare_rsp() - set credits and sign response of a work item
+ * @smb_work:	smb work containing response buffer
+ * @command:	smb command code of the request
+ */
+static void smb_prepare_rsp(struct smb_work *smb_work, unsigned int command)
+{
+	struct tcp_server_info *server = smb_work->server;
+
+	/* call set_rsp_credits() function to set number of credits granted in
+	 * hdr of smb2 response.
+	 */
+	if (is_smb2_rsp(smb_work))
+		server->ops->set_rsp_credits(smb_work);
+
+	if (server->dialect == SMB311_PROT_ID)
+		smb3_preauth_hash_rsp(smb_work);
+
+	if (smb_work->sess && smb_work->sess->sign &&
+		server->ops->is_sign_req &&
+		server->ops->is_sign_req(smb_work, command))
+		server->ops->set_sign_rsp(smb_work);
+}
+
+/**
+ * smb_finish_work() - free a processed work item and drop its references
+ * @smb_work:	smb work item
+ *
+ * Called with server->srv_mutex held, which is released here.
+ */
+static void smb_finish_work(struct smb_work *smb_work)
+{
+	struct tcp_server_info *server = smb_work->server;
+	long int start_time = smb_work->when_alloc;
+	long int end_time = 0, time_elapsed = 0;
+
+	/* free buffers */
+	free_workitem_buffers(smb_work);
+
+	if (cifssrv_debug_enable) {
+		end_time = jiffies;
+
+		time_elapsed = end_time - start_time;
+		server->stats.avg_req_duration =
+				(server->stats.avg_req_duration *
+					server->stats.request_served +
+					time_elapsed)/
+					server->stats.request_served;
+
+		if (time_elapsed > server->stats.max_timed_request)
+			server->stats.max_timed_request = time_elapsed;
+	}
+
+	if (server->tcp_status == CifsExiting)
+		force_sig(SIGKILL, server->handler);
+
+	mutex_unlock(&server->srv_mutex);
+	atomic_dec(&server->req_running);
+	cifssrv_debug("req running = %d\n", atomic_read(&server->req_running));
+	if (waitqueue_active(&server->req_running_q))
+		wake_up_all(&server->req_running_q);
+
+	/*
+	 * Decrement Ref count when all processing finished
+	 *  - in both success or failure cases
+	 */
+	atomic_dec(&server->r_count);
+}
+
+/**
+ * handle_async_smb_work() - send response of a completed asynchronous request
+ * @work:	async work struct of smb work whose I/O has completed
+ *
+ * The command handler returned -EIOCBQUEUED after submitting I/O, so
+ * the work item still holds its server references and response buffer.
+ */
+static void handle_async_smb_work(struct work_struct *work)
+{
+	struct smb_work *smb_work = container_of(work, struct smb_work,
+			async_work);
+	struct tcp_server_info *server = smb_work->server;
+	unsigned int command;
+	int rc;
+
+	mutex_lock(&server->srv_mutex);
+	command = server->ops->get_cmd_val(smb_work);
+	rc = smb_work->async_done(smb_work, smb_vfs_aio_result(smb_work));
+	if (rc < 0)
+		cifssrv_debug("error(%d) while processing cmd %u\n",
+							rc, command);
+
+	if (smb_work->send_no_response) {
+		spin_lock(&server->request_lock);
+		if (smb_work->added_in_request_list) {
+			list_del_init(&smb_work->request_entry);
+			smb_work->added_in_request_list = 0;
+		}
+		spin_unlock(&server->request_lock);
+	} else {
+		smb_prepare_rsp(smb_work, command);
+		smb_send_rsp(smb_work);
+	}
+
+	smb_finish_work(smb_work);
+}
+
+/**
+ * queue_async_smb_work() - queue response of a completed asynchronous request
+ * @smb_work:	smb work whose I/O has completed
+ *
+ * Can be called from I/O completion context.
+ */
+void queue_async_smb_work(struct smb_work *smb_work)
+{
+	INIT_WORK(&smb_work->async_work, handle_async_smb_work);
+	schedule_work(&smb_work->async_work);
+}
+
 /**
  * handle_smb_work() - process pending smb work requests
  * @smb_work:	smb work containing request command buffer
@@ -400,13 +567,12 @@ void handle_smb_work(struct work_struct *work)
 	int rc;
 	bool server_valid = false;
 	struct smb_version_cmds *cmds;
-	long int start_time = 0, end_time = 0, time_elapsed = 0;
 
 	atomic_inc(&server->req_running);
 	mutex_lock(&server->srv_mutex);
 
 	if (cifssrv_debug_enable)
-		start_time = jiffies;
+		smb_work->when_alloc = jiffies;
 
 	server->stats.request_served++;
 
@@ -483,6 +649,14 @@ again:
 	}
 
 	rc = cmds->proc(smb_work);
+	if (rc == -EIOCBQUEUED) {
+		/*
+		 * response is sent by handle_async_smb_work(), which may
+		 * already have freed smb_work
+		 */
+		return;
+	}
+
 	mutex_lock(&server->srv_mutex);
 	if (server->need_neg && (server->dialect == SMB20_PROT_ID ||
 				server->dialect == SMB21_PROT_ID ||
@@ -513,19 +687,7 @@ again:
 	}
 
 send:
-	/* call set_rsp_credits() function to set number of credits granted in
-	 * hdr of smb2 response.
-	 */
-	if (is_smb2_rsp(smb_work))
-		server->ops->set_rsp_credits(smb_work);
-
-	if (server->dialect == SMB311_PROT_ID)
-		smb3_preauth_hash_rsp(smb_work);
-
-	if (smb_work->sess && smb_work->sess->sign &&
-		server->ops->is_sign_req &&
-		server->ops->is_sign_req(smb_work, command))
-		server->ops->set_sign_rsp(smb_work);
+	smb_prepare_rsp(smb_work, command);
 
 	if (is_chained_smb2_message(smb_work))
 		goto chained;
@@ -533,37 +695,7 @@ send:
 	smb_send_rsp(smb_work);
 
 nosend:
-	/* free buffers */
-	free_workitem_buffers(smb_work);
-
-	if (cifssrv_debug_enable) {
-		end_time = jiffies;
-
-		time_elapsed = end_time - start_time;
-		server->stats.avg_req_duration =
-				(server->stats.avg_req_duration *
-					server->stats.request_served +
-					time_elapsed)/
-					server->stats.request_served;
-
-		if (time_elapsed > server->stats.max_timed_request)
-			server->stats.max_timed_request = time_elapsed;
-	}
-
-	if (server->tcp_status == CifsExiting)
-		force_sig(SIGKILL, server->handler);
-
-	mutex_unlock(&server->srv_mutex);
-	atomic_dec(&server->req_running);
-	cifssrv_debug("req running = %d\n", atomic_read(&server->req_running));
-	if (waitqueue_active(&server->req_running_q))
-		wake_up_all(&server->req_running_q);
-
-	/*
-	 * Decrement Ref count when all processing finished
-	 *  - in both success or failure cases
-	 */
-	atomic_dec(&server->r_count);
+	smb_finish_work(smb_work);
 }
 
 /**
@@ -980,10 +1112,17 @@ static int __init init_smb_server(void)
 	if (rc)
 		goto err1;
 
+	rc = smb_vfs_reclaim_init();
+	if (rc)
+		goto err_reclaim;
+
 #ifdef CONFIG_CIFS_SMB2_SERVER
 	rc = init_fidtable(&global_fidtable);
 	if (rc)
 		goto err2;
+	rc = cifssrv_pcc_init();
+	if (rc)
+		goto err_pcc;
 #endif
 	rc = cifssrv_create_socket();
 	if (rc)
@@ -1002,9 +1141,13 @@ err4:
 	cifssrv_stop_forker_thread();
 err3:
 #ifdef CONFIG_CIFS_SMB2_SERVER
+	cifssrv_pcc_exit();
+err_pcc:
 	destroy_global_fidtable();
 err2:
 #endif
+	smb_vfs_reclaim_exit();
+err_reclaim:
 	cifssrv_export_exit();
 err1:
 	smb_free_mempools();
@@ -1022,8 +1165,16 @@ static void __exit exit_smb_server(void)
 
 	cifssrv_stop_forker_thread();
 #ifdef CONFIG_CIFS_SMB2_SERVER
+	cifssrv_pcc_exit();
 	destroy_global_fidtable();
 #endif
+	smb_vfs_offload_exit();
+	smb_vfs_reclaim_exit();
+	smb_vfs_attr_exit();
+	smb_acl_exit();
+	smb_neg_exit();
+	smb_casefold_exit();
+	smb_vfs_fileid_exit();
 	cifssrv_export_exit();
 	dispose_ofile_list();
 	smb_free_mempools();
@@ -24,21 +24,36 @@
 #include <linux/uaccess.h>
 #include <linux/backing-dev.h>
 #include <linux/writeback.h>
+#include <linux/pagemap.h>
+#include <linux/uio.h>
+#include <linux/bio.h>
+#include <linux/hashtable.h>
 #include <linux/version.h>
 #if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
 #include <linux/xattr.h>
 #endif
 #include <linux/falloc.h>
+#include <linux/magic.h>
+#include <linux/random.h>
+#include <linux/ktime.h>
+#include <linux/exportfs.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+#include <linux/iversion.h>
+#endif
 
 #include "export.h"
 #include "glob.h"
 #include "oplock.h"
+#include "smbacl.h"
 
 /**
  * smb_vfs_create() - vfs helper for smb create file
  * @name:	file name
  * @mode:	file create mode
  *
+ * Private directories of the server are never created for a client,
+ * see smb_share_private_name().
+ *
  * Return:	0 on success, otherwise error
  */
 int smb_vfs_create(const char *name, umode_t mode)
@@ -47,6 +62,9 @@ int smb_vfs_create(const char *name, umode_t mode)
 	struct dentry *dentry;
 	int err;
 
+	if (smb_share_private_name(name))
+		return -EACCES;
+
 	dentry = kern_path_create(AT_FDCWD, name, &path, 0);
 	if (IS_ERR(dentry)) {
 		err = PTR_ERR(dentry);
@@ -65,13 +83,13 @@ int smb_vfs_create(const char *name, umode_t mode)
 }
 
 /**
- * smb_vfs_mkdir() - vfs helper for smb create directory
+ * smb_vfs_make_dir() - create a directory
  * @name:	directory name
  * @mode:	directory create mode
  *
  * Return:	0 on success, otherwise error
  */
-int smb_vfs_mkdir(const char *name, umode_t mode)
+static int smb_vfs_make_dir(const char *name, umode_t mode)
 {
 	struct path path;
 	struct dentry *dentry;
@@ -97,1107 +115,4739 @@ int smb_vfs_mkdir(const char *name, umode_t mode)
 }
 
 /**
- * smb_vfs_read() - vfs helper for smb file read
- * @sess:	TCP server session
- * @fid:	file id of open file
- * @buf:	buf containing read data
- * @count:	read byte count
- * @pos:	file pos
+ * smb_vfs_mkdir() - vfs helper for smb create directory
+ * @name:	directory name
+ * @mode:	directory create mode
  *
- * Return:	number of read bytes on success, otherwise error
+ * Private directories of the server are never created for a client,
+ * see smb_share_private_name().
+ *
+ * Return:	0 on success, otherwise error
  */
-int smb_vfs_read(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
-	char **buf, size_t count, loff_t *pos)
+int smb_vfs_mkdir(const char *name, umode_t mode)
 {
-	struct file *filp;
-	ssize_t nbytes;
-	mm_segment_t old_fs;
-	struct cifssrv_file *fp;
-	char *rbuf, *name;
-	struct inode *inode;
-	char namebuf[NAME_MAX];
-	int ret;
+	if (smb_share_private_name(name))
+		return -EACCES;
 
-	fp = get_id_from_fidtable(sess, fid);
-	if (!fp) {
-		cifssrv_err("failed to get filp for fid %llu\n", fid);
-		return -ENOENT;
+	return smb_vfs_make_dir(name, mode);
+}
+
+/**
+ * smb_vfs_read_meta() - read Windows metadata record of a file
+ * @dentry:	dentry of the file
+ * @meta:	record to fill
+ *
+ * Return:	0 if a record is stored, otherwise error
+ */
+static int smb_vfs_read_meta(struct dentry *dentry, struct smb_meta *meta)
+{
+	char *buf = NULL;
+	ssize_t len;
+
+	len = vfs_getxattr(dentry, XATTR_NAME_META, meta, sizeof(*meta));
+	if (len == -ERANGE) {
+		/* record of a later version, known fields come first */
+		len = smb_vfs_getxattr(dentry, XATTR_NAME_META, &buf, 1);
+		if (len > sizeof(*meta))
+			memcpy(meta, buf, sizeof(*meta));
+		kvfree(buf);
 	}
 
-	filp = fp->filp;
-	inode = filp->f_path.dentry->d_inode;
-	if (S_ISDIR(inode->i_mode))
-		return -EISDIR;
+	if (len < (ssize_t)sizeof(*meta) || meta->version < SMB_META_VERSION)
+		return -ENODATA;
+	return 0;
+}
 
-	if (unlikely(count == 0))
+/**
+ * smb_vfs_get_meta() - get Windows metadata of a file
+ * @path:	path of the file
+ * @meta:	record to fill
+ *
+ * Creation time and DOS attributes used to be kept in xattrs of their
+ * own, files that still have them are moved to a record on first access.
+ * A file without any gets a fresh record with creation time taken from
+ * change time, which the caller is expected to store.
+ *
+ * Return:	0 if a record is stored, otherwise -ENODATA
+ */
+int smb_vfs_get_meta(struct path *path, struct smb_meta *meta)
+{
+	struct dentry *dentry = path->dentry;
+	bool legacy = false;
+	__u64 create_time;
+	__le32 attr;
+	int err;
+
+	if (!smb_vfs_read_meta(dentry, meta))
 		return 0;
 
-#ifdef CONFIG_CIFS_SMB2_SERVER
-	if (fp->is_durable && fp->persistent_id != p_id) {
-		cifssrv_err("persistent id mismatch : %llu, %llu\n",
-				fp->persistent_id, p_id);
-		return -ENOENT;
-	}
+	memset(meta, 0, sizeof(*meta));
+	meta->version = SMB_META_VERSION;
+	meta->create_time = cpu_to_le64(cifs_UnixTimeToNT(
+				dentry->d_inode->i_ctime));
 
-	if (!(fp->daccess & (FILE_READ_DATA_LE | FILE_GENERIC_READ_LE |
-		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE))) {
-		cifssrv_err("no right to read(%llu)\n", fid);
-		return -EACCES;
-	}
-#endif
-	rbuf = kzalloc(count, GFP_KERNEL);
-	if (!rbuf) {
-		rbuf = vmalloc(count);
-		if (!rbuf)
-			return -ENOMEM;
+	if (vfs_getxattr(dentry, XATTR_NAME_CREATION_TIME, &create_time,
+				CREATIOM_TIME_LEN) == CREATIOM_TIME_LEN) {
+		meta->create_time = cpu_to_le64(create_time);
+		legacy = true;
 	}
 
-	if (fp->is_stream) {
-		ssize_t v_len;
-		char *stream_buf = NULL;
+	if (vfs_getxattr(dentry, XATTR_NAME_DOS_ATTRIBUTE, &attr,
+				DOS_ATTRIBUTE_LEN) == DOS_ATTRIBUTE_LEN) {
+		meta->attr = attr;
+		meta->flags |= cpu_to_le16(SMB_META_ATTR);
+		legacy = true;
+	}
 
-		cifssrv_debug("read stream data pos : %llu, count : %zd\n",
-			*pos, count);
+	if (vfs_getxattr(dentry, XATTR_NAME_STREAM, NULL, 0) >= 0) {
+		meta->flags |= cpu_to_le16(SMB_META_DEFAULT_STREAM);
+		legacy = true;
+	}
 
-		v_len = smb_find_cont_xattr(&filp->f_path, fp->stream_name,
-			fp->ssize, &stream_buf, 1);
-		if (v_len < 0) {
-			cifssrv_err("not found stream in xattr : %zd\n", v_len);
-			kvfree(rbuf);
-			return -ENOENT;
-		}
+	if (!legacy)
+		return -ENODATA;
 
-		memcpy(rbuf, &stream_buf[*pos], count);
+	/* streams were not tracked before */
+	meta->flags |= cpu_to_le16(SMB_META_HAS_STREAMS);
+	err = smb_vfs_set_meta(path, meta);
+	if (err)
+		return -ENODATA;
 
-		*buf = rbuf;
-		return v_len > count ? count : v_len;
-	}
+	vfs_removexattr(dentry, XATTR_NAME_CREATION_TIME);
+	vfs_removexattr(dentry, XATTR_NAME_DOS_ATTRIBUTE);
+	return 0;
+}
 
-	ret = smb_vfs_locks_mandatory_area(filp, *pos, *pos + count - 1,
-			F_RDLCK);
-	if (ret == -EAGAIN) {
-		cifssrv_err("%s: unable to read due to lock\n",
-				__func__);
-		kvfree(rbuf);
-		return ret;
-	}
+/**
+ * smb_vfs_set_meta() - store Windows metadata of a file
+ * @path:	path of the file
+ * @meta:	record to store
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_set_meta(struct path *path, struct smb_meta *meta)
+{
+	return smb_store_cont_xattr(path, XATTR_NAME_META, meta,
+			sizeof(*meta));
+}
 
-	old_fs = get_fs();
-	set_fs(KERNEL_DS);
+/* attribute cache, see smb_vfs_get_attr() */
+#define SMB_ATTR_HASH_BITS	8
+#define SMB_ATTR_MAX_ENTRIES	4096
+/* formatted EA lists up to this size are kept with the attributes */
+#define SMB_ATTR_EA_LIST_MAX	1024
 
-	nbytes = vfs_read(filp, rbuf, count, pos);
-	set_fs(old_fs);
-	if (nbytes < 0) {
-		name = d_path(&filp->f_path, namebuf, sizeof(namebuf));
-		if (IS_ERR(name))
-			name = "(error)";
-		cifssrv_err("smb read failed for (%s), err = %zd\n",
-				name, nbytes);
-		kvfree(rbuf);
-	} else {
-		*buf = rbuf;
-		filp->f_pos = *pos;
-	}
+/**
+ * struct smb_attr_entry - cached attributes of an inode
+ * @node:	entry in smb_attr_cache
+ * @lru:	entry in smb_attr_lru, most recently used first
+ * @inode:	inode the attributes are of, only compared as a key
+ * @stamp:	inode state the attributes were read at
+ * @gen:	smb_attr_gen the attributes were read under
+ * @attr:	attributes taken from xattrs
+ * @ea_len:	length of formatted EA list, -1 if not kept
+ * @ea:		FILE_FULL_EA_INFORMATION list of all EAs
+ */
+struct smb_attr_entry {
+	struct hlist_node	node;
+	struct list_head	lru;
+	struct inode		*inode;
+	struct smb_attr_stamp	stamp;
+	unsigned int		gen;
+	struct smb_attr		attr;
+	int			ea_len;
+	char			ea[0];
+};
+
+static DEFINE_HASHTABLE(smb_attr_cache, SMB_ATTR_HASH_BITS);
+static LIST_HEAD(smb_attr_lru);
+static DEFINE_SPINLOCK(smb_attr_lock);
+static int smb_attr_count;
+/* bumped by smb_vfs_attr_invalidate(), under smb_attr_lock */
+static unsigned int smb_attr_gen;
 
-	return nbytes;
+/**
+ * smb_vfs_attr_stamp() - take the state of an inode attributes depend on
+ * @inode:	inode to stamp
+ * @stamp:	filled with inode number, change time and version
+ *
+ * Any xattr change updates the change time, and the inode version too
+ * where file system keeps one.
+ */
+void smb_vfs_attr_stamp(struct inode *inode, struct smb_attr_stamp *stamp)
+{
+	stamp->ino = inode->i_ino;
+	stamp->ctime = inode->i_ctime;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+	stamp->version = inode_peek_iversion(inode);
+#else
+	stamp->version = inode->i_version;
+#endif
 }
 
 /**
- * smb_vfs_write() - vfs helper for smb file write
- * @sess:	TCP server session
- * @fid:	file id of open file
- * @buf:	buf containing data for writing
- * @count:	read byte count
- * @pos:	file pos
- * @sync:	fsync after write
- * @written:	number of bytes written
+ * smb_vfs_attr_stamp_equal() - check if two stamps are of one inode state
+ * @a:		first stamp
+ * @b:		second stamp
  *
- * Return:	0 on success, otherwise error
+ * Return:	true if equal
  */
-int smb_vfs_write(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
-	char *buf, size_t count, loff_t *pos, bool sync, ssize_t *written)
+bool smb_vfs_attr_stamp_equal(struct smb_attr_stamp *a,
+	struct smb_attr_stamp *b)
 {
-	struct file *filp;
-	loff_t	offset = *pos;
-	mm_segment_t old_fs;
-	struct cifssrv_file *fp;
-	int err;
+	return a->ino == b->ino && timespec_equal(&a->ctime, &b->ctime) &&
+		a->version == b->version;
+}
 
-	fp = get_id_from_fidtable(sess, fid);
-	if (!fp) {
-		cifssrv_err("failed to get filp for fid %llu session = 0x%p\n",
-				fid, sess);
-		return -ENOENT;
+/* called with smb_attr_lock held, returns a still valid entry */
+static struct smb_attr_entry *smb_attr_lookup(struct inode *inode)
+{
+	struct smb_attr_stamp stamp;
+	struct smb_attr_entry *e;
+
+	hash_for_each_possible(smb_attr_cache, e, node, (unsigned long)inode) {
+		if (e->inode != inode)
+			continue;
+
+		smb_vfs_attr_stamp(inode, &stamp);
+		if (!smb_vfs_attr_stamp_equal(&e->stamp, &stamp))
+			return NULL;
+		list_move(&e->lru, &smb_attr_lru);
+		return e;
 	}
+	return NULL;
+}
 
-#ifdef CONFIG_CIFS_SMB2_SERVER
-	if (fp->is_durable && fp->persistent_id != p_id) {
-		cifssrv_err("persistent id mismatch : %llu, %llu\n",
-			fp->persistent_id, p_id);
-		return -ENOENT;
+/* called with smb_attr_lock held */
+static struct smb_attr_entry *smb_attr_unhash(struct inode *inode)
+{
+	struct smb_attr_entry *e;
+
+	hash_for_each_possible(smb_attr_cache, e, node, (unsigned long)inode) {
+		if (e->inode == inode) {
+			hash_del(&e->node);
+			list_del(&e->lru);
+			smb_attr_count--;
+			return e;
+		}
 	}
+	return NULL;
+}
 
-	if (!(fp->daccess & (FILE_WRITE_DATA_LE | FILE_GENERIC_WRITE_LE |
-		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE))) {
-		cifssrv_err("no right to write(%llu)\n", fid);
-		return -EACCES;
-	}
-#endif
+/*
+ * replace cached attributes of an inode, evicting least recently used.
+ * An entry read before an invalidation may predate it and is dropped.
+ */
+static void smb_attr_insert(struct smb_attr_entry *new)
+{
+	struct smb_attr_entry *old;
 
-	filp = fp->filp;
+	spin_lock(&smb_attr_lock);
+	if (new->gen != smb_attr_gen) {
+		spin_unlock(&smb_attr_lock);
+		kfree(new);
+		return;
+	}
 
-	if (fp->is_stream) {
-		char *stream_buf = NULL, *wbuf;
-		size_t size, v_len;
+	old = smb_attr_unhash(new->inode);
+	if (!old && smb_attr_count >= SMB_ATTR_MAX_ENTRIES) {
+		old = list_last_entry(&smb_attr_lru, struct smb_attr_entry,
+				lru);
+		hash_del(&old->node);
+		list_del(&old->lru);
+		smb_attr_count--;
+	}
+	hash_add(smb_attr_cache, &new->node, (unsigned long)new->inode);
+	list_add(&new->lru, &smb_attr_lru);
+	smb_attr_count++;
+	spin_unlock(&smb_attr_lock);
+	kfree(old);
+}
 
-		cifssrv_debug("write stream data pos : %llu, count : %zd\n",
-			*pos, count);
+/**
+ * smb_vfs_user_ea() - check if an xattr is shown to clients as an EA
+ * @name:	xattr name
+ *
+ * Return:	true for user xattrs not used by cifssrv itself
+ */
+bool smb_vfs_user_ea(const char *name)
+{
+	if (strncmp(name, XATTR_USER_PREFIX, XATTR_USER_PREFIX_LEN))
+		return false;
+
+	name += XATTR_USER_PREFIX_LEN;
+	return strncmp(name, CREATION_TIME_PREFIX, CREATION_TIME_PREFIX_LEN) &&
+		strncmp(name, STREAM_PREFIX, STREAM_PREFIX_LEN) &&
+		strncmp(name, STREAM_REF_PREFIX, STREAM_REF_PREFIX_LEN) &&
+		strncmp(name, DOS_ATTRIBUTE_PREFIX, DOS_ATTRIBUTE_PREFIX_LEN) &&
+		strncmp(name, PEERDIST_PREFIX, PEERDIST_PREFIX_LEN) &&
+		strncmp(name, META_PREFIX, META_PREFIX_LEN);
+}
 
-		size = *pos + count;
-		if (size > XATTR_SIZE_MAX) {
-			size = XATTR_SIZE_MAX;
-			count = (*pos + count) - XATTR_SIZE_MAX;
-		}
+/* size of all EAs of a file as a FILE_FULL_EA_INFORMATION list */
+static int smb_vfs_ea_size(struct dentry *dentry, __u32 *size)
+{
+	char *name, *xattr_list = NULL;
+	ssize_t list_len, value_len;
 
-		v_len = smb_find_cont_xattr(&filp->f_path, fp->stream_name,
-			fp->ssize, &stream_buf, 1);
-		if (v_len < 0) {
-			cifssrv_err("not found stream in xattr : %zd\n", v_len);
-			kvfree(stream_buf);
-			return -ENOENT;
-		}
+	*size = 0;
+	list_len = smb_vfs_listxattr(dentry, &xattr_list, XATTR_LIST_MAX);
+	if (list_len <= 0)
+		return list_len;
 
-		if (v_len < size) {
-			wbuf = kzalloc(size, GFP_KERNEL);
-			if (!wbuf) {
-				wbuf = vzalloc(size);
-				if (!wbuf)
-					return -ENOMEM;
-			}
+	for (name = xattr_list; name - xattr_list < list_len;
+			name += strlen(name) + 1) {
+		if (!smb_vfs_user_ea(name))
+			continue;
 
-			if (v_len > 0) {
-				memcpy(wbuf, stream_buf, v_len);
-				kvfree(stream_buf);
-			}
-			stream_buf = wbuf;
-		}
+		value_len = smb_vfs_getxattr(dentry, name, NULL, 0);
+		if (value_len < 0)
+			continue;
 
-		memcpy(&stream_buf[*pos], buf, count);
+		/* 8 bytes of entry header, name and its terminator, value */
+		*size += ALIGN(8 + strlen(name) - XATTR_USER_PREFIX_LEN + 1 +
+				value_len, 4);
+	}
+	vfree(xattr_list);
+	return 0;
+}
 
-		err = smb_store_cont_xattr(&filp->f_path, fp->stream_name,
-			(void *)stream_buf, size);
-		if (err < 0)
-			return err;
+/**
+ * smb_vfs_get_attr() - get attributes of a file kept in xattrs
+ * @dentry:	dentry of the file
+ * @attr:	filled with creation time, DOS attributes and EA size
+ *
+ * Clients query the same few files over and over, so the xattr reads
+ * behind these are cached per inode and revalidated against the inode
+ * change time and version on every use.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_get_attr(struct dentry *dentry, struct smb_attr *attr)
+{
+	struct inode *inode = dentry->d_inode;
+	struct smb_attr_entry *e;
+	struct smb_meta meta;
+	unsigned int gen;
+	int err;
 
-		kvfree(stream_buf);
-		filp->f_pos = *pos;
-		*written = count;
+	spin_lock(&smb_attr_lock);
+	e = smb_attr_lookup(inode);
+	if (e)
+		*attr = e->attr;
+	gen = smb_attr_gen;
+	spin_unlock(&smb_attr_lock);
+	if (e) {
+		atomic_long_inc(&cifssrv_attr_hits);
 		return 0;
 	}
-
-	err = smb_vfs_locks_mandatory_area(filp, *pos, *pos + count - 1,
-			F_WRLCK);
-	if (err == -EAGAIN) {
-		cifssrv_err("%s: unable to write due to lock\n",
-				__func__);
-		return err;
+	atomic_long_inc(&cifssrv_attr_misses);
+
+	e = kzalloc(sizeof(struct smb_attr_entry), GFP_KERNEL);
+	if (e) {
+		e->inode = inode;
+		e->gen = gen;
+		e->ea_len = -1;
+		/* taken first, a change while reading makes the entry stale */
+		smb_vfs_attr_stamp(inode, &e->stamp);
 	}
 
-	old_fs = get_fs();
-	set_fs(KERNEL_DS);
-
-	if (oplocks_enable) {
-		/* Do we need to break any of a levelII oplock? */
-		mutex_lock(&ofile_list_lock);
-		smb_breakII_oplock(sess->server, fp, NULL);
-		mutex_unlock(&ofile_list_lock);
+	if (smb_vfs_read_meta(dentry, &meta)) {
+		attr->create_time = cifs_UnixTimeToNT(inode->i_ctime);
+		attr->attr = 0;
+	} else {
+		attr->create_time = le64_to_cpu(meta.create_time);
+		attr->attr = le16_to_cpu(meta.flags) & SMB_META_ATTR ?
+			meta.attr : 0;
 	}
 
-	err = vfs_write(filp, buf, count, pos);
-	set_fs(old_fs);
-	if (err < 0) {
-		cifssrv_debug("smb write failed, err = %d\n", err);
+	err = smb_vfs_ea_size(dentry, &attr->ea_size);
+	if (err || !e) {
+		kfree(e);
 		return err;
 	}
 
-	filp->f_pos = *pos;
-	*written = err;
-	err = 0;
-	if (sync) {
-		err = vfs_fsync_range(filp, offset, offset + *written, 0);
-		if (err < 0)
-			cifssrv_err("fsync failed for fid %llu, err = %d\n",
-					fid, err);
-	}
-
-	return err;
+	e->attr = *attr;
+	smb_attr_insert(e);
+	return 0;
 }
 
 /**
- * smb_check_attrs() - sanitize inode attributes
- * @inode:	inode
- * @attrs:	inode attributes
+ * smb_vfs_get_ea_list() - get cached list of all EAs of a file
+ * @dentry:	dentry of the file
+ * @buf:	buffer to copy FILE_FULL_EA_INFORMATION list to
+ * @len:	buffer length
+ *
+ * Return:	list length on success, -ENOENT if not cached
  */
-void smb_check_attrs(struct inode *inode, struct iattr *attrs)
+int smb_vfs_get_ea_list(struct dentry *dentry, char *buf, int len)
 {
-	/* sanitize the mode change */
-	if (attrs->ia_valid & ATTR_MODE) {
-		attrs->ia_mode &= S_IALLUGO;
-		attrs->ia_mode |= (inode->i_mode & ~S_IALLUGO);
+	struct smb_attr_entry *e;
+	int ret = -ENOENT;
+
+	spin_lock(&smb_attr_lock);
+	e = smb_attr_lookup(dentry->d_inode);
+	if (e && e->ea_len >= 0 && e->ea_len <= len) {
+		memcpy(buf, e->ea, e->ea_len);
+		ret = e->ea_len;
 	}
+	spin_unlock(&smb_attr_lock);
 
-	/* Revoke setuid/setgid on chown */
-	if (!S_ISDIR(inode->i_mode) &&
-		(((attrs->ia_valid & ATTR_UID) &&
-				!uid_eq(attrs->ia_uid, inode->i_uid)) ||
-		 ((attrs->ia_valid & ATTR_GID) &&
-				!gid_eq(attrs->ia_gid, inode->i_gid)))) {
-		attrs->ia_valid |= ATTR_KILL_PRIV;
-		if (attrs->ia_valid & ATTR_MODE) {
-			/* we're setting mode too, just clear the s*id bits */
-			attrs->ia_mode &= ~S_ISUID;
-			if (attrs->ia_mode & S_IXGRP)
-				attrs->ia_mode &= ~S_ISGID;
-		} else {
-			/* set ATTR_KILL_* bits and let VFS handle it */
-			attrs->ia_valid |= (ATTR_KILL_SUID | ATTR_KILL_SGID);
-		}
-	}
+	atomic_long_inc(ret < 0 ? &cifssrv_attr_misses : &cifssrv_attr_hits);
+	return ret;
 }
 
 /**
- * smb_vfs_setattr() - vfs helper for smb setattr
- * @sess:	TCP server session
- * @name:	file name
- * @fid:	file id of open file
- * @attrs:	inode attributes
+ * smb_vfs_attr_gen() - get generation of the attribute cache
  *
- * Return:	0 on success, otherwise error
+ * Taken before reading what is later cached, see smb_vfs_put_ea_list().
+ *
+ * Return:	current generation
  */
-int smb_vfs_setattr(struct cifssrv_sess *sess, const char *name,
-		uint64_t fid, struct iattr *attrs)
+unsigned int smb_vfs_attr_gen(void)
 {
-	struct file *filp;
-	struct dentry *dentry;
-	struct inode *inode;
-	struct path path;
-	bool update_size = false;
-	int err = 0;
-	struct cifssrv_file *fp;
+	unsigned int gen;
 
-	if (name) {
-		err = kern_path(name, 0, &path);
-		if (err) {
-			cifssrv_debug("lookup failed for %s, err = %d\n",
-					name, err);
-			return -ENOENT;
-		}
-		dentry = path.dentry;
-		inode = dentry->d_inode;
-	} else {
+	spin_lock(&smb_attr_lock);
+	gen = smb_attr_gen;
+	spin_unlock(&smb_attr_lock);
+	return gen;
+}
 
-		fp = get_id_from_fidtable(sess, fid);
-		if (!fp) {
-			cifssrv_err("failed to get filp for fid %llu\n", fid);
-			return -ENOENT;
-		}
+/**
+ * smb_vfs_put_ea_list() - cache list of all EAs of a file
+ * @dentry:	dentry of the file
+ * @stamp:	inode state taken before the list was read
+ * @gen:	smb_vfs_attr_gen() taken before the list was read
+ * @buf:	FILE_FULL_EA_INFORMATION list
+ * @len:	list length
+ */
+void smb_vfs_put_ea_list(struct dentry *dentry, struct smb_attr_stamp *stamp,
+	unsigned int gen, char *buf, int len)
+{
+	struct smb_attr_entry *e, *old;
+	struct smb_attr attr;
+	bool stale;
 
-		filp = fp->filp;
-		dentry = filp->f_path.dentry;
-		inode = dentry->d_inode;
-	}
+	if (len > SMB_ATTR_EA_LIST_MAX ||
+			smb_vfs_get_attr(dentry, &attr))
+		return;
 
-	/* no need to update mode of symlink */
-	if (S_ISLNK(inode->i_mode))
-		attrs->ia_valid &= ~ATTR_MODE;
+	e = kzalloc(sizeof(struct smb_attr_entry) + len, GFP_KERNEL);
+	if (!e)
+		return;
 
-	/* skip setattr, if nothing to update */
-	if (!attrs->ia_valid) {
-		err = 0;
-		goto out;
+	e->inode = dentry->d_inode;
+	e->stamp = *stamp;
+	e->gen = gen;
+	e->attr = attr;
+	e->ea_len = len;
+	memcpy(e->ea, buf, len);
+
+	/* list was read before the attributes, both must be of one state */
+	spin_lock(&smb_attr_lock);
+	old = smb_attr_lookup(e->inode);
+	stale = !old || !smb_vfs_attr_stamp_equal(&old->stamp, &e->stamp);
+	spin_unlock(&smb_attr_lock);
+	if (stale) {
+		kfree(e);
+		return;
 	}
+	smb_attr_insert(e);
+}
 
-	smb_check_attrs(inode, attrs);
-	if (attrs->ia_valid & ATTR_SIZE) {
-		err = get_write_access(inode);
-		if (err)
-			goto out;
+/**
+ * smb_vfs_attr_invalidate() - drop cached attributes of an inode
+ * @inode:	inode whose xattrs changed
+ *
+ * Change time has a coarse granularity on some file systems, so xattr
+ * changes made by cifssrv drop the entry instead of relying on it, and
+ * bump the generation so that an entry read before is not inserted.
+ */
+void smb_vfs_attr_invalidate(struct inode *inode)
+{
+	struct smb_attr_entry *e;
 
-		err = locks_verify_truncate(inode, NULL, attrs->ia_size);
-		if (err) {
-			put_write_access(inode);
-			goto out;
-		}
-		update_size = true;
+	spin_lock(&smb_attr_lock);
+	smb_attr_gen++;
+	e = smb_attr_unhash(inode);
+	spin_unlock(&smb_attr_lock);
+	kfree(e);
+}
+
+/**
+ * smb_vfs_attr_exit() - free attribute cache
+ */
+void smb_vfs_attr_exit(void)
+{
+	struct smb_attr_entry *e, *tmp;
+
+	spin_lock(&smb_attr_lock);
+	list_for_each_entry_safe(e, tmp, &smb_attr_lru, lru) {
+		hash_del(&e->node);
+		list_del(&e->lru);
+		kfree(e);
 	}
+	smb_attr_count = 0;
+	spin_unlock(&smb_attr_lock);
+}
 
-	attrs->ia_valid |= ATTR_CTIME;
+/*
+ * serializes moving of streams from xattrs to companion files with
+ * every access to stream data kept in an xattr
+ */
+static DEFINE_MUTEX(smb_stream_mutex);
 
-#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
-	inode_lock(inode);
-	err = notify_change(dentry, attrs, NULL);
-	inode_unlock(inode);
-#else
-	mutex_lock(&inode->i_mutex);
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 13, 0)
-	err = notify_change(dentry, attrs, NULL);
-#else
-	err = notify_change(dentry, attrs);
-#endif
-	mutex_unlock(&inode->i_mutex);
-#endif
+/**
+ * smb_vfs_stream_ref_name() - name of the reference xattr of a stream
+ * @name:	stream xattr name
+ *
+ * The companion file id is kept apart from the stream xattr, whose value
+ * is client data, under a name clients can not set, see
+ * smb_vfs_user_ea().
+ *
+ * Return:	allocated xattr name on success, otherwise NULL
+ */
+static char *smb_vfs_stream_ref_name(const char *name)
+{
+	return kasprintf(GFP_KERNEL, "%s%s", XATTR_NAME_STREAM_REF,
+			name + XATTR_NAME_STREAM_LEN);
+}
 
-	if (update_size)
-		put_write_access(inode);
+/**
+ * smb_vfs_stream_ref() - get companion file id of a stream
+ * @dentry:	dentry of file owning the stream
+ * @name:	stream xattr name
+ * @id:	companion file id
+ *
+ * Return:	0 if stream data is in a companion file, otherwise error
+ */
+static int smb_vfs_stream_ref(struct dentry *dentry, char *name, u64 *id)
+{
+	char *ref_name;
+	__le64 ref;
+	ssize_t len;
 
-	if (!err) {
-		sync_inode_metadata(inode, 1);
-		cifssrv_debug("fid %llu, setattr done\n", fid);
-	}
+	ref_name = smb_vfs_stream_ref_name(name);
+	if (!ref_name)
+		return -ENOMEM;
 
-out:
-	if (name)
-		path_put(&path);
-	return err;
+	len = vfs_getxattr(dentry, ref_name, &ref, sizeof(ref));
+	kfree(ref_name);
+	if (len != sizeof(ref))
+		return -ENODATA;
+
+	*id = le64_to_cpu(ref);
+	return 0;
+}
+
+static char *smb_vfs_stream_path(struct cifssrv_share *share, u64 id)
+{
+	return kasprintf(GFP_KERNEL, "%s/%s/%016llx", share->path,
+			SMB_STREAMS_NAME, (unsigned long long)id);
 }
 
 /**
- * smb_vfs_getattr() - vfs helper for smb getattr
- * @sess:	TCP server session
- * @fid:	file id of open file
- * @attrs:	inode attributes
+ * smb_vfs_stream_file() - open companion file of a stream
+ * @share:	share of the file owning the stream
+ * @id:		companion file id
+ * @create:	create a new companion file
  *
- * Return:	0 on success, otherwise error
+ * Return:	file pointer on success, otherwise error pointer
  */
-int smb_vfs_getattr(struct cifssrv_sess *sess, uint64_t fid,
-		struct kstat *stat)
+static struct file *smb_vfs_stream_file(struct cifssrv_share *share, u64 id,
+	bool create)
 {
+	int flags = O_RDWR | O_LARGEFILE;
 	struct file *filp;
-	struct cifssrv_file *fp;
+	char *name, *last;
 	int err;
 
-	fp = get_id_from_fidtable(sess, fid);
-	if (!fp) {
-		cifssrv_err("failed to get filp for fid %llu\n", fid);
-		return -ENOENT;
-	}
+	name = smb_vfs_stream_path(share, id);
+	if (!name)
+		return ERR_PTR(-ENOMEM);
 
-	filp = fp->filp;
-	err = vfs_getattr(&filp->f_path, stat);
-	if (err)
-		cifssrv_err("getattr failed for fid %llu, err %d\n", fid, err);
-	return err;
+	if (create)
+		flags |= O_CREAT | O_EXCL;
+	filp = filp_open(name, flags, 0600);
+	if (create && PTR_ERR(filp) == -ENOENT) {
+		/* first companion file of the share */
+		last = strrchr(name, '/');
+		*last = '\0';
+		err = smb_vfs_make_dir(name, 0700);
+		*last = '/';
+		if (!err || err == -EEXIST)
+			filp = filp_open(name, flags, 0600);
+	}
+	kfree(name);
+	return filp;
 }
 
 /**
- * smb_vfs_fsync() - vfs helper for smb fsync
- * @sess:	TCP server session
- * @fid:	file id of open file
+ * smb_vfs_stream_attach() - attach companion file of a stream to an open
+ * @fp:		cifssrv file pointer of open stream
  *
- * Return:	0 on success, otherwise error
+ * Another open may have moved the stream data since this one was made,
+ * so this is checked before every xattr access.
+ *
+ * Return:	0 if attached, -ENODATA if data is in xattr, otherwise error
  */
-int smb_vfs_fsync(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id)
+static int smb_vfs_stream_attach(struct cifssrv_file *fp)
 {
-	struct cifssrv_file *fp;
+	struct file *sfilp;
+	u64 id;
 	int err;
 
-	fp = get_id_from_fidtable(sess, fid);
-	if (!fp) {
-		cifssrv_err("failed to get filp for fid %llu\n", fid);
-		return -ENOENT;
-	}
+	if (fp->ext->sfilp)
+		return 0;
 
-	if (fp->is_durable && fp->persistent_id != p_id) {
-		cifssrv_err("persistent id mismatch : %llu, %llu\n",
-				fp->persistent_id, p_id);
-		return -ENOENT;
-	}
+	if (!fp->share)
+		return -ENODATA;
 
-	err = vfs_fsync(fp->filp, 0);
-	if (err < 0)
-		cifssrv_err("smb fsync failed, err = %d\n", err);
+	err = smb_vfs_stream_ref(fp->filp->f_path.dentry,
+			fp->ext->stream_name, &id);
+	if (err)
+		return err;
 
-	return err;
+	sfilp = smb_vfs_stream_file(fp->share, id, false);
+	if (IS_ERR(sfilp)) {
+		cifssrv_err("stream %s lost its data file, err %ld\n",
+				fp->ext->stream_name, PTR_ERR(sfilp));
+		return PTR_ERR(sfilp);
+	}
+
+	fp->ext->sfilp = sfilp;
+	return 0;
 }
 
 /**
- * smb_vfs_unlink() - vfs helper for smb rmdir or unlink
- * @name:	absolute directory or file name
+ * smb_vfs_stream_move() - move stream data from xattr to a companion file
+ * @fp:		cifssrv file pointer of open stream
+ *
+ * Data is copied to a new companion file before its reference xattr is
+ * stored, so a failure leaves the stream in its xattr. The stream xattr
+ * is emptied afterwards and only names the stream from then on.
+ * Called with smb_stream_mutex held.
  *
  * Return:	0 on success, otherwise error
  */
-int smb_vfs_unlink(char *name)
+static int smb_vfs_stream_move(struct cifssrv_file *fp)
 {
-	struct path parent;
-	struct dentry *dir, *dentry;
-	char *last;
-	int err = -ENOENT;
+	struct path *path = &fp->filp->f_path;
+	struct file *sfilp;
+	char *buf = NULL, *name, *ref_name = NULL;
+	__le64 ref;
+	mm_segment_t old_fs;
+	loff_t pos = 0;
+	ssize_t len;
+	u64 id;
+	int err;
 
-	last = strrchr(name, '/');
-	if (last && last[1] != '\0') {
-		*last = '\0';
-		last++;
-	}
-	else {
-		cifssrv_debug("can't get last component in path %s\n", name);
-		return -ENOENT;
-	}
+	err = smb_vfs_stream_attach(fp);
+	if (err != -ENODATA)
+		goto out;
 
-	err = kern_path(name, LOOKUP_FOLLOW | LOOKUP_DIRECTORY, &parent);
-	if (err) {
-		cifssrv_debug("can't get %s, err %d\n", name, err);
-		return err;
+	ref_name = smb_vfs_stream_ref_name(fp->ext->stream_name);
+	if (!ref_name) {
+		err = -ENOMEM;
+		goto out;
 	}
 
-	dir = parent.dentry;
-	if (!dir->d_inode)
+	len = smb_vfs_getxattr(path->dentry, fp->ext->stream_name, &buf, 1);
+	if (len < 0) {
+		err = len;
 		goto out;
-
-#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
-	inode_lock_nested(dir->d_inode, I_MUTEX_PARENT);
-#else
-	mutex_lock_nested(&dir->d_inode->i_mutex, I_MUTEX_PARENT);
-#endif
-	dentry = lookup_one_len(last, dir, strlen(last));
-	if (IS_ERR(dentry)) {
-		err = PTR_ERR(dentry);
-		cifssrv_debug("%s: lookup failed, err %d\n", last, err);
-		goto out_err;
 	}
 
-	if (!dentry->d_inode || !dentry->d_inode->i_nlink) {
-		dput(dentry);
-		err = -ENOENT;
-		goto out_err;
+	get_random_bytes(&id, sizeof(id));
+	sfilp = smb_vfs_stream_file(fp->share, id, true);
+	if (IS_ERR(sfilp)) {
+		err = PTR_ERR(sfilp);
+		goto out;
 	}
 
-	if (S_ISDIR(dentry->d_inode->i_mode)) {
-		err = vfs_rmdir(dir->d_inode, dentry);
-		if (err && err != -ENOTEMPTY)
-			cifssrv_debug("%s: rmdir failed, err %d\n", name, err);
-	} else {
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-		err = vfs_unlink(dir->d_inode, dentry, NULL);
-#else
-		err = vfs_unlink(dir->d_inode, dentry);
-#endif
-		if (err)
-			cifssrv_debug("%s: unlink failed, err %d\n", name, err);
+	if (len > 0) {
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		err = vfs_write(sfilp, buf, len, &pos);
+		set_fs(old_fs);
+		if (err >= 0 && err != len)
+			err = -ENOSPC;
+		if (err < 0)
+			goto out_unlink;
 	}
 
-	dput(dentry);
-out_err:
-#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
-	inode_unlock(dir->d_inode);
-#else
-	mutex_unlock(&dir->d_inode->i_mutex);
-#endif
+	ref = cpu_to_le64(id);
+	err = smb_store_cont_xattr(path, ref_name, &ref, sizeof(ref));
+	if (err)
+		goto out_unlink;
+
+	/* the reference wins, a stale copy is only wasted space */
+	if (smb_store_cont_xattr(path, fp->ext->stream_name, NULL, 0))
+		cifssrv_debug("stream %s kept its xattr copy\n",
+				fp->ext->stream_name);
+
+	fp->ext->sfilp = sfilp;
+	goto out;
+
+out_unlink:
+	fput(sfilp);
+	name = smb_vfs_stream_path(fp->share, id);
+	if (name) {
+		smb_vfs_unlink(name);
+		kfree(name);
+	}
 out:
-	path_put(&parent);
+	kfree(ref_name);
+	kvfree(buf);
 	return err;
 }
 
 /**
- * smb_vfs_link() - vfs helper for creating smb hardlink
- * @oldname:	source file name
- * @newname:	hardlink name
+ * smb_vfs_stream_read() - read data from a stream
+ * @fp:		cifssrv file pointer of open stream
+ * @rbuf:	destination buffer for read data
+ * @count:	read byte count
+ * @pos:	stream pos
  *
- * Return:	0 on success, otherwise error
+ * Return:	number of read bytes on success, otherwise error
  */
-int smb_vfs_link(const char *oldname, const char *newname)
+static ssize_t smb_vfs_stream_read(struct cifssrv_file *fp, char *rbuf,
+	size_t count, loff_t *pos)
 {
-	struct path oldpath, newpath;
-	struct dentry *dentry;
+	mm_segment_t old_fs;
+	ssize_t v_len;
+	char *stream_buf = NULL;
 	int err;
 
-	err = kern_path(oldname, LOOKUP_FOLLOW, &oldpath);
-	if (err) {
-		cifssrv_err("cannot get linux path for %s, err = %d\n",
-				oldname, err);
-		goto out1;
-	}
+	cifssrv_debug("read stream data pos : %llu, count : %zd\n",
+		*pos, count);
 
-	dentry = kern_path_create(AT_FDCWD, newname, &newpath,
-			LOOKUP_FOLLOW & LOOKUP_REVAL);
-	if (IS_ERR(dentry)) {
-		err = PTR_ERR(dentry);
-		cifssrv_err("path create err for %s, err %d\n", newname, err);
-		goto out2;
+	mutex_lock(&smb_stream_mutex);
+	err = smb_vfs_stream_attach(fp);
+	if (!err) {
+		mutex_unlock(&smb_stream_mutex);
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		v_len = vfs_read(fp->ext->sfilp, rbuf, count, pos);
+		set_fs(old_fs);
+		return v_len;
+	} else if (err != -ENODATA) {
+		mutex_unlock(&smb_stream_mutex);
+		return err;
 	}
 
-	err = -EXDEV;
-	if (oldpath.mnt != newpath.mnt) {
-		cifssrv_err("vfs_link failed err %d\n", err);
-		goto out3;
+	/* a move by another open would replace the data with a reference */
+	v_len = smb_find_cont_xattr(&fp->filp->f_path, fp->ext->stream_name,
+		fp->ext->ssize, &stream_buf, 1);
+	mutex_unlock(&smb_stream_mutex);
+	if (v_len < 0) {
+		cifssrv_err("not found stream in xattr : %zd\n", v_len);
+		return -ENOENT;
 	}
 
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-	err = vfs_link(oldpath.dentry, newpath.dentry->d_inode, dentry, NULL);
-#else
-	err = vfs_link(oldpath.dentry, newpath.dentry->d_inode, dentry);
-#endif
-	if (err)
-		cifssrv_debug("vfs_link failed err %d\n", err);
-
-out3:
-	done_path_create(&newpath, dentry);
-out2:
-	path_put(&oldpath);
+	if (*pos >= v_len)
+		count = 0;
+	else
+		count = min_t(size_t, count, v_len - *pos);
+	if (count)
+		memcpy(rbuf, &stream_buf[*pos], count);
+	kvfree(stream_buf);
 
-out1:
-	return err;
+	return count;
 }
 
 /**
- * smb_vfs_symlink() - vfs helper for creating smb symlink
- * @name:	source file name
- * @symname:	symlink name
+ * smb_vfs_stream_write() - write data to a stream
+ * @sess:	TCP server session
+ * @fp:		cifssrv file pointer of open stream
+ * @buf:	buf containing data for writing
+ * @count:	write byte count
+ * @pos:	stream pos
+ * @written:	number of bytes written
+ *
+ * Small streams are kept in an xattr, which is read, modified and stored
+ * back as a whole, so the temporary buffer is charged to the session and
+ * share while it is held. A stream growing past the share stream xattr
+ * size moves to a companion file written in place from then on. The
+ * read, modify and store of the xattr holds smb_stream_mutex, so no
+ * move from another open can happen in between.
  *
  * Return:	0 on success, otherwise error
  */
-int smb_vfs_symlink(const char *name, const char *symname)
+static int smb_vfs_stream_write(struct cifssrv_sess *sess,
+	struct cifssrv_file *fp, char *buf, size_t count, loff_t *pos,
+	ssize_t *written)
 {
-	struct path path;
-	struct dentry *dentry;
+	struct file *filp = fp->filp;
+	char *stream_buf = NULL, *wbuf;
+	mm_segment_t old_fs;
+	size_t size;
+	ssize_t v_len;
 	int err;
 
-	dentry = kern_path_create(AT_FDCWD, symname, &path, 0);
-	if (IS_ERR(dentry)) {
-		err = PTR_ERR(dentry);
-		cifssrv_err("path create failed for %s, err %d\n", name, err);
+	cifssrv_debug("write stream data pos : %llu, count : %zd\n",
+		*pos, count);
+
+	mutex_lock(&smb_stream_mutex);
+	err = smb_vfs_stream_attach(fp);
+	if (err == -ENODATA && fp->share &&
+			fp->share->config.stream_xattr_max &&
+			*pos + count > fp->share->config.stream_xattr_max)
+		err = smb_vfs_stream_move(fp);
+
+	if (!err) {
+		/* data stays in the companion file from now on */
+		mutex_unlock(&smb_stream_mutex);
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		v_len = vfs_write(fp->ext->sfilp, buf, count, pos);
+		set_fs(old_fs);
+		if (v_len < 0)
+			return v_len;
+
+		filp->f_pos = *pos;
+		*written = v_len;
+		return 0;
+	} else if (err != -ENODATA) {
+		mutex_unlock(&smb_stream_mutex);
 		return err;
 	}
 
-	err = vfs_symlink(dentry->d_parent->d_inode, dentry, name);
-	if (err && (err != -EEXIST || err != -ENOSPC))
-		cifssrv_debug("failed to create symlink, err %d\n", err);
+	size = *pos + count;
+	if (size > XATTR_SIZE_MAX) {
+		size = XATTR_SIZE_MAX;
+		count = (*pos + count) - XATTR_SIZE_MAX;
+	}
 
-	done_path_create(&path, dentry);
+	err = cifssrv_charge_mem(sess, fp->share, size);
+	if (err) {
+		mutex_unlock(&smb_stream_mutex);
+		return err;
+	}
 
-	return err;
-}
+	v_len = smb_find_cont_xattr(&filp->f_path, fp->ext->stream_name,
+		fp->ext->ssize, &stream_buf, 1);
+	if (v_len < 0) {
+		cifssrv_err("not found stream in xattr : %zd\n", v_len);
+		err = -ENOENT;
+		goto out;
+	}
 
-/**
- * smb_vfs_readlink() - vfs helper for reading value of symlink
- * @path:	path of symlink
- * @buf:	destination buffer for symlink value
- * @lenp:	destination buffer length
- *
- * Return:	symlink value length on success, otherwise error
- */
-int smb_vfs_readlink(struct path *path, char *buf, int lenp)
-{
-	struct inode *inode;
-	mm_segment_t old_fs;
-	int err;
+	if (v_len < size) {
+		wbuf = kzalloc(size, GFP_KERNEL);
+		if (!wbuf) {
+			wbuf = vzalloc(size);
+			if (!wbuf) {
+				kvfree(stream_buf);
+				err = -ENOMEM;
+				goto out;
+			}
+		}
 
-	if (!path)
-		return -ENOENT;
+		if (v_len > 0) {
+			memcpy(wbuf, stream_buf, v_len);
+			kvfree(stream_buf);
+		}
+		stream_buf = wbuf;
+	}
 
-	inode = path->dentry->d_inode;
-	if (!S_ISLNK(inode->i_mode))
-		return -EINVAL;
+	memcpy(&stream_buf[*pos], buf, count);
 
-	old_fs = get_fs();
-	set_fs(KERNEL_DS);
-	err = inode->i_op->readlink(path->dentry, (char __user *)buf, lenp);
-	set_fs(old_fs);
+	err = smb_store_cont_xattr(&filp->f_path, fp->ext->stream_name,
+		(void *)stream_buf, size);
+	kvfree(stream_buf);
 	if (err < 0)
-		cifssrv_err("readlink failed, err = %d\n", err);
+		goto out;
 
+	filp->f_pos = *pos;
+	*written = count;
+	err = 0;
+out:
+	mutex_unlock(&smb_stream_mutex);
+	cifssrv_uncharge_mem(sess, fp->share, size);
 	return err;
 }
 
 /**
- * smb_vfs_rename() - vfs helper for smb rename
- * @sess:		TCP server session
- * @abs_oldname:	old filename
- * @abs_newname:	new filename
- * @oldfid:		file id of old file
+ * smb_vfs_stream_size() - get data size of a stream
+ * @share:	share of the file owning the stream
+ * @dentry:	dentry of file owning the stream
+ * @name:	stream xattr name
+ *
+ * Return:	stream size on success, otherwise error
+ */
+ssize_t smb_vfs_stream_size(struct cifssrv_share *share,
+	struct dentry *dentry, char *name)
+{
+	struct file *sfilp;
+	loff_t size;
+	u64 id;
+
+	if (!share || smb_vfs_stream_ref(dentry, name, &id))
+		return smb_vfs_getxattr(dentry, name, NULL, 0);
+
+	sfilp = smb_vfs_stream_file(share, id, false);
+	if (IS_ERR(sfilp))
+		return PTR_ERR(sfilp);
+	size = i_size_read(file_inode(sfilp));
+	fput(sfilp);
+	return size;
+}
+
+/**
+ * smb_vfs_stream_remove() - remove a stream and its companion file
+ * @share:	share of the file owning the stream
+ * @dentry:	dentry of file owning the stream
+ * @name:	stream xattr name
  *
  * Return:	0 on success, otherwise error
  */
-int smb_vfs_rename(struct cifssrv_sess *sess, char *abs_oldname,
-		char *abs_newname, uint64_t oldfid)
+int smb_vfs_stream_remove(struct cifssrv_share *share,
+	struct dentry *dentry, char *name)
 {
-	struct path oldpath_p, newpath_p;
-	struct dentry *dold, *dnew, *dold_p, *dnew_p, *trap, *child_de;
-	char *oldname = NULL, *newname = NULL;
-	struct file *filp = NULL;
-	struct cifssrv_file *fp = NULL;
+	char *sname = NULL, *ref_name = NULL;
+	u64 id;
 	int err;
 
-	if (abs_oldname) {
-		/* normal case: rename with source filename */
-		oldname = strrchr(abs_oldname, '/');
-		if (oldname && oldname[1] != '\0') {
-			*oldname = '\0';
-			oldname++;
-		}
-		else {
-			cifssrv_err("can't get last component in path %s\n",
-					abs_oldname);
-			return -ENOENT;
+	if (share && !smb_vfs_stream_ref(dentry, name, &id)) {
+		sname = smb_vfs_stream_path(share, id);
+		ref_name = smb_vfs_stream_ref_name(name);
+		if (!sname || !ref_name) {
+			err = -ENOMEM;
+			goto out;
 		}
+	}
 
-		err = kern_path(abs_oldname, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
-				&oldpath_p);
-		if (err) {
-			cifssrv_err("cannot get linux path for %s, err %d\n",
-					abs_oldname, err);
-			return -ENOENT;
-		}
-		dold_p = oldpath_p.dentry;
+	err = vfs_removexattr(dentry, name);
+	if (!err && sname) {
+		vfs_removexattr(dentry, ref_name);
+		smb_vfs_unlink(sname);
+	}
+out:
+	kfree(ref_name);
+	kfree(sname);
+	return err;
+}
 
-		newname = strrchr(abs_newname, '/');
-		if (newname && newname[1] != '\0') {
-			*newname = '\0';
-			newname++;
-		}
-		else {
-			cifssrv_err("can't get last component in path %s\n",
-					abs_newname);
-			err = -ENOMEM;
-			goto out1;
-		}
+/**
+ * smb_vfs_stream_purge() - remove companion files of all streams of a file
+ * @share:	share of the file
+ * @dentry:	dentry of the file
+ *
+ * Called before the file is deleted or its streams are dropped, the
+ * stream xattrs themselves are left to the caller.
+ */
+void smb_vfs_stream_purge(struct cifssrv_share *share, struct dentry *dentry)
+{
+	char *name, *xattr_list = NULL, *sname;
+	struct smb_meta meta;
+	ssize_t list_len;
+	u64 id;
 
-		err = kern_path(abs_newname, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
-				&newpath_p);
-		if (err) {
-			cifssrv_err("cannot get linux path for %s, err = %d\n",
-					abs_newname, err);
-			goto out1;
-		}
-		dnew_p = newpath_p.dentry;
-	} else {
-		/* rename by fid of source file instead of source filename */
-		fp = get_id_from_fidtable(sess, oldfid);
-		if (!fp) {
-			cifssrv_err("can't find filp for fid %llu\n", oldfid);
-			return -ENOENT;
-		}
+	if (!share)
+		return;
 
-		filp = fp->filp;
-		dold_p = filp->f_path.dentry->d_parent;
+	/* no named stream was ever made, nothing to list */
+	if (!smb_vfs_read_meta(dentry, &meta) &&
+			!(le16_to_cpu(meta.flags) & SMB_META_HAS_STREAMS))
+		return;
 
-		newname = strrchr(abs_newname, '/');
-		if (newname && newname[1] != '\0') {
-			*newname = '\0';
-			newname++;
-		}
-		else {
-			cifssrv_err("can't get last component in path %s\n",
-					abs_newname);
-			return -ENOMEM;
-		}
+	list_len = smb_vfs_listxattr(dentry, &xattr_list, XATTR_LIST_MAX);
+	if (list_len <= 0)
+		return;
 
-		err = kern_path(abs_newname, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
-				&newpath_p);
-		if (err) {
-			cifssrv_err("cannot get linux path for %s, err = %d\n",
-					abs_newname, err);
-			return err;
-		}
-		dnew_p = newpath_p.dentry;
+	for (name = xattr_list; name - xattr_list < list_len;
+			name += strlen(name) + 1) {
+		if (strncmp(name, XATTR_NAME_STREAM, XATTR_NAME_STREAM_LEN) ||
+				smb_vfs_stream_ref(dentry, name, &id))
+			continue;
+
+		sname = smb_vfs_stream_path(share, id);
+		if (!sname)
+			break;
+		smb_vfs_unlink(sname);
+		kfree(sname);
 	}
+	vfree(xattr_list);
+}
 
-	cifssrv_debug("oldname %s, newname %s\n", oldname, newname);
-	trap = lock_rename(dold_p, dnew_p);
-	if (abs_oldname) {
-		dold = lookup_one_len(oldname, dold_p, strlen(oldname));
-		err = PTR_ERR(dold);
-		if (IS_ERR(dold)) {
-			cifssrv_err("%s lookup failed with error = %d\n",
-					oldname, err);
-			goto out2;
-		}
-	} else {
-		dold = filp->f_path.dentry;
-		dget(dold);
-	}
+/* upper bound of readahead window kept ahead of a client read stream */
+#define SMB_MAX_RA_WINDOW	(16 * 1024 * 1024)
 
-	spin_lock(&dold->d_lock);
-	list_for_each_entry(child_de, &dold->d_subdirs, d_child) {
-		struct cifssrv_file *child_fp;
+/* amount of recently written data left dirty for out of order writes */
+#define SMB_WRITE_BEHIND_CHUNK	(8 * 1024 * 1024)
 
-		child_fp = find_fp_in_hlist_using_inode(child_de->d_inode);
-		if (child_fp) {
-			cifssrv_debug("not allow to rename dir with opening sub file\n");
-			err = -ENOTEMPTY;
-			spin_unlock(&dold->d_lock);
-			goto out3;
-		}
-	}
-	spin_unlock(&dold->d_lock);
+/**
+ * smb_vfs_read_window() - size of client read window
+ * @server:	TCP server instance of connection
+ * @count:	read byte count
+ *
+ * Return:	outstanding credits times read size, capped at
+ *		SMB_MAX_RA_WINDOW. SMB1 has no credits, so the maximum
+ *		multiplex count is used instead.
+ */
+static loff_t smb_vfs_read_window(struct tcp_server_info *server,
+	size_t count)
+{
+	loff_t window;
 
-	err = -ENOENT;
-	if (!dold->d_inode)
-		goto out3;
-	err = -EINVAL;
-	if (dold == trap)
-		goto out3;
+	window = server->credits_granted ? server->credits_granted :
+		SERVER_MAX_MPX_COUNT;
+	return min_t(loff_t, window * count, SMB_MAX_RA_WINDOW);
+}
 
-	dnew = lookup_one_len(newname, dnew_p, strlen(newname));
-	err = PTR_ERR(dnew);
-	if (IS_ERR(dnew)) {
-		cifssrv_err("%s lookup failed with error = %d\n",
-				newname, err);
-		goto out3;
+/**
+ * smb_vfs_readahead() - issue readahead for a client read stream
+ * @server:	TCP server instance of connection
+ * @fp:		cifssrv file pointer of open file
+ * @pos:	read offset
+ * @count:	read byte count
+ *
+ * SMB clients keep several reads in flight and they can be processed
+ * out of order, which defeats sequential detection in f_ra. A read is
+ * treated as sequential if it falls within the client window, i.e.
+ * outstanding credits times read size, around the end of the stream so
+ * far, and readahead is kept one window ahead of the stream.
+ */
+static void smb_vfs_readahead(struct tcp_server_info *server,
+	struct cifssrv_file *fp, loff_t pos, size_t count)
+{
+	struct file *filp = fp->filp;
+	struct inode *inode = file_inode(filp);
+	struct cifssrv_file_ext *ext;
+	loff_t end = pos + count, window, start, isize;
+	unsigned long nr_pages;
+
+	if (filp->f_mode & FMODE_RANDOM)
+		return;
+
+	ext = cifssrv_file_ext(fp);
+	if (!ext)
+		return;
+
+	window = smb_vfs_read_window(server, count);
+	if (pos + window < ext->ra_end || pos > ext->ra_end + window) {
+		/* random access, restart detection from here */
+		ext->ra_start = pos;
+		ext->ra_end = end;
+		ext->ra_ahead = end;
+		return;
 	}
 
-	err = -ENOTEMPTY;
-	if (dnew == trap)
-		goto out4;
+	if (fp->share) {
+		if (end <= ext->ra_ahead)
+			atomic_long_inc(&fp->share->stats.ra_hits);
+		else
+			atomic_long_inc(&fp->share->stats.ra_misses);
+	}
 
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-	err = vfs_rename(dold_p->d_inode, dold, dnew_p->d_inode, dnew, NULL, 0);
-#else
-	err = vfs_rename(dold_p->d_inode, dold, dnew_p->d_inode, dnew);
-#endif
-	if (err)
-		cifssrv_err("vfs_rename failed err %d\n", err);
+	if (end > ext->ra_end)
+		ext->ra_end = end;
 
-out4:
-	dput(dnew);
-out3:
-	dput(dold);
-out2:
-	unlock_rename(dold_p, dnew_p);
-	path_put(&newpath_p);
-out1:
-	if (abs_oldname)
-		path_put(&oldpath_p);
-	return err;
+	/* refill once less than half a window is left in flight */
+	if (ext->ra_ahead - ext->ra_end >= window / 2)
+		return;
+
+	isize = i_size_read(inode);
+	start = max(ext->ra_ahead, ext->ra_end);
+	if (start >= isize)
+		return;
+
+	nr_pages = DIV_ROUND_UP(min(ext->ra_end + window, isize) - start,
+			PAGE_SIZE);
+	if (filp->f_ra.ra_pages < nr_pages)
+		filp->f_ra.ra_pages = nr_pages;
+	page_cache_sync_readahead(filp->f_mapping, &filp->f_ra, filp,
+			start >> PAGE_SHIFT, nr_pages);
+	ext->ra_ahead = start + ((loff_t)nr_pages << PAGE_SHIFT);
 }
 
 /**
- * smb_vfs_truncate() - vfs helper for smb file truncate
- * @sess:	TCP server session
- * @name:	old filename
- * @fid:	file id of old file
- * @size:	truncate to given size
+ * smb_vfs_drop_range() - drop clean page cache pages of a byte range
+ * @fp:		cifssrv file pointer of open file
+ * @start:	start offset of range
+ * @end:	end offset of range, exclusive
  *
- * Return:	0 on success, otherwise error
+ * Only whole pages are dropped. Dirty, mapped or locked pages are
+ * skipped by invalidate_mapping_pages().
  */
-int smb_vfs_truncate(struct cifssrv_sess *sess, const char *name,
-		uint64_t fid, loff_t size)
+static void smb_vfs_drop_range(struct cifssrv_file *fp, loff_t start,
+	loff_t end)
 {
-	struct path path;
-	struct file *filp;
-	int err = 0;
-	struct cifssrv_file *fp;
-	struct inode *inode;
+	pgoff_t first = DIV_ROUND_UP(start, PAGE_SIZE);
+	pgoff_t last = end >> PAGE_SHIFT;
+	unsigned long nr;
 
-	if (name) {
-		err = kern_path(name, 0, &path);
-		if (err) {
-			cifssrv_err("cannot get linux path for %s, err %d\n",
-					name, err);
-			return err;
-		}
-		err = vfs_truncate(&path, size);
-		if (err)
-			cifssrv_err("truncate failed for %s err %d\n",
-					name, err);
-		path_put(&path);
-	} else {
-		fp = get_id_from_fidtable(sess, fid);
-		if (!fp) {
-			cifssrv_err("failed to get filp for fid %llu\n", fid);
-			return -ENOENT;
-		}
+	if (last <= first)
+		return;
 
-		filp = fp->filp;
-		if (oplocks_enable) {
-			/* Do we need to break any of a levelII oplock? */
-			mutex_lock(&ofile_list_lock);
-			smb_breakII_oplock(sess->server, fp, NULL);
-			mutex_unlock(&ofile_list_lock);
-		} else {
-			inode = file_inode(filp);
-			if (size < inode->i_size) {
-				err = smb_vfs_locks_mandatory_area(filp, size,
-						inode->i_size - 1, F_WRLCK);
-			} else {
-				err = smb_vfs_locks_mandatory_area(filp,
-						inode->i_size, size - 1,
-						F_WRLCK);
-			}
+	nr = invalidate_mapping_pages(fp->filp->f_mapping, first, last - 1);
+	atomic_long_add(nr, &fp->share->stats.dropped_pages);
+}
 
-			if (err == -EAGAIN) {
-				cifssrv_err("failed due to lock\n");
-				return err;
+/**
+ * smb_vfs_read_drop_behind() - drop pages already sent to a streaming reader
+ * @server:	TCP server instance of connection
+ * @fp:		cifssrv file pointer of open file
+ * @count:	read byte count
+ *
+ * Once a sequential read stream grows past the share streaming
+ * threshold, pages more than a client window behind the stream are
+ * dropped so that backup and media traffic does not flush the cache.
+ */
+static void smb_vfs_read_drop_behind(struct tcp_server_info *server,
+	struct cifssrv_file *fp, size_t count)
+{
+	struct cifssrv_file_ext *ext;
+	loff_t end;
+
+	if (!fp->share || !fp->share->config.stream_threshold)
+		return;
+
+	/* set up by smb_vfs_readahead() */
+	ext = fp->ext;
+	if (!ext ||
+	    ext->ra_end - ext->ra_start < fp->share->config.stream_threshold)
+		return;
+
+	if (ext->rd_dropped < ext->ra_start)
+		ext->rd_dropped = ext->ra_start;
+
+	/* keep reads still in flight in the cache */
+	end = ext->ra_end - smb_vfs_read_window(server, count);
+	if (end - ext->rd_dropped < SMB_WRITE_BEHIND_CHUNK)
+		return;
+
+	smb_vfs_drop_range(fp, ext->rd_dropped, end);
+	ext->rd_dropped = end;
+}
+
+/**
+ * smb_vfs_write_behind() - write back and drop pages of a streaming writer
+ * @fp:		cifssrv file pointer of open file
+ * @pos:	write offset
+ * @count:	written byte count
+ *
+ * Once a sequential write stream grows past the share streaming
+ * threshold, writeback is started for all but the most recent chunk,
+ * and pages written back on the previous pass are dropped. Dirty
+ * pages of a large copy then stay bounded instead of piling up until
+ * the flusher threads kick in.
+ */
+static void smb_vfs_write_behind(struct cifssrv_file *fp, loff_t pos,
+	size_t count)
+{
+	struct address_space *mapping = fp->filp->f_mapping;
+	struct cifssrv_file_ext *ext;
+	loff_t end = pos + count, flush_end;
+
+	if (!fp->share || !fp->share->config.stream_threshold)
+		return;
+
+	ext = cifssrv_file_ext(fp);
+	if (!ext)
+		return;
+
+	if (pos > ext->wr_end + SMB_MAX_RA_WINDOW || end < ext->wr_flushed) {
+		/* not sequential, restart detection from here */
+		ext->wr_start = pos;
+		ext->wr_flushed = pos;
+		ext->wr_dropped = pos;
+		ext->wr_end = end;
+		return;
+	}
+
+	if (end > ext->wr_end)
+		ext->wr_end = end;
+
+	if (ext->wr_end - ext->wr_start < fp->share->config.stream_threshold)
+		return;
+
+	flush_end = ext->wr_end - SMB_WRITE_BEHIND_CHUNK;
+	if (flush_end - ext->wr_flushed < SMB_WRITE_BEHIND_CHUNK)
+		return;
+
+	if (ext->wr_dropped < ext->wr_flushed) {
+		filemap_fdatawait_range(mapping, ext->wr_dropped,
+				ext->wr_flushed - 1);
+		smb_vfs_drop_range(fp, ext->wr_dropped, ext->wr_flushed);
+		ext->wr_dropped = ext->wr_flushed;
+	}
+
+	filemap_fdatawrite_range(mapping, ext->wr_flushed, flush_end - 1);
+	ext->wr_flushed = flush_end;
+}
+
+/**
+ * smb_vfs_alloc_rbuf() - allocate buffer for read data
+ * @count:	buffer size
+ *
+ * Return:	kmalloc'ed buffer, or vmalloc'ed one for large reads
+ */
+static char *smb_vfs_alloc_rbuf(size_t count)
+{
+	char *rbuf;
+
+	rbuf = kzalloc(count, GFP_KERNEL);
+	if (!rbuf)
+		rbuf = vmalloc(count);
+	return rbuf;
+}
+
+/**
+ * smb_vfs_use_direct() - check if an I/O should bypass the page cache
+ * @fp:		cifssrv file pointer of open file
+ * @unbuffered:	client asked for unbuffered I/O on this request
+ *
+ * Return:	true if the client asked for unbuffered I/O, either per
+ *		request or with FILE_NO_INTERMEDIATE_BUFFERING at open,
+ *		and the file system supports direct I/O
+ */
+static bool smb_vfs_use_direct(struct cifssrv_file *fp, bool unbuffered)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	struct file *filp = fp->filp;
+
+	if (!unbuffered && !(fp->coption & FILE_NO_INTERMEDIATE_BUFFERING_LE))
+		return false;
+
+	return filp->f_mapping->a_ops && filp->f_mapping->a_ops->direct_IO &&
+		filp->f_op->read_iter && filp->f_op->write_iter;
+#else
+	return false;
+#endif
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+/**
+ * smb_vfs_buf_bvec() - build bio_vec array for the pages of a buffer
+ * @buf:	page aligned, vmalloc'ed data buffer
+ * @len:	buffer length
+ * @nr:	number of bio_vec entries returned
+ *
+ * Return:	allocated bio_vec array, or NULL on allocation failure
+ */
+static struct bio_vec *smb_vfs_buf_bvec(char *buf, size_t len,
+	unsigned int *nr)
+{
+	struct bio_vec *bvec;
+	unsigned int i;
+
+	*nr = DIV_ROUND_UP(len, PAGE_SIZE);
+	bvec = kcalloc(*nr, sizeof(struct bio_vec), GFP_KERNEL);
+	if (!bvec)
+		return NULL;
+
+	for (i = 0; i < *nr; i++) {
+		bvec[i].bv_page = vmalloc_to_page(buf + i * PAGE_SIZE);
+		bvec[i].bv_offset = 0;
+		bvec[i].bv_len = min_t(size_t, PAGE_SIZE, len - i * PAGE_SIZE);
+	}
+	return bvec;
+}
+
+/**
+ * smb_vfs_direct_rw() - direct I/O on a vmalloc'ed buffer
+ * @filp:	file pointer for IO
+ * @buf:	page aligned, vmalloc'ed data buffer
+ * @len:	I/O length, multiple of file system block size
+ * @pos:	file offset, multiple of file system block size
+ * @rw:		READ or WRITE
+ *
+ * Work items run in kworkers without a user mm, so vfs_read() with
+ * O_DIRECT cannot pin the buffer pages. Pass the pages of the buffer
+ * as a bvec iterator to ->read_iter()/->write_iter() instead, with
+ * IOCB_DIRECT set on a synchronous kiocb.
+ *
+ * Return:	number of bytes transferred on success, otherwise error
+ */
+static ssize_t smb_vfs_direct_rw(struct file *filp, char *buf, size_t len,
+	loff_t pos, int rw)
+{
+	struct bio_vec *bvec;
+	struct iov_iter iter;
+	struct kiocb kiocb;
+	unsigned int nr;
+	ssize_t ret;
+
+	bvec = smb_vfs_buf_bvec(buf, len, &nr);
+	if (!bvec)
+		return -ENOMEM;
+
+	iov_iter_bvec(&iter, ITER_BVEC | rw, bvec, nr, len);
+	init_sync_kiocb(&kiocb, filp);
+	kiocb.ki_flags |= IOCB_DIRECT;
+	kiocb.ki_pos = pos;
+
+	if (rw == READ) {
+		ret = filp->f_op->read_iter(&kiocb, &iter);
+	} else {
+		file_start_write(filp);
+		ret = filp->f_op->write_iter(&kiocb, &iter);
+		file_end_write(filp);
+	}
+
+	kfree(bvec);
+	return ret;
+}
+
+/**
+ * smb_vfs_direct_read() - read file data bypassing the page cache
+ * @fp:		cifssrv file pointer of open file
+ * @buf:	buf containing read data
+ * @count:	read byte count
+ * @pos:	file pos
+ *
+ * Unaligned requests are widened to file system block boundaries and
+ * read into a bounce buffer, and the requested range is moved to its
+ * start, so the bounce buffer is handed out as the read data.
+ *
+ * Return:	number of read bytes on success, otherwise error
+ */
+static ssize_t smb_vfs_direct_read(struct cifssrv_file *fp, char **buf,
+	size_t count, loff_t *pos)
+{
+	unsigned int bsize = 1 << file_inode(fp->filp)->i_blkbits;
+	loff_t start = round_down(*pos, bsize);
+	size_t head = *pos - start;
+	size_t len = round_up(head + count, bsize);
+	ssize_t nbytes;
+	char *dbuf;
+
+	dbuf = vmalloc(len);
+	if (!dbuf)
+		return -ENOMEM;
+
+	nbytes = smb_vfs_direct_rw(fp->filp, dbuf, len, start, READ);
+	if (nbytes < 0) {
+		vfree(dbuf);
+		return nbytes;
+	}
+
+	nbytes = nbytes > head ? min_t(ssize_t, nbytes - head, count) : 0;
+	if (head)
+		memmove(dbuf, dbuf + head, nbytes);
+
+	*buf = dbuf;
+	*pos += nbytes;
+	return nbytes;
+}
+
+/**
+ * smb_vfs_direct_write() - write file data bypassing the page cache
+ * @fp:		cifssrv file pointer of open file
+ * @buf:	buf containing data for writing
+ * @count:	write byte count
+ * @pos:	file pos
+ *
+ * Write data sits at an arbitrary offset of the request buffer, so it
+ * is copied to a page aligned bounce buffer first. Requests which are
+ * not file system block aligned are refused with -EINVAL, the caller
+ * falls back to a buffered write followed by writeback of the range.
+ *
+ * Return:	number of written bytes on success, otherwise error
+ */
+static ssize_t smb_vfs_direct_write(struct cifssrv_file *fp, char *buf,
+	size_t count, loff_t *pos)
+{
+	unsigned int bsize = 1 << file_inode(fp->filp)->i_blkbits;
+	ssize_t nbytes;
+	char *dbuf;
+
+	if ((*pos | count) & (bsize - 1))
+		return -EINVAL;
+
+	dbuf = vmalloc(count);
+	if (!dbuf)
+		return -ENOMEM;
+
+	memcpy(dbuf, buf, count);
+	nbytes = smb_vfs_direct_rw(fp->filp, dbuf, count, *pos, WRITE);
+	vfree(dbuf);
+	if (nbytes > 0)
+		*pos += nbytes;
+	return nbytes;
+}
+#else
+static ssize_t smb_vfs_direct_read(struct cifssrv_file *fp, char **buf,
+	size_t count, loff_t *pos)
+{
+	return -EOPNOTSUPP;
+}
+
+static ssize_t smb_vfs_direct_write(struct cifssrv_file *fp, char *buf,
+	size_t count, loff_t *pos)
+{
+	return -EOPNOTSUPP;
+}
+#endif
+
+/* first preallocation for an appending writer, doubled on each refill */
+#define SMB_PREALLOC_MIN	(1024 * 1024)
+
+/**
+ * smb_vfs_prealloc() - preallocate blocks ahead of an appending writer
+ * @fp:		cifssrv file pointer of open file
+ * @pos:	write offset
+ * @count:	write byte count
+ *
+ * Copy engines append in chunks of 1MB or so, and allocating each
+ * chunk as it is written fragments the file when several files grow
+ * at once. Writes at end of file preallocate past it without changing
+ * file size, starting at SMB_PREALLOC_MIN and doubling up to the share
+ * limit while the file keeps growing. Blocks left over are released
+ * by smb_vfs_trim_alloc() at close.
+ */
+static void smb_vfs_prealloc(struct cifssrv_file *fp, loff_t pos,
+	size_t count)
+{
+	struct inode *inode = file_inode(fp->filp);
+	struct cifssrv_file_ext *ext;
+	loff_t end = pos + count, isize, chunk, max;
+	int err;
+
+	if (!fp->share || fp->no_prealloc || !S_ISREG(inode->i_mode))
+		return;
+
+	max = fp->share->config.prealloc_max;
+	if (!max)
+		return;
+
+	isize = i_size_read(inode);
+	if (pos != isize) {
+		/* not an append, start over on the next one */
+		if (fp->ext)
+			fp->ext->prealloc_chunk = 0;
+		return;
+	}
+
+	ext = cifssrv_file_ext(fp);
+	if (!ext)
+		return;
+
+	/* covered by our last preallocation, or by the allocation size */
+	if (end <= ext->prealloc_end || ((loff_t)inode->i_blocks << 9) >= end)
+		return;
+
+	chunk = ext->prealloc_chunk ? ext->prealloc_chunk * 2 :
+		SMB_PREALLOC_MIN;
+	chunk = min(chunk, max);
+
+	err = vfs_fallocate(fp->filp, FALLOC_FL_KEEP_SIZE, isize,
+			end + chunk - isize);
+	if (err) {
+		cifssrv_debug("preallocation failed, err = %d\n", err);
+		if (err == -EOPNOTSUPP)
+			fp->no_prealloc = 1;
+		return;
+	}
+
+	ext->prealloc_chunk = chunk;
+	ext->prealloc_end = end + chunk;
+	atomic_long_add(chunk, &fp->share->stats.prealloc_bytes);
+}
+
+/* writes smaller than this are stored as they are, without a scan */
+#define SMB_ZERO_DETECT_MIN	(64 * 1024)
+
+/**
+ * smb_vfs_zero_scan() - look for all-zero blocks in a write payload
+ * @fp:		cifssrv file pointer of open file
+ * @buf:	write payload
+ * @count:	write byte count
+ * @pos:	write offset
+ *
+ * Only done on shares with zero detection enabled. The time spent is
+ * accounted in share stats so that the cost of the scan can be judged.
+ *
+ * Return:	true if payload has a file system block of zeroes
+ */
+static bool smb_vfs_zero_scan(struct cifssrv_file *fp, char *buf,
+	size_t count, loff_t pos)
+{
+	struct cifssrv_share *share = fp->share;
+	unsigned int bsize;
+	ktime_t start;
+	loff_t off;
+	bool found = false;
+
+	if (!share || !get_attr_zerodetect(&share->config.attr) ||
+			count < SMB_ZERO_DETECT_MIN)
+		return false;
+
+	bsize = 1 << file_inode(fp->filp)->i_blkbits;
+	start = ktime_get();
+	for (off = round_up(pos, bsize); off + bsize <= pos + count;
+			off += bsize) {
+		if (!memchr_inv(buf + (off - pos), 0, bsize)) {
+			found = true;
+			break;
+		}
+	}
+	atomic_long_add(ktime_to_ns(ktime_sub(ktime_get(), start)),
+			&share->stats.zero_scan_ns);
+	atomic_long_add(count, &share->stats.zero_scan_bytes);
+	return found;
+}
+
+/**
+ * smb_vfs_extend_size() - grow a file to a size, never shrink it
+ * @filp:	file pointer of open file
+ * @size:	new end of file
+ *
+ * The size is checked with inode lock held, so a concurrent write that
+ * moved end of file further is never cut back.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb_vfs_extend_size(struct file *filp, loff_t size)
+{
+	struct dentry *dentry = filp->f_path.dentry;
+	struct inode *inode = file_inode(filp);
+	struct iattr attrs;
+	int err = 0;
+
+	attrs.ia_valid = ATTR_SIZE;
+	attrs.ia_size = size;
+	file_start_write(filp);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock(inode);
+	if (size > i_size_read(inode))
+		err = notify_change(dentry, &attrs, NULL);
+	inode_unlock(inode);
+#else
+	mutex_lock(&inode->i_mutex);
+	if (size > i_size_read(inode))
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 13, 0)
+		err = notify_change(dentry, &attrs, NULL);
+#else
+		err = notify_change(dentry, &attrs);
+#endif
+	mutex_unlock(&inode->i_mutex);
+#endif
+	file_end_write(filp);
+	return err;
+}
+
+/**
+ * smb_vfs_write_holes() - write a payload, leaving holes for zero blocks
+ * @fp:		cifssrv file pointer of open file
+ * @buf:	write payload
+ * @count:	write byte count
+ * @pos:	write offset, advanced by bytes written
+ *
+ * Aligned zero blocks inside the file are punched, those past end of
+ * file are skipped and end of file is moved over them afterwards. Other
+ * parts of the payload are written, so the file reads back the same as
+ * if the whole payload had been written.
+ *
+ * Return:	number of bytes written on success, otherwise error
+ */
+static ssize_t smb_vfs_write_holes(struct cifssrv_file *fp, char *buf,
+	size_t count, loff_t *pos)
+{
+	struct file *filp = fp->filp;
+	struct inode *inode = file_inode(filp);
+	unsigned int bsize = 1 << inode->i_blkbits;
+	loff_t start = *pos, end = *pos + count, off = *pos, run, isize;
+	mm_segment_t old_fs;
+	ssize_t nbytes;
+	size_t saved = 0;
+	int err = 0;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (off < end) {
+		if (IS_ALIGNED(off, bsize) && off + bsize <= end &&
+				!memchr_inv(buf + (off - start), 0, bsize)) {
+			for (run = off + bsize; run + bsize <= end &&
+				!memchr_inv(buf + (run - start), 0, bsize);
+				run += bsize)
+				;
+
+			isize = i_size_read(inode);
+			err = 0;
+			if (off < isize)
+				err = vfs_fallocate(filp, FALLOC_FL_PUNCH_HOLE |
+						FALLOC_FL_KEEP_SIZE, off,
+						min(run, isize) - off);
+			if (!err) {
+				saved += run - off;
+				off = run;
+				continue;
 			}
+			if (err != -EOPNOTSUPP)
+				break;
+			/* no hole punching here, write the zeroes */
+			err = 0;
+		} else {
+			for (run = min_t(loff_t, round_up(off + 1, bsize), end);
+				run + bsize <= end &&
+				memchr_inv(buf + (run - start), 0, bsize);
+				run += bsize)
+				;
+			if (run + bsize > end)
+				run = end;
 		}
-		err = vfs_truncate(&filp->f_path, size);
-		if (err)
-			cifssrv_err("truncate failed for fid %llu err %d\n",
-					fid, err);
+
+		nbytes = vfs_write(filp, buf + (off - start), run - off, &off);
+		if (nbytes <= 0) {
+			err = nbytes ? nbytes : -EIO;
+			break;
+		}
+	}
+	set_fs(old_fs);
+
+	/* file ends in skipped zero blocks */
+	if (!err && end > i_size_read(inode))
+		err = smb_vfs_extend_size(filp, end);
+
+	if (off > start && fp->share) {
+		atomic_long_add(saved, &fp->share->stats.zero_saved_bytes);
+		atomic_long_add(off - start - saved,
+				&fp->share->stats.buffered_bytes);
+	}
+
+	if (err && off == start)
+		return err;
+	*pos = off;
+	return off - start;
+}
+
+/*
+ * Group commit: concurrent write-through writes and flushes of one
+ * inode are batched into a single fsync, see smb_vfs_group_fsync().
+ */
+#define SMB_SYNC_HASH_BITS	6
+static DEFINE_HASHTABLE(smb_sync_groups, SMB_SYNC_HASH_BITS);
+static DEFINE_SPINLOCK(smb_sync_lock);
+
+/**
+ * struct smb_sync_group - fsync batching state of an inode
+ * @node:	entry in smb_sync_groups
+ * @inode:	inode being synced
+ * @refcount:	number of syncs in progress on this inode
+ * @running:	a leader is running fsync
+ * @requested:	last ticket handed out
+ * @completed:	last ticket covered by a finished fsync
+ * @start:	start offset of range wanted by pending tickets
+ * @end:	end offset of range wanted by pending tickets
+ * @tickets:	pending tickets, see struct smb_sync_ticket
+ * @wait:	waiters for the running fsync
+ *
+ * All fields are protected by smb_sync_lock.
+ */
+struct smb_sync_group {
+	struct hlist_node	node;
+	struct inode		*inode;
+	int			refcount;
+	bool			running;
+	u64			requested;
+	u64			completed;
+	loff_t			start;
+	loff_t			end;
+	struct list_head	tickets;
+	wait_queue_head_t	wait;
+};
+
+/**
+ * struct smb_sync_ticket - a caller waiting for its data to be synced
+ * @list:	entry in tickets of the group
+ * @ticket:	ticket number
+ * @err:	result of the fsync that covered this ticket
+ * @done:	@err is set
+ *
+ * Lives on the stack of the caller. The fsync covering the ticket sets
+ * its result, so a later fsync can neither hide nor hand out an error.
+ */
+struct smb_sync_ticket {
+	struct list_head	list;
+	u64			ticket;
+	int			err;
+	bool			done;
+};
+
+/**
+ * smb_sync_group_get() - find or add fsync batching state of an inode
+ * @inode:	inode to sync
+ *
+ * Called with smb_sync_lock held, which may be dropped to allocate.
+ *
+ * Return:	referenced group, or NULL on allocation failure
+ */
+static struct smb_sync_group *smb_sync_group_get(struct inode *inode)
+{
+	struct smb_sync_group *group, *new = NULL;
+
+again:
+	hash_for_each_possible(smb_sync_groups, group, node,
+			(unsigned long)inode) {
+		if (group->inode == inode) {
+			group->refcount++;
+			kfree(new);
+			return group;
+		}
+	}
+
+	if (!new) {
+		spin_unlock(&smb_sync_lock);
+		new = kzalloc(sizeof(struct smb_sync_group), GFP_KERNEL);
+		spin_lock(&smb_sync_lock);
+		if (!new)
+			return NULL;
+		goto again;
+	}
+
+	new->inode = inode;
+	new->refcount = 1;
+	new->start = LLONG_MAX;
+	INIT_LIST_HEAD(&new->tickets);
+	init_waitqueue_head(&new->wait);
+	hash_add(smb_sync_groups, &new->node, (unsigned long)inode);
+	return new;
+}
+
+/**
+ * smb_sync_batch_stat() - account size of a group commit batch
+ * @share:	share of synced file
+ * @batch:	number of syncs completed by one fsync
+ */
+static void smb_sync_batch_stat(struct cifssrv_share *share, u64 batch)
+{
+	int bucket = 0;
+
+	if (!share)
+		return;
+
+	if (batch > 1)
+		bucket = min_t(int, fls64(batch - 1),
+				SMB_SYNC_BATCH_BUCKETS - 1);
+	atomic_long_inc(&share->stats.sync_batch[bucket]);
+}
+
+/**
+ * smb_vfs_group_fsync() - fsync a file range together with concurrent syncs
+ * @fp:		cifssrv file pointer of open file
+ * @start:	start offset of range
+ * @end:	end offset of range, inclusive
+ *
+ * Each caller takes a ticket. If no fsync is running on the inode, the
+ * caller leads one over the union of the ranges of all pending tickets
+ * and completes them together. A caller arriving while an fsync runs
+ * waits for the next one, as its data may postdate the running one.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb_vfs_group_fsync(struct cifssrv_file *fp, loff_t start,
+	loff_t end)
+{
+	struct smb_sync_group *group;
+	struct smb_sync_ticket me, *t, *tmp;
+	loff_t sync_start, sync_end;
+	u64 target, batch;
+	int err;
+
+	spin_lock(&smb_sync_lock);
+	group = smb_sync_group_get(file_inode(fp->filp));
+	if (!group) {
+		spin_unlock(&smb_sync_lock);
+		return vfs_fsync_range(fp->filp, start, end, 0);
+	}
+
+	me.ticket = ++group->requested;
+	me.err = 0;
+	me.done = false;
+	list_add_tail(&me.list, &group->tickets);
+	group->start = min(group->start, start);
+	group->end = max(group->end, end);
+
+	while (!me.done) {
+		if (group->running) {
+			spin_unlock(&smb_sync_lock);
+			wait_event(group->wait, READ_ONCE(me.done) ||
+					!READ_ONCE(group->running));
+			spin_lock(&smb_sync_lock);
+			continue;
+		}
+
+		group->running = true;
+		target = group->requested;
+		batch = target - group->completed;
+		sync_start = group->start;
+		sync_end = group->end;
+		group->start = LLONG_MAX;
+		group->end = 0;
+		spin_unlock(&smb_sync_lock);
+
+		err = vfs_fsync_range(fp->filp, sync_start, sync_end, 0);
+		smb_sync_batch_stat(fp->share, batch);
+
+		spin_lock(&smb_sync_lock);
+		list_for_each_entry_safe(t, tmp, &group->tickets, list) {
+			if (t->ticket > target)
+				continue;
+			t->err = err;
+			list_del(&t->list);
+			WRITE_ONCE(t->done, true);
+		}
+		group->completed = target;
+		group->running = false;
+		wake_up_all(&group->wait);
+	}
+
+	err = me.err;
+	if (--group->refcount == 0)
+		hash_del(&group->node);
+	else
+		group = NULL;
+	spin_unlock(&smb_sync_lock);
+
+	kfree(group);
+	return err;
+}
+
+/**
+ * smb_vfs_read() - vfs helper for smb file read
+ * @sess:	TCP server session
+ * @fid:	file id of open file
+ * @buf:	buf containing read data
+ * @count:	read byte count
+ * @pos:	file pos
+ * @unbuffered:	bypass the page cache if the file system allows it
+ *
+ * Return:	number of read bytes on success, otherwise error
+ */
+int smb_vfs_read(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
+	char **buf, size_t count, loff_t *pos, bool unbuffered)
+{
+	struct file *filp;
+	ssize_t nbytes;
+	mm_segment_t old_fs;
+	struct cifssrv_file *fp;
+	char *rbuf, *name;
+	struct inode *inode;
+	char namebuf[NAME_MAX];
+	int ret;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp) {
+		cifssrv_err("failed to get filp for fid %llu\n", fid);
+		return -ENOENT;
+	}
+
+	filp = fp->filp;
+	inode = filp->f_path.dentry->d_inode;
+	if (S_ISDIR(inode->i_mode))
+		return -EISDIR;
+
+	if (unlikely(count == 0))
+		return 0;
+
+#ifdef CONFIG_CIFS_SMB2_SERVER
+	if (fp->is_durable && fp->persistent_id != p_id) {
+		cifssrv_err("persistent id mismatch : %llu, %llu\n",
+				fp->persistent_id, p_id);
+		return -ENOENT;
+	}
+
+	if (!(fp->daccess & (FILE_READ_DATA_LE | FILE_GENERIC_READ_LE |
+		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE))) {
+		cifssrv_err("no right to read(%llu)\n", fid);
+		return -EACCES;
+	}
+#endif
+	if (fp->is_stream) {
+		rbuf = smb_vfs_alloc_rbuf(count);
+		if (!rbuf)
+			return -ENOMEM;
+
+		nbytes = smb_vfs_stream_read(fp, rbuf, count, pos);
+		if (nbytes < 0)
+			kvfree(rbuf);
+		else
+			*buf = rbuf;
+		return nbytes;
+	}
+
+	ret = smb_vfs_locks_mandatory_area(filp, *pos, *pos + count - 1,
+			F_RDLCK);
+	if (ret == -EAGAIN) {
+		cifssrv_err("%s: unable to read due to lock\n",
+				__func__);
+		return ret;
+	}
+
+	if (smb_vfs_use_direct(fp, unbuffered)) {
+		nbytes = smb_vfs_direct_read(fp, buf, count, pos);
+		if (nbytes != -EINVAL) {
+			if (nbytes >= 0) {
+				filp->f_pos = *pos;
+				if (fp->share)
+					atomic_long_add(nbytes,
+						&fp->share->stats.direct_bytes);
+			}
+			return nbytes;
+		}
+		/* file system refused this request, retry buffered */
+	}
+
+	rbuf = smb_vfs_alloc_rbuf(count);
+	if (!rbuf)
+		return -ENOMEM;
+
+	smb_vfs_readahead(sess->server, fp, *pos, count);
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+
+	nbytes = vfs_read(filp, rbuf, count, pos);
+	set_fs(old_fs);
+	if (nbytes < 0) {
+		name = d_path(&filp->f_path, namebuf, sizeof(namebuf));
+		if (IS_ERR(name))
+			name = "(error)";
+		cifssrv_err("smb read failed for (%s), err = %zd\n",
+				name, nbytes);
+		kvfree(rbuf);
+	} else {
+		*buf = rbuf;
+		filp->f_pos = *pos;
+		if (fp->share)
+			atomic_long_add(nbytes,
+				&fp->share->stats.buffered_bytes);
+		smb_vfs_read_drop_behind(sess->server, fp, count);
+	}
+
+	return nbytes;
+}
+
+/**
+ * smb_vfs_write() - vfs helper for smb file write
+ * @sess:	TCP server session
+ * @fid:	file id of open file
+ * @buf:	buf containing data for writing
+ * @count:	read byte count
+ * @pos:	file pos
+ * @sync:	fsync after write
+ * @unbuffered:	bypass the page cache if the file system allows it
+ * @written:	number of bytes written
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_write(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id,
+	char *buf, size_t count, loff_t *pos, bool sync, bool unbuffered,
+	ssize_t *written)
+{
+	struct file *filp;
+	loff_t	offset = *pos;
+	mm_segment_t old_fs;
+	struct cifssrv_file *fp;
+	bool writeback;
+	int err;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp) {
+		cifssrv_err("failed to get filp for fid %llu session = 0x%p\n",
+				fid, sess);
+		return -ENOENT;
+	}
+
+#ifdef CONFIG_CIFS_SMB2_SERVER
+	if (fp->is_durable && fp->persistent_id != p_id) {
+		cifssrv_err("persistent id mismatch : %llu, %llu\n",
+			fp->persistent_id, p_id);
+		return -ENOENT;
+	}
+
+	if (!(fp->daccess & (FILE_WRITE_DATA_LE | FILE_GENERIC_WRITE_LE |
+		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE))) {
+		cifssrv_err("no right to write(%llu)\n", fid);
+		return -EACCES;
+	}
+#endif
+
+	filp = fp->filp;
+
+	if (fp->is_stream)
+		return smb_vfs_stream_write(sess, fp, buf, count, pos, written);
+
+	err = smb_vfs_locks_mandatory_area(filp, *pos, *pos + count - 1,
+			F_WRLCK);
+	if (err == -EAGAIN) {
+		cifssrv_err("%s: unable to write due to lock\n",
+				__func__);
+		return err;
+	}
+
+	if (oplocks_enable) {
+		/* Do we need to break any of a levelII oplock? */
+		mutex_lock(&ofile_list_lock);
+		smb_breakII_oplock(sess->server, fp, NULL);
+		mutex_unlock(&ofile_list_lock);
+	}
+
+	if (smb_vfs_zero_scan(fp, buf, count, *pos)) {
+		writeback = false;
+		err = smb_vfs_write_holes(fp, buf, count, pos);
+		goto written;
+	}
+
+	smb_vfs_prealloc(fp, *pos, count);
+
+	writeback = smb_vfs_use_direct(fp, unbuffered);
+	err = -EINVAL;
+	if (writeback)
+		err = smb_vfs_direct_write(fp, buf, count, pos);
+
+	if (err == -EINVAL) {
+		old_fs = get_fs();
+		set_fs(KERNEL_DS);
+		err = vfs_write(filp, buf, count, pos);
+		set_fs(old_fs);
+		if (err >= 0 && fp->share)
+			atomic_long_add(err, &fp->share->stats.buffered_bytes);
+	} else {
+		writeback = false;
+		if (err >= 0 && fp->share)
+			atomic_long_add(err, &fp->share->stats.direct_bytes);
+	}
+written:
+	if (err < 0) {
+		cifssrv_debug("smb write failed, err = %d\n", err);
+		return err;
+	}
+
+	filp->f_pos = *pos;
+	*written = err;
+	err = 0;
+	smb_vfs_offload_invalidate(file_inode(filp), offset, *written);
+	smb_vfs_statfs_dirty(fp->share, *written);
+	if (writeback && *written) {
+		/*
+		 * Unaligned unbuffered write went through the page cache,
+		 * write it out and drop it as the client asked.
+		 */
+		err = filemap_write_and_wait_range(filp->f_mapping, offset,
+				offset + *written - 1);
+		if (err < 0) {
+			cifssrv_err("writeback failed for fid %llu, err = %d\n",
+					fid, err);
+			return err;
+		}
+		invalidate_mapping_pages(filp->f_mapping, offset >> PAGE_SHIFT,
+				(offset + *written - 1) >> PAGE_SHIFT);
+	}
+
+	if (sync || fp->coption & FILE_WRITE_THROUGH_LE) {
+		err = smb_vfs_group_fsync(fp, offset, offset + *written);
+		if (err < 0)
+			cifssrv_err("fsync failed for fid %llu, err = %d\n",
+					fid, err);
+	} else {
+		smb_vfs_write_behind(fp, offset, *written);
+	}
+
+	return err;
+}
+
+/**
+ * smb_vfs_splice_range() - copy a range through the page cache
+ * @src:	source file
+ * @src_off:	offset in source file, advanced by the copied length
+ * @dst:	destination file
+ * @dst_off:	offset in destination file, advanced by the copied length
+ * @len:	number of bytes to copy
+ *
+ * Unlike vfs_copy_file_range(), do_splice_direct() leaves freeze
+ * protection of the destination to its caller.
+ *
+ * Return:	number of bytes copied on success, otherwise error
+ */
+static ssize_t smb_vfs_splice_range(struct file *src, loff_t *src_off,
+	struct file *dst, loff_t *dst_off, size_t len)
+{
+	ssize_t ret;
+
+	file_start_write(dst);
+	ret = do_splice_direct(src, src_off, dst, dst_off, len, 0);
+	file_end_write(dst);
+	return ret;
+}
+
+/**
+ * smb_vfs_copy_range() - copy a range from a file to an open file
+ * @sess:	session the target file was opened on
+ * @src:	source file
+ * @src_off:	offset in source file
+ * @dst_fp:	destination file, opened with write access
+ * @dst_off:	offset in destination file
+ * @len:	number of bytes to copy
+ * @copied:	number of bytes copied
+ *
+ * Data does not leave the server: the file system may clone or copy the
+ * range itself, otherwise it is spliced through the page cache.
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb_vfs_copy_range(struct cifssrv_sess *sess, struct file *src,
+	loff_t src_off, struct cifssrv_file *dst_fp, loff_t dst_off,
+	size_t len, ssize_t *copied)
+{
+	struct file *dst = dst_fp->filp;
+	loff_t dst_start = dst_off;
+	ssize_t ret = 0;
+	int err;
+
+	*copied = 0;
+	if (dst_fp->is_stream)
+		return -EOPNOTSUPP;
+
+	if (!len)
+		return 0;
+
+	/* whole chunk must be readable, a short copy is never returned */
+	if (src_off + len > i_size_read(file_inode(src)))
+		return -ENODATA;
+
+	if (smb_vfs_locks_mandatory_area(src, src_off, src_off + len - 1,
+			F_RDLCK) == -EAGAIN ||
+		smb_vfs_locks_mandatory_area(dst, dst_off, dst_off + len - 1,
+			F_WRLCK) == -EAGAIN) {
+		cifssrv_err("%s: unable to copy due to lock\n", __func__);
+		return -EAGAIN;
+	}
+
+	if (oplocks_enable) {
+		mutex_lock(&ofile_list_lock);
+		smb_breakII_oplock(sess->server, dst_fp, NULL);
+		mutex_unlock(&ofile_list_lock);
+	}
+
+	smb_vfs_prealloc(dst_fp, dst_off, len);
+	smb_vfs_offload_invalidate(file_inode(dst), dst_off, len);
+
+	while (len) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+		ret = vfs_copy_file_range(src, src_off, dst, dst_off, len, 0);
+		if (ret > 0) {
+			src_off += ret;
+			dst_off += ret;
+		} else if (ret == -EOPNOTSUPP || ret == -EXDEV ||
+				ret == -EINVAL)
+			ret = smb_vfs_splice_range(src, &src_off, dst,
+					&dst_off, len);
+#else
+		ret = smb_vfs_splice_range(src, &src_off, dst, &dst_off, len);
+#endif
+		if (ret <= 0)
+			break;
+		len -= ret;
+		*copied += ret;
+	}
+
+	if (*copied && dst_fp->share)
+		atomic_long_add(*copied, &dst_fp->share->stats.copy_bytes);
+
+	if (ret < 0) {
+		cifssrv_debug("copy failed, err = %zd\n", ret);
+		return ret;
+	}
+
+	if (len)
+		return -ENODATA;
+
+	if (dst_fp->coption & FILE_WRITE_THROUGH_LE) {
+		err = smb_vfs_group_fsync(dst_fp, dst_start,
+				dst_start + *copied);
+		if (err < 0)
+			return err;
+	} else {
+		smb_vfs_write_behind(dst_fp, dst_start, *copied);
+	}
+
+	return 0;
+}
+
+/**
+ * smb_vfs_copy_file_range() - copy a range between two open files
+ * @sess:	session the files were opened on
+ * @src_fp:	source file, opened with read access
+ * @src_off:	offset in source file
+ * @dst_fp:	destination file, opened with write access
+ * @dst_off:	offset in destination file
+ * @len:	number of bytes to copy
+ * @copied:	number of bytes copied
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_copy_file_range(struct cifssrv_sess *sess,
+	struct cifssrv_file *src_fp, loff_t src_off,
+	struct cifssrv_file *dst_fp, loff_t dst_off, size_t len,
+	ssize_t *copied)
+{
+	*copied = 0;
+	if (src_fp->is_stream)
+		return -EOPNOTSUPP;
+
+	return smb_vfs_copy_range(sess, src_fp->filp, src_off, dst_fp,
+			dst_off, len, copied);
+}
+
+/**
+ * smb_vfs_can_reflink() - check file system type for block sharing
+ * @f_type:	file system magic from statfs
+ *
+ * Used to advertise block refcounting, whether an individual XFS volume
+ * was made with reflink enabled is only known once cloning is tried.
+ *
+ * Return:	true if file system can share blocks between files
+ */
+bool smb_vfs_can_reflink(long f_type)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+	return f_type == BTRFS_SUPER_MAGIC || f_type == XFS_SUPER_MAGIC;
+#else
+	return false;
+#endif
+}
+
+/**
+ * smb_vfs_clone_range() - share blocks of a file with an open file
+ * @sess:	session the target file was opened on
+ * @src:	source file
+ * @src_off:	offset in source file
+ * @dst_fp:	destination file, opened with write access
+ * @dst_off:	offset in destination file
+ * @len:	number of bytes to clone
+ *
+ * Return:	0 on success, -EOPNOTSUPP if file system can not clone,
+ *		otherwise error
+ */
+static int smb_vfs_clone_range(struct cifssrv_sess *sess, struct file *src,
+	loff_t src_off, struct cifssrv_file *dst_fp, loff_t dst_off,
+	loff_t len)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 5, 0)
+	struct file *dst = dst_fp->filp;
+	loff_t ret;
+
+	if (dst_fp->is_stream)
+		return -EOPNOTSUPP;
+
+	if (!len)
+		return 0;
+
+	if (src_off + len > i_size_read(file_inode(src)))
+		return -EINVAL;
+
+	if (smb_vfs_locks_mandatory_area(src, src_off, src_off + len - 1,
+			F_RDLCK) == -EAGAIN ||
+		smb_vfs_locks_mandatory_area(dst, dst_off, dst_off + len - 1,
+			F_WRLCK) == -EAGAIN) {
+		cifssrv_err("%s: unable to clone due to lock\n", __func__);
+		return -EAGAIN;
+	}
+
+	if (oplocks_enable) {
+		mutex_lock(&ofile_list_lock);
+		smb_breakII_oplock(sess->server, dst_fp, NULL);
+		mutex_unlock(&ofile_list_lock);
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	ret = vfs_clone_file_range(src, src_off, dst, dst_off, len, 0);
+	if (ret >= 0 && ret != len)
+		ret = -EINVAL;
+#else
+	ret = vfs_clone_file_range(src, src_off, dst, dst_off, len);
+#endif
+	if (ret < 0) {
+		cifssrv_debug("clone failed, err = %lld\n", ret);
+		return ret;
+	}
+
+	smb_vfs_offload_invalidate(file_inode(dst), dst_off, len);
+	if (dst_fp->share)
+		atomic_long_add(len, &dst_fp->share->stats.clone_bytes);
+
+	if (dst_fp->coption & FILE_WRITE_THROUGH_LE)
+		return smb_vfs_group_fsync(dst_fp, dst_off, dst_off + len);
+	return 0;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/**
+ * smb_vfs_clone_file_range() - share blocks of a range with another file
+ * @sess:	session the files were opened on
+ * @src_fp:	source file, opened with read access
+ * @src_off:	offset in source file
+ * @dst_fp:	destination file, opened with write access
+ * @dst_off:	offset in destination file
+ * @len:	number of bytes to clone
+ *
+ * Return:	0 on success, -EOPNOTSUPP if file system can not clone,
+ *		otherwise error
+ */
+int smb_vfs_clone_file_range(struct cifssrv_sess *sess,
+	struct cifssrv_file *src_fp, loff_t src_off,
+	struct cifssrv_file *dst_fp, loff_t dst_off, loff_t len)
+{
+	if (src_fp->is_stream)
+		return -EOPNOTSUPP;
+
+	return smb_vfs_clone_range(sess, src_fp->filp, src_off, dst_fp,
+			dst_off, len);
+}
+
+/* offload tokens handed out by FSCTL_OFFLOAD_READ */
+#define SMB_ODX_TOKEN_TYPE	0x43534f31
+#define SMB_ODX_ZERO_TOKEN_TYPE	0xffff0001
+#define SMB_ODX_DEFAULT_TTL	(30 * HZ)
+#define SMB_ODX_MAX_TTL		(300 * HZ)
+#define SMB_ODX_MAX_TOKENS	256
+/* offsets and lengths are in units of logical sector */
+#define SMB_ODX_ALIGN		512
+
+/**
+ * struct smb_odx_token - file range described by an offload token
+ * @node:	entry in smb_odx_tokens
+ * @id:		token id, also the hash key
+ * @secret:	random part of token, so that ids can not be guessed
+ * @filp:	source file, referenced until token is dropped
+ * @off:	start of range
+ * @len:	length of range
+ * @expires:	jiffies after which token is no longer accepted
+ */
+struct smb_odx_token {
+	struct hlist_node node;
+	u64 id;
+	u8 secret[16];
+	struct file *filp;
+	loff_t off;
+	loff_t len;
+	unsigned long expires;
+};
+
+static DEFINE_HASHTABLE(smb_odx_tokens, 6);
+static DEFINE_SPINLOCK(smb_odx_lock);
+static atomic_t smb_odx_count = ATOMIC_INIT(0);
+static atomic64_t smb_odx_seq = ATOMIC64_INIT(0);
+static void smb_odx_gc(struct work_struct *work);
+static DECLARE_DELAYED_WORK(smb_odx_gc_work, smb_odx_gc);
+
+/* called with smb_odx_lock held, files are put by smb_odx_free() */
+static void smb_odx_unhash(struct smb_odx_token *tok,
+	struct hlist_head *dead)
+{
+	hash_del(&tok->node);
+	atomic_dec(&smb_odx_count);
+	hlist_add_head(&tok->node, dead);
+}
+
+static void smb_odx_free(struct hlist_head *dead)
+{
+	struct smb_odx_token *tok;
+	struct hlist_node *tmp;
+
+	hlist_for_each_entry_safe(tok, tmp, dead, node) {
+		fput(tok->filp);
+		kfree(tok);
+	}
+}
+
+/* drop expired tokens, so that their source files are released */
+static void smb_odx_gc(struct work_struct *work)
+{
+	struct smb_odx_token *tok;
+	struct hlist_node *tmp;
+	HLIST_HEAD(dead);
+	unsigned long next = 0;
+	int bkt;
+
+	spin_lock(&smb_odx_lock);
+	hash_for_each_safe(smb_odx_tokens, bkt, tmp, tok, node) {
+		if (time_after_eq(jiffies, tok->expires))
+			smb_odx_unhash(tok, &dead);
+		else if (!next || time_before(tok->expires, next))
+			next = tok->expires;
+	}
+	spin_unlock(&smb_odx_lock);
+
+	smb_odx_free(&dead);
+	if (next)
+		schedule_delayed_work(&smb_odx_gc_work,
+				time_after(next, jiffies) ? next - jiffies : 0);
+}
+
+/**
+ * smb_vfs_offload_invalidate() - drop offload tokens of a modified range
+ * @inode:	inode being modified
+ * @off:	start of modified range
+ * @len:	length of modified range
+ *
+ * A token promises the data as it was when the token was issued, once
+ * that data changes the token must not be used.
+ */
+void smb_vfs_offload_invalidate(struct inode *inode, loff_t off, loff_t len)
+{
+	struct smb_odx_token *tok;
+	struct hlist_node *tmp;
+	HLIST_HEAD(dead);
+	int bkt;
+
+	if (!atomic_read(&smb_odx_count))
+		return;
+
+	spin_lock(&smb_odx_lock);
+	hash_for_each_safe(smb_odx_tokens, bkt, tmp, tok, node) {
+		if (file_inode(tok->filp) == inode &&
+				off < tok->off + tok->len &&
+				tok->off < off + len)
+			smb_odx_unhash(tok, &dead);
+	}
+	spin_unlock(&smb_odx_lock);
+
+	smb_odx_free(&dead);
+}
+
+/**
+ * smb_vfs_offload_read() - issue a token for a range of a file
+ * @fp:		cifssrv file pointer, opened with read access
+ * @off:	start of range
+ * @len:	length of range
+ * @ttl:	token lifetime in milliseconds, 0 for default
+ * @token:	token to fill in
+ * @xfer_len:	length of range the token describes, clipped to EOF
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_offload_read(struct cifssrv_file *fp, loff_t off, loff_t len,
+	unsigned int ttl, struct storage_offload_token *token,
+	loff_t *xfer_len)
+{
+	struct smb_odx_token *tok;
+	loff_t size = i_size_read(file_inode(fp->filp));
+	unsigned long expires;
+
+	if (fp->is_stream)
+		return -EOPNOTSUPP;
+
+	if (off < 0 || len <= 0 || (off | len) & (SMB_ODX_ALIGN - 1))
+		return -EINVAL;
+
+	if (off >= size)
+		return -ENODATA;
+
+	expires = ttl ? min_t(unsigned long, msecs_to_jiffies(ttl),
+			SMB_ODX_MAX_TTL) : SMB_ODX_DEFAULT_TTL;
+
+	tok = kzalloc(sizeof(struct smb_odx_token), GFP_KERNEL);
+	if (!tok)
+		return -ENOMEM;
+
+	/* data written back, so clone can be used by the consumer */
+	filemap_write_and_wait_range(fp->filp->f_mapping, off,
+			min(off + len, size) - 1);
+
+	tok->id = atomic64_inc_return(&smb_odx_seq);
+	get_random_bytes(tok->secret, sizeof(tok->secret));
+	tok->filp = get_file(fp->filp);
+	tok->off = off;
+	tok->len = min(len, size - off);
+	tok->expires = jiffies + expires;
+
+	spin_lock(&smb_odx_lock);
+	if (atomic_read(&smb_odx_count) >= SMB_ODX_MAX_TOKENS) {
+		spin_unlock(&smb_odx_lock);
+		fput(tok->filp);
+		kfree(tok);
+		return -EBUSY;
+	}
+	hash_add(smb_odx_tokens, &tok->node, tok->id);
+	atomic_inc(&smb_odx_count);
+	spin_unlock(&smb_odx_lock);
+	schedule_delayed_work(&smb_odx_gc_work, expires);
+
+	memset(token, 0, sizeof(struct storage_offload_token));
+	token->TokenType = cpu_to_be32(SMB_ODX_TOKEN_TYPE);
+	token->TokenIdLength = cpu_to_be16(sizeof(token->TokenId));
+	*(__le64 *)token->TokenId = cpu_to_le64(tok->id);
+	memcpy(&token->TokenId[8], tok->secret, sizeof(tok->secret));
+	*xfer_len = tok->len;
+	return 0;
+}
+
+/**
+ * smb_vfs_offload_write() - write the range described by a token
+ * @sess:	session the target file was opened on
+ * @dst_fp:	target file, opened with write access
+ * @dst_off:	offset in target file
+ * @len:	number of bytes to write
+ * @xfer_off:	offset into the range described by @token
+ * @token:	token from smb_vfs_offload_read() or the zero token
+ * @written:	number of bytes written
+ *
+ * Data is cloned when the file system can share blocks, otherwise it is
+ * copied on the server.
+ *
+ * Return:	0 on success, -ENOKEY for unknown or expired token,
+ *		otherwise error
+ */
+int smb_vfs_offload_write(struct cifssrv_sess *sess,
+	struct cifssrv_file *dst_fp, loff_t dst_off, loff_t len,
+	loff_t xfer_off, struct storage_offload_token *token,
+	loff_t *written)
+{
+	struct smb_odx_token *tok;
+	struct file *src = NULL;
+	loff_t src_off = 0;
+	ssize_t copied;
+	u64 id;
+	int err;
+
+	*written = 0;
+	if (dst_off < 0 || len <= 0 || xfer_off < 0 ||
+			(dst_off | len | xfer_off) & (SMB_ODX_ALIGN - 1))
+		return -EINVAL;
+
+	if (be32_to_cpu(token->TokenType) == SMB_ODX_ZERO_TOKEN_TYPE) {
+		err = smb_vfs_zero_data(sess, dst_fp, dst_off, len, false);
+		if (!err)
+			*written = len;
+		return err;
+	}
+
+	if (be32_to_cpu(token->TokenType) != SMB_ODX_TOKEN_TYPE)
+		return -ENOKEY;
+
+	id = le64_to_cpu(*(__le64 *)token->TokenId);
+	spin_lock(&smb_odx_lock);
+	hash_for_each_possible(smb_odx_tokens, tok, node, id) {
+		if (tok->id != id || memcmp(tok->secret, &token->TokenId[8],
+				sizeof(tok->secret)))
+			continue;
+		if (time_before(jiffies, tok->expires) &&
+				xfer_off < tok->len) {
+			src = get_file(tok->filp);
+			src_off = tok->off + xfer_off;
+			len = min(len, tok->len - xfer_off);
+		}
+		break;
+	}
+	spin_unlock(&smb_odx_lock);
+
+	if (!src)
+		return -ENOKEY;
+
+	err = smb_vfs_clone_range(sess, src, src_off, dst_fp, dst_off, len);
+	if (!err) {
+		*written = len;
+	} else {
+		err = smb_vfs_copy_range(sess, src, src_off, dst_fp, dst_off,
+				len, &copied);
+		*written = copied;
+	}
+	fput(src);
+	return err;
+}
+
+/**
+ * smb_vfs_offload_exit() - drop all offload tokens
+ */
+void smb_vfs_offload_exit(void)
+{
+	struct smb_odx_token *tok;
+	struct hlist_node *tmp;
+	HLIST_HEAD(dead);
+	int bkt;
+
+	cancel_delayed_work_sync(&smb_odx_gc_work);
+	spin_lock(&smb_odx_lock);
+	hash_for_each_safe(smb_odx_tokens, bkt, tmp, tok, node)
+		smb_odx_unhash(tok, &dead);
+	spin_unlock(&smb_odx_lock);
+	smb_odx_free(&dead);
+}
+
+/**
+ * struct smb_aio - asynchronous direct I/O issued for a smb work
+ * @kiocb:	kiocb submitted to the file system
+ * @bvec:	pages of @buf
+ * @work:	smb work to complete once I/O is done
+ * @share:	share of the file, for queue depth accounting
+ * @buf:	page aligned bounce buffer
+ * @head:	bytes read ahead of requested offset for block alignment
+ * @count:	requested byte count
+ * @rw:		READ or WRITE
+ * @ret:	result of I/O
+ */
+struct smb_aio {
+	struct kiocb		kiocb;
+	struct bio_vec		*bvec;
+	struct smb_work		*work;
+	struct cifssrv_share	*share;
+	char			*buf;
+	size_t			head;
+	size_t			count;
+	int			rw;
+	long			ret;
+};
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+/**
+ * smb_vfs_aio_complete() - kiocb completion of asynchronous direct I/O
+ * @kiocb:	completed kiocb
+ * @ret:	result of I/O
+ * @ret2:	unused
+ *
+ * May run in interrupt context, so the response is built and sent
+ * from a work queue. Freeze protection taken for a write at submission
+ * is dropped here, once the data is no longer in flight.
+ */
+static void smb_vfs_aio_complete(struct kiocb *kiocb, long ret, long ret2)
+{
+	struct smb_aio *aio = container_of(kiocb, struct smb_aio, kiocb);
+
+	if (aio->rw == WRITE) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+		struct inode *inode = file_inode(kiocb->ki_filp);
+
+		/* tell lockdep this context now owns it, as fs/aio.c does */
+		if (S_ISREG(inode->i_mode))
+			__sb_writers_acquired(inode->i_sb, SB_FREEZE_WRITE);
+#endif
+		file_end_write(kiocb->ki_filp);
+	}
+
+	aio->ret = ret;
+	queue_async_smb_work(aio->work);
+}
+
+/**
+ * smb_vfs_aio_submit() - submit asynchronous direct I/O for a smb work
+ * @work:	smb work to complete once I/O is done
+ * @fp:		cifssrv file pointer of open file
+ * @buf:	page aligned, vmalloc'ed data buffer, owned by aio from now
+ * @len:	I/O length, multiple of file system block size
+ * @pos:	file offset, multiple of file system block size
+ * @rw:		READ or WRITE
+ * @head:	bytes of @buf ahead of the requested range
+ * @count:	requested byte count
+ *
+ * I/O that completes at submission is completed through the same
+ * work queue path as I/O that completes later.
+ *
+ * Return:	-EIOCBQUEUED if submitted, otherwise -ENOMEM
+ */
+static int smb_vfs_aio_submit(struct smb_work *work, struct cifssrv_file *fp,
+	char *buf, size_t len, loff_t pos, int rw, size_t head, size_t count)
+{
+	struct file *filp = fp->filp;
+	struct iov_iter iter;
+	struct smb_aio *aio;
+	unsigned int nr;
+	ssize_t ret;
+	int depth;
+
+	aio = kzalloc(sizeof(struct smb_aio), GFP_KERNEL);
+	if (!aio)
+		goto out_buf;
+
+	aio->bvec = smb_vfs_buf_bvec(buf, len, &nr);
+	if (!aio->bvec)
+		goto out_aio;
+
+	aio->work = work;
+	aio->share = fp->share;
+	aio->buf = buf;
+	aio->head = head;
+	aio->count = count;
+	aio->rw = rw;
+	work->aio = aio;
+
+	if (aio->share) {
+		depth = atomic_inc_return(&aio->share->stats.aio_inflight);
+		if (depth > atomic_read(&aio->share->stats.aio_max_inflight))
+			atomic_set(&aio->share->stats.aio_max_inflight, depth);
+	}
+
+	iov_iter_bvec(&iter, ITER_BVEC | rw, aio->bvec, nr, len);
+	init_sync_kiocb(&aio->kiocb, get_file(filp));
+	aio->kiocb.ki_flags |= IOCB_DIRECT;
+	aio->kiocb.ki_pos = pos;
+	aio->kiocb.ki_complete = smb_vfs_aio_complete;
+
+	if (rw == READ) {
+		ret = filp->f_op->read_iter(&aio->kiocb, &iter);
+	} else {
+		/* held until smb_vfs_aio_complete(), fsfreeze waits for it */
+		file_start_write(filp);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 3, 0)
+		/* completion may run before write_iter returns */
+		if (S_ISREG(file_inode(filp)->i_mode))
+			__sb_writers_release(file_inode(filp)->i_sb,
+					SB_FREEZE_WRITE);
+#endif
+		ret = filp->f_op->write_iter(&aio->kiocb, &iter);
+	}
+
+	if (ret != -EIOCBQUEUED)
+		smb_vfs_aio_complete(&aio->kiocb, ret, 0);
+	return -EIOCBQUEUED;
+
+out_aio:
+	kfree(aio);
+out_buf:
+	vfree(buf);
+	return -ENOMEM;
+}
+#endif
+
+/**
+ * smb_vfs_read_async() - submit asynchronous read for a smb work
+ * @work:	smb work containing read request
+ * @fid:	file id of open file
+ * @p_id:	persistent file id of open file
+ * @count:	read byte count
+ * @pos:	file pos
+ * @unbuffered:	client asked for unbuffered I/O on this request
+ *
+ * Only direct I/O is asynchronous in the file systems, buffered
+ * ->read_iter() always completes before returning. Reads which can
+ * not be done with direct I/O, or fail any check of smb_vfs_read(),
+ * are refused so that the caller retries them synchronously.
+ *
+ * Return:	-EIOCBQUEUED if submitted, work->async_done() is called
+ *		with the read byte count once done, -EOPNOTSUPP if refused
+ */
+int smb_vfs_read_async(struct smb_work *work, uint64_t fid, uint64_t p_id,
+	size_t count, loff_t pos, bool unbuffered)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	struct cifssrv_file *fp;
+	unsigned int bsize;
+	loff_t start;
+	size_t head, len;
+	char *dbuf;
+	int ret;
+
+	fp = get_id_from_fidtable(work->sess, fid);
+	if (!fp || fp->is_stream || !count ||
+			S_ISDIR(file_inode(fp->filp)->i_mode) ||
+			!smb_vfs_use_direct(fp, unbuffered))
+		return -EOPNOTSUPP;
+
+	if (fp->is_durable && fp->persistent_id != p_id)
+		return -EOPNOTSUPP;
+
+	if (!(fp->daccess & (FILE_READ_DATA_LE | FILE_GENERIC_READ_LE |
+		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE)))
+		return -EOPNOTSUPP;
+
+	if (smb_vfs_locks_mandatory_area(fp->filp, pos, pos + count - 1,
+			F_RDLCK) == -EAGAIN)
+		return -EOPNOTSUPP;
+
+	bsize = 1 << file_inode(fp->filp)->i_blkbits;
+	start = round_down(pos, bsize);
+	head = pos - start;
+	len = round_up(head + count, bsize);
+
+	dbuf = vmalloc(len);
+	if (!dbuf)
+		return -EOPNOTSUPP;
+
+	ret = smb_vfs_aio_submit(work, fp, dbuf, len, start, READ, head,
+			count);
+	if (ret != -EIOCBQUEUED)
+		return -EOPNOTSUPP;
+	return ret;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/**
+ * smb_vfs_write_async() - submit asynchronous write for a smb work
+ * @work:	smb work containing write request
+ * @fid:	file id of open file
+ * @p_id:	persistent file id of open file
+ * @buf:	buf containing data for writing
+ * @count:	write byte count
+ * @pos:	file pos
+ * @unbuffered:	client asked for unbuffered I/O on this request
+ *
+ * Like smb_vfs_read_async(), only block aligned direct writes are
+ * submitted, anything else is refused for a synchronous retry.
+ *
+ * Return:	-EIOCBQUEUED if submitted, work->async_done() is called
+ *		with the written byte count once done, -EOPNOTSUPP if refused
+ */
+int smb_vfs_write_async(struct smb_work *work, uint64_t fid, uint64_t p_id,
+	char *buf, size_t count, loff_t pos, bool unbuffered)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	struct cifssrv_file *fp;
+	unsigned int bsize;
+	char *dbuf;
+	int ret;
+
+	fp = get_id_from_fidtable(work->sess, fid);
+	if (!fp || fp->is_stream || !count ||
+			fp->coption & FILE_WRITE_THROUGH_LE ||
+			!smb_vfs_use_direct(fp, unbuffered))
+		return -EOPNOTSUPP;
+
+	bsize = 1 << file_inode(fp->filp)->i_blkbits;
+	if ((pos | count) & (bsize - 1))
+		return -EOPNOTSUPP;
+
+	if (fp->is_durable && fp->persistent_id != p_id)
+		return -EOPNOTSUPP;
+
+	if (!(fp->daccess & (FILE_WRITE_DATA_LE | FILE_GENERIC_WRITE_LE |
+		FILE_MAXIMAL_ACCESS_LE | FILE_GENERIC_ALL_LE)))
+		return -EOPNOTSUPP;
+
+	if (smb_vfs_locks_mandatory_area(fp->filp, pos, pos + count - 1,
+			F_WRLCK) == -EAGAIN)
+		return -EOPNOTSUPP;
+
+	dbuf = vmalloc(count);
+	if (!dbuf)
+		return -EOPNOTSUPP;
+	memcpy(dbuf, buf, count);
+
+	if (oplocks_enable) {
+		/* Do we need to break any of a levelII oplock? */
+		mutex_lock(&ofile_list_lock);
+		smb_breakII_oplock(work->server, fp, NULL);
+		mutex_unlock(&ofile_list_lock);
+	}
+
+	smb_vfs_offload_invalidate(file_inode(fp->filp), pos, count);
+	smb_vfs_statfs_dirty(fp->share, count);
+	ret = smb_vfs_aio_submit(work, fp, dbuf, count, pos, WRITE, 0,
+			count);
+	if (ret != -EIOCBQUEUED)
+		return -EOPNOTSUPP;
+	return ret;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
+
+/**
+ * smb_vfs_aio_result() - finish asynchronous I/O of a smb work
+ * @work:	smb work whose I/O has completed
+ *
+ * Releases the I/O resources. For reads, the requested range is moved
+ * to the start of the bounce buffer, which becomes the read data.
+ *
+ * Return:	number of bytes transferred on success, otherwise error
+ */
+ssize_t smb_vfs_aio_result(struct smb_work *work)
+{
+	struct smb_aio *aio = work->aio;
+	ssize_t ret = aio->ret;
+
+	if (aio->rw == READ && ret >= 0) {
+		ret = ret > aio->head ?
+			min_t(ssize_t, ret - aio->head, aio->count) : 0;
+		if (aio->head)
+			memmove(aio->buf, aio->buf + aio->head, ret);
+		work->rdata_buf = aio->buf;
+	} else {
+		vfree(aio->buf);
+	}
+
+	if (aio->share) {
+		atomic_dec(&aio->share->stats.aio_inflight);
+		if (ret > 0)
+			atomic_long_add(ret, &aio->share->stats.direct_bytes);
+	}
+
+	fput(aio->kiocb.ki_filp);
+	kfree(aio->bvec);
+	kfree(aio);
+	work->aio = NULL;
+	return ret;
+}
+
+/**
+ * smb_check_attrs() - sanitize inode attributes
+ * @inode:	inode
+ * @attrs:	inode attributes
+ */
+void smb_check_attrs(struct inode *inode, struct iattr *attrs)
+{
+	/* sanitize the mode change */
+	if (attrs->ia_valid & ATTR_MODE) {
+		attrs->ia_mode &= S_IALLUGO;
+		attrs->ia_mode |= (inode->i_mode & ~S_IALLUGO);
+	}
+
+	/* Revoke setuid/setgid on chown */
+	if (!S_ISDIR(inode->i_mode) &&
+		(((attrs->ia_valid & ATTR_UID) &&
+				!uid_eq(attrs->ia_uid, inode->i_uid)) ||
+		 ((attrs->ia_valid & ATTR_GID) &&
+				!gid_eq(attrs->ia_gid, inode->i_gid)))) {
+		attrs->ia_valid |= ATTR_KILL_PRIV;
+		if (attrs->ia_valid & ATTR_MODE) {
+			/* we're setting mode too, just clear the s*id bits */
+			attrs->ia_mode &= ~S_ISUID;
+			if (attrs->ia_mode & S_IXGRP)
+				attrs->ia_mode &= ~S_ISGID;
+		} else {
+			/* set ATTR_KILL_* bits and let VFS handle it */
+			attrs->ia_valid |= (ATTR_KILL_SUID | ATTR_KILL_SGID);
+		}
+	}
+}
+
+/**
+ * smb_vfs_setattr() - vfs helper for smb setattr
+ * @sess:	TCP server session
+ * @name:	file name
+ * @fid:	file id of open file
+ * @attrs:	inode attributes
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_setattr(struct cifssrv_sess *sess, const char *name,
+		uint64_t fid, struct iattr *attrs)
+{
+	struct file *filp;
+	struct dentry *dentry;
+	struct inode *inode;
+	struct path path;
+	bool update_size = false;
+	int err = 0;
+	struct cifssrv_file *fp;
+
+	if (name) {
+		err = kern_path(name, 0, &path);
+		if (err) {
+			cifssrv_debug("lookup failed for %s, err = %d\n",
+					name, err);
+			return -ENOENT;
+		}
+		dentry = path.dentry;
+		inode = dentry->d_inode;
+	} else {
+
+		fp = get_id_from_fidtable(sess, fid);
+		if (!fp) {
+			cifssrv_err("failed to get filp for fid %llu\n", fid);
+			return -ENOENT;
+		}
+
+		filp = fp->filp;
+		dentry = filp->f_path.dentry;
+		inode = dentry->d_inode;
+	}
+
+	/* no need to update mode of symlink */
+	if (S_ISLNK(inode->i_mode))
+		attrs->ia_valid &= ~ATTR_MODE;
+
+	/* skip setattr, if nothing to update */
+	if (!attrs->ia_valid) {
+		err = 0;
+		goto out;
+	}
+
+	smb_check_attrs(inode, attrs);
+	if (attrs->ia_valid & ATTR_SIZE) {
+		err = get_write_access(inode);
+		if (err)
+			goto out;
+
+		err = locks_verify_truncate(inode, NULL, attrs->ia_size);
+		if (err) {
+			put_write_access(inode);
+			goto out;
+		}
+		update_size = true;
+	}
+
+	attrs->ia_valid |= ATTR_CTIME;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock(inode);
+	err = notify_change(dentry, attrs, NULL);
+	inode_unlock(inode);
+#else
+	mutex_lock(&inode->i_mutex);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 13, 0)
+	err = notify_change(dentry, attrs, NULL);
+#else
+	err = notify_change(dentry, attrs);
+#endif
+	mutex_unlock(&inode->i_mutex);
+#endif
+
+	if (update_size)
+		put_write_access(inode);
+
+	if (!err) {
+		sync_inode_metadata(inode, 1);
+		cifssrv_debug("fid %llu, setattr done\n", fid);
+		if (attrs->ia_valid & (ATTR_MODE | ATTR_UID | ATTR_GID))
+			smb_acl_invalidate(inode);
+	}
+
+out:
+	if (name)
+		path_put(&path);
+	return err;
+}
+
+/**
+ * smb_vfs_getattr() - vfs helper for smb getattr
+ * @sess:	TCP server session
+ * @fid:	file id of open file
+ * @attrs:	inode attributes
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_getattr(struct cifssrv_sess *sess, uint64_t fid,
+		struct kstat *stat)
+{
+	struct file *filp;
+	struct cifssrv_file *fp;
+	int err;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp) {
+		cifssrv_err("failed to get filp for fid %llu\n", fid);
+		return -ENOENT;
+	}
+
+	filp = fp->filp;
+	err = vfs_getattr(&filp->f_path, stat);
+	if (err)
+		cifssrv_err("getattr failed for fid %llu, err %d\n", fid, err);
+	return err;
+}
+
+/**
+ * smb_vfs_fsync() - vfs helper for smb fsync
+ * @sess:	TCP server session
+ * @fid:	file id of open file
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_fsync(struct cifssrv_sess *sess, uint64_t fid, uint64_t p_id)
+{
+	struct cifssrv_file *fp;
+	int err;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp) {
+		cifssrv_err("failed to get filp for fid %llu\n", fid);
+		return -ENOENT;
+	}
+
+	if (fp->is_durable && fp->persistent_id != p_id) {
+		cifssrv_err("persistent id mismatch : %llu, %llu\n",
+				fp->persistent_id, p_id);
+		return -ENOENT;
+	}
+
+	/*
+	 * fsync of an O_PATH file fails, a handle without write access
+	 * must never lead a group commit batch and fail other tickets
+	 */
+	if (fp->filp->f_mode & FMODE_PATH ||
+		(!(fp->filp->f_mode & FMODE_WRITE) &&
+		 !S_ISDIR(file_inode(fp->filp)->i_mode))) {
+		cifssrv_debug("no write access to flush fid %llu\n", fid);
+		return -EACCES;
+	}
+
+	err = smb_vfs_group_fsync(fp, 0, LLONG_MAX);
+	if (err < 0)
+		cifssrv_err("smb fsync failed, err = %d\n", err);
+
+	return err;
+}
+
+/**
+ * smb_vfs_unlink() - vfs helper for smb rmdir or unlink
+ * @name:	absolute directory or file name
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_unlink(char *name)
+{
+	struct path parent;
+	struct dentry *dir, *dentry;
+	char *last;
+	int err = -ENOENT;
+
+	last = strrchr(name, '/');
+	if (last && last[1] != '\0') {
+		*last = '\0';
+		last++;
+	}
+	else {
+		cifssrv_debug("can't get last component in path %s\n", name);
+		return -ENOENT;
+	}
+
+	err = kern_path(name, LOOKUP_FOLLOW | LOOKUP_DIRECTORY, &parent);
+	if (err) {
+		cifssrv_debug("can't get %s, err %d\n", name, err);
+		return err;
+	}
+
+	dir = parent.dentry;
+	if (!dir->d_inode)
+		goto out;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock_nested(dir->d_inode, I_MUTEX_PARENT);
+#else
+	mutex_lock_nested(&dir->d_inode->i_mutex, I_MUTEX_PARENT);
+#endif
+	dentry = lookup_one_len(last, dir, strlen(last));
+	if (IS_ERR(dentry)) {
+		err = PTR_ERR(dentry);
+		cifssrv_debug("%s: lookup failed, err %d\n", last, err);
+		goto out_err;
+	}
+
+	if (!dentry->d_inode || !dentry->d_inode->i_nlink) {
+		dput(dentry);
+		err = -ENOENT;
+		goto out_err;
+	}
+
+	if (S_ISDIR(dentry->d_inode->i_mode)) {
+		err = vfs_rmdir(dir->d_inode, dentry);
+		if (err && err != -ENOTEMPTY)
+			cifssrv_debug("%s: rmdir failed, err %d\n", name, err);
+	} else {
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		err = vfs_unlink(dir->d_inode, dentry, NULL);
+#else
+		err = vfs_unlink(dir->d_inode, dentry);
+#endif
+		if (err)
+			cifssrv_debug("%s: unlink failed, err %d\n", name, err);
+	}
+
+	dput(dentry);
+out_err:
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_unlock(dir->d_inode);
+#else
+	mutex_unlock(&dir->d_inode->i_mutex);
+#endif
+out:
+	path_put(&parent);
+	return err;
+}
+
+/**
+ * smb_vfs_share_parent() - resolve the parent directory of a target name
+ * @tcon:	tree connection the name belongs to
+ * @name:	absolute name of the target, split at its last component
+ * @parent:	if lookup succeed, return path info of the parent directory
+ *
+ * The parent is walked from the pinned share root, see
+ * smb_share_kern_path(), and a target named after a private directory
+ * of the server is refused.
+ *
+ * Return:	last component of @name on success, otherwise error pointer
+ */
+static char *smb_vfs_share_parent(struct cifssrv_tcon *tcon, char *name,
+		struct path *parent)
+{
+	char *last;
+	int err;
+
+	last = strrchr(name, '/');
+	if (!last || last[1] == '\0') {
+		cifssrv_err("can't get last component in path %s\n", name);
+		return ERR_PTR(-ENOENT);
+	}
+
+	if (smb_share_private_name(last + 1))
+		return ERR_PTR(-EACCES);
+
+	*last = '\0';
+	last++;
+	err = smb_share_kern_path(tcon, name, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+			parent, 0);
+	if (err) {
+		cifssrv_err("cannot get linux path for %s, err %d\n",
+				name, err);
+		return ERR_PTR(err);
+	}
+	return last;
+}
+
+/**
+ * smb_vfs_link() - vfs helper for creating smb hardlink
+ * @tcon:	tree connection of the request
+ * @oldname:	source file name
+ * @newname:	hardlink name
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_link(struct cifssrv_tcon *tcon, char *oldname, char *newname)
+{
+	struct path oldpath, newpath;
+	struct dentry *dentry;
+	char *last;
+	int err;
+
+	err = smb_share_kern_path(tcon, oldname, LOOKUP_FOLLOW, &oldpath, 0);
+	if (err) {
+		cifssrv_err("cannot get linux path for %s, err = %d\n",
+				oldname, err);
+		goto out1;
+	}
+
+	last = smb_vfs_share_parent(tcon, newname, &newpath);
+	if (IS_ERR(last)) {
+		err = PTR_ERR(last);
+		goto out2;
+	}
+
+	err = -EXDEV;
+	if (oldpath.mnt != newpath.mnt) {
+		cifssrv_err("vfs_link failed err %d\n", err);
+		goto out3;
+	}
+
+	err = mnt_want_write(newpath.mnt);
+	if (err)
+		goto out3;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock_nested(newpath.dentry->d_inode, I_MUTEX_PARENT);
+#else
+	mutex_lock_nested(&newpath.dentry->d_inode->i_mutex, I_MUTEX_PARENT);
+#endif
+	dentry = lookup_one_len(last, newpath.dentry, strlen(last));
+	if (IS_ERR(dentry)) {
+		err = PTR_ERR(dentry);
+		cifssrv_err("path create err for %s, err %d\n", last, err);
+		goto out4;
+	}
+
+	err = -EEXIST;
+	if (dentry->d_inode)
+		goto out5;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+	err = vfs_link(oldpath.dentry, newpath.dentry->d_inode, dentry, NULL);
+#else
+	err = vfs_link(oldpath.dentry, newpath.dentry->d_inode, dentry);
+#endif
+	if (err)
+		cifssrv_debug("vfs_link failed err %d\n", err);
+
+out5:
+	dput(dentry);
+out4:
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_unlock(newpath.dentry->d_inode);
+#else
+	mutex_unlock(&newpath.dentry->d_inode->i_mutex);
+#endif
+	mnt_drop_write(newpath.mnt);
+out3:
+	path_put(&newpath);
+out2:
+	path_put(&oldpath);
+
+out1:
+	return err;
+}
+
+/**
+ * smb_vfs_symlink() - vfs helper for creating smb symlink
+ * @name:	source file name
+ * @symname:	symlink name
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_symlink(const char *name, const char *symname)
+{
+	struct path path;
+	struct dentry *dentry;
+	int err;
+
+	dentry = kern_path_create(AT_FDCWD, symname, &path, 0);
+	if (IS_ERR(dentry)) {
+		err = PTR_ERR(dentry);
+		cifssrv_err("path create failed for %s, err %d\n", name, err);
+		return err;
+	}
+
+	err = vfs_symlink(dentry->d_parent->d_inode, dentry, name);
+	if (err && (err != -EEXIST || err != -ENOSPC))
+		cifssrv_debug("failed to create symlink, err %d\n", err);
+
+	done_path_create(&path, dentry);
+
+	return err;
+}
+
+/**
+ * smb_vfs_readlink() - vfs helper for reading value of symlink
+ * @path:	path of symlink
+ * @buf:	destination buffer for symlink value
+ * @lenp:	destination buffer length
+ *
+ * Return:	symlink value length on success, otherwise error
+ */
+int smb_vfs_readlink(struct path *path, char *buf, int lenp)
+{
+	struct inode *inode;
+	mm_segment_t old_fs;
+	int err;
+
+	if (!path)
+		return -ENOENT;
+
+	inode = path->dentry->d_inode;
+	if (!S_ISLNK(inode->i_mode))
+		return -EINVAL;
+
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	err = inode->i_op->readlink(path->dentry, (char __user *)buf, lenp);
+	set_fs(old_fs);
+	if (err < 0)
+		cifssrv_err("readlink failed, err = %d\n", err);
+
+	return err;
+}
+
+/**
+ * smb_vfs_rename() - vfs helper for smb rename
+ * @sess:		TCP server session
+ * @tcon:		tree connection of the request
+ * @abs_oldname:	old filename
+ * @abs_newname:	new filename
+ * @oldfid:		file id of old file
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_rename(struct cifssrv_sess *sess, struct cifssrv_tcon *tcon,
+		char *abs_oldname, char *abs_newname, uint64_t oldfid)
+{
+	struct path oldpath_p, newpath_p;
+	struct dentry *dold, *dnew, *dold_p, *dnew_p, *trap, *child_de;
+	char *oldname = NULL, *newname = NULL;
+	struct file *filp = NULL;
+	struct cifssrv_file *fp = NULL;
+	int err;
+
+	if (abs_oldname) {
+		/* normal case: rename with source filename */
+		oldname = smb_vfs_share_parent(tcon, abs_oldname, &oldpath_p);
+		if (IS_ERR(oldname))
+			return PTR_ERR(oldname);
+		dold_p = oldpath_p.dentry;
+
+		newname = smb_vfs_share_parent(tcon, abs_newname, &newpath_p);
+		if (IS_ERR(newname)) {
+			err = PTR_ERR(newname);
+			goto out1;
+		}
+		dnew_p = newpath_p.dentry;
+	} else {
+		/* rename by fid of source file instead of source filename */
+		fp = get_id_from_fidtable(sess, oldfid);
+		if (!fp) {
+			cifssrv_err("can't find filp for fid %llu\n", oldfid);
+			return -ENOENT;
+		}
+
+		filp = fp->filp;
+		dold_p = filp->f_path.dentry->d_parent;
+
+		newname = smb_vfs_share_parent(tcon, abs_newname, &newpath_p);
+		if (IS_ERR(newname))
+			return PTR_ERR(newname);
+		dnew_p = newpath_p.dentry;
+	}
+
+	cifssrv_debug("oldname %s, newname %s\n", oldname, newname);
+	trap = lock_rename(dold_p, dnew_p);
+	if (abs_oldname) {
+		dold = lookup_one_len(oldname, dold_p, strlen(oldname));
+		err = PTR_ERR(dold);
+		if (IS_ERR(dold)) {
+			cifssrv_err("%s lookup failed with error = %d\n",
+					oldname, err);
+			goto out2;
+		}
+	} else {
+		dold = filp->f_path.dentry;
+		dget(dold);
+	}
+
+	spin_lock(&dold->d_lock);
+	list_for_each_entry(child_de, &dold->d_subdirs, d_child) {
+		struct cifssrv_file *child_fp;
+
+		child_fp = find_fp_in_hlist_using_inode(child_de->d_inode);
+		if (child_fp) {
+			cifssrv_debug("not allow to rename dir with opening sub file\n");
+			err = -ENOTEMPTY;
+			spin_unlock(&dold->d_lock);
+			goto out3;
+		}
+	}
+	spin_unlock(&dold->d_lock);
+
+	err = -ENOENT;
+	if (!dold->d_inode)
+		goto out3;
+	err = -EINVAL;
+	if (dold == trap)
+		goto out3;
+
+	dnew = lookup_one_len(newname, dnew_p, strlen(newname));
+	err = PTR_ERR(dnew);
+	if (IS_ERR(dnew)) {
+		cifssrv_err("%s lookup failed with error = %d\n",
+				newname, err);
+		goto out3;
+	}
+
+	err = -ENOTEMPTY;
+	if (dnew == trap)
+		goto out4;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+	err = vfs_rename(dold_p->d_inode, dold, dnew_p->d_inode, dnew, NULL, 0);
+#else
+	err = vfs_rename(dold_p->d_inode, dold, dnew_p->d_inode, dnew);
+#endif
+	if (err)
+		cifssrv_err("vfs_rename failed err %d\n", err);
+
+out4:
+	dput(dnew);
+out3:
+	dput(dold);
+out2:
+	unlock_rename(dold_p, dnew_p);
+	path_put(&newpath_p);
+out1:
+	if (abs_oldname)
+		path_put(&oldpath_p);
+	return err;
+}
+
+/**
+ * smb_vfs_truncate() - vfs helper for smb file truncate
+ * @sess:	TCP server session
+ * @name:	old filename
+ * @fid:	file id of old file
+ * @size:	truncate to given size
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_truncate(struct cifssrv_sess *sess, const char *name,
+		uint64_t fid, loff_t size)
+{
+	struct path path;
+	struct file *filp;
+	int err = 0;
+	struct cifssrv_file *fp;
+	struct inode *inode;
+
+	if (name) {
+		err = kern_path(name, 0, &path);
+		if (err) {
+			cifssrv_err("cannot get linux path for %s, err %d\n",
+					name, err);
+			return err;
+		}
+		err = vfs_truncate(&path, size);
+		if (err)
+			cifssrv_err("truncate failed for %s err %d\n",
+					name, err);
+		else
+			smb_vfs_offload_invalidate(path.dentry->d_inode, size,
+					LLONG_MAX - size);
+		path_put(&path);
+	} else {
+		fp = get_id_from_fidtable(sess, fid);
+		if (!fp) {
+			cifssrv_err("failed to get filp for fid %llu\n", fid);
+			return -ENOENT;
+		}
+
+		filp = fp->filp;
+		if (oplocks_enable) {
+			/* Do we need to break any of a levelII oplock? */
+			mutex_lock(&ofile_list_lock);
+			smb_breakII_oplock(sess->server, fp, NULL);
+			mutex_unlock(&ofile_list_lock);
+		} else {
+			inode = file_inode(filp);
+			if (size < inode->i_size) {
+				err = smb_vfs_locks_mandatory_area(filp, size,
+						inode->i_size - 1, F_WRLCK);
+			} else {
+				err = smb_vfs_locks_mandatory_area(filp,
+						inode->i_size, size - 1,
+						F_WRLCK);
+			}
+
+			if (err == -EAGAIN) {
+				cifssrv_err("failed due to lock\n");
+				return err;
+			}
+		}
+		err = vfs_truncate(&filp->f_path, size);
+		if (err)
+			cifssrv_err("truncate failed for fid %llu err %d\n",
+					fid, err);
+		else {
+			smb_vfs_offload_invalidate(file_inode(filp), size,
+					LLONG_MAX - size);
+			if (fp->share)
+				smb_vfs_statfs_invalidate(fp->share);
+		}
+	}
+
+	return err;
+}
+
+/**
+ * smb_vfs_listxattr() - vfs helper for smb list extended attributes
+ * @dentry:	dentry of file for listing xattrs
+ * @list:	destination buffer
+ * @size:	destination buffer length
+ *
+ * Return:	xattr list length on success, otherwise error
+ */
+ssize_t smb_vfs_listxattr(struct dentry *dentry, char **list, int size)
+{
+	ssize_t err;
+	char *vlist = NULL;
+
+	if (size) {
+		if (size > XATTR_LIST_MAX)
+			size = XATTR_LIST_MAX;
+		vlist = vmalloc(size);
+		if (!vlist)
+			return -ENOMEM;
+	}
+
+	*list = vlist;
+	err = vfs_listxattr(dentry, vlist, size);
+	if (err == -ERANGE) {
+		/* The file system tried to returned a list bigger
+		   than XATTR_LIST_MAX bytes. Not possible. */
+		err = -E2BIG;
+		cifssrv_debug("listxattr failed\n");
+	}
+
+	return err;
+}
+
+/**
+ * smb_vfs_getxattr() - vfs helper for smb get extended attributes value
+ * @dentry:	dentry of file for getting xattrs
+ * @xattr_name:	name of xattr name to query
+ * @xattr_buf:	destination buffer xattr value
+ *
+ * Return:	read xattr value length on success, otherwise error
+ */
+ssize_t smb_vfs_getxattr(struct dentry *dentry, char *xattr_name,
+	char **xattr_buf, int flags)
+{
+	ssize_t xattr_len;
+	char *buf;
+
+	xattr_len = vfs_getxattr(dentry, xattr_name, NULL, 0);
+	if (xattr_len <= 0)
+		return xattr_len;
+
+	if (!flags)
+		return xattr_len;
+
+	buf = kzalloc(xattr_len, GFP_KERNEL);
+	if (!buf) {
+		buf = vzalloc(xattr_len);
+		if (!buf)
+			return -ENOMEM;
+	}
+
+	xattr_len = vfs_getxattr(dentry, xattr_name, (void *)buf,
+		xattr_len);
+	if (xattr_len < 0)
+		cifssrv_debug("getxattr failed, ret %zd\n", xattr_len);
+	else
+		*xattr_buf = buf;
+
+	return xattr_len;
+}
+
+/**
+ * smb_vfs_setxattr() - vfs helper for smb set extended attributes value
+ * @filename:	file name
+ * @fpath:	path of file for setxattr
+ * @name:	xattr name for setxattr
+ * @value:	xattr value to set
+ * @size:	size of xattr value
+ * @flags:	destination buffer length
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_setxattr(const char *filename, struct path *fpath, const char *name,
+		const void *value, size_t size, int flags)
+{
+	struct path path;
+	int err;
+
+	if (filename) {
+		err = kern_path(filename, 0, &path);
+		if (err) {
+			cifssrv_debug("cannot get linux path %s, err %d\n",
+					filename, err);
+			return err;
+		}
+		err = vfs_setxattr(path.dentry, name, value, size, flags);
+		if (err)
+			cifssrv_debug("setxattr failed, err %d\n", err);
+		smb_vfs_attr_invalidate(path.dentry->d_inode);
+		smb_acl_invalidate(path.dentry->d_inode);
+		path_put(&path);
+	} else {
+		err = vfs_setxattr(fpath->dentry, name, value, size, flags);
+		if (err)
+			cifssrv_debug("setxattr failed, err %d\n", err);
+		smb_vfs_attr_invalidate(fpath->dentry->d_inode);
+		smb_acl_invalidate(fpath->dentry->d_inode);
+	}
+
+	return err;
+}
+
+int smb_vfs_truncate_xattr(struct dentry *dentry)
+{
+	char *name, *xattr_list = NULL;
+	ssize_t xattr_list_len;
+	int err = 0;
+
+	xattr_list_len = smb_vfs_listxattr(dentry, &xattr_list,
+		XATTR_LIST_MAX);
+	if (xattr_list_len < 0) {
+		goto out;
+	} else if (!xattr_list_len) {
+		cifssrv_debug("empty xattr in the file\n");
+		goto out;
+	}
+
+	for (name = xattr_list; name - xattr_list < xattr_list_len;
+			name += strlen(name) + 1) {
+		cifssrv_debug("%s, len %zd\n", name, strlen(name));
+
+		err = vfs_removexattr(dentry, name);
+		if (err)
+			cifssrv_err("remove xattr failed : %s\n", name);
+	}
+	smb_vfs_attr_invalidate(dentry->d_inode);
+out:
+	if (xattr_list)
+		vfree(xattr_list);
+
+	return err;
+}
+
+/**
+ * smb_vfs_set_fadvise() - convert smb IO caching options to linux options
+ * @filp:	file pointer for IO
+ * @options:	smb IO options
+ */
+void smb_vfs_set_fadvise(struct file *filp, int option)
+{
+	struct address_space *mapping;
+	mapping = filp->f_mapping;
+
+	if (!option || !mapping)
+		return;
+
+	/*
+	 * FILE_WRITE_THROUGH is not mapped to O_SYNC, smb_vfs_write()
+	 * syncs each write through group commit so that concurrent
+	 * writers share one fsync.
+	 *
+	 * FILE_NO_INTERMEDIATE_BUFFERING is not mapped to O_DIRECT here,
+	 * kworkers have no user mm for vfs_read() to pin pages from.
+	 * smb_vfs_read()/smb_vfs_write() issue direct I/O per request
+	 * for such opens instead.
+	 */
+	if (option & FILE_SEQUENTIAL_ONLY_LE) {
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		filp->f_ra.ra_pages = inode_to_bdi(mapping->host)->ra_pages * 2;
+#else
+		filp->f_ra.ra_pages = mapping->backing_dev_info->ra_pages * 2;
+#endif
+		spin_lock(&filp->f_lock);
+		filp->f_mode &= ~FMODE_RANDOM;
+		spin_unlock(&filp->f_lock);
+	} else if (option & FILE_RANDOM_ACCESS_LE) {
+		spin_lock(&filp->f_lock);
+		filp->f_mode |= FMODE_RANDOM;
+		spin_unlock(&filp->f_lock);
+	}
+}
+
+/**
+ * smb_vfs_lock() - vfs helper for smb file locking
+ * @filp:	the file to apply the lock to
+ * @cmd:	type of locking operation (F_SETLK, F_GETLK, etc.)
+ * @flock:	The lock to be applied
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_lock(struct file *filp, int cmd,
+			struct file_lock *flock)
+{
+	cifssrv_debug("%s: calling vfs_lock_file\n", __func__);
+	return vfs_lock_file(filp, cmd, flock, NULL);
+}
+
+/**
+ * smb_vfs_locks_mandatory_area() - vfs helper for smb byte range file locking
+ * @filp:	the file to apply the lock to
+ * @start:	lock start byte offset
+ * @end:	lock end byte offset
+ * @type:	byte range type read/write
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_locks_mandatory_area(struct file *filp, loff_t start, loff_t end,
+		unsigned char type)
+{
+	struct file_lock fl;
+	int error;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+	struct file_lock_context *ctx = file_inode(filp)->i_flctx;
+	if (!ctx || list_empty_careful(&ctx->flc_posix))
+		return 0;
+#else
+	if (!file_inode(filp)->i_flock)
+		return 0;
+#endif
+
+	locks_init_lock(&fl);
+	fl.fl_owner = (struct files_struct *)filp;
+	fl.fl_pid = current->tgid;
+	fl.fl_file = filp;
+	fl.fl_flags = FL_POSIX | FL_ACCESS;
+	fl.fl_type = type;
+	fl.fl_start = start;
+	fl.fl_end = end;
+	error = posix_lock_file(filp, &fl, NULL);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+	posix_unblock_lock(&fl);
+#else
+	locks_delete_block(&fl);
+#endif
+	return error;
+}
+
+int smb_vfs_readdir(struct file *file, filldir_t filler,
+			struct smb_readdir_data *rdata)
+{
+	int err;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+	err = iterate_dir(file, &rdata->ctx);
+#else
+	err = vfs_readdir(file, smb_filldir, rdata);
+#endif
+
+	return err;
+}
+
+
+
+int smb_vfs_alloc_size(struct file *filp, loff_t len)
+{
+	return vfs_fallocate(filp, FALLOC_FL_KEEP_SIZE, 0, len);
+}
+
+/**
+ * smb_vfs_trim_alloc() - release blocks allocated beyond end of file
+ * @filp:	file pointer of open file
+ *
+ * Truncating to the current size, with inode lock held so that the
+ * size can not move, frees blocks preallocated past end of file. Like
+ * any truncate it runs under freeze protection.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_trim_alloc(struct file *filp)
+{
+	struct dentry *dentry = filp->f_path.dentry;
+	struct inode *inode = file_inode(filp);
+	struct iattr attrs;
+	int err;
+
+	attrs.ia_valid = ATTR_SIZE;
+	file_start_write(filp);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock(inode);
+	attrs.ia_size = i_size_read(inode);
+	err = notify_change(dentry, &attrs, NULL);
+	inode_unlock(inode);
+#else
+	mutex_lock(&inode->i_mutex);
+	attrs.ia_size = i_size_read(inode);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 13, 0)
+	err = notify_change(dentry, &attrs, NULL);
+#else
+	err = notify_change(dentry, &attrs);
+#endif
+	mutex_unlock(&inode->i_mutex);
+#endif
+	file_end_write(filp);
+	return err;
+}
+
+/**
+ * smb_vfs_set_alloc_size() - set allocation size of an open file
+ * @sess:	TCP server session
+ * @fid:	file id of open file
+ * @size:	new allocation size
+ *
+ * An allocation size below end of file truncates the file. Otherwise
+ * blocks up to @size are allocated without changing file size, after
+ * releasing any allocation beyond it. Allocation size is advisory on
+ * file systems without fallocate support.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_set_alloc_size(struct cifssrv_sess *sess, uint64_t fid,
+	loff_t size)
+{
+	struct cifssrv_file *fp;
+	struct inode *inode;
+	loff_t allocated;
+	int err;
+
+	fp = get_id_from_fidtable(sess, fid);
+	if (!fp) {
+		cifssrv_err("failed to get filp for fid %llu\n", fid);
+		return -ENOENT;
+	}
+
+	inode = file_inode(fp->filp);
+	if (size < i_size_read(inode))
+		return smb_vfs_truncate(sess, NULL, fid, size);
+
+	allocated = (loff_t)inode->i_blocks << 9;
+	if (allocated > size) {
+		err = smb_vfs_trim_alloc(fp->filp);
+		if (err)
+			return err;
+	}
+
+	err = smb_vfs_alloc_size(fp->filp, size);
+	if (err == -EOPNOTSUPP)
+		err = 0;
+	else if (!err)
+		smb_vfs_statfs_dirty(fp->share, size - allocated);
+	return err;
+}
+
+/**
+ * smb_vfs_zero_data() - zero a range of a file without writing it out
+ * @sess:	session the file was opened on
+ * @fp:		cifssrv file pointer
+ * @off:	start of range
+ * @len:	length of range
+ * @punch:	deallocate the range, used for sparse files
+ *
+ * The range is clipped to end of file, which is never changed.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_zero_data(struct cifssrv_sess *sess, struct cifssrv_file *fp,
+	loff_t off, loff_t len, bool punch)
+{
+	struct file *filp = fp->filp;
+	loff_t size = i_size_read(file_inode(filp));
+	mm_segment_t old_fs;
+	ssize_t nbytes = 0;
+	int err;
+
+	if (fp->is_stream)
+		return -EOPNOTSUPP;
+
+	if (off >= size || len <= 0)
+		return 0;
+	len = min(len, size - off);
+
+	err = smb_vfs_locks_mandatory_area(filp, off, off + len - 1, F_WRLCK);
+	if (err == -EAGAIN) {
+		cifssrv_err("%s: unable to zero due to lock\n", __func__);
+		return err;
+	}
+
+	if (oplocks_enable) {
+		mutex_lock(&ofile_list_lock);
+		smb_breakII_oplock(sess->server, fp, NULL);
+		mutex_unlock(&ofile_list_lock);
+	}
+
+	smb_vfs_offload_invalidate(file_inode(filp), off, len);
+	if (punch) {
+		err = vfs_fallocate(filp,
+				FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				off, len);
+		if (err != -EOPNOTSUPP)
+			return err;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0)
+	err = vfs_fallocate(filp, FALLOC_FL_ZERO_RANGE | FALLOC_FL_KEEP_SIZE,
+			off, len);
+	if (err != -EOPNOTSUPP)
+		return err;
+#endif
+
+	/* file system can not do it, write out zeroes */
+	old_fs = get_fs();
+	set_fs(KERNEL_DS);
+	while (len) {
+		nbytes = vfs_write(filp, page_address(ZERO_PAGE(0)),
+				min_t(loff_t, len, PAGE_SIZE), &off);
+		if (nbytes <= 0)
+			break;
+		len -= nbytes;
+	}
+	set_fs(old_fs);
+
+	if (len)
+		return nbytes < 0 ? nbytes : -EIO;
+	return 0;
+}
+
+/**
+ * smb_vfs_fill_holes() - allocate all holes of a file
+ * @filp:	file pointer of open file
+ *
+ * Used when sparse attribute is cleared, a non-sparse file is expected
+ * to be fully allocated.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_fill_holes(struct file *filp)
+{
+	loff_t size = i_size_read(file_inode(filp));
+	int err;
+
+	if (!size)
+		return 0;
+
+	err = vfs_fallocate(filp, FALLOC_FL_KEEP_SIZE, 0, size);
+	if (err == -EOPNOTSUPP)
+		err = 0;
+	return err;
+}
+
+/**
+ * smb_vfs_fqar_lseek() - find allocated ranges of a file
+ * @filp:	file pointer of open file
+ * @start:	start of range to look in
+ * @length:	length of range to look in
+ * @ranges:	buffer to fill with data ranges found
+ * @in_count:	number of entries @ranges can hold
+ * @out_count:	number of entries filled in
+ *
+ * Ranges are found with SEEK_DATA and SEEK_HOLE, on file systems without
+ * hole support the whole file is reported as one range.
+ *
+ * Return:	0 on success, -E2BIG when @ranges was too small,
+ *		otherwise error
+ */
+int smb_vfs_fqar_lseek(struct file *filp, loff_t start, loff_t length,
+	struct file_allocated_range_buffer *ranges, int in_count,
+	int *out_count)
+{
+	loff_t end, data_start, data_end;
+	int count = 0;
+
+	*out_count = 0;
+	if (start < 0 || length < 0)
+		return -EINVAL;
+
+	end = i_size_read(file_inode(filp));
+	if (length < end - start)
+		end = start + length;
+
+	while (start < end) {
+		data_start = vfs_llseek(filp, start, SEEK_DATA);
+		if (data_start == -ENXIO)
+			break;
+		if (data_start < 0)
+			return data_start;
+		if (data_start >= end)
+			break;
+
+		data_end = vfs_llseek(filp, data_start, SEEK_HOLE);
+		if (data_end < 0)
+			return data_end;
+		data_end = min(data_end, end);
+
+		if (count == in_count) {
+			*out_count = count;
+			return -E2BIG;
+		}
+
+		ranges[count].file_offset = cpu_to_le64(data_start);
+		ranges[count].length = cpu_to_le64(data_end - data_start);
+		count++;
+		start = data_end;
+	}
+
+	*out_count = count;
+	return 0;
+}
+
+/* number of deleted files whose blocks are freed in parallel */
+#define SMB_RECLAIM_MAX_ACTIVE	2
+
+/* delay before reclaim, so that the close releasing the file is done */
+#define SMB_RECLAIM_DELAY	HZ
+
+static struct workqueue_struct *smb_reclaim_wq;
+static LIST_HEAD(smb_reclaim_list);
+static DEFINE_SPINLOCK(smb_reclaim_lock);
+static atomic64_t smb_trash_seq = ATOMIC64_INIT(0);
+
+/**
+ * struct smb_reclaim_work - deleted file waiting in a trash directory
+ * @dwork:	reclaim work on smb_reclaim_wq
+ * @list:	entry in smb_reclaim_list
+ * @share:	share of the file, for pending bytes accounting
+ * @trash:	trash directory of the share
+ * @dentry:	trash directory entry of the file
+ * @size:	bytes allocated to the file
+ */
+struct smb_reclaim_work {
+	struct delayed_work	dwork;
+	struct list_head	list;
+	struct cifssrv_share	*share;
+	struct path		trash;
+	struct dentry		*dentry;
+	loff_t			size;
+};
+
+/**
+ * smb_vfs_reclaim() - unlink a deleted file from trash directory
+ * @work:	work struct of smb_reclaim_work
+ *
+ * The file has no other name left, so unless a handle is still open
+ * its blocks are freed here when the last dentry reference is put.
+ */
+static void smb_vfs_reclaim(struct work_struct *work)
+{
+	struct smb_reclaim_work *rw = container_of(to_delayed_work(work),
+			struct smb_reclaim_work, dwork);
+	struct dentry *trash = rw->trash.dentry, *dentry = rw->dentry;
+	int err = -ENOENT;
+
+	spin_lock(&smb_reclaim_lock);
+	list_del(&rw->list);
+	spin_unlock(&smb_reclaim_lock);
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock_nested(trash->d_inode, I_MUTEX_PARENT);
+#else
+	mutex_lock_nested(&trash->d_inode->i_mutex, I_MUTEX_PARENT);
+#endif
+	/* a sweep may have queued the same entry again */
+	if (dentry->d_parent == trash && !d_unhashed(dentry) &&
+			dentry->d_inode)
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		err = vfs_unlink(trash->d_inode, dentry, NULL);
+#else
+		err = vfs_unlink(trash->d_inode, dentry);
+#endif
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_unlock(trash->d_inode);
+#else
+	mutex_unlock(&trash->d_inode->i_mutex);
+#endif
+	if (err)
+		cifssrv_err("reclaim of deleted file failed, err %d\n", err);
+
+	dput(dentry);
+	path_put(&rw->trash);
+	atomic_long_sub(rw->size, &rw->share->stats.reclaim_pending);
+	smb_vfs_statfs_dirty(rw->share, rw->size);
+	kfree(rw);
+}
+
+/**
+ * smb_vfs_queue_reclaim() - queue reclaim of a file in trash directory
+ * @share:	share of the file
+ * @trash:	trash directory of the share, reference taken over
+ * @dentry:	trash directory entry of the file, reference taken over
+ *
+ * Return:	0 on success, otherwise -ENOMEM
+ */
+static int smb_vfs_queue_reclaim(struct cifssrv_share *share,
+	struct path *trash, struct dentry *dentry)
+{
+	struct smb_reclaim_work *rw;
+
+	rw = kzalloc(sizeof(struct smb_reclaim_work), GFP_KERNEL);
+	if (!rw) {
+		dput(dentry);
+		path_put(trash);
+		return -ENOMEM;
+	}
+
+	rw->share = share;
+	rw->trash = *trash;
+	rw->dentry = dentry;
+	rw->size = dentry->d_inode ?
+		(loff_t)dentry->d_inode->i_blocks << 9 : 0;
+	atomic_long_add(rw->size, &share->stats.reclaim_pending);
+	INIT_DELAYED_WORK(&rw->dwork, smb_vfs_reclaim);
+
+	spin_lock(&smb_reclaim_lock);
+	list_add_tail(&rw->list, &smb_reclaim_list);
+	queue_delayed_work(smb_reclaim_wq, &rw->dwork, SMB_RECLAIM_DELAY);
+	spin_unlock(&smb_reclaim_lock);
+	return 0;
+}
+
+/**
+ * smb_vfs_sweep_trash() - queue reclaim of files left in trash directory
+ * @share:	share owning the trash directory
+ * @trash:	trash directory of the share
+ *
+ * Files renamed to trash before a crash or module unload are not
+ * known to the reclaimer, pick them up when the directory is found.
+ */
+static void smb_vfs_sweep_trash(struct cifssrv_share *share,
+	struct path *trash)
+{
+	struct smb_readdir_data r_data = {
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		.ctx.actor = smb_filldir,
+#endif
+		.dirent = (void *)__get_free_page(GFP_KERNEL),
+	};
+	struct inode *dir = trash->dentry->d_inode;
+	struct smb_dirent *de;
+	struct dentry *dentry;
+	struct file *filp;
+	struct path path;
+	unsigned int off;
+
+	if (!r_data.dirent)
+		return;
+
+	filp = dentry_open(trash, O_RDONLY | O_DIRECTORY, current_cred());
+	if (IS_ERR(filp))
+		goto out;
+
+	do {
+		r_data.used = 0;
+		r_data.full = 0;
+		smb_vfs_readdir(filp, smb_filldir, &r_data);
+
+		off = 0;
+		while (off < r_data.used) {
+			de = (struct smb_dirent *)(r_data.dirent + off);
+			off += ALIGN(sizeof(struct smb_dirent) + de->namelen,
+					sizeof(u64));
+			if (de->name[0] == '.' && (de->namelen == 1 ||
+				(de->namelen == 2 && de->name[1] == '.')))
+				continue;
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+			inode_lock(dir);
+#else
+			mutex_lock(&dir->i_mutex);
+#endif
+			dentry = lookup_one_len(de->name, trash->dentry,
+					de->namelen);
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+			inode_unlock(dir);
+#else
+			mutex_unlock(&dir->i_mutex);
+#endif
+			if (IS_ERR(dentry))
+				continue;
+
+			path.mnt = trash->mnt;
+			path.dentry = trash->dentry;
+			path_get(&path);
+			smb_vfs_queue_reclaim(share, &path, dentry);
+		}
+	} while (r_data.full);
+
+	fput(filp);
+out:
+	free_page((unsigned long)r_data.dirent);
+}
+
+/**
+ * smb_vfs_trash_path() - find or create trash directory of a share
+ * @share:	share to find trash directory for
+ * @trash:	trash directory path, to be put by caller
+ *
+ * Return:	0 on success, otherwise error
+ */
+static int smb_vfs_trash_path(struct cifssrv_share *share,
+	struct path *trash)
+{
+	struct dentry *root, *dentry;
+	struct path root_path;
+	bool found = false;
+	int err;
+
+	err = kern_path(share->path, LOOKUP_FOLLOW | LOOKUP_DIRECTORY,
+			&root_path);
+	if (err)
+		return err;
+
+	root = root_path.dentry;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_lock_nested(root->d_inode, I_MUTEX_PARENT);
+#else
+	mutex_lock_nested(&root->d_inode->i_mutex, I_MUTEX_PARENT);
+#endif
+	dentry = lookup_one_len(SMB_TRASH_NAME, root, strlen(SMB_TRASH_NAME));
+	if (IS_ERR(dentry))
+		err = PTR_ERR(dentry);
+	else if (!dentry->d_inode)
+		err = vfs_mkdir(root->d_inode, dentry, 0700);
+	else if (!S_ISDIR(dentry->d_inode->i_mode))
+		err = -ENOTDIR;
+	else
+		found = true;
+#if LINUX_VERSION_CODE > KERNEL_VERSION(4, 1, 10)
+	inode_unlock(root->d_inode);
+#else
+	mutex_unlock(&root->d_inode->i_mutex);
+#endif
+
+	if (err) {
+		if (!IS_ERR(dentry))
+			dput(dentry);
+		path_put(&root_path);
+		return err;
+	}
+
+	trash->mnt = mntget(root_path.mnt);
+	trash->dentry = dentry;
+	path_put(&root_path);
+
+	if (!atomic_xchg(&share->trash_swept, 1) && found)
+		smb_vfs_sweep_trash(share, trash);
+	return 0;
+}
+
+/**
+ * smb_vfs_defer_unlink() - delete a file by moving it to share trash
+ * @share:	share of the file
+ * @filp:	file pointer of file to be deleted
+ *
+ * Freeing the blocks of a large file can take seconds, which clients
+ * time out on while waiting for CLOSE. The name is removed right away
+ * by a rename into the hidden trash directory of the share, and the
+ * file is unlinked from there by the reclaimer later.
+ *
+ * Return:	0 if deferred, otherwise error and the caller unlinks
+ */
+int smb_vfs_defer_unlink(struct cifssrv_share *share, struct file *filp)
+{
+	struct dentry *dentry = filp->f_path.dentry, *dir, *dnew, *trap;
+	struct inode *inode = dentry->d_inode;
+	struct path trash;
+	char name[40];
+	int err;
+
+	if (!share || !share->config.defer_delete_size || !smb_reclaim_wq ||
+			!S_ISREG(inode->i_mode) ||
+			((loff_t)inode->i_blocks << 9) <
+			share->config.defer_delete_size)
+		return -EOPNOTSUPP;
+
+	err = smb_vfs_trash_path(share, &trash);
+	if (err)
+		return err;
+
+	if (trash.mnt != filp->f_path.mnt) {
+		path_put(&trash);
+		return -EXDEV;
+	}
+
+	snprintf(name, sizeof(name), "%lu.%llx", inode->i_ino,
+			(unsigned long long)atomic64_inc_return(&smb_trash_seq));
+
+	dget(dentry);
+	dir = dget_parent(dentry);
+	trap = lock_rename(dir, trash.dentry);
+	err = -ENOENT;
+	if (dentry->d_parent != dir || d_unhashed(dentry) ||
+			!inode->i_nlink)
+		goto out_unlock;
+
+	err = -EINVAL;
+	if (dentry == trap)
+		goto out_unlock;
+
+	dnew = lookup_one_len(name, trash.dentry, strlen(name));
+	err = PTR_ERR(dnew);
+	if (IS_ERR(dnew))
+		goto out_unlock;
+
+	err = -EEXIST;
+	if (!dnew->d_inode)
+#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
+		err = vfs_rename(dir->d_inode, dentry, trash.dentry->d_inode,
+				dnew, NULL, 0);
+#else
+		err = vfs_rename(dir->d_inode, dentry, trash.dentry->d_inode,
+				dnew);
+#endif
+	dput(dnew);
+
+out_unlock:
+	unlock_rename(dir, trash.dentry);
+	dput(dir);
+	if (err) {
+		cifssrv_debug("move to trash failed, err %d\n", err);
+		dput(dentry);
+		path_put(&trash);
+		return err;
 	}
 
-	return err;
+	/* the renamed dentry is now the trash entry */
+	return smb_vfs_queue_reclaim(share, &trash, dentry);
 }
 
 /**
- * smb_vfs_listxattr() - vfs helper for smb list extended attributes
- * @dentry:	dentry of file for listing xattrs
- * @list:	destination buffer
- * @size:	destination buffer length
+ * smb_vfs_reclaim_init() - start reclaimer of deferred deletes
  *
- * Return:	xattr list length on success, otherwise error
+ * Return:	0 on success, otherwise -ENOMEM
  */
-ssize_t smb_vfs_listxattr(struct dentry *dentry, char **list, int size)
+int smb_vfs_reclaim_init(void)
 {
-	ssize_t err;
-	char *vlist = NULL;
+	smb_reclaim_wq = alloc_workqueue("cifssrv_reclaim", WQ_UNBOUND,
+			SMB_RECLAIM_MAX_ACTIVE);
+	if (!smb_reclaim_wq)
+		return -ENOMEM;
+	return 0;
+}
 
-	if (size) {
-		if (size > XATTR_LIST_MAX)
-			size = XATTR_LIST_MAX;
-		vlist = vmalloc(size);
-		if (!vlist)
-			return -ENOMEM;
-	}
+/**
+ * smb_vfs_reclaim_exit() - reclaim pending deletes and stop reclaimer
+ */
+void smb_vfs_reclaim_exit(void)
+{
+	struct smb_reclaim_work *rw;
 
-	*list = vlist;
-	err = vfs_listxattr(dentry, vlist, size);
-	if (err == -ERANGE) {
-		/* The file system tried to returned a list bigger
-		   than XATTR_LIST_MAX bytes. Not possible. */
-		err = -E2BIG;
-		cifssrv_debug("listxattr failed\n");
-	}
+	spin_lock(&smb_reclaim_lock);
+	list_for_each_entry(rw, &smb_reclaim_list, list)
+		mod_delayed_work(smb_reclaim_wq, &rw->dwork, 0);
+	spin_unlock(&smb_reclaim_lock);
 
-	return err;
+	destroy_workqueue(smb_reclaim_wq);
+	smb_reclaim_wq = NULL;
 }
 
+/* written bytes after which cached statfs of a share is dropped */
+#define SMB_STATFS_DIRTY_MAX	(64 << 20)
+
 /**
- * smb_vfs_getxattr() - vfs helper for smb get extended attributes value
- * @dentry:	dentry of file for getting xattrs
- * @xattr_name:	name of xattr name to query
- * @xattr_buf:	destination buffer xattr value
+ * smb_vfs_statfs_fill() - statfs share root and store result in cache
+ * @share:	share to statfs
+ * @st:		destination for statfs result
  *
- * Return:	read xattr value length on success, otherwise error
+ * Return:	0 on success, otherwise error
  */
-ssize_t smb_vfs_getxattr(struct dentry *dentry, char *xattr_name,
-	char **xattr_buf, int flags)
+static int smb_vfs_statfs_fill(struct cifssrv_share *share,
+	struct kstatfs *st)
 {
-	ssize_t xattr_len;
-	char *buf;
+	struct smb_statfs_cache *sc = &share->statfs;
+	unsigned long stamp = jiffies;
+	struct path path;
+	unsigned int gen;
+	int err;
 
-	xattr_len = vfs_getxattr(dentry, xattr_name, NULL, 0);
-	if (xattr_len <= 0)
-		return xattr_len;
+	spin_lock(&sc->lock);
+	gen = sc->gen;
+	spin_unlock(&sc->lock);
 
-	if (!flags)
-		return xattr_len;
+	err = kern_path(share->path, LOOKUP_FOLLOW, &path);
+	if (err)
+		return err;
+	err = vfs_statfs(&path, st);
+	path_put(&path);
+	if (err)
+		return err;
 
-	buf = kzalloc(xattr_len, GFP_KERNEL);
-	if (!buf) {
-		buf = vzalloc(xattr_len);
-		if (!buf)
-			return -ENOMEM;
+	spin_lock(&sc->lock);
+	/* an invalidation raced with us, our result may predate it */
+	if (sc->gen == gen) {
+		sc->st = *st;
+		sc->stamp = stamp;
+		sc->valid = true;
+		atomic_long_set(&sc->dirty, 0);
 	}
+	spin_unlock(&sc->lock);
+	return 0;
+}
 
-	xattr_len = vfs_getxattr(dentry, xattr_name, (void *)buf,
-		xattr_len);
-	if (xattr_len < 0)
-		cifssrv_debug("getxattr failed, ret %zd\n", xattr_len);
-	else
-		*xattr_buf = buf;
+/**
+ * smb_vfs_statfs_refresh() - background refresh of cached statfs
+ * @work:	work struct of smb_statfs_cache
+ */
+static void smb_vfs_statfs_refresh(struct work_struct *work)
+{
+	struct cifssrv_share *share = container_of(work,
+			struct cifssrv_share, statfs.work);
+	struct kstatfs st;
 
-	return xattr_len;
+	if (smb_vfs_statfs_fill(share, &st))
+		cifssrv_debug("statfs refresh of %s failed\n", share->path);
 }
 
 /**
- * smb_vfs_setxattr() - vfs helper for smb set extended attributes value
- * @filename:	file name
- * @fpath:	path of file for setxattr
- * @name:	xattr name for setxattr
- * @value:	xattr value to set
- * @size:	size of xattr value
- * @flags:	destination buffer length
+ * smb_vfs_share_statfs() - statfs of share root for file system info
+ * @share:	share to statfs
+ * @st:		destination for statfs result
+ *
+ * Clients poll file system size for free space display, and statfs
+ * can be slow on network or FUSE backed shares. A result younger than
+ * the configured freshness window is copied from the share cache. Up
+ * to twice the window the cached result is still served while a new
+ * one is taken in the background, only older or invalidated results
+ * make the caller wait for statfs.
  *
  * Return:	0 on success, otherwise error
  */
-int smb_vfs_setxattr(const char *filename, struct path *fpath, const char *name,
-		const void *value, size_t size, int flags)
+int smb_vfs_share_statfs(struct cifssrv_share *share, struct kstatfs *st)
 {
-	struct path path;
-	int err;
-
-	if (filename) {
-		err = kern_path(filename, 0, &path);
-		if (err) {
-			cifssrv_debug("cannot get linux path %s, err %d\n",
-					filename, err);
-			return err;
+	struct smb_statfs_cache *sc = &share->statfs;
+	unsigned long ttl = msecs_to_jiffies(share->config.statfs_cache_time);
+	bool hit = false, refresh = false;
+
+	if (ttl) {
+		spin_lock(&sc->lock);
+		if (sc->valid && time_before(jiffies, sc->stamp + 2 * ttl)) {
+			*st = sc->st;
+			hit = true;
+			refresh = !time_before(jiffies, sc->stamp + ttl);
 		}
-		err = vfs_setxattr(path.dentry, name, value, size, flags);
-		if (err)
-			cifssrv_debug("setxattr failed, err %d\n", err);
-		path_put(&path);
-	} else {
-		err = vfs_setxattr(fpath->dentry, name, value, size, flags);
-		if (err)
-			cifssrv_debug("setxattr failed, err %d\n", err);
+		spin_unlock(&sc->lock);
 	}
 
-	return err;
+	if (hit) {
+		if (refresh)
+			queue_work(system_unbound_wq, &sc->work);
+		atomic_long_inc(&share->stats.statfs_hits);
+		return 0;
+	}
+
+	atomic_long_inc(&share->stats.statfs_misses);
+	return smb_vfs_statfs_fill(share, st);
 }
 
-int smb_vfs_truncate_xattr(struct dentry *dentry)
+/**
+ * smb_vfs_statfs_invalidate() - drop cached statfs of a share
+ * @share:	share whose free space changed
+ */
+void smb_vfs_statfs_invalidate(struct cifssrv_share *share)
 {
-	char *name, *xattr_list = NULL;
-	ssize_t xattr_list_len;
-	int err = 0;
+	struct smb_statfs_cache *sc = &share->statfs;
 
-	xattr_list_len = smb_vfs_listxattr(dentry, &xattr_list,
-		XATTR_LIST_MAX);
-	if (xattr_list_len < 0) {
-		goto out;
-	} else if (!xattr_list_len) {
-		cifssrv_debug("empty xattr in the file\n");
-		goto out;
-	}
+	spin_lock(&sc->lock);
+	sc->valid = false;
+	sc->gen++;
+	spin_unlock(&sc->lock);
+}
 
-	for (name = xattr_list; name - xattr_list < xattr_list_len;
-			name += strlen(name) + 1) {
-		cifssrv_debug("%s, len %zd\n", name, strlen(name));
+/**
+ * smb_vfs_statfs_dirty() - account bytes written or allocated on a share
+ * @share:	share of the file, may be NULL
+ * @bytes:	bytes written or allocated
+ *
+ * Small writes are left to the freshness window, cached statfs is only
+ * dropped once enough data went in to visibly move free space.
+ */
+void smb_vfs_statfs_dirty(struct cifssrv_share *share, loff_t bytes)
+{
+	if (!share || bytes <= 0)
+		return;
 
-		err = vfs_removexattr(dentry, name);
-		if (err)
-			cifssrv_err("remove xattr failed : %s\n", name);
+	if (atomic_long_add_return(bytes, &share->statfs.dirty) >=
+			SMB_STATFS_DIRTY_MAX) {
+		atomic_long_set(&share->statfs.dirty, 0);
+		smb_vfs_statfs_invalidate(share);
 	}
-out:
-	if (xattr_list)
-		vfree(xattr_list);
+}
 
-	return err;
+/**
+ * smb_vfs_statfs_init() - initialize statfs cache of a new share
+ * @share:	share to initialize
+ */
+void smb_vfs_statfs_init(struct cifssrv_share *share)
+{
+	spin_lock_init(&share->statfs.lock);
+	INIT_WORK(&share->statfs.work, smb_vfs_statfs_refresh);
 }
 
 /**
- * smb_vfs_set_fadvise() - convert smb IO caching options to linux options
- * @filp:	file pointer for IO
- * @options:	smb IO options
+ * smb_vfs_statfs_exit() - wait for background statfs of a share
+ * @share:	share about to be freed
  */
-void smb_vfs_set_fadvise(struct file *filp, int option)
+void smb_vfs_statfs_exit(struct cifssrv_share *share)
 {
-	struct address_space *mapping;
-	mapping = filp->f_mapping;
+	cancel_work_sync(&share->statfs.work);
+}
 
-	if (!option || !mapping)
+/* handles behind file ids, see smb_vfs_file_id() */
+#define SMB_FILEID_HASH_BITS	8
+#define SMB_FILEID_MAX_ENTRIES	16384
+#define SMB_FILEID_FH_WORDS	8
+
+/**
+ * struct smb_fileid_entry - file handle behind a file id
+ * @node:	entry in smb_fileid_cache
+ * @lru:	entry in smb_fileid_lru, most recently used first
+ * @sb:		super block of the file
+ * @id:		file id handed out to clients
+ * @type:	file handle type from exportfs_encode_fh()
+ * @len:	file handle length in 32 bit words
+ * @fh:		file handle
+ */
+struct smb_fileid_entry {
+	struct hlist_node	node;
+	struct list_head	lru;
+	struct super_block	*sb;
+	u64			id;
+	int			type;
+	int			len;
+	u32			fh[SMB_FILEID_FH_WORDS];
+};
+
+static DEFINE_HASHTABLE(smb_fileid_cache, SMB_FILEID_HASH_BITS);
+static LIST_HEAD(smb_fileid_lru);
+static DEFINE_SPINLOCK(smb_fileid_lock);
+static int smb_fileid_count;
+
+/* called with smb_fileid_lock held */
+static struct smb_fileid_entry *smb_fileid_find(struct super_block *sb,
+		u64 id)
+{
+	struct smb_fileid_entry *e;
+
+	hash_for_each_possible(smb_fileid_cache, e, node, (unsigned long)id) {
+		if (e->sb == sb && e->id == id)
+			return e;
+	}
+	return NULL;
+}
+
+/* remember handle of a file id, evicting least recently used */
+static void smb_fileid_insert(struct super_block *sb, u64 id, int type,
+		u32 *fh, int len)
+{
+	struct smb_fileid_entry *e, *old = NULL;
+
+	spin_lock(&smb_fileid_lock);
+	e = smb_fileid_find(sb, id);
+	if (e && e->type == type && e->len == len &&
+			!memcmp(e->fh, fh, len * sizeof(u32))) {
+		list_move(&e->lru, &smb_fileid_lru);
+		spin_unlock(&smb_fileid_lock);
 		return;
+	}
+	spin_unlock(&smb_fileid_lock);
 
-	if (option & FILE_WRITE_THROUGH_LE)
-		filp->f_flags |= O_SYNC;
-/*
-	 * TODO : need to add special handling for Direct I/O.
-	 * Direct I/O relies on MM Context of the "current" process
-	 * to retrieve the pages corresponding to the user address
-	 * do_direct_IO()->dio_get_page()->
-				dio_refill_pages()->get_user_pages_fast()
-	 * struct mm_struct *mm = current->mm;
-	 * All work items in CIFSSRV are handled through default "kworker"
-	 * - which do not have any MM Context.
-	 * To handle Direct I/O will need to create another thread
-	 * in kernel with MM context and redirect all direct I/O calls to
-	 * thread. Since, this is Server and direct I/O not bottleneck.
-	 * So, making default READ path to be buffered in all sequences
-	 * (clearing direct IO flag).
-	else if (option & FILE_NO_INTERMEDIATE_BUFFERING_LE &&
-		 filp->f_mapping->a_ops->direct_IO)
-		filp->f_flags |= O_DIRECT;
-*/
-	else if (option & FILE_SEQUENTIAL_ONLY_LE) {
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-		filp->f_ra.ra_pages = inode_to_bdi(mapping->host)->ra_pages * 2;
-#else
-		filp->f_ra.ra_pages = mapping->backing_dev_info->ra_pages * 2;
-#endif
-		spin_lock(&filp->f_lock);
-		filp->f_mode &= ~FMODE_RANDOM;
-		spin_unlock(&filp->f_lock);
-	} else if (option & FILE_RANDOM_ACCESS_LE) {
-		spin_lock(&filp->f_lock);
-		filp->f_mode |= FMODE_RANDOM;
-		spin_unlock(&filp->f_lock);
+	e = kmalloc(sizeof(struct smb_fileid_entry), GFP_KERNEL);
+	if (!e)
+		return;
+
+	e->sb = sb;
+	e->id = id;
+	e->type = type;
+	e->len = len;
+	memcpy(e->fh, fh, len * sizeof(u32));
+
+	spin_lock(&smb_fileid_lock);
+	old = smb_fileid_find(sb, id);
+	if (!old && smb_fileid_count >= SMB_FILEID_MAX_ENTRIES)
+		old = list_last_entry(&smb_fileid_lru,
+				struct smb_fileid_entry, lru);
+	if (old) {
+		hash_del(&old->node);
+		list_del(&old->lru);
+		smb_fileid_count--;
 	}
+	hash_add(smb_fileid_cache, &e->node, (unsigned long)id);
+	list_add(&e->lru, &smb_fileid_lru);
+	smb_fileid_count++;
+	spin_unlock(&smb_fileid_lock);
+	kfree(old);
+}
+
+/* check if a file handle of two words is the whole inode and generation */
+static bool smb_fileid_inline(struct dentry *dentry, u32 *fh)
+{
+	int len = 2;
+
+	return exportfs_encode_fh(dentry, (struct fid *)fh, &len, 0) ==
+		FILEID_INO32_GEN && len == 2;
 }
 
 /**
- * smb_vfs_lock() - vfs helper for smb file locking
- * @filp:	the file to apply the lock to
- * @cmd:	type of locking operation (F_SETLK, F_GETLK, etc.)
- * @flock:	The lock to be applied
+ * smb_vfs_file_id() - get the file id reported to clients for a file
+ * @path:	path of the file
  *
- * Return:	0 on success, otherwise error
+ * Where the file handle of a file system is a 32 bit inode number and a
+ * generation, the file id is that handle, which stays valid across
+ * restarts and never names a reused inode. Other file systems report
+ * the inode number.
+ *
+ * A directory found from its handle is always reconnected to the share,
+ * a file only if the handle also names its parent. So the handle behind
+ * the id of a file, or of any file on other file systems, is remembered
+ * in connectable form, and the file can be opened by id while it is
+ * remembered even if it left the dentry cache.
+ *
+ * Return:	file id
  */
-int smb_vfs_lock(struct file *filp, int cmd,
-			struct file_lock *flock)
+u64 smb_vfs_file_id(struct path *path)
 {
-	cifssrv_debug("%s: calling vfs_lock_file\n", __func__);
-	return vfs_lock_file(filp, cmd, flock, NULL);
+	struct dentry *dentry = path->dentry;
+	struct inode *inode = dentry->d_inode;
+	bool dir = S_ISDIR(inode->i_mode);
+	u32 fh[SMB_FILEID_FH_WORDS];
+	int len, type;
+	u64 id;
+
+	if (!inode->i_sb->s_export_op)
+		return inode->i_ino;
+
+	if (smb_fileid_inline(dentry, fh)) {
+		id = (u64)fh[1] << 32 | fh[0];
+		if (dir)
+			return id;
+	} else {
+		id = inode->i_ino;
+	}
+
+	len = SMB_FILEID_FH_WORDS;
+	type = exportfs_encode_fh(dentry, (struct fid *)fh, &len, !dir);
+	/* 255 is FILEID_INVALID, a handle that did not fit */
+	if (type > 0 && type < 255 && len <= SMB_FILEID_FH_WORDS)
+		smb_fileid_insert(inode->i_sb, id, type, fh, len);
+	return id;
 }
 
-/**
- * smb_vfs_locks_mandatory_area() - vfs helper for smb byte range file locking
- * @filp:	the file to apply the lock to
- * @start:	lock start byte offset
- * @end:	lock end byte offset
- * @type:	byte range type read/write
- *
- * Return:	0 on success, otherwise error
+/*
+ * accept only dentries known to be inside the share root and outside its
+ * private directories. A file not connected to its parent can not be
+ * placed, it may well be in the trash directory; exportfs then retries
+ * through the parent named by a connectable handle.
  */
-int smb_vfs_locks_mandatory_area(struct file *filp, loff_t start, loff_t end,
-		unsigned char type)
+static int smb_fileid_acceptable(void *context, struct dentry *dentry)
 {
-	struct file_lock fl;
-	int error;
+	struct path *root = context;
 
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-	struct file_lock_context *ctx = file_inode(filp)->i_flctx;
-	if (!ctx || list_empty_careful(&ctx->flc_posix))
-		return 0;
-#else
-	if (!file_inode(filp)->i_flock)
+	if (dentry->d_flags & DCACHE_DISCONNECTED)
 		return 0;
-#endif
-
-	locks_init_lock(&fl);
-	fl.fl_owner = (struct files_struct *)filp;
-	fl.fl_pid = current->tgid;
-	fl.fl_file = filp;
-	fl.fl_flags = FL_POSIX | FL_ACCESS;
-	fl.fl_type = type;
-	fl.fl_start = start;
-	fl.fl_end = end;
-	error = posix_lock_file(filp, &fl, NULL);
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-	posix_unblock_lock(&fl);
-#else
-	locks_delete_block(&fl);
-#endif
-	return error;
+	return is_subdir(dentry, root->dentry) &&
+		!smb_share_private_dentry(root, dentry);
 }
 
-int smb_vfs_readdir(struct file *file, filldir_t filler,
-			struct smb_readdir_data *rdata)
+/**
+ * smb_vfs_open_by_id() - lookup a file by file id within a share
+ * @root:	path of share root
+ * @id:		file id from smb_vfs_file_id()
+ * @path:	if lookup succeed, return path info
+ *
+ * The file is found from its file handle, no path is walked. Only files
+ * below @root on the same mount and outside the private directories of
+ * the share are accepted, see smb_fileid_acceptable(). A remembered
+ * connectable handle is preferred to the id itself, so that a file out
+ * of the dentry cache is reconnected through its parent.
+ *
+ * Return:	0 on success, otherwise error
+ */
+int smb_vfs_open_by_id(struct path *root, u64 id, struct path *path)
 {
-	int err;
-
-#if LINUX_VERSION_CODE > KERNEL_VERSION(3, 10, 30)
-	err = iterate_dir(file, &rdata->ctx);
-#else
-	err = vfs_readdir(file, smb_filldir, rdata);
-#endif
+	struct super_block *sb = root->mnt->mnt_sb;
+	struct smb_fileid_entry *e;
+	struct dentry *dentry;
+	u32 fh[SMB_FILEID_FH_WORDS];
+	int len = 2, type = FILEID_INO32_GEN;
+
+	if (!sb->s_export_op)
+		return -EOPNOTSUPP;
+
+	spin_lock(&smb_fileid_lock);
+	e = smb_fileid_find(sb, id);
+	if (e) {
+		type = e->type;
+		len = e->len;
+		memcpy(fh, e->fh, len * sizeof(u32));
+		list_move(&e->lru, &smb_fileid_lru);
+	}
+	spin_unlock(&smb_fileid_lock);
 
-	return err;
-}
+	if (!e) {
+		if (!smb_fileid_inline(root->dentry, fh))
+			return -ESTALE;
+		fh[0] = (u32)id;
+		fh[1] = id >> 32;
+	}
 
+	dentry = exportfs_decode_fh(root->mnt, (struct fid *)fh, len, type,
+			smb_fileid_acceptable, root);
+	if (IS_ERR_OR_NULL(dentry))
+		return dentry ? PTR_ERR(dentry) : -ESTALE;
 
+	path->mnt = mntget(root->mnt);
+	path->dentry = dentry;
+	return 0;
+}
 
-int smb_vfs_alloc_size(struct file *filp, loff_t len)
+/**
+ * smb_vfs_fileid_exit() - free remembered file handles
+ */
+void smb_vfs_fileid_exit(void)
 {
-	return vfs_fallocate(filp, FALLOC_FL_KEEP_SIZE, 0, len);
+	struct smb_fileid_entry *e, *tmp;
+
+	spin_lock(&smb_fileid_lock);
+	list_for_each_entry_safe(e, tmp, &smb_fileid_lru, lru) {
+		hash_del(&e->node);
+		list_del(&e->lru);
+		kfree(e);
+	}
+	smb_fileid_count = 0;
+	spin_unlock(&smb_fileid_lock);
 }